@@ -0,0 +1,1498 @@
+// bench.c
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "frame_arena.h"
+#include "math.h"
+#include "renderer.h"
+#include "renderer_blit.h"
+#include "renderer_command.h"
+#include "renderer_draw.h"
+#include "renderer_scale.h"
+#include "renderer_texture.h"
+#include "renderer_varying.h"
+#include "vertex_transform.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_CYCLE_COUNTER 1
+#endif
+
+#define BENCH_MAX_RESULTS 512
+#define BENCH_MAX_SAMPLES 1024
+#define BENCH_MAX_OUTPUTS 4
+
+// Each sample runs the workload enough times to take at least this long
+#define BENCH_MIN_SAMPLE_NS 1000000.0
+#define BENCH_WARMUP_NS 50000000.0
+
+typedef void BenchFunction(void* data);
+
+typedef struct BenchOutput {
+    void* data;
+    size_t size;
+} BenchOutput;
+
+typedef struct BenchCase {
+    char name[96];
+    BenchFunction* run;
+    void* data;
+
+    // Work done by one run of the workload
+    double pixels;
+    double triangles;
+    double vertices;
+
+    // Memory the workload writes, which --verify compares between levels
+    BenchOutput outputs[BENCH_MAX_OUTPUTS];
+} BenchCase;
+
+typedef struct BenchResult {
+    char name[96];
+    int32_t samples;
+    int32_t iterations;
+
+    // Nanoseconds per run of the workload
+    double median_ns;
+    double p10_ns;
+    double p90_ns;
+    double p99_ns;
+
+    double pixels_per_second;
+    double triangles_per_second;
+    double vertices_per_second;
+    double cycles_per_pixel;
+} BenchResult;
+
+typedef struct BenchOptions {
+    const char* filter;
+    const char* json_path;
+    const char* baseline_path;
+    double regression_threshold;
+    int32_t sample_count;
+    int32_t all_simd_levels;
+    // Run every workload once at each SIMD level instead of timing it, and
+    // count those whose outputs differ from the scalar ones
+    int32_t verify;
+    int32_t mismatch_count;
+} BenchOptions;
+
+typedef struct BenchTarget {
+    RendererTargetBuffer buffer;
+    RendererDepthBuffer* depth_buffer;
+} BenchTarget;
+
+typedef struct BenchTriangles {
+    BenchTarget* target;
+    RendererTriangle* triangles;
+    int32_t count;
+    // Same triangles for the varying rasterizer, colors as varyings
+    RendererVaryingTriangle* varying_triangles;
+} BenchTriangles;
+
+typedef struct BenchRects {
+    BenchTarget* target;
+    RendererRect* rects;
+    int32_t count;
+} BenchRects;
+
+typedef struct BenchVertices {
+    Matrix4 transform;
+    Vector3* positions;
+    Vector3* transformed_positions;
+    VertexStream stream;
+    VertexScreenStream screen_positions;
+    int32_t count;
+} BenchVertices;
+
+typedef struct BenchMesh {
+    BenchTarget* target;
+    RendererVertexCache* cache;
+    FrameArena* frame_arena;
+    Matrix4 transform;
+    RendererVertexBuffer vertices;
+    RendererIndexBuffer indices;
+    // Model matrices of the instanced workload, transform is then the view
+    // projection
+    Matrix4* models;
+    int32_t instance_count;
+} BenchMesh;
+
+// Sprites drawn at scattered positions, or translucent rects when sprite
+// is 0
+typedef struct BenchBlits {
+    BenchTarget* target;
+    RendererSprite* sprite;
+    RendererRect* rects;
+    int32_t count;
+} BenchBlits;
+
+// Two triangles covering the target, textured with the texture repeated
+// repeat times each way
+typedef struct BenchTextured {
+    BenchTarget* target;
+    RendererTexture* texture;
+    RendererTextureFilter filter;
+    RendererVaryingTriangle triangles[2];
+} BenchTextured;
+
+// A smaller target stretched over the whole of target
+typedef struct BenchScale {
+    BenchTarget* target;
+    BenchTarget* source;
+    RendererScaleFilter filter;
+} BenchScale;
+
+// Triangles recorded into two command buffers, merged with sort and
+// executed into a depth tested target
+typedef struct BenchCommands {
+    BenchTarget* target;
+    RendererCommandBuffer* buffers[2];
+    FrameArena* merge_arena;
+    RendererCommandSort sort;
+} BenchCommands;
+
+// Whole target converted into another of a different pixel format
+typedef struct BenchConvert {
+    BenchTarget* source;
+    BenchTarget* destination;
+} BenchConvert;
+
+typedef enum BenchTriangleShape {
+    BENCH_TRIANGLE_TINY = 0,
+    BENCH_TRIANGLE_MEDIUM = 1,
+    BENCH_TRIANGLE_HUGE = 2,
+    BENCH_TRIANGLE_THIN = 3,
+    BENCH_TRIANGLE_CLIPPED = 4,
+    BENCH_TRIANGLE_SHAPE_COUNT = 5,
+} BenchTriangleShape;
+
+static const char* bench_triangle_shape_names[BENCH_TRIANGLE_SHAPE_COUNT] = {
+    "tiny", "medium", "huge", "thin", "clipped"
+};
+
+static const int32_t bench_triangle_shape_counts[BENCH_TRIANGLE_SHAPE_COUNT] = {
+    4096, 512, 2, 256, 64
+};
+
+static const int32_t bench_resolutions[][2] = {
+    {320, 240},
+    {1280, 720},
+    {1920, 1080},
+    {3840, 2160},
+};
+
+static const char* bench_simd_level_names[] = {
+    "scalar", "sse2", "avx2"
+};
+
+// Workloads are generated from fixed seeds so runs of different builds
+// measure the exact same work.
+static uint32_t
+bench_random(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static int32_t
+bench_random_range(uint32_t* state, int32_t min, int32_t max)
+{
+    return min + (int32_t)(bench_random(state) % (uint32_t)(max - min + 1));
+}
+
+static float
+bench_random_float(uint32_t* state, float min, float max)
+{
+    return min + (max - min) * (float)(bench_random(state) & 0xffffff) / (float)0xffffff;
+}
+
+static double
+bench_now_ns()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static uint64_t
+bench_cycles()
+{
+#ifdef BENCH_HAS_CYCLE_COUNTER
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int
+bench_compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double
+bench_percentile(double* sorted, int32_t count, double percentile)
+{
+    int32_t index = (int32_t)(percentile * (count - 1) + 0.5);
+    return sorted[Min(index, count - 1)];
+}
+
+static BenchTarget*
+bench_target_create(int32_t width, int32_t height, RendererPixelFormat format, int32_t depth)
+{
+    BenchTarget* target = calloc(1, sizeof(BenchTarget));
+    int32_t size = width * height * renderer_pixel_format_bytes(format);
+    uint8_t* pixels = aligned_alloc(64, (size + 63) & ~63);
+    target->buffer = renderer_create_target_buffer(width, height, format, pixels);
+    memset(pixels, 0, size);
+
+    if (depth)
+    {
+        target->depth_buffer = renderer_create_depth_buffer(width, height);
+        target->buffer.depth = target->depth_buffer;
+    }
+
+    return target;
+}
+
+static void
+bench_target_destroy(BenchTarget* target)
+{
+    if (target->depth_buffer)
+    {
+        renderer_destroy_depth_buffer(target->depth_buffer);
+    }
+
+    free(target->buffer.pixels);
+    free(target);
+}
+
+static BenchOutput
+bench_target_output(BenchTarget* target)
+{
+    BenchOutput output = {
+        target->buffer.pixels, (size_t)renderer_target_buffer_size(target->buffer)
+    };
+    return output;
+}
+
+static RendererTriangle
+bench_triangle_create(uint32_t* seed, BenchTriangleShape shape, int32_t width, int32_t height)
+{
+    RendererPoint p[3];
+    int32_t center_x = bench_random_range(seed, 0, width - 1);
+    int32_t center_y = bench_random_range(seed, 0, height - 1);
+
+    switch (shape)
+    {
+        case BENCH_TRIANGLE_TINY:
+        case BENCH_TRIANGLE_MEDIUM:
+        {
+            int32_t size = shape == BENCH_TRIANGLE_TINY ? 3 : 48;
+            for (int32_t i = 0; i < 3; ++i)
+            {
+                int32_t x = center_x + bench_random_range(seed, -size, size);
+                int32_t y = center_y + bench_random_range(seed, -size, size);
+                x = Max(x, 0);
+                y = Max(y, 0);
+                p[i].x = Min(x, width);
+                p[i].y = Min(y, height);
+            }
+            break;
+        }
+        case BENCH_TRIANGLE_HUGE:
+            // Two triangles covering the whole target, picked by the seed
+            p[0].x = 0;
+            p[0].y = 0;
+            p[1].x = width;
+            p[1].y = (bench_random(seed) & 1) ? 0 : height;
+            p[2].x = p[1].y == 0 ? width : 0;
+            p[2].y = height;
+            break;
+        case BENCH_TRIANGLE_THIN:
+        {
+            // Long slivers a couple of pixels wide in a random direction
+            int32_t length = Max(width, height) / 2;
+            int32_t dx = bench_random_range(seed, -length, length);
+            int32_t dy = bench_random_range(seed, -length, length);
+            p[0].x = center_x;
+            p[0].y = center_y;
+            p[1].x = center_x + dx;
+            p[1].y = center_y + dy;
+            p[2].x = center_x + dx + 2;
+            p[2].y = center_y + dy + 2;
+            break;
+        }
+        default:
+            // Corners up to a target size outside of it on every side
+            for (int32_t i = 0; i < 3; ++i)
+            {
+                p[i].x = bench_random_range(seed, -width, 2 * width);
+                p[i].y = bench_random_range(seed, -height, 2 * height);
+            }
+            break;
+    }
+
+    for (int32_t i = 0; i < 3; ++i)
+    {
+        p[i].z = bench_random_float(seed, 0.0f, 1.0f);
+    }
+
+    RendererTriangle triangle = {
+        p[0], p[1], p[2],
+        bench_random(seed) & 0xffffff,
+        bench_random(seed) & 0xffffff,
+        bench_random(seed) & 0xffffff
+    };
+
+    // Only one winding is filled
+    if (signed_area2(triangle.p0, triangle.p1, triangle.p2) < 0)
+    {
+        triangle.p1 = p[2];
+        triangle.p2 = p[1];
+    }
+
+    return triangle;
+}
+
+// Count the pixels triangles actually shade by drawing each one in white on
+// a black target and counting and clearing what changed in its bounds
+static double
+bench_count_pixels(BenchTarget* target, RendererTriangle* triangles, int32_t count)
+{
+    RendererTargetBuffer buffer = target->buffer;
+    buffer.depth = 0;
+    renderer_fill(buffer, 0);
+
+    RendererRect bounds = {
+        0, 0, buffer.width, buffer.height
+    };
+
+    double pixels = 0.0;
+    for (int32_t i = 0; i < count; ++i)
+    {
+        RendererTriangle triangle = triangles[i];
+        triangle.c0 = triangle.c1 = triangle.c2 = 0xffffff;
+        renderer_fill_triangle(buffer, triangle);
+
+        int32_t min_x = Min3(triangle.p0.x, triangle.p1.x, triangle.p2.x);
+        int32_t min_y = Min3(triangle.p0.y, triangle.p1.y, triangle.p2.y);
+        int32_t max_x = Max3(triangle.p0.x, triangle.p1.x, triangle.p2.x);
+        int32_t max_y = Max3(triangle.p0.y, triangle.p1.y, triangle.p2.y);
+        RendererRect rect = {
+            min_x, min_y, max_x - min_x + 1, max_y - min_y + 1
+        };
+
+        rect = renderer_rect_intersect(rect, bounds);
+        for (int32_t y = rect.y; y < rect.y + rect.h; ++y)
+        {
+            uint32_t* row = (uint32_t*)(buffer.pixels + IndexPixel(0, y, buffer));
+            for (int32_t x = rect.x; x < rect.x + rect.w; ++x)
+            {
+                pixels += row[x] != 0;
+                row[x] = 0;
+            }
+        }
+    }
+
+    return pixels;
+}
+
+static void
+bench_run_fill(void* data)
+{
+    BenchTarget* target = data;
+    renderer_fill(target->buffer, PackColorRGB(32, 64, 128));
+}
+
+static void
+bench_run_fill_rects(void* data)
+{
+    BenchRects* rects = data;
+    for (int32_t i = 0; i < rects->count; ++i)
+    {
+        renderer_fill_rect(rects->target->buffer, rects->rects[i], PackColorRGB(i, 64, 128));
+    }
+}
+
+static void
+bench_run_triangles(void* data)
+{
+    BenchTriangles* triangles = data;
+    if (triangles->target->depth_buffer)
+    {
+        renderer_clear_depth(triangles->target->depth_buffer, 1.0f);
+    }
+
+    for (int32_t i = 0; i < triangles->count; ++i)
+    {
+        renderer_fill_triangle(triangles->target->buffer, triangles->triangles[i]);
+    }
+}
+
+// Same triangles through the batched entry point, small ones take the small
+// triangle path
+static void
+bench_run_triangles_batched(void* data)
+{
+    BenchTriangles* triangles = data;
+    if (triangles->target->depth_buffer)
+    {
+        renderer_clear_depth(triangles->target->depth_buffer, 1.0f);
+    }
+
+    RendererTargetBuffer buffer = triangles->target->buffer;
+    RendererRect clip = {
+        0, 0, buffer.width, buffer.height
+    };
+
+    RendererTriangleBatch batch;
+    batch.count = 0;
+
+    for (int32_t i = 0; i < triangles->count; ++i)
+    {
+        renderer_fill_triangle_batched(buffer, &batch, triangles->triangles[i], clip);
+    }
+
+    renderer_flush_triangle_batch(buffer, &batch);
+}
+
+// Same triangles through the affine color variant of the varying rasterizer
+static void
+bench_run_triangles_varying(void* data)
+{
+    BenchTriangles* triangles = data;
+    if (triangles->target->depth_buffer)
+    {
+        renderer_clear_depth(triangles->target->depth_buffer, 1.0f);
+    }
+
+    RendererTargetBuffer buffer = triangles->target->buffer;
+    RendererRect clip = {
+        0, 0, buffer.width, buffer.height
+    };
+
+    for (int32_t i = 0; i < triangles->count; ++i)
+    {
+        renderer_fill_triangle_varying_color(buffer, &triangles->varying_triangles[i], clip, 0);
+    }
+}
+
+static void
+bench_run_transform_positions(void* data)
+{
+    BenchVertices* vertices = data;
+    vertex_transform_positions(vertices->transform, vertices->positions, vertices->transformed_positions, vertices->count);
+}
+
+static void
+bench_run_project(void* data)
+{
+    BenchVertices* vertices = data;
+    vertex_transform_project(vertices->transform, 1920, 1080, vertices->stream, vertices->screen_positions, vertices->count);
+}
+
+static void
+bench_run_mesh(void* data)
+{
+    BenchMesh* mesh = data;
+    renderer_clear_depth(mesh->target->depth_buffer, 1.0f);
+    RendererDrawState state = renderer_draw_state_create(mesh->target->buffer);
+    renderer_draw_indexed(mesh->target->buffer, mesh->cache, mesh->transform, state, mesh->vertices, mesh->indices);
+    frame_arena_reset(mesh->frame_arena);
+}
+
+static void
+bench_run_mesh_instanced(void* data)
+{
+    BenchMesh* mesh = data;
+    renderer_clear_depth(mesh->target->depth_buffer, 1.0f);
+    RendererDrawState state = renderer_draw_state_create(mesh->target->buffer);
+    renderer_draw_indexed_instanced(mesh->target->buffer, mesh->cache, mesh->transform, mesh->models,
+                                    mesh->instance_count, state, mesh->vertices, mesh->indices);
+    frame_arena_reset(mesh->frame_arena);
+}
+
+static void
+bench_run_blits(void* data)
+{
+    BenchBlits* blits = data;
+    for (int32_t i = 0; i < blits->count; ++i)
+    {
+        RendererRect rect = blits->rects[i];
+        if (blits->sprite)
+        {
+            renderer_draw_sprite(blits->target->buffer, blits->sprite, rect.x, rect.y);
+        }
+        else
+        {
+            renderer_blend_rect(blits->target->buffer, rect, 0x80402010);
+        }
+    }
+}
+
+static void
+bench_run_scale(void* data)
+{
+    BenchScale* scale = data;
+    renderer_scale(scale->source->buffer, scale->target->buffer, scale->filter);
+}
+
+static void
+bench_run_commands(void* data)
+{
+    BenchCommands* commands = data;
+    renderer_clear_depth(commands->target->depth_buffer, 1.0f);
+    frame_arena_reset(commands->merge_arena);
+
+    RendererCommandList list = renderer_command_merge(commands->buffers, 2, commands->sort, commands->merge_arena);
+    renderer_command_execute(list, commands->target->buffer, 0);
+}
+
+static void
+bench_run_convert(void* data)
+{
+    BenchConvert* convert = data;
+    renderer_resolve(convert->source->buffer, convert->destination->buffer);
+}
+
+static void
+bench_run_textured(void* data)
+{
+    BenchTextured* textured = data;
+    RendererTargetBuffer buffer = textured->target->buffer;
+    RendererRect clip = {
+        0, 0, buffer.width, buffer.height
+    };
+
+    for (int32_t i = 0; i < 2; ++i)
+    {
+        renderer_fill_triangle_textured(buffer, &textured->triangles[i], clip, textured->texture, textured->filter);
+    }
+}
+
+static int32_t
+bench_matches(BenchOptions* options, const char* name)
+{
+    return !options->filter || strstr(name, options->filter) != 0;
+}
+
+static void
+bench_measure(BenchOptions* options, BenchCase* bench_case, BenchResult* result)
+{
+    // Warm up caches, branch predictors and clocks, then size samples so
+    // timer resolution doesn't matter
+    int32_t iterations = 0;
+    double start = bench_now_ns();
+    double elapsed = 0.0;
+    do
+    {
+        bench_case->run(bench_case->data);
+        ++iterations;
+        elapsed = bench_now_ns() - start;
+    } while (elapsed < BENCH_WARMUP_NS && iterations < 1000000);
+
+    double run_ns = elapsed / iterations;
+    int32_t sample_iterations = (int32_t)(BENCH_MIN_SAMPLE_NS / run_ns) + 1;
+
+    static double sample_ns[BENCH_MAX_SAMPLES];
+    static double sample_cycles[BENCH_MAX_SAMPLES];
+    int32_t sample_count = Min(options->sample_count, BENCH_MAX_SAMPLES);
+
+    for (int32_t sample = 0; sample < sample_count; ++sample)
+    {
+        double sample_start = bench_now_ns();
+        uint64_t cycles_start = bench_cycles();
+
+        for (int32_t i = 0; i < sample_iterations; ++i)
+        {
+            bench_case->run(bench_case->data);
+        }
+
+        sample_cycles[sample] = (double)(bench_cycles() - cycles_start) / sample_iterations;
+        sample_ns[sample] = (bench_now_ns() - sample_start) / sample_iterations;
+    }
+
+    qsort(sample_ns, sample_count, sizeof(double), bench_compare_double);
+    qsort(sample_cycles, sample_count, sizeof(double), bench_compare_double);
+
+    memset(result, 0, sizeof(BenchResult));
+    snprintf(result->name, sizeof(result->name), "%s", bench_case->name);
+    result->samples = sample_count;
+    result->iterations = sample_iterations;
+    result->median_ns = bench_percentile(sample_ns, sample_count, 0.5);
+    result->p10_ns = bench_percentile(sample_ns, sample_count, 0.1);
+    result->p90_ns = bench_percentile(sample_ns, sample_count, 0.9);
+    result->p99_ns = bench_percentile(sample_ns, sample_count, 0.99);
+
+    double seconds = result->median_ns * 1e-9;
+    result->pixels_per_second = bench_case->pixels / seconds;
+    result->triangles_per_second = bench_case->triangles / seconds;
+    result->vertices_per_second = bench_case->vertices / seconds;
+
+    // Cycles of the time stamp counter, which ticks at a fixed rate rather
+    // than the core clock on most CPUs
+    if (bench_case->pixels > 0.0)
+    {
+        result->cycles_per_pixel = bench_percentile(sample_cycles, sample_count, 0.5) / bench_case->pixels;
+    }
+}
+
+static void
+bench_report(BenchResult* result)
+{
+    printf("%-44s %10.3f %10.3f %10.1f %10.2f %10.2f %8.2f\n",
+           result->name,
+           result->median_ns * 1e-6,
+           result->p90_ns * 1e-6,
+           result->pixels_per_second * 1e-6,
+           result->triangles_per_second * 1e-6,
+           result->vertices_per_second * 1e-6,
+           result->cycles_per_pixel);
+    fflush(stdout);
+}
+
+// Run the workload once at each supported level, starting from the same
+// outputs every time, and compare what each level wrote with the scalar run
+static void
+bench_verify(BenchOptions* options, BenchCase* bench_case)
+{
+    RendererSimdLevel current = renderer_get_simd_level();
+    RendererSimdLevel supported = renderer_simd_level_supported();
+
+    int32_t output_count = 0;
+    uint8_t* initial[BENCH_MAX_OUTPUTS];
+    uint8_t* expected[BENCH_MAX_OUTPUTS];
+    while (output_count < BENCH_MAX_OUTPUTS && bench_case->outputs[output_count].data)
+    {
+        BenchOutput output = bench_case->outputs[output_count];
+        initial[output_count] = malloc(output.size);
+        expected[output_count] = malloc(output.size);
+        memcpy(initial[output_count], output.data, output.size);
+        ++output_count;
+    }
+
+    char mismatches[64] = "";
+    for (int32_t level = RENDERER_SIMD_SCALAR; level <= (int32_t)supported; ++level)
+    {
+        renderer_set_simd_level((RendererSimdLevel)level);
+        for (int32_t o = 0; o < output_count; ++o)
+        {
+            memcpy(bench_case->outputs[o].data, initial[o], bench_case->outputs[o].size);
+        }
+
+        bench_case->run(bench_case->data);
+
+        int32_t matches = 1;
+        for (int32_t o = 0; o < output_count; ++o)
+        {
+            BenchOutput output = bench_case->outputs[o];
+            if (level == RENDERER_SIMD_SCALAR)
+            {
+                memcpy(expected[o], output.data, output.size);
+            }
+            else if (memcmp(expected[o], output.data, output.size) != 0)
+            {
+                matches = 0;
+            }
+        }
+
+        if (!matches)
+        {
+            size_t length = strlen(mismatches);
+            snprintf(mismatches + length, sizeof(mismatches) - length, " %s", bench_simd_level_names[level]);
+        }
+    }
+
+    for (int32_t o = 0; o < output_count; ++o)
+    {
+        free(initial[o]);
+        free(expected[o]);
+    }
+
+    renderer_set_simd_level(current);
+
+    if (output_count == 0)
+    {
+        printf("%-44s no outputs\n", bench_case->name);
+    }
+    else if (mismatches[0])
+    {
+        printf("%-44s MISMATCH%s\n", bench_case->name, mismatches);
+        ++options->mismatch_count;
+    }
+    else
+    {
+        printf("%-44s ok\n", bench_case->name);
+    }
+
+    fflush(stdout);
+}
+
+// Blend a rect and draw a sprite with translucent and opaque runs into
+// linear and tiled XRGB8888 targets at each supported level, which must leave
+// the top byte of every pixel zero
+static void
+bench_verify_blit_alpha(BenchOptions* options)
+{
+    if (!bench_matches(options, "blit_alpha"))
+    {
+        return;
+    }
+
+    RendererSimdLevel current = renderer_get_simd_level();
+    RendererSimdLevel supported = renderer_simd_level_supported();
+
+    uint32_t sprite_pixels[32 * 32];
+    uint32_t seed = 0xa1fa;
+    for (int32_t i = 0; i < 32 * 32; ++i)
+    {
+        uint32_t alpha = i % 3 == 0 ? 255 : bench_random(&seed) & 0xff;
+        sprite_pixels[i] = renderer_premultiply(alpha << 24 | (bench_random(&seed) & 0xffffff));
+    }
+
+    RendererSprite* sprite = renderer_sprite_create(32, 32, sprite_pixels);
+    RendererRect rect = {
+        5, 7, 90, 50
+    };
+
+    for (int32_t level = RENDERER_SIMD_SCALAR; level <= (int32_t)supported; ++level)
+    {
+        renderer_set_simd_level((RendererSimdLevel)level);
+
+        for (int32_t tiled = 0; tiled < 2; ++tiled)
+        {
+            RendererTargetBuffer buffer = tiled ?
+                renderer_create_tiled_target_buffer(100, 60, RENDERER_PIXEL_FORMAT_XRGB8888, 0) :
+                renderer_create_target_buffer(100, 60, RENDERER_PIXEL_FORMAT_XRGB8888, 0);
+            int32_t size = renderer_target_buffer_size(buffer);
+            buffer.pixels = aligned_alloc(64, (size + 63) & ~63);
+            renderer_fill(buffer, PackColorRGB(200, 100, 50));
+
+            renderer_blend_rect(buffer, rect, 0x80402010);
+            renderer_blend_rect(buffer, rect, 0xff102030);
+            renderer_draw_sprite(buffer, sprite, 3, 2);
+            renderer_draw_sprite(buffer, sprite, 80, 40);
+
+            int32_t alpha_count = 0;
+            for (int32_t i = 0; i < size / 4; ++i)
+            {
+                alpha_count += ((uint32_t*)buffer.pixels)[i] >> 24 != 0;
+            }
+
+            char name[96];
+            snprintf(name, sizeof(name), "blit_alpha/%s/%s", tiled ? "tiled" : "linear", bench_simd_level_names[level]);
+            if (alpha_count != 0)
+            {
+                printf("%-44s MISMATCH %d pixels with alpha\n", name, alpha_count);
+                ++options->mismatch_count;
+            }
+            else
+            {
+                printf("%-44s ok\n", name);
+            }
+
+            free(buffer.pixels);
+        }
+    }
+
+    renderer_sprite_destroy(sprite);
+    renderer_set_simd_level(current);
+}
+
+static void
+bench_run_case(BenchOptions* options, BenchCase* bench_case, BenchResult* results, int32_t* result_count)
+{
+    if (!bench_matches(options, bench_case->name))
+    {
+        return;
+    }
+
+    if (options->verify)
+    {
+        bench_verify(options, bench_case);
+        return;
+    }
+
+    if (*result_count >= BENCH_MAX_RESULTS)
+    {
+        return;
+    }
+
+    BenchResult* result = results + (*result_count)++;
+    bench_measure(options, bench_case, result);
+    bench_report(result);
+}
+
+static void
+bench_run_level(BenchOptions* options, const char* level, BenchResult* results, int32_t* result_count)
+{
+    BenchCase bench_case;
+    int32_t resolution_count = sizeof(bench_resolutions) / sizeof(bench_resolutions[0]);
+
+    for (int32_t r = 0; r < resolution_count; ++r)
+    {
+        int32_t width = bench_resolutions[r][0];
+        int32_t height = bench_resolutions[r][1];
+        BenchTarget* target = bench_target_create(width, height, RENDERER_PIXEL_FORMAT_XRGB8888, 1);
+        BenchTarget* packed_target = bench_target_create(width, height, RENDERER_PIXEL_FORMAT_RGB565, 0);
+
+        memset(&bench_case, 0, sizeof(bench_case));
+        snprintf(bench_case.name, sizeof(bench_case.name), "fill/%dx%d/%s", width, height, level);
+        bench_case.run = bench_run_fill;
+        bench_case.data = target;
+        bench_case.pixels = (double)width * height;
+        bench_case.outputs[0] = bench_target_output(target);
+        bench_run_case(options, &bench_case, results, result_count);
+
+        snprintf(bench_case.name, sizeof(bench_case.name), "fill_rgb565/%dx%d/%s", width, height, level);
+        bench_case.data = packed_target;
+        bench_case.outputs[0] = bench_target_output(packed_target);
+        bench_run_case(options, &bench_case, results, result_count);
+
+        BenchConvert convert = {
+            target, packed_target
+        };
+        snprintf(bench_case.name, sizeof(bench_case.name), "convert/rgb565/%dx%d/%s", width, height, level);
+        bench_case.run = bench_run_convert;
+        bench_case.data = &convert;
+        bench_run_case(options, &bench_case, results, result_count);
+
+        // Rects from a few pixels up to a quarter of the target
+        int32_t rect_sizes[3] = {8, 64, Min(width, height) / 2};
+        int32_t rect_counts[3] = {256, 256, 16};
+        for (int32_t s = 0; s < 3; ++s)
+        {
+            uint32_t seed = 0x12345678u + s;
+            RendererRect rect_storage[256];
+            BenchRects rects = {
+                target, rect_storage, rect_counts[s]
+            };
+
+            memset(&bench_case, 0, sizeof(bench_case));
+            for (int32_t i = 0; i < rects.count; ++i)
+            {
+                rects.rects[i].w = rect_sizes[s];
+                rects.rects[i].h = rect_sizes[s];
+                rects.rects[i].x = bench_random_range(&seed, 0, width - rect_sizes[s]);
+                rects.rects[i].y = bench_random_range(&seed, 0, height - rect_sizes[s]);
+                bench_case.pixels += (double)rect_sizes[s] * rect_sizes[s];
+            }
+
+            snprintf(bench_case.name, sizeof(bench_case.name), "fill_rect/%d/%dx%d/%s", rect_sizes[s], width, height, level);
+            bench_case.run = bench_run_fill_rects;
+            bench_case.data = &rects;
+            bench_case.outputs[0] = bench_target_output(target);
+            bench_run_case(options, &bench_case, results, result_count);
+        }
+
+        for (int32_t shape = 0; shape < BENCH_TRIANGLE_SHAPE_COUNT; ++shape)
+        {
+            uint32_t seed = 0x9e3779b9u + shape;
+            int32_t count = bench_triangle_shape_counts[shape];
+            BenchTriangles triangles = {
+                target, malloc(count * sizeof(RendererTriangle)), count,
+                malloc(count * sizeof(RendererVaryingTriangle))
+            };
+
+            for (int32_t i = 0; i < count; ++i)
+            {
+                triangles.triangles[i] = bench_triangle_create(&seed, shape, width, height);
+                triangles.varying_triangles[i] = renderer_varying_triangle_from_colors(triangles.triangles[i]);
+            }
+
+            double pixels = bench_count_pixels(target, triangles.triangles, count);
+
+            // Without depth, and with a depth test against a cleared buffer
+            for (int32_t depth = 0; depth < 2; ++depth)
+            {
+                BenchTarget depth_target = *target;
+                if (!depth)
+                {
+                    depth_target.buffer.depth = 0;
+                    depth_target.depth_buffer = 0;
+                }
+
+                BenchTriangles depth_triangles = triangles;
+                depth_triangles.target = &depth_target;
+
+                // General, batched and varying rasterizer paths
+                BenchFunction* paths[3] = {
+                    bench_run_triangles, bench_run_triangles_batched, bench_run_triangles_varying
+                };
+                const char* path_names[3] = {
+                    "", "_batched", "_varying"
+                };
+
+                for (int32_t path = 0; path < 3; ++path)
+                {
+                    memset(&bench_case, 0, sizeof(bench_case));
+                    snprintf(bench_case.name, sizeof(bench_case.name), "triangle/%s%s%s/%dx%d/%s",
+                             bench_triangle_shape_names[shape], depth ? "_depth" : "", path_names[path],
+                             width, height, level);
+                    bench_case.run = paths[path];
+                    bench_case.data = &depth_triangles;
+                    bench_case.outputs[0] = bench_target_output(target);
+                    bench_case.pixels = pixels;
+                    bench_case.triangles = count;
+                    bench_run_case(options, &bench_case, results, result_count);
+                }
+            }
+
+            // Packed to 16 bits as they are written
+            BenchTriangles packed_triangles = triangles;
+            packed_triangles.target = packed_target;
+
+            memset(&bench_case, 0, sizeof(bench_case));
+            snprintf(bench_case.name, sizeof(bench_case.name), "triangle/%s_rgb565/%dx%d/%s",
+                     bench_triangle_shape_names[shape], width, height, level);
+            bench_case.run = bench_run_triangles;
+            bench_case.data = &packed_triangles;
+            bench_case.outputs[0] = bench_target_output(packed_target);
+            bench_case.pixels = pixels;
+            bench_case.triangles = count;
+            bench_run_case(options, &bench_case, results, result_count);
+
+            // Recorded halves merged in each sort order
+            FrameArena* command_arena = frame_arena_create(count * 128);
+            BenchCommands commands = {
+                target,
+                {renderer_command_buffer_create(command_arena), renderer_command_buffer_create(command_arena)},
+                frame_arena_create(count * 64)
+            };
+
+            RendererRect bounds = {
+                0, 0, width, height
+            };
+
+            for (int32_t b = 0; b < 2; ++b)
+            {
+                renderer_command_buffer_begin(commands.buffers[b], width, height);
+                for (int32_t i = b; i < count; i += 2)
+                {
+                    renderer_command_fill_triangle(commands.buffers[b], triangles.triangles[i], bounds);
+                }
+            }
+
+            const char* sort_names[4] = {
+                "none", "state", "depth", "tile"
+            };
+
+            for (int32_t sort = 0; sort < 4; ++sort)
+            {
+                commands.sort = (RendererCommandSort)sort;
+
+                memset(&bench_case, 0, sizeof(bench_case));
+                snprintf(bench_case.name, sizeof(bench_case.name), "commands/%s_%s/%dx%d/%s",
+                         bench_triangle_shape_names[shape], sort_names[sort], width, height, level);
+                bench_case.run = bench_run_commands;
+                bench_case.data = &commands;
+                bench_case.outputs[0] = bench_target_output(target);
+                bench_case.pixels = pixels;
+                bench_case.triangles = count;
+                bench_run_case(options, &bench_case, results, result_count);
+            }
+
+            renderer_command_buffer_destroy(commands.buffers[0]);
+            renderer_command_buffer_destroy(commands.buffers[1]);
+            frame_arena_destroy(commands.merge_arena);
+            frame_arena_destroy(command_arena);
+
+            free(triangles.triangles);
+            free(triangles.varying_triangles);
+        }
+
+        // Magnified and minified through the mip chain, without depth
+        uint32_t* texture_pixels = malloc(256 * 256 * sizeof(uint32_t));
+        uint32_t texture_seed = 0x7e47u;
+        for (int32_t i = 0; i < 256 * 256; ++i)
+        {
+            texture_pixels[i] = bench_random(&texture_seed);
+        }
+
+        RendererTexture* texture = renderer_texture_create(256, 256, texture_pixels);
+        BenchTarget texture_target = *target;
+        texture_target.buffer.depth = 0;
+        texture_target.depth_buffer = 0;
+
+        int32_t repeats[2] = {1, 16};
+        for (int32_t r = 0; r < 2; ++r)
+        {
+            for (int32_t filter = 0; filter < 2; ++filter)
+            {
+                RendererVaryingVertex corners[4] = {
+                    {{0, 0, 0.5f}, 1.0f, {0.0f, 0.0f}},
+                    {{width, 0, 0.5f}, 1.0f, {(float)repeats[r], 0.0f}},
+                    {{width, height, 0.5f}, 1.0f, {(float)repeats[r], (float)repeats[r]}},
+                    {{0, height, 0.5f}, 1.0f, {0.0f, (float)repeats[r]}},
+                };
+                BenchTextured textured = {
+                    &texture_target, texture, (RendererTextureFilter)filter,
+                    {{corners[0], corners[1], corners[2]}, {corners[0], corners[2], corners[3]}}
+                };
+
+                memset(&bench_case, 0, sizeof(bench_case));
+                snprintf(bench_case.name, sizeof(bench_case.name), "texture/%s/x%d/%dx%d/%s",
+                         filter ? "bilinear" : "nearest", repeats[r], width, height, level);
+                bench_case.run = bench_run_textured;
+                bench_case.data = &textured;
+                bench_case.outputs[0] = bench_target_output(target);
+                bench_case.pixels = (double)width * height;
+                bench_case.triangles = 2;
+                bench_run_case(options, &bench_case, results, result_count);
+            }
+        }
+
+        renderer_texture_destroy(texture);
+        free(texture_pixels);
+
+        // A 64x64 disc with a soft edge, mostly transparent or opaque runs,
+        // and rects of the same size
+        uint32_t* sprite_pixels = malloc(64 * 64 * sizeof(uint32_t));
+        for (int32_t y = 0; y < 64; ++y)
+        {
+            for (int32_t x = 0; x < 64; ++x)
+            {
+                float dx = x - 31.5f;
+                float dy = y - 31.5f;
+                float edge = (32.0f - sqrtf(dx * dx + dy * dy)) * 64.0f;
+                uint32_t alpha = edge <= 0.0f ? 0 : edge >= 255.0f ? 255 : (uint32_t)edge;
+                sprite_pixels[y * 64 + x] = renderer_premultiply(alpha << 24 | 0x40c080);
+            }
+        }
+
+        RendererSprite* sprite = renderer_sprite_create(64, 64, sprite_pixels);
+        RendererRect blit_rects[256];
+        uint32_t blit_seed = 0x5b17u;
+        for (int32_t i = 0; i < 256; ++i)
+        {
+            blit_rects[i].x = bench_random_range(&blit_seed, -32, width - 32);
+            blit_rects[i].y = bench_random_range(&blit_seed, -32, height - 32);
+            blit_rects[i].w = 64;
+            blit_rects[i].h = 64;
+        }
+
+        for (int32_t kind = 0; kind < 2; ++kind)
+        {
+            BenchBlits blits = {
+                target, kind ? sprite : 0, blit_rects, 256
+            };
+
+            memset(&bench_case, 0, sizeof(bench_case));
+            snprintf(bench_case.name, sizeof(bench_case.name), "%s/64/%dx%d/%s", kind ? "sprite" : "blend_rect",
+                     width, height, level);
+            bench_case.run = bench_run_blits;
+            bench_case.data = &blits;
+            bench_case.outputs[0] = bench_target_output(target);
+            bench_case.pixels = 256.0 * (kind ? sprite->visible_pixel_count : 64 * 64);
+            bench_run_case(options, &bench_case, results, result_count);
+        }
+
+        renderer_sprite_destroy(sprite);
+        free(sprite_pixels);
+
+        // Upscaled from half and three quarters of the size, as dynamic
+        // resolution does
+        int32_t scale_percents[2] = {50, 75};
+        for (int32_t p = 0; p < 2; ++p)
+        {
+            BenchTarget* source = bench_target_create(width * scale_percents[p] / 100, height * scale_percents[p] / 100,
+                                                       RENDERER_PIXEL_FORMAT_XRGB8888, 0);
+            uint32_t scale_seed = 0x5ca1eu;
+            uint32_t* source_pixels = (uint32_t*)source->buffer.pixels;
+            for (int32_t i = 0; i < source->buffer.width * source->buffer.height; ++i)
+            {
+                source_pixels[i] = bench_random(&scale_seed);
+            }
+
+            for (int32_t filter = 0; filter < 2; ++filter)
+            {
+                BenchScale scale = {
+                    target, source, (RendererScaleFilter)filter
+                };
+
+                memset(&bench_case, 0, sizeof(bench_case));
+                snprintf(bench_case.name, sizeof(bench_case.name), "scale/%s/%d%%/%dx%d/%s",
+                         filter ? "bilinear" : "nearest", scale_percents[p], width, height, level);
+                bench_case.run = bench_run_scale;
+                bench_case.data = &scale;
+                bench_case.outputs[0] = bench_target_output(target);
+                bench_case.pixels = (double)width * height;
+                bench_run_case(options, &bench_case, results, result_count);
+            }
+
+            bench_target_destroy(source);
+        }
+
+        bench_target_destroy(packed_target);
+        bench_target_destroy(target);
+    }
+
+    // Vertex transforms are independent of the target size
+    int32_t vertex_counts[2] = {1024, 262144};
+    for (int32_t v = 0; v < 2; ++v)
+    {
+        uint32_t seed = 0xc0ffee00u + v;
+        int32_t count = vertex_counts[v];
+
+        BenchVertices vertices;
+        vertices.count = count;
+        vertices.transform = matrix4_multiply(
+            matrix4_lookat_lh(vector3_create(0.0f, 1.0f, -4.0f), vector3_create(0.0f, 0.0f, 0.0f), vector3_create(0.0f, 1.0f, 0.0f)),
+            matrix4_perspective_lh(60.0f, 16.0f / 9.0f, 0.1f, 100.0f));
+        vertices.positions = malloc(count * sizeof(Vector3));
+        vertices.transformed_positions = malloc(count * sizeof(Vector3));
+        vertices.stream.x = malloc(count * sizeof(float));
+        vertices.stream.y = malloc(count * sizeof(float));
+        vertices.stream.z = malloc(count * sizeof(float));
+        vertices.screen_positions.x = malloc(count * sizeof(int32_t));
+        vertices.screen_positions.y = malloc(count * sizeof(int32_t));
+        vertices.screen_positions.z = malloc(count * sizeof(float));
+        vertices.screen_positions.clip_codes = malloc(count);
+
+        for (int32_t i = 0; i < count; ++i)
+        {
+            vertices.positions[i] = vector3_create(bench_random_float(&seed, -2.0f, 2.0f),
+                                                   bench_random_float(&seed, -2.0f, 2.0f),
+                                                   bench_random_float(&seed, -2.0f, 2.0f));
+        }
+
+        vertex_transform_split(vertices.positions, vertices.stream, count);
+
+        memset(&bench_case, 0, sizeof(bench_case));
+        snprintf(bench_case.name, sizeof(bench_case.name), "transform_positions/%d/%s", count, level);
+        bench_case.run = bench_run_transform_positions;
+        bench_case.data = &vertices;
+        bench_case.vertices = count;
+        bench_case.outputs[0].data = vertices.transformed_positions;
+        bench_case.outputs[0].size = count * sizeof(Vector3);
+        bench_run_case(options, &bench_case, results, result_count);
+
+        snprintf(bench_case.name, sizeof(bench_case.name), "project/%d/%s", count, level);
+        bench_case.run = bench_run_project;
+        bench_case.outputs[0].data = vertices.screen_positions.x;
+        bench_case.outputs[0].size = count * sizeof(int32_t);
+        bench_case.outputs[1].data = vertices.screen_positions.y;
+        bench_case.outputs[1].size = count * sizeof(int32_t);
+        bench_case.outputs[2].data = vertices.screen_positions.z;
+        bench_case.outputs[2].size = count * sizeof(float);
+        bench_case.outputs[3].data = vertices.screen_positions.clip_codes;
+        bench_case.outputs[3].size = count;
+        bench_run_case(options, &bench_case, results, result_count);
+
+        free(vertices.positions);
+        free(vertices.transformed_positions);
+        free(vertices.stream.x);
+        free(vertices.stream.y);
+        free(vertices.stream.z);
+        free(vertices.screen_positions.x);
+        free(vertices.screen_positions.y);
+        free(vertices.screen_positions.z);
+        free(vertices.screen_positions.clip_codes);
+    }
+
+    // Random height fields through the whole indexed draw path, from big
+    // triangles to ones covering a few dozen pixels
+    int32_t mesh_grid_sizes[2] = {23, 225};
+    for (int32_t m = 0; m < 2; ++m)
+    {
+        uint32_t seed = 0x5eed0000u + m;
+        int32_t grid_size = mesh_grid_sizes[m];
+        int32_t vertex_count = grid_size * grid_size;
+        int32_t triangle_count = (grid_size - 1) * (grid_size - 1) * 2;
+
+        BenchMesh mesh;
+        mesh.target = bench_target_create(1920, 1080, RENDERER_PIXEL_FORMAT_XRGB8888, 1);
+        mesh.frame_arena = frame_arena_create(0);
+        mesh.cache = renderer_vertex_cache_create(vertex_count, mesh.frame_arena);
+        mesh.transform = matrix4_multiply(
+            matrix4_lookat_lh(vector3_create(0.0f, 0.0f, -5.0f), vector3_create(0.0f, 0.0f, 0.0f), vector3_create(0.0f, 1.0f, 0.0f)),
+            matrix4_perspective_lh(60.0f, 16.0f / 9.0f, 0.1f, 100.0f));
+
+        float* x = malloc(vertex_count * sizeof(float));
+        float* y = malloc(vertex_count * sizeof(float));
+        float* z = malloc(vertex_count * sizeof(float));
+        uint32_t* colors = malloc(vertex_count * sizeof(uint32_t));
+        uint32_t* indices = malloc(triangle_count * 3 * sizeof(uint32_t));
+
+        float cell_size = 6.0f / (grid_size - 1);
+        for (int32_t i = 0; i < vertex_count; ++i)
+        {
+            x[i] = -5.0f + (i % grid_size) * cell_size * 10.0f / 6.0f + bench_random_float(&seed, -0.25f, 0.25f) * cell_size;
+            y[i] = -3.0f + (i / grid_size) * cell_size + bench_random_float(&seed, -0.25f, 0.25f) * cell_size;
+            z[i] = bench_random_float(&seed, -0.5f, 0.5f);
+            // Never black, so covered pixels can be counted
+            colors[i] = (bench_random(&seed) & 0xffffff) | 0x010101;
+        }
+
+        int32_t index_count = 0;
+        for (int32_t row = 0; row < grid_size - 1; ++row)
+        {
+            for (int32_t column = 0; column < grid_size - 1; ++column)
+            {
+                uint32_t corner = row * grid_size + column;
+                indices[index_count++] = corner;
+                indices[index_count++] = corner + grid_size;
+                indices[index_count++] = corner + 1;
+                indices[index_count++] = corner + 1;
+                indices[index_count++] = corner + grid_size;
+                indices[index_count++] = corner + grid_size + 1;
+            }
+        }
+
+        VertexStream positions = {
+            x, y, z
+        };
+
+        RendererVertexBuffer vertex_buffer = {
+            positions, colors, vertex_count
+        };
+
+        RendererIndexBuffer index_buffer = {
+            indices, sizeof(uint32_t), triangle_count * 3
+        };
+
+        mesh.vertices = vertex_buffer;
+        mesh.indices = index_buffer;
+
+        memset(&bench_case, 0, sizeof(bench_case));
+        renderer_fill(mesh.target->buffer, 0);
+        bench_run_mesh(&mesh);
+        for (int32_t i = 0; i < mesh.target->buffer.width * mesh.target->buffer.height; ++i)
+        {
+            bench_case.pixels += ((uint32_t*)mesh.target->buffer.pixels)[i] != 0;
+        }
+
+        snprintf(bench_case.name, sizeof(bench_case.name), "mesh/%d/1920x1080/%s", triangle_count, level);
+        bench_case.run = bench_run_mesh;
+        bench_case.data = &mesh;
+        bench_case.outputs[0] = bench_target_output(mesh.target);
+        bench_case.triangles = triangle_count;
+        bench_case.vertices = vertex_count;
+        bench_run_case(options, &bench_case, results, result_count);
+
+        // The small mesh shrunk and spread over the screen as a grid of
+        // instances, each drawn with its own model matrix
+        if (m == 0)
+        {
+            int32_t instance_side = 8;
+            mesh.instance_count = instance_side * instance_side;
+            mesh.models = malloc(mesh.instance_count * sizeof(Matrix4));
+            for (int32_t i = 0; i < mesh.instance_count; ++i)
+            {
+                Vector3 offset = vector3_create(((i % instance_side) - (instance_side - 1) * 0.5f) * 10.0f / instance_side,
+                                                ((i / instance_side) - (instance_side - 1) * 0.5f) * 6.0f / instance_side,
+                                                0.0f);
+                mesh.models[i] = matrix4_multiply(matrix4_scale(1.0f / instance_side), matrix4_translate(offset));
+            }
+
+            memset(&bench_case, 0, sizeof(bench_case));
+            renderer_fill(mesh.target->buffer, 0);
+            bench_run_mesh_instanced(&mesh);
+            for (int32_t i = 0; i < mesh.target->buffer.width * mesh.target->buffer.height; ++i)
+            {
+                bench_case.pixels += ((uint32_t*)mesh.target->buffer.pixels)[i] != 0;
+            }
+
+            snprintf(bench_case.name, sizeof(bench_case.name), "mesh_instanced/%dx%d/1920x1080/%s", triangle_count,
+                     mesh.instance_count, level);
+            bench_case.run = bench_run_mesh_instanced;
+            bench_case.data = &mesh;
+            bench_case.outputs[0] = bench_target_output(mesh.target);
+            bench_case.triangles = (double)triangle_count * mesh.instance_count;
+            bench_case.vertices = (double)vertex_count * mesh.instance_count;
+            bench_run_case(options, &bench_case, results, result_count);
+
+            free(mesh.models);
+        }
+        free(x);
+        free(y);
+        free(z);
+        free(colors);
+        free(indices);
+        renderer_vertex_cache_destroy(mesh.cache);
+        frame_arena_destroy(mesh.frame_arena);
+        bench_target_destroy(mesh.target);
+    }
+}
+
+// One result per line, so builds can be compared with line based tools and
+// with --baseline without a JSON parser.
+static int32_t
+bench_write_json(const char* path, BenchResult* results, int32_t result_count)
+{
+    FILE* file = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!file)
+    {
+        printf("failed to open %s\n", path);
+        return 0;
+    }
+
+    fprintf(file, "{\"simd_supported\": \"%s\", \"results\": [\n",
+            bench_simd_level_names[renderer_simd_level_supported()]);
+
+    for (int32_t i = 0; i < result_count; ++i)
+    {
+        BenchResult* result = results + i;
+        fprintf(file,
+                "{\"name\": \"%s\", \"median_ns\": %.1f, \"p10_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f, "
+                "\"samples\": %d, \"iterations\": %d, \"pixels_per_second\": %.0f, \"triangles_per_second\": %.0f, "
+                "\"vertices_per_second\": %.0f, \"cycles_per_pixel\": %.4f}%s\n",
+                result->name, result->median_ns, result->p10_ns, result->p90_ns, result->p99_ns,
+                result->samples, result->iterations, result->pixels_per_second, result->triangles_per_second,
+                result->vertices_per_second, result->cycles_per_pixel,
+                i + 1 < result_count ? "," : "");
+    }
+
+    fprintf(file, "]}\n");
+
+    if (file != stdout)
+    {
+        fclose(file);
+    }
+
+    return 1;
+}
+
+// Compare medians against a previous --json file and return the number of
+// workloads that got slower by more than the threshold
+static int32_t
+bench_compare_baseline(BenchOptions* options, BenchResult* results, int32_t result_count)
+{
+    FILE* file = fopen(options->baseline_path, "r");
+    if (!file)
+    {
+        printf("failed to open baseline %s\n", options->baseline_path);
+        return -1;
+    }
+
+    int32_t regression_count = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), file))
+    {
+        char name[96];
+        double median_ns;
+        if (sscanf(line, "{\"name\": \"%95[^\"]\", \"median_ns\": %lf", name, &median_ns) != 2)
+        {
+            continue;
+        }
+
+        for (int32_t i = 0; i < result_count; ++i)
+        {
+            if (strcmp(results[i].name, name) != 0)
+            {
+                continue;
+            }
+
+            double change = (results[i].median_ns - median_ns) / median_ns * 100.0;
+            if (change > options->regression_threshold)
+            {
+                printf("REGRESSION %-44s %+.1f%% (%.3fms -> %.3fms)\n",
+                       name, change, median_ns * 1e-6, results[i].median_ns * 1e-6);
+                ++regression_count;
+            }
+            else if (change < -options->regression_threshold)
+            {
+                printf("improved   %-44s %+.1f%%\n", name, change);
+            }
+        }
+    }
+
+    fclose(file);
+    return regression_count;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options = {
+        0, 0, 0, 5.0, 31, 0, 0, 0
+    };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+            options.filter = argv[++i];
+        }
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+        {
+            options.json_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+        {
+            options.baseline_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+        {
+            options.regression_threshold = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+        {
+            int32_t sample_count = atoi(argv[++i]);
+            options.sample_count = Max(sample_count, 1);
+        }
+        else if (strcmp(argv[i], "--all-simd") == 0)
+        {
+            options.all_simd_levels = 1;
+        }
+        else if (strcmp(argv[i], "--verify") == 0)
+        {
+            options.verify = 1;
+        }
+        else
+        {
+            printf("usage: %s [--filter substring] [--samples n] [--all-simd] [--verify] [--json path] "
+                   "[--baseline path] [--threshold percent]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.verify)
+    {
+        bench_run_level(&options, "verify", 0, 0);
+        bench_verify_blit_alpha(&options);
+        printf("%d checks failed\n", options.mismatch_count);
+        return options.mismatch_count != 0 ? 3 : 0;
+    }
+
+    static BenchResult results[BENCH_MAX_RESULTS];
+    int32_t result_count = 0;
+
+    printf("%-44s %10s %10s %10s %10s %10s %8s\n",
+           "workload", "median ms", "p90 ms", "Mpixel/s", "Mtri/s", "Mvert/s", "cyc/px");
+
+    RendererSimdLevel supported = renderer_simd_level_supported();
+    RendererSimdLevel first = options.all_simd_levels ? RENDERER_SIMD_SCALAR : supported;
+    for (int32_t level = first; level <= (int32_t)supported; ++level)
+    {
+        renderer_set_simd_level((RendererSimdLevel)level);
+        bench_run_level(&options, bench_simd_level_names[level], results, &result_count);
+    }
+
+    if (options.json_path && !bench_write_json(options.json_path, results, result_count))
+    {
+        return 1;
+    }
+
+    if (options.baseline_path)
+    {
+        int32_t regression_count = bench_compare_baseline(&options, results, result_count);
+        if (regression_count != 0)
+        {
+            return 2;
+        }
+    }
+
+    return 0;
+}
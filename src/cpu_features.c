@@ -0,0 +1,69 @@
+// cpu_features.c
+
+#include "cpu_features.h"
+
+#include <stdatomic.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+
+static uint32_t
+cpu_features_detect()
+{
+    uint32_t features = CPU_FEATURE_NONE;
+    uint32_t eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return features;
+    }
+
+    if (edx & bit_SSE2) features |= CPU_FEATURE_SSE2;
+    if (ecx & bit_SSE4_1) features |= CPU_FEATURE_SSE41;
+
+    // AVX state has to be enabled by the OS as well, otherwise the upper
+    // halves of the ymm registers are not preserved across context switches.
+    int os_saves_ymm = 0;
+    if (ecx & bit_OSXSAVE)
+    {
+        uint32_t xcr0_lo, xcr0_hi;
+        __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        os_saves_ymm = (xcr0_lo & 0x6) == 0x6;
+    }
+
+    if (os_saves_ymm && (ecx & bit_AVX))
+    {
+        features |= CPU_FEATURE_AVX;
+
+        if (ecx & bit_FMA) features |= CPU_FEATURE_FMA;
+
+        if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2))
+        {
+            features |= CPU_FEATURE_AVX2;
+        }
+    }
+
+    return features;
+}
+#else
+static uint32_t
+cpu_features_detect()
+{
+    return CPU_FEATURE_NONE;
+}
+#endif
+
+uint32_t cpu_features_get()
+{
+    // Detection is idempotent so racing threads all store the same value.
+    static atomic_uint cached_features = 0;
+    static atomic_int detected = 0;
+
+    if (!atomic_load_explicit(&detected, memory_order_acquire))
+    {
+        atomic_store_explicit(&cached_features, cpu_features_detect(), memory_order_relaxed);
+        atomic_store_explicit(&detected, 1, memory_order_release);
+    }
+
+    return atomic_load_explicit(&cached_features, memory_order_relaxed);
+}
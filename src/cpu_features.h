@@ -0,0 +1,20 @@
+// cpu_features.h
+
+#ifndef CPU_FEATURES_INCLUDED
+#define CPU_FEATURES_INCLUDED
+
+#include <stdint.h>
+
+enum CpuFeatureFlags {
+    CPU_FEATURE_NONE = 0,
+    CPU_FEATURE_SSE2 = 1 << 0,
+    CPU_FEATURE_SSE41 = 1 << 1,
+    CPU_FEATURE_AVX = 1 << 2,
+    CPU_FEATURE_AVX2 = 1 << 3,
+    CPU_FEATURE_FMA = 1 << 4,
+};
+
+// Query CPUID once and return the CpuFeatureFlags usable on this machine
+uint32_t cpu_features_get();
+
+#endif // CPU_FEATURES_INCLUDED
@@ -0,0 +1,95 @@
+// dynamic_resolution.c
+
+#include "dynamic_resolution.h"
+#include "math.h"
+#include "renderer.h"
+
+// Weight of each new frame time in the moving average
+#define DYNAMIC_RESOLUTION_SMOOTHING 0.25f
+
+// Most the scale grows by in one change. Shrinking is not limited, a frame
+// over budget is a dropped frame.
+#define DYNAMIC_RESOLUTION_MAX_GROWTH 1.1f
+
+DynamicResolutionDesc
+dynamic_resolution_desc_create(float frame_time_budget)
+{
+    DynamicResolutionDesc desc = {
+        frame_time_budget, 0.5f, 1.0f, 0.85f, 4
+    };
+
+    return desc;
+}
+
+DynamicResolution
+dynamic_resolution_create(DynamicResolutionDesc desc)
+{
+    // Targets are never larger than the frame
+    desc.max_scale = Min(desc.max_scale, 1.0f);
+    desc.min_scale = Max(desc.min_scale, 0.05f);
+    desc.min_scale = Min(desc.min_scale, desc.max_scale);
+
+    DynamicResolution resolution = {
+        desc, desc.max_scale, 0.0f, 0
+    };
+
+    return resolution;
+}
+
+float
+dynamic_resolution_update(DynamicResolution* resolution, float frame_time)
+{
+    DynamicResolutionDesc* desc = &resolution->desc;
+    if (desc->frame_time_budget <= 0.0f)
+    {
+        return resolution->scale;
+    }
+
+    resolution->frame_time = resolution->frame_time > 0.0f ?
+        resolution->frame_time + (frame_time - resolution->frame_time) * DYNAMIC_RESOLUTION_SMOOTHING :
+        frame_time;
+
+    if (++resolution->frames_since_change < desc->settle_frames || resolution->frame_time <= 0.0f)
+    {
+        return resolution->scale;
+    }
+
+    // Render time goes with the pixel count, the square of the scale. Going
+    // up aims for the bottom of the hysteresis band instead of the budget.
+    float budget = desc->frame_time_budget;
+    float scale = resolution->scale;
+    if (resolution->frame_time > budget)
+    {
+        scale *= sqrtf(budget / resolution->frame_time);
+    }
+    else if (resolution->frame_time < budget * desc->hysteresis)
+    {
+        float growth = sqrtf(budget * desc->hysteresis / resolution->frame_time);
+        scale *= Min(growth, DYNAMIC_RESOLUTION_MAX_GROWTH);
+    }
+
+    scale = Max(scale, desc->min_scale);
+    scale = Min(scale, desc->max_scale);
+
+    if (scale != resolution->scale)
+    {
+        resolution->scale = scale;
+        resolution->frames_since_change = 0;
+    }
+
+    return resolution->scale;
+}
+
+void
+dynamic_resolution_size(const DynamicResolution* resolution, int32_t width, int32_t height, int32_t* scaled_width,
+                        int32_t* scaled_height)
+{
+    int32_t block_width = (int32_t)(width * resolution->scale / RENDERER_BLOCK_SIZE + 0.5f) * RENDERER_BLOCK_SIZE;
+    int32_t block_height = (int32_t)(height * resolution->scale / RENDERER_BLOCK_SIZE + 0.5f) * RENDERER_BLOCK_SIZE;
+
+    // Never below a block, nor above the full size
+    block_width = Max(block_width, RENDERER_BLOCK_SIZE);
+    block_height = Max(block_height, RENDERER_BLOCK_SIZE);
+    *scaled_width = Min(block_width, width);
+    *scaled_height = Min(block_height, height);
+}
@@ -0,0 +1,49 @@
+// dynamic_resolution.h
+
+#ifndef DYNAMIC_RESOLUTION_INCLUDED
+#define DYNAMIC_RESOLUTION_INCLUDED
+
+#include <stdint.h>
+
+typedef struct DynamicResolutionDesc {
+    // Seconds rendering a frame should take, 0 keeps the scale at max_scale
+    float frame_time_budget;
+    // Bounds on the fraction of the full width and height rendered
+    float min_scale;
+    float max_scale;
+    // Fraction of the budget frame times must drop below before the scale
+    // goes back up, so it does not flip between two sizes at the budget
+    float hysteresis;
+    // Frames a new scale is kept before the next change, letting the
+    // smoothed frame time catch up with it
+    int32_t settle_frames;
+} DynamicResolutionDesc;
+
+// Picks the render scale for each frame from how long the last ones took
+typedef struct DynamicResolution {
+    DynamicResolutionDesc desc;
+    float scale;
+    // Moving average of the frame times seen, 0 before the first
+    float frame_time;
+    int32_t frames_since_change;
+} DynamicResolution;
+
+// Desc with a budget and the default bounds, 0 disables scaling
+DynamicResolutionDesc
+dynamic_resolution_desc_create(float frame_time_budget);
+
+DynamicResolution
+dynamic_resolution_create(DynamicResolutionDesc desc);
+
+// Account for a frame that took frame_time seconds to render, returns the
+// scale to render the next one at
+float
+dynamic_resolution_update(DynamicResolution* resolution, float frame_time);
+
+// Size of a width by height target at the current scale, rounded to whole
+// RENDERER_BLOCK_SIZE blocks so small changes in scale do not resize it
+void
+dynamic_resolution_size(const DynamicResolution* resolution, int32_t width, int32_t height, int32_t* scaled_width,
+                        int32_t* scaled_height);
+
+#endif // DYNAMIC_RESOLUTION_INCLUDED
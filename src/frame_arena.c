@@ -0,0 +1,159 @@
+// frame_arena.c
+
+#include "frame_arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Base and overflow memory is aligned to a cache line
+#define FRAME_ARENA_ALIGNMENT 64
+
+typedef struct FrameArenaBlock {
+    struct FrameArenaBlock* next;
+    size_t capacity;
+    size_t used;
+} FrameArenaBlock;
+
+static size_t
+frame_arena_align(size_t offset, size_t alignment)
+{
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+static uint8_t*
+frame_arena_block_data(FrameArenaBlock* block)
+{
+    return (uint8_t*)block + FRAME_ARENA_ALIGNMENT;
+}
+
+FrameArena*
+frame_arena_create(size_t capacity)
+{
+    FrameArena* arena = calloc(1, sizeof(FrameArena));
+    arena->capacity = frame_arena_align(capacity, FRAME_ARENA_ALIGNMENT);
+    arena->base = arena->capacity ? aligned_alloc(FRAME_ARENA_ALIGNMENT, arena->capacity) : 0;
+
+    return arena;
+}
+
+static void
+frame_arena_free_overflow(FrameArena* arena)
+{
+    FrameArenaBlock* block = arena->overflow;
+    while (block)
+    {
+        FrameArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    arena->overflow = 0;
+}
+
+void
+frame_arena_destroy(FrameArena* arena)
+{
+    frame_arena_free_overflow(arena);
+    free(arena->base);
+    free(arena);
+}
+
+void*
+frame_arena_push(FrameArena* arena, size_t size, size_t alignment)
+{
+    // Alignment is relative to memory aligned to at least a cache line
+    alignment = alignment < 1 ? 1 : alignment;
+
+    size_t offset = frame_arena_align(arena->used, alignment);
+    if (offset + size <= arena->capacity)
+    {
+        arena->frame_used += offset + size - arena->used;
+        arena->used = offset + size;
+        arena->high_water = arena->frame_used > arena->high_water ? arena->frame_used : arena->high_water;
+        return arena->base + offset;
+    }
+
+    FrameArenaBlock* block = arena->overflow;
+    offset = block ? frame_arena_align(block->used, alignment) : 0;
+    if (!block || offset + size > block->capacity)
+    {
+        // Overflow blocks at least double what the frame used so far, so a
+        // frame far bigger than the arena still only allocates a few times
+        size_t capacity = size + alignment > arena->frame_used ? size + alignment : arena->frame_used;
+        capacity = frame_arena_align(capacity, FRAME_ARENA_ALIGNMENT);
+
+        block = aligned_alloc(FRAME_ARENA_ALIGNMENT, FRAME_ARENA_ALIGNMENT + capacity);
+        block->next = arena->overflow;
+        block->capacity = capacity;
+        block->used = 0;
+        arena->overflow = block;
+
+        if (block->next == 0)
+        {
+            arena->overflow_count++;
+        }
+
+        offset = 0;
+    }
+
+    arena->frame_used += offset + size - block->used;
+    block->used = offset + size;
+    arena->high_water = arena->frame_used > arena->high_water ? arena->frame_used : arena->high_water;
+    return frame_arena_block_data(block) + offset;
+}
+
+void*
+frame_arena_grow(FrameArena* arena, void* memory, size_t old_size, size_t new_size, size_t alignment)
+{
+    if (memory && new_size <= old_size)
+    {
+        return memory;
+    }
+
+    // The last allocation in base can simply be extended
+    uint8_t* bytes = memory;
+    if (bytes && !arena->overflow && bytes + old_size == arena->base + arena->used &&
+        arena->used - old_size + new_size <= arena->capacity)
+    {
+        arena->frame_used += new_size - old_size;
+        arena->used += new_size - old_size;
+        arena->high_water = arena->frame_used > arena->high_water ? arena->frame_used : arena->high_water;
+        return memory;
+    }
+
+    void* result = frame_arena_push(arena, new_size, alignment);
+    if (bytes)
+    {
+        memcpy(result, bytes, old_size);
+    }
+
+    return result;
+}
+
+void
+frame_arena_reset(FrameArena* arena)
+{
+    if (arena->overflow)
+    {
+        frame_arena_free_overflow(arena);
+
+        // Regrow to what this frame needed plus some slack for alignment
+        // padding, so the next one fits in base
+        free(arena->base);
+        arena->capacity = frame_arena_align(arena->high_water + arena->high_water / 8, FRAME_ARENA_ALIGNMENT);
+        arena->base = aligned_alloc(FRAME_ARENA_ALIGNMENT, arena->capacity);
+    }
+
+    arena->used = 0;
+    arena->frame_used = 0;
+}
+
+FrameArenaStats
+frame_arena_stats(FrameArena* arena)
+{
+    FrameArenaStats stats = {
+        arena->capacity, arena->frame_used, arena->high_water, arena->overflow_count
+    };
+
+    return stats;
+}
@@ -0,0 +1,55 @@
+// frame_arena.h
+
+#ifndef FRAME_ARENA_INCLUDED
+#define FRAME_ARENA_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Linear allocator for data that only lives until the end of a frame. Not
+// thread safe, threads push from their own arena.
+typedef struct FrameArena {
+    uint8_t* base;
+    size_t capacity;
+    size_t used;
+
+    // Blocks allocated when base ran out this frame, newest first
+    struct FrameArenaBlock* overflow;
+
+    // Bytes pushed this frame, base and overflow together
+    size_t frame_used;
+    size_t high_water;
+    uint32_t overflow_count;
+} FrameArena;
+
+typedef struct FrameArenaStats {
+    size_t capacity;
+    size_t used;
+    // Most bytes any frame pushed since the arena was created
+    size_t high_water;
+    // Frames that ran out of capacity and had to allocate
+    uint32_t overflow_count;
+} FrameArenaStats;
+
+FrameArena* frame_arena_create(size_t capacity);
+void frame_arena_destroy(FrameArena* arena);
+
+// Push size bytes aligned to alignment, a power of two. Running out of
+// capacity falls back to the heap for the rest of the frame, and the next
+// reset grows the arena so later frames fit without allocating.
+void* frame_arena_push(FrameArena* arena, size_t size, size_t alignment);
+
+// Resize the allocation at memory from old_size to new_size bytes, in place
+// when it is the last one pushed and otherwise by pushing a copy
+void* frame_arena_grow(FrameArena* arena, void* memory, size_t old_size, size_t new_size, size_t alignment);
+
+// Forget everything pushed this frame. Constant time unless the frame
+// overflowed, then the overflow is freed and the arena regrown once.
+void frame_arena_reset(FrameArena* arena);
+
+FrameArenaStats frame_arena_stats(FrameArena* arena);
+
+#define FrameArenaPushArray(arena, type, count) \
+    ((type*)frame_arena_push(arena, sizeof(type) * (count), _Alignof(type)))
+
+#endif // FRAME_ARENA_INCLUDED
@@ -0,0 +1,277 @@
+// frame_sink.c
+
+#include "frame_sink.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+struct FrameSink {
+    FrameSinkDesc desc;
+    int fd;
+    int32_t owns_fd;
+
+    // Converted PPM or Y4M frame, including its header
+    uint8_t* scratch;
+    int32_t scratch_header_size;
+    int32_t scratch_size;
+
+    // Mapped ring file
+    uint8_t* ring;
+    uint64_t ring_size;
+};
+
+static int32_t
+frame_sink_write_all(int fd, const uint8_t* bytes, uint64_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return 0;
+        }
+
+        bytes += written;
+        size -= written;
+    }
+
+    return 1;
+}
+
+static int32_t
+frame_sink_open_ring(FrameSink* sink)
+{
+    FrameSinkDesc desc = sink->desc;
+    uint32_t pitch = desc.width * 4;
+
+    // Slots start on a page so readers can map them on their own
+    uint64_t slot_offset = 4096;
+    sink->ring_size = slot_offset + (uint64_t)desc.ring_slot_count * pitch * desc.height;
+
+    if (ftruncate(sink->fd, sink->ring_size) != 0)
+    {
+        return 0;
+    }
+
+    sink->ring = mmap(0, sink->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, sink->fd, 0);
+    if (sink->ring == MAP_FAILED)
+    {
+        sink->ring = 0;
+        return 0;
+    }
+
+    FrameSinkRingHeader* header = (FrameSinkRingHeader*)sink->ring;
+    memcpy(header->magic, FRAME_SINK_RING_MAGIC, sizeof(header->magic));
+    header->width = desc.width;
+    header->height = desc.height;
+    header->pitch = pitch;
+    header->slot_count = desc.ring_slot_count;
+    header->slot_offset = slot_offset;
+    atomic_store_explicit((_Atomic uint64_t*)&header->frame_count, 0, memory_order_release);
+
+    return 1;
+}
+
+FrameSink*
+frame_sink_open(FrameSinkDesc desc)
+{
+    FrameSink* sink = calloc(1, sizeof(FrameSink));
+    sink->desc = desc;
+    sink->fd = -1;
+
+    if (desc.format == FRAME_SINK_NONE)
+    {
+        return sink;
+    }
+
+    if (desc.format != FRAME_SINK_RING && strcmp(desc.path, "-") == 0)
+    {
+        sink->fd = STDOUT_FILENO;
+    }
+    else
+    {
+        int flags = desc.format == FRAME_SINK_RING ? O_RDWR : O_WRONLY;
+        sink->fd = open(desc.path, flags | O_CREAT | O_TRUNC, 0644);
+        sink->owns_fd = 1;
+    }
+
+    if (sink->fd < 0)
+    {
+        printf("failed to open frame sink %s\n", desc.path);
+        free(sink);
+        return 0;
+    }
+
+    int32_t pixel_count = desc.width * desc.height;
+    int32_t opened = 1;
+    switch (desc.format)
+    {
+        case FRAME_SINK_PPM:
+            sink->scratch_header_size = snprintf(0, 0, "P6\n%d %d\n255\n", desc.width, desc.height);
+            sink->scratch_size = sink->scratch_header_size + pixel_count * 3;
+            sink->scratch = malloc(sink->scratch_size + 1);
+            snprintf((char*)sink->scratch, sink->scratch_header_size + 1, "P6\n%d %d\n255\n", desc.width, desc.height);
+            break;
+        case FRAME_SINK_Y4M:
+        {
+            char header[128];
+            int32_t header_size = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+                                           desc.width, desc.height, desc.frame_rate);
+            opened = frame_sink_write_all(sink->fd, (uint8_t*)header, header_size);
+
+            sink->scratch_header_size = 6;
+            sink->scratch_size = sink->scratch_header_size + pixel_count * 3;
+            sink->scratch = malloc(sink->scratch_size);
+            memcpy(sink->scratch, "FRAME\n", 6);
+            break;
+        }
+        case FRAME_SINK_RING:
+            opened = frame_sink_open_ring(sink);
+            break;
+        default:
+            break;
+    }
+
+    if (!opened)
+    {
+        printf("failed to set up frame sink %s\n", desc.path);
+        frame_sink_close(sink);
+        return 0;
+    }
+
+    return sink;
+}
+
+void
+frame_sink_close(FrameSink* sink)
+{
+    if (sink->ring)
+    {
+        munmap(sink->ring, sink->ring_size);
+    }
+
+    if (sink->owns_fd)
+    {
+        close(sink->fd);
+    }
+
+    free(sink->scratch);
+    free(sink);
+}
+
+uint8_t*
+frame_sink_frame_pixels(FrameSink* sink, uint64_t frame_index)
+{
+    if (!sink->ring)
+    {
+        return 0;
+    }
+
+    FrameSinkRingHeader* header = (FrameSinkRingHeader*)sink->ring;
+    uint64_t slot = frame_index % header->slot_count;
+    return sink->ring + header->slot_offset + slot * header->pitch * header->height;
+}
+
+static void
+frame_sink_convert_ppm(FrameSink* sink, const uint8_t* pixels, int32_t pitch)
+{
+    uint8_t* rgb = sink->scratch + sink->scratch_header_size;
+    for (int32_t y = 0; y < sink->desc.height; ++y)
+    {
+        const uint32_t* row = (const uint32_t*)(pixels + y * pitch);
+        for (int32_t x = 0; x < sink->desc.width; ++x)
+        {
+            uint32_t color = row[x];
+            rgb[0] = (color >> 16) & 0xff;
+            rgb[1] = (color >> 8) & 0xff;
+            rgb[2] = color & 0xff;
+            rgb += 3;
+        }
+    }
+}
+
+// BT.601 limited range in 8 bit integer math
+static void
+frame_sink_convert_y4m(FrameSink* sink, const uint8_t* pixels, int32_t pitch)
+{
+    int32_t pixel_count = sink->desc.width * sink->desc.height;
+    uint8_t* plane_y = sink->scratch + sink->scratch_header_size;
+    uint8_t* plane_u = plane_y + pixel_count;
+    uint8_t* plane_v = plane_u + pixel_count;
+
+    for (int32_t y = 0; y < sink->desc.height; ++y)
+    {
+        const uint32_t* row = (const uint32_t*)(pixels + y * pitch);
+        for (int32_t x = 0; x < sink->desc.width; ++x)
+        {
+            int32_t r = (row[x] >> 16) & 0xff;
+            int32_t g = (row[x] >> 8) & 0xff;
+            int32_t b = row[x] & 0xff;
+
+            *plane_y++ = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            *plane_u++ = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            *plane_v++ = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+}
+
+int32_t
+frame_sink_write(FrameSink* sink, uint64_t frame_index, const uint8_t* pixels, int32_t pitch)
+{
+    FrameSinkDesc desc = sink->desc;
+    int32_t row_size = desc.width * 4;
+
+    switch (desc.format)
+    {
+        case FRAME_SINK_RAW:
+            if (pitch == row_size)
+            {
+                return frame_sink_write_all(sink->fd, pixels, (uint64_t)row_size * desc.height);
+            }
+
+            for (int32_t y = 0; y < desc.height; ++y)
+            {
+                if (!frame_sink_write_all(sink->fd, pixels + y * pitch, row_size))
+                {
+                    return 0;
+                }
+            }
+
+            return 1;
+        case FRAME_SINK_PPM:
+            frame_sink_convert_ppm(sink, pixels, pitch);
+            return frame_sink_write_all(sink->fd, sink->scratch, sink->scratch_size);
+        case FRAME_SINK_Y4M:
+            frame_sink_convert_y4m(sink, pixels, pitch);
+            return frame_sink_write_all(sink->fd, sink->scratch, sink->scratch_size);
+        case FRAME_SINK_RING:
+        {
+            // Frames rendered somewhere other than their slot are copied in
+            uint8_t* slot = frame_sink_frame_pixels(sink, frame_index);
+            if (pixels != slot)
+            {
+                for (int32_t y = 0; y < desc.height; ++y)
+                {
+                    memcpy(slot + y * row_size, pixels + y * pitch, row_size);
+                }
+            }
+
+            FrameSinkRingHeader* header = (FrameSinkRingHeader*)sink->ring;
+            atomic_store_explicit((_Atomic uint64_t*)&header->frame_count, frame_index + 1, memory_order_release);
+            return 1;
+        }
+        default:
+            return 1;
+    }
+}
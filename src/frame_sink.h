@@ -0,0 +1,66 @@
+// frame_sink.h
+
+#ifndef FRAME_SINK_INCLUDED
+#define FRAME_SINK_INCLUDED
+
+#include <stdint.h>
+
+typedef enum FrameSinkFormat {
+    // Frames are rendered and dropped
+    FRAME_SINK_NONE = 0,
+    // Packed 32 bit 0x00RRGGBB pixels, one frame after the other
+    FRAME_SINK_RAW = 1,
+    // Concatenated binary PPM images, as read by image2pipe decoders
+    FRAME_SINK_PPM = 2,
+    // YUV4MPEG2 stream in 4:4:4
+    FRAME_SINK_Y4M = 3,
+    // Memory mapped file of frame slots other processes can map and read
+    FRAME_SINK_RING = 4,
+} FrameSinkFormat;
+
+typedef struct FrameSinkDesc {
+    FrameSinkFormat format;
+    // File to write, "-" streams to stdout
+    const char* path;
+    int32_t width;
+    int32_t height;
+    // Frames per second written into the Y4M header
+    int32_t frame_rate;
+    // Frames the ring file holds
+    int32_t ring_slot_count;
+} FrameSinkDesc;
+
+// Header at the start of a ring file. frame_count is stored with release
+// ordering after a frame is complete, so a reader that loads it with acquire
+// ordering can read slot (frame_count - 1) % slot_count. Slots are reused,
+// readers falling more than slot_count frames behind see torn frames.
+typedef struct FrameSinkRingHeader {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+    uint32_t slot_count;
+    uint64_t slot_offset;
+    uint64_t frame_count;
+} FrameSinkRingHeader;
+
+#define FRAME_SINK_RING_MAGIC "B2BRING1"
+
+typedef struct FrameSink FrameSink;
+
+// Open a sink for frames of a fixed size. Everything a frame needs is
+// allocated here, writing frames never allocates. Returns 0 on failure.
+FrameSink* frame_sink_open(FrameSinkDesc desc);
+void frame_sink_close(FrameSink* sink);
+
+// Pixels a ring sink's frame index is rendered into, width * 4 bytes per
+// row. Other formats return 0 and frames live wherever the caller wants.
+uint8_t* frame_sink_frame_pixels(FrameSink* sink, uint64_t frame_index);
+
+// Write out the frame. Raw frames with packed rows are written straight
+// from pixels, PPM and Y4M are converted in a buffer owned by the sink and
+// ring frames, already in place, are only published. Frames must be written
+// in index order. Returns 0 if writing failed.
+int32_t frame_sink_write(FrameSink* sink, uint64_t frame_index, const uint8_t* pixels, int32_t pitch);
+
+#endif // FRAME_SINK_INCLUDED
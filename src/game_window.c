@@ -1,13 +1,92 @@
 // game_window.c
 
 #include "game_window.h"
+#include "profiler.h"
 
 #include <SDL2/SDL.h>
+
+// How long present waits for a frame before handing control back for events
+#define GAME_WINDOW_PRESENT_TIMEOUT_MS 100
+
+typedef enum GameWindowFrameState {
+    GAME_WINDOW_FRAME_FREE = 0,
+    GAME_WINDOW_FRAME_RENDERING = 1,
+    GAME_WINDOW_FRAME_READY = 2,
+} GameWindowFrameState;
+
 typedef struct GameWindowInternal {
     SDL_Window* window_handle;
     SDL_Surface* surface;
+
+    // Guards the frame states, the pixel buffer size and format and stopped
+    SDL_mutex* mutex;
+    SDL_cond* frame_free_cond;
+    SDL_cond* frame_ready_cond;
+    GameWindowFrame frames[GAME_WINDOW_MAX_FRAMES];
+    GameWindowFrameState frame_states[GAME_WINDOW_MAX_FRAMES];
+    int32_t frame_capacities[GAME_WINDOW_MAX_FRAMES];
+    int32_t frame_count;
+    uint64_t next_frame_index;
+    int32_t stopped;
+
+    // Drawn regions of the frame on the surface, which the next present has
+    // to cover as well. Everything is presented after the surface changed.
+    RendererDirtyRects presented_dirty;
+    int32_t present_all;
+
+    // Frames keep the format set by game_window_set_pixel_format instead of
+    // following the surface
+    int32_t pixel_format_set;
+
+    uint64_t target_frame_ticks;
+    uint64_t next_present_ticks;
+    uint64_t last_present_ticks;
+
+    // Headless windows only
+    FrameSink* sink;
+    uint8_t* surface_pixels;
+    uint64_t surface_frame_index;
+    int32_t frame_limit;
+    uint64_t written_frame_count;
 } GameWindowInternal;
 
+// Format the renderer draws for a surface of sdl_format, XRGB8888 for any it
+// cannot draw directly, which presenting then converts from
+static RendererPixelFormat
+game_window_renderer_format(uint32_t sdl_format)
+{
+    switch (sdl_format)
+    {
+        case SDL_PIXELFORMAT_RGB565:
+            return RENDERER_PIXEL_FORMAT_RGB565;
+        case SDL_PIXELFORMAT_ARGB8888:
+            return RENDERER_PIXEL_FORMAT_ARGB8888;
+        default:
+            return RENDERER_PIXEL_FORMAT_XRGB8888;
+    }
+}
+
+static int32_t
+game_window_is_renderer_format(uint32_t sdl_format)
+{
+    return sdl_format == SDL_PIXELFORMAT_RGB565 || sdl_format == SDL_PIXELFORMAT_ARGB8888 ||
+        sdl_format == SDL_PIXELFORMAT_RGB888;
+}
+
+static uint32_t
+game_window_sdl_format(RendererPixelFormat format)
+{
+    switch (format)
+    {
+        case RENDERER_PIXEL_FORMAT_RGB565:
+            return SDL_PIXELFORMAT_RGB565;
+        case RENDERER_PIXEL_FORMAT_ARGB8888:
+            return SDL_PIXELFORMAT_ARGB8888;
+        default:
+            return SDL_PIXELFORMAT_RGB888;
+    }
+}
+
 void game_window_update_size(GameWindow* window)
 {
     SDL_GetWindowSize(window->internal->window_handle,
@@ -17,12 +96,54 @@ void game_window_update_size(GameWindow* window)
     SDL_Renderer* renderer = 
         SDL_GetRenderer(window->internal->window_handle);
 
-    SDL_GetRendererOutputSize(renderer,
-                              &window->pixel_buffer_width,
-                              &window->pixel_buffer_height);
+    int32_t width = 0;
+    int32_t height = 0;
+    SDL_GetRendererOutputSize(renderer, &width, &height);
+
+    uint32_t sdl_format = SDL_GetWindowPixelFormat(window->internal->window_handle);
+
+    SDL_LockMutex(window->internal->mutex);
+    window->pixel_buffer_width = width;
+    window->pixel_buffer_height = height;
+    if (!window->internal->pixel_format_set)
+    {
+        window->pixel_buffer_format = game_window_renderer_format(sdl_format);
+    }
+    SDL_UnlockMutex(window->internal->mutex);
+}
+
+static GameWindow*
+game_window_allocate(int width, int height, int32_t frame_count)
+{
+    uintptr_t window_and_internal_size = 
+        sizeof(GameWindow) + sizeof(GameWindowInternal);
+    GameWindow* game_window = malloc(window_and_internal_size);
+    game_window->internal = (GameWindowInternal*)(game_window + 1);
+    memset(game_window->internal, 0, sizeof(GameWindowInternal));
+
+    game_window->internal->mutex = SDL_CreateMutex();
+    game_window->internal->frame_free_cond = SDL_CreateCond();
+    game_window->internal->frame_ready_cond = SDL_CreateCond();
+    game_window->internal->frame_count = frame_count < 2 ? 2 : frame_count;
+    if (game_window->internal->frame_count > GAME_WINDOW_MAX_FRAMES)
+    {
+        game_window->internal->frame_count = GAME_WINDOW_MAX_FRAMES;
+    }
+
+    game_window->window_width = width;
+    game_window->window_height = height;
+    game_window->pixel_buffer_width = 0;
+    game_window->pixel_buffer_height = 0;
+    game_window->pixel_buffer_pitch = 0;
+    game_window->pixel_buffer_format = RENDERER_PIXEL_FORMAT_XRGB8888;
+    game_window->pixels = 0;
+    game_window->flags = GAME_WINDOW_FLAGS_NONE;
+    game_window->frame_time = 0.0f;
+
+    return game_window;
 }
 
-GameWindow* game_window_create(const char* title, int width, int height)
+GameWindow* game_window_create(const char* title, int width, int height, int32_t frame_count)
 {
     uint32_t window_flags = SDL_WINDOW_RESIZABLE;
     SDL_Window *sdl_window = SDL_CreateWindow(title,
@@ -37,33 +158,83 @@ GameWindow* game_window_create(const char* title, int width, int height)
         return 0;
     }
 
-    uintptr_t window_and_internal_size = 
-        sizeof(GameWindow) + sizeof(GameWindowInternal);
-    GameWindow* game_window = malloc(window_and_internal_size);
-    game_window->internal = (GameWindowInternal*)(game_window + 1);
+    GameWindow* game_window = game_window_allocate(width, height, frame_count);
     game_window->internal->window_handle = sdl_window;
     game_window->internal->surface = 0;
 
-    game_window->window_width = width;
-    game_window->window_height = height;
-    game_window->pixel_buffer_width = 0;
-    game_window->pixel_buffer_height = 0;
-    game_window->pixels = 0;
-    game_window->flags = GAME_WINDOW_FLAGS_NONE;
+    return game_window;
+}
+
+GameWindow* game_window_create_headless(FrameSinkDesc sink_desc, int32_t frame_count, int32_t frame_limit)
+{
+    GameWindow* game_window = game_window_allocate(sink_desc.width, sink_desc.height, frame_count);
+    GameWindowInternal* internal = game_window->internal;
+
+    // Every frame in flight needs a slot of its own besides the newest
+    // published one readers may still be looking at.
+    if (sink_desc.ring_slot_count < internal->frame_count + 1)
+    {
+        sink_desc.ring_slot_count = internal->frame_count + 1;
+    }
+
+    internal->sink = frame_sink_open(sink_desc);
+    if (!internal->sink)
+    {
+        game_window_destroy(game_window);
+        return 0;
+    }
+
+    internal->frame_limit = frame_limit;
+    internal->surface_pixels = malloc(sink_desc.width * sink_desc.height * 4);
+
+    game_window->pixel_buffer_width = sink_desc.width;
+    game_window->pixel_buffer_height = sink_desc.height;
 
     return game_window;
 }
 
 void game_window_destroy(GameWindow* game_window)
 {
-    SDL_DestroyWindow(game_window->internal->window_handle);
-    game_window->internal->window_handle = 0;
+    GameWindowInternal* internal = game_window->internal;
+    for (int32_t i = 0; i < internal->frame_count; ++i)
+    {
+        // Frames of a ring sink live in the ring
+        if (internal->frame_capacities[i] > 0)
+        {
+            free(internal->frames[i].pixels);
+        }
+    }
+
+    SDL_DestroyCond(internal->frame_ready_cond);
+    SDL_DestroyCond(internal->frame_free_cond);
+    SDL_DestroyMutex(internal->mutex);
+
+    if (internal->sink)
+    {
+        frame_sink_close(internal->sink);
+    }
+
+    free(internal->surface_pixels);
+
+    if (internal->window_handle)
+    {
+        SDL_DestroyWindow(game_window->internal->window_handle);
+        game_window->internal->window_handle = 0;
+    }
 
     free(game_window);
 }
 
 void game_window_process_events(GameWindow* game_window)
 {
+    // Headless windows have no events, they close on their own
+    if (!game_window->internal->window_handle)
+    {
+        return;
+    }
+
+    ProfilerBegin(process_events);
+
     SDL_Event event;
     while(SDL_PollEvent(&event))
     {
@@ -72,9 +243,14 @@ void game_window_process_events(GameWindow* game_window)
             case SDL_WINDOWEVENT:
                 if (event.window.event == SDL_WINDOWEVENT_SHOWN) {
                     game_window_update_size(game_window);
+                    game_window->internal->present_all = 1;
                 }
                 if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
                     game_window_update_size(game_window);
+                    game_window->internal->present_all = 1;
+                }
+                if (event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                    game_window->internal->present_all = 1;
                 }
                 break;
             case SDL_QUIT:
@@ -82,10 +258,62 @@ void game_window_process_events(GameWindow* game_window)
                 break;
         }
     }
+
+    ProfilerEnd(process_events);
+}
+
+// Write a finished headless frame to the sink
+static void
+game_window_write_frame(GameWindow* game_window, uint64_t frame_index, const uint8_t* pixels, int32_t pitch)
+{
+    GameWindowInternal* internal = game_window->internal;
+    if (!frame_sink_write(internal->sink, frame_index, pixels, pitch))
+    {
+        printf("failed to write frame %llu\n", (unsigned long long)frame_index);
+        game_window->flags |= GAME_WINDOW_FLAGS_CLOSED;
+    }
+
+    internal->written_frame_count++;
+    if (internal->frame_limit > 0 && internal->written_frame_count >= (uint64_t)internal->frame_limit)
+    {
+        game_window->flags |= GAME_WINDOW_FLAGS_CLOSED;
+    }
+}
+
+// Write a headless frame in another format than the sink's, converted into
+// its ring slot or the window's own pixels first
+static void
+game_window_write_converted_frame(GameWindow* game_window, GameWindowFrame* frame)
+{
+    GameWindowInternal* internal = game_window->internal;
+    uint8_t* pixels = frame_sink_frame_pixels(internal->sink, frame->index);
+    pixels = pixels ? pixels : internal->surface_pixels;
+
+    RendererTargetBuffer source = renderer_create_target_buffer(frame->width, frame->height, frame->format,
+                                                                frame->pixels);
+    source.pitch = frame->pitch;
+    RendererTargetBuffer destination = renderer_create_target_buffer(frame->width, frame->height,
+                                                                     RENDERER_PIXEL_FORMAT_XRGB8888, pixels);
+
+    renderer_resolve(source, destination);
+    game_window_write_frame(game_window, frame->index, pixels, destination.pitch);
 }
 
 void game_window_surface_lock_pixels(GameWindow* game_window)
 {
+    GameWindowInternal* internal = game_window->internal;
+    if (internal->sink)
+    {
+        SDL_LockMutex(internal->mutex);
+        internal->surface_frame_index = internal->next_frame_index++;
+        SDL_UnlockMutex(internal->mutex);
+
+        uint8_t* pixels = frame_sink_frame_pixels(internal->sink, internal->surface_frame_index);
+        game_window->pixels = pixels ? pixels : internal->surface_pixels;
+        game_window->pixel_buffer_pitch = game_window->pixel_buffer_width * 4;
+        return;
+    }
+
     SDL_Surface *surface = 
         SDL_GetWindowSurface(game_window->internal->window_handle);
     
@@ -93,12 +321,386 @@ void game_window_surface_lock_pixels(GameWindow* game_window)
 
     game_window->internal->surface = surface;
     game_window->pixels = surface->pixels;
+    game_window->pixel_buffer_pitch = surface->pitch;
 }
 
 void game_window_surface_unlock_and_update_pixels(GameWindow* game_window)
 {
+    GameWindowInternal* internal = game_window->internal;
+    if (internal->sink)
+    {
+        game_window_write_frame(game_window, internal->surface_frame_index,
+                                game_window->pixels, game_window->pixel_buffer_pitch);
+        game_window->pixels = 0;
+        return;
+    }
+
     game_window->pixels = 0;
 
     SDL_UnlockSurface(game_window->internal->surface);
+    ProfilerBegin(update_window_surface);
     SDL_UpdateWindowSurface(game_window->internal->window_handle);
+    ProfilerEnd(update_window_surface);
+}
+
+void game_window_surface_unlock_and_update_rects(GameWindow* game_window, const RendererDirtyRects* rects)
+{
+    GameWindowInternal* internal = game_window->internal;
+    if (internal->sink)
+    {
+        game_window_surface_unlock_and_update_pixels(game_window);
+        return;
+    }
+
+    game_window->pixels = 0;
+
+    SDL_Rect sdl_rects[RENDERER_DIRTY_RECT_MAX];
+    for (int32_t i = 0; i < rects->count; ++i)
+    {
+        RendererRect rect = rects->rects[i];
+        sdl_rects[i].x = rect.x;
+        sdl_rects[i].y = rect.y;
+        sdl_rects[i].w = rect.w;
+        sdl_rects[i].h = rect.h;
+    }
+
+    SDL_UnlockSurface(internal->surface);
+    ProfilerBegin(update_window_surface);
+    if (rects->count > 0)
+    {
+        SDL_UpdateWindowSurfaceRects(internal->window_handle, sdl_rects, rects->count);
+    }
+    ProfilerEnd(update_window_surface);
+}
+
+void game_window_set_pixel_format(GameWindow* game_window, RendererPixelFormat format)
+{
+    GameWindowInternal* internal = game_window->internal;
+
+    SDL_LockMutex(internal->mutex);
+    game_window->pixel_buffer_format = format;
+    internal->pixel_format_set = 1;
+    SDL_UnlockMutex(internal->mutex);
+}
+
+void game_window_set_target_frame_time(GameWindow* game_window, float target_frame_time)
+{
+    GameWindowInternal* internal = game_window->internal;
+    internal->target_frame_ticks = 
+        (uint64_t)(target_frame_time * (double)SDL_GetPerformanceFrequency());
+    internal->next_present_ticks = 0;
+}
+
+GameWindowFrame* game_window_acquire_frame(GameWindow* game_window)
+{
+    GameWindowInternal* internal = game_window->internal;
+
+    SDL_LockMutex(internal->mutex);
+
+    int32_t frame_index = -1;
+    while (!internal->stopped)
+    {
+        for (int32_t i = 0; i < internal->frame_count && frame_index < 0; ++i)
+        {
+            if (internal->frame_states[i] == GAME_WINDOW_FRAME_FREE)
+            {
+                frame_index = i;
+            }
+        }
+
+        if (frame_index >= 0)
+        {
+            break;
+        }
+
+        ProfilerBegin(wait_for_free_frame);
+        SDL_CondWait(internal->frame_free_cond, internal->mutex);
+        ProfilerEnd(wait_for_free_frame);
+    }
+
+    if (internal->stopped)
+    {
+        SDL_UnlockMutex(internal->mutex);
+        return 0;
+    }
+
+    GameWindowFrame* frame = internal->frames + frame_index;
+    internal->frame_states[frame_index] = GAME_WINDOW_FRAME_RENDERING;
+    frame->index = internal->next_frame_index++;
+
+    int32_t resized = frame->width != game_window->pixel_buffer_width ||
+        frame->height != game_window->pixel_buffer_height ||
+        frame->format != game_window->pixel_buffer_format;
+    frame->width = game_window->pixel_buffer_width;
+    frame->height = game_window->pixel_buffer_height;
+    frame->format = game_window->pixel_buffer_format;
+
+    SDL_UnlockMutex(internal->mutex);
+
+    // Nothing is known about pixels that are new or laid out differently
+    RendererRect frame_rect = {
+        0, 0, frame->width, frame->height
+    };
+
+    if (resized)
+    {
+        renderer_dirty_rects_clear(&frame->dirty);
+        renderer_dirty_rects_add(&frame->dirty, frame_rect);
+    }
+
+    // Headless frames are rendered in place in a ring sink when they are in
+    // its format, or with packed rows so they are written out in one go.
+    int32_t bytes_per_pixel = renderer_pixel_format_bytes(frame->format);
+    if (internal->sink)
+    {
+        frame->pitch = frame->width * bytes_per_pixel;
+
+        uint8_t* pixels = frame->format == RENDERER_PIXEL_FORMAT_XRGB8888 ?
+            frame_sink_frame_pixels(internal->sink, frame->index) : 0;
+        if (pixels)
+        {
+            if (internal->frame_capacities[frame_index] > 0)
+            {
+                free(frame->pixels);
+                internal->frame_capacities[frame_index] = 0;
+            }
+
+            frame->pixels = pixels;
+            renderer_dirty_rects_clear(&frame->dirty);
+            renderer_dirty_rects_add(&frame->dirty, frame_rect);
+            return frame;
+        }
+    }
+    else
+    {
+        // Rows are padded to a cache line for the renderer's wide stores
+        frame->pitch = (frame->width * bytes_per_pixel + 63) & ~63;
+    }
+
+    // The frame belongs to the caller now, so it can be grown unlocked.
+    int32_t size = frame->pitch * frame->height;
+    if (size > internal->frame_capacities[frame_index])
+    {
+        // Pixels without a capacity are a ring slot, not ours to free
+        if (internal->frame_capacities[frame_index] > 0)
+        {
+            free(frame->pixels);
+        }
+
+        // aligned_alloc takes a multiple of the alignment
+        int32_t capacity = (size + 63) & ~63;
+        frame->pixels = aligned_alloc(64, capacity);
+        internal->frame_capacities[frame_index] = capacity;
+
+        renderer_dirty_rects_clear(&frame->dirty);
+        renderer_dirty_rects_add(&frame->dirty, frame_rect);
+    }
+
+    return frame;
+}
+
+void game_window_submit_frame(GameWindow* game_window, GameWindowFrame* frame)
+{
+    GameWindowInternal* internal = game_window->internal;
+
+    SDL_LockMutex(internal->mutex);
+    internal->frame_states[frame - internal->frames] = GAME_WINDOW_FRAME_READY;
+    SDL_CondSignal(internal->frame_ready_cond);
+    SDL_UnlockMutex(internal->mutex);
+}
+
+// Sleep for most of the time left until the next present and spin the rest,
+// since sleeps routinely overshoot by a millisecond or more.
+static void
+game_window_wait_for_present_time(GameWindowInternal* internal)
+{
+    if (internal->target_frame_ticks == 0)
+    {
+        return;
+    }
+
+    uint64_t frequency = SDL_GetPerformanceFrequency();
+    uint64_t now = SDL_GetPerformanceCounter();
+
+    if (internal->next_present_ticks != 0)
+    {
+        while (now < internal->next_present_ticks)
+        {
+            uint64_t remaining_ms = (internal->next_present_ticks - now) * 1000 / frequency;
+            if (remaining_ms > 2)
+            {
+                SDL_Delay((uint32_t)(remaining_ms - 1));
+            }
+
+            now = SDL_GetPerformanceCounter();
+        }
+    }
+
+    // Keep a steady cadence, but don't try to catch up on frames that were
+    // missed by more than a whole frame.
+    internal->next_present_ticks += internal->target_frame_ticks;
+    if (internal->next_present_ticks + internal->target_frame_ticks < now)
+    {
+        internal->next_present_ticks = now + internal->target_frame_ticks;
+    }
+}
+
+// Copy the regions drawn to frame or to the frame before it, which together
+// hold every pixel that changed, and update only those on screen
+static void
+game_window_copy_to_surface(GameWindow* game_window, GameWindowFrame* frame)
+{
+    GameWindowInternal* internal = game_window->internal;
+    SDL_Surface* previous_surface = internal->surface;
+    game_window_surface_lock_pixels(game_window);
+
+    SDL_Surface* surface = internal->surface;
+    int32_t width = frame->width < surface->w ? frame->width : surface->w;
+    int32_t height = frame->height < surface->h ? frame->height : surface->h;
+    RendererRect bounds = {
+        0, 0, width, height
+    };
+
+    RendererDirtyRects present_rects;
+    renderer_dirty_rects_clear(&present_rects);
+    if (internal->present_all || surface != previous_surface)
+    {
+        renderer_dirty_rects_add(&present_rects, bounds);
+        internal->present_all = 0;
+    }
+    else
+    {
+        present_rects = internal->presented_dirty;
+        renderer_dirty_rects_add_all(&present_rects, &frame->dirty);
+    }
+
+    // Frames in the surface's format are copied, or converted between the
+    // formats the renderer draws. Anything else is left to SDL.
+    uint32_t surface_format = surface->format->format;
+    int32_t renderer_converts = game_window_is_renderer_format(surface_format);
+
+    RendererTargetBuffer source = renderer_create_target_buffer(frame->width, frame->height, frame->format,
+                                                                frame->pixels);
+    source.pitch = frame->pitch;
+    RendererTargetBuffer destination = renderer_create_target_buffer(
+        surface->w, surface->h, game_window_renderer_format(surface_format), game_window->pixels);
+    destination.pitch = game_window->pixel_buffer_pitch;
+
+    int64_t presented_pixels = 0;
+    int32_t rect_count = present_rects.count;
+    present_rects.count = 0;
+    for (int32_t i = 0; i < rect_count; ++i)
+    {
+        RendererRect rect = renderer_rect_intersect(present_rects.rects[i], bounds);
+        if (rect.w == 0 || rect.h == 0)
+        {
+            continue;
+        }
+
+        present_rects.rects[present_rects.count++] = rect;
+        presented_pixels += rect.w * rect.h;
+
+        if (renderer_converts)
+        {
+            renderer_resolve_rect(source, destination, rect);
+        }
+        else
+        {
+            SDL_ConvertPixels(rect.w, rect.h, game_window_sdl_format(frame->format),
+                              source.pixels + IndexPixel(rect.x, rect.y, source), source.pitch, surface_format,
+                              destination.pixels + rect.y * destination.pitch + rect.x * surface->format->BytesPerPixel,
+                              destination.pitch);
+        }
+    }
+
+    ProfilerCount(PROFILER_COUNTER_PIXELS_PRESENTED, presented_pixels);
+    internal->presented_dirty = frame->dirty;
+
+    game_window_surface_unlock_and_update_rects(game_window, &present_rects);
+}
+
+int32_t game_window_present(GameWindow* game_window)
+{
+    GameWindowInternal* internal = game_window->internal;
+
+    SDL_LockMutex(internal->mutex);
+
+    int32_t frame_index = -1;
+    for (int32_t attempt = 0; attempt < 2 && frame_index < 0; ++attempt)
+    {
+        for (int32_t i = 0; i < internal->frame_count; ++i)
+        {
+            if (internal->frame_states[i] == GAME_WINDOW_FRAME_READY &&
+                (frame_index < 0 || internal->frames[i].index < internal->frames[frame_index].index))
+            {
+                frame_index = i;
+            }
+        }
+
+        if (frame_index < 0 && attempt == 0)
+        {
+            ProfilerBegin(wait_for_ready_frame);
+            SDL_CondWaitTimeout(internal->frame_ready_cond, internal->mutex, GAME_WINDOW_PRESENT_TIMEOUT_MS);
+            ProfilerEnd(wait_for_ready_frame);
+        }
+    }
+
+    SDL_UnlockMutex(internal->mutex);
+
+    if (frame_index < 0)
+    {
+        return 0;
+    }
+
+    // Ready frames are only touched by the presenting thread, so the copy or
+    // write happens while the next frame is being rendered.
+    GameWindowFrame* frame = internal->frames + frame_index;
+    ProfilerBegin(frame_pacing);
+    game_window_wait_for_present_time(internal);
+    ProfilerEnd(frame_pacing);
+
+    if (internal->sink)
+    {
+        ProfilerBegin(write_frame);
+        if (frame->format == RENDERER_PIXEL_FORMAT_XRGB8888)
+        {
+            game_window_write_frame(game_window, frame->index, frame->pixels, frame->pitch);
+        }
+        else
+        {
+            game_window_write_converted_frame(game_window, frame);
+        }
+        ProfilerEnd(write_frame);
+    }
+    else
+    {
+        ProfilerBegin(copy_to_surface);
+        game_window_copy_to_surface(game_window, frame);
+        ProfilerEnd(copy_to_surface);
+    }
+
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (internal->last_present_ticks != 0)
+    {
+        game_window->frame_time = 
+            (float)((double)(now - internal->last_present_ticks) / (double)SDL_GetPerformanceFrequency());
+    }
+    internal->last_present_ticks = now;
+
+    SDL_LockMutex(internal->mutex);
+    internal->frame_states[frame_index] = GAME_WINDOW_FRAME_FREE;
+    SDL_CondSignal(internal->frame_free_cond);
+    SDL_UnlockMutex(internal->mutex);
+
+    return 1;
+}
+
+void game_window_stop_frames(GameWindow* game_window)
+{
+    GameWindowInternal* internal = game_window->internal;
+
+    SDL_LockMutex(internal->mutex);
+    internal->stopped = 1;
+    SDL_CondBroadcast(internal->frame_free_cond);
+    SDL_UnlockMutex(internal->mutex);
 }
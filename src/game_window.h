@@ -5,14 +5,45 @@
 
 #include <stdint.h>
 
+#include "frame_sink.h"
+#include "renderer.h"
+
+// Most offscreen frames a window can pipeline
+#define GAME_WINDOW_MAX_FRAMES 3
+
+// Offscreen frame rendered on any thread and presented by the window
+typedef struct GameWindowFrame {
+    int32_t width;
+    int32_t height;
+    int32_t pitch;
+    RendererPixelFormat format;
+    uint8_t* pixels;
+
+    // Frames are presented in the order they were acquired
+    uint64_t index;
+
+    // Everything drawn over the background this frame, only these regions
+    // are presented along with those of the previous frame. On acquire it
+    // still holds what was drawn the last time, or the whole frame when the
+    // pixels are new, which is what needs clearing back to the background.
+    RendererDirtyRects dirty;
+} GameWindowFrame;
+
 typedef struct GameWindow {
     int32_t window_width;
     int32_t window_height;
     int32_t pixel_buffer_width;
     int32_t pixel_buffer_height;
+    int32_t pixel_buffer_pitch;
+    // Format frames are rendered in, the surface's own whenever the renderer
+    // can draw it, so presenting is a plain copy
+    RendererPixelFormat pixel_buffer_format;
     uint8_t flags;
     uint8_t *pixels;
 
+    // Seconds between the last two presented frames
+    float frame_time;
+
     struct GameWindowInternal* internal;
 } GameWindow;
 
@@ -21,10 +52,44 @@ enum GameWindowFlags {
     GAME_WINDOW_FLAGS_CLOSED = 1 << 0,
 };
 
-GameWindow* game_window_create();
+// Create a window presenting frame_count offscreen frames, clamped to 2..3.
+// Two lets one frame render while the other is presented, three lets
+// rendering run a frame ahead to absorb uneven frame times.
+GameWindow* game_window_create(const char* title, int width, int height, int32_t frame_count);
+
+// Create a window without a display, owning pixel memory the size of sink
+// and writing every presented or unlocked frame to it. Nothing throttles
+// presents unless a target frame time is set. The window flags itself
+// closed after frame_limit frames, or when the sink fails, 0 never closes.
+GameWindow* game_window_create_headless(FrameSinkDesc sink, int32_t frame_count, int32_t frame_limit);
 void game_window_destroy(GameWindow *game_window);
 void game_window_process_events(GameWindow *game_window);
 void game_window_surface_lock_pixels(GameWindow *game_window);
 void game_window_surface_unlock_and_update_pixels(GameWindow *game_window);
 
-#endif // GAME_WINDOW_INCLUDED
\ No newline at end of file
+// Same as game_window_surface_unlock_and_update_pixels, but only update the
+// parts of the window inside rects
+void game_window_surface_unlock_and_update_rects(GameWindow *game_window, const RendererDirtyRects *rects);
+
+// Render frames in format whatever the surface is, presenting converts them.
+// Headless frames are converted to the 0x00RRGGBB pixels the sink takes.
+void game_window_set_pixel_format(GameWindow *game_window, RendererPixelFormat format);
+
+// Present at most one frame every target_frame_time seconds, 0 is uncapped
+void game_window_set_target_frame_time(GameWindow *game_window, float target_frame_time);
+
+// Take a free frame sized to the pixel buffer, blocking while every frame is
+// waiting to be presented. Returns 0 once game_window_stop_frames is called.
+// Safe to call from a thread other than the one processing events.
+GameWindowFrame* game_window_acquire_frame(GameWindow *game_window);
+void game_window_submit_frame(GameWindow *game_window, GameWindowFrame *frame);
+
+// Copy the oldest submitted frame to the window surface once the target
+// frame time has passed and free it for rendering again. Waits a bounded
+// time for a frame so events keep being processed, returns 0 if none came.
+int32_t game_window_present(GameWindow *game_window);
+
+// Wake and turn away every thread waiting to acquire a frame
+void game_window_stop_frames(GameWindow *game_window);
+
+#endif // GAME_WINDOW_INCLUDED
@@ -2,119 +2,798 @@
 
 #include <SDL2/SDL.h>
 
+#include "dynamic_resolution.h"
+#include "frame_arena.h"
 #include "game_window.h"
+#include "mesh.h"
+#include "profiler.h"
 #include "renderer.h"
+#include "renderer_command.h"
+#include "renderer_draw.h"
+#include "renderer_scale.h"
+#include "scene.h"
+#include "tile_renderer.h"
 #include "vertex_transform.h"
 
-int main(int argc, char* argv[])
+// Everything the render thread owns. Only the window is shared, and it hands
+// frames back and forth under its own lock.
+typedef struct RenderThreadState {
+    GameWindow* game_window;
+    int32_t thread_count;
+    int32_t tiled;
+    // Drawn instead of the built in triangle when set
+    Scene* scene;
+    // The scene renders below the frame size when a budget is set, and is
+    // then stretched over the frame with upscale_filter
+    DynamicResolutionDesc resolution;
+    RendererScaleFilter upscale_filter;
+    // Order the scene's commands execute in
+    RendererCommandSort command_sort;
+} RenderThreadState;
+
+// Records the overlay on a thread of its own while the render thread records
+// the scene, into a command buffer and arena nothing else pushes to
+typedef struct OverlayRecorder {
+    SDL_Thread* thread;
+    SDL_mutex* mutex;
+    SDL_cond* cond;
+    // The render thread bumps requested to have another frame recorded
+    uint32_t requested;
+    uint32_t recorded;
+    int32_t quit;
+    int32_t width;
+    int32_t height;
+
+    FrameArena* arena;
+    RendererCommandBuffer* commands;
+} OverlayRecorder;
+
+// Recorded apart from the scene, as it is drawn at the size of the frame
+// whatever the scene renders at
+static void
+draw_overlay(RendererCommandBuffer* commands, int32_t width, int32_t height)
+{
+    RendererRect top_left = {
+        0, 0, 32, 32
+    };
+
+    RendererRect top_right = {
+        width - 32,
+        0, 32, 32
+    };
+
+    RendererRect bottom_left = {
+        0, 
+        height - 32,
+        32, 32
+    };
+
+    RendererRect bottom_right = {
+        width - 32,
+        height - 32,
+        32, 32
+    };
+
+    renderer_command_fill_rect(commands, top_left, PackColorRGB(255, 0, 0));
+    renderer_command_fill_rect(commands, top_right, PackColorRGB(0, 255, 0));
+    renderer_command_fill_rect(commands, bottom_left, PackColorRGB(0, 255, 255));
+    renderer_command_fill_rect(commands, bottom_right, PackColorRGB(255, 255, 0));
+}
+
+// Asking for another frame means the last one was executed, so its commands
+// can go. Layer 1 keeps the overlay above the scene when both are merged.
+static void
+overlay_recorder_record(OverlayRecorder* recorder, int32_t width, int32_t height)
 {
-    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+    ProfilerBegin(record_overlay);
+    frame_arena_reset(recorder->arena);
+    renderer_command_buffer_begin(recorder->commands, width, height);
+    renderer_command_buffer_set_layer(recorder->commands, 1);
+    draw_overlay(recorder->commands, width, height);
+    ProfilerEnd(record_overlay);
+}
+
+static int
+overlay_thread(void* data)
+{
+    OverlayRecorder* recorder = data;
+    profiler_set_thread_name("overlay");
+
+    SDL_LockMutex(recorder->mutex);
+    for (;;)
     {
-        printf("failed initializing SDL2\n");
-        return -1;
+        while (!recorder->quit && recorder->recorded == recorder->requested)
+        {
+            SDL_CondWait(recorder->cond, recorder->mutex);
+        }
+
+        if (recorder->quit)
+        {
+            break;
+        }
+
+        uint32_t requested = recorder->requested;
+        int32_t width = recorder->width;
+        int32_t height = recorder->height;
+        SDL_UnlockMutex(recorder->mutex);
+
+        overlay_recorder_record(recorder, width, height);
+
+        SDL_LockMutex(recorder->mutex);
+        recorder->recorded = requested;
+        SDL_CondBroadcast(recorder->cond);
     }
+    SDL_UnlockMutex(recorder->mutex);
+
+    return 0;
+}
+
+static void
+overlay_recorder_init(OverlayRecorder* recorder)
+{
+    memset(recorder, 0, sizeof(OverlayRecorder));
+    recorder->mutex = SDL_CreateMutex();
+    recorder->cond = SDL_CreateCond();
+    recorder->arena = frame_arena_create(4096);
+    recorder->commands = renderer_command_buffer_create(recorder->arena);
+    recorder->thread = SDL_CreateThread(overlay_thread, "overlay", recorder);
+    if (!recorder->thread)
+    {
+        printf("failed to create overlay thread: %s\n", SDL_GetError());
+    }
+}
+
+static void
+overlay_recorder_destroy(OverlayRecorder* recorder)
+{
+    if (recorder->thread)
+    {
+        SDL_LockMutex(recorder->mutex);
+        recorder->quit = 1;
+        SDL_CondBroadcast(recorder->cond);
+        SDL_UnlockMutex(recorder->mutex);
+        SDL_WaitThread(recorder->thread, 0);
+    }
+
+    renderer_command_buffer_destroy(recorder->commands);
+    frame_arena_destroy(recorder->arena);
+    SDL_DestroyCond(recorder->cond);
+    SDL_DestroyMutex(recorder->mutex);
+}
+
+// Start recording the overlay for a width by height frame
+static void
+overlay_recorder_request(OverlayRecorder* recorder, int32_t width, int32_t height)
+{
+    SDL_LockMutex(recorder->mutex);
+    recorder->width = width;
+    recorder->height = height;
+    recorder->requested++;
+    SDL_CondBroadcast(recorder->cond);
+    SDL_UnlockMutex(recorder->mutex);
+
+    // Without a thread of its own it is recorded here instead
+    if (!recorder->thread)
+    {
+        overlay_recorder_record(recorder, width, height);
+        recorder->recorded = recorder->requested;
+    }
+}
+
+// Wait for the requested overlay and return its commands
+static RendererCommandBuffer*
+overlay_recorder_wait(OverlayRecorder* recorder)
+{
+    SDL_LockMutex(recorder->mutex);
+    while (recorder->recorded != recorder->requested)
+    {
+        SDL_CondWait(recorder->cond, recorder->mutex);
+    }
+    SDL_UnlockMutex(recorder->mutex);
+
+    return recorder->commands;
+}
+
+// Record the scene into commands and render it. The overlay, when given, is
+// merged with the scene and drawn on top of it.
+static void
+render_frame(RendererTargetBuffer target, TileRenderer* tile_renderer, RendererDepthBuffer* depth_buffer,
+             RendererTargetBuffer pixel_buffer, RendererVertexCache* vertex_cache, FrameArena* frame_arena,
+             RendererCommandBuffer* commands, OverlayRecorder* overlay, RendererCommandSort command_sort,
+             Scene* scene, float rotation)
+{
+    float positions_x[3] = {-1.0f, 0.0f, 1.0f};
+    float positions_y[3] = {-1.0f, 1.0f, -1.0f};
+    float positions_z[3] = {0.0f, 0.0f, 0.0f};
+    VertexStream positions = {
+        positions_x, positions_y, positions_z
+    };
+
+    uint32_t colors[3] = {
+        PackColorRGB(255, 0, 0),
+        PackColorRGB(0, 255, 0),
+        PackColorRGB(0, 0, 255)};
+
+    uint16_t triangle_indices[6] = {
+        0, 1, 2,
+        1, 0, 2};
+
+    pixel_buffer.depth = depth_buffer;
+
+    float aspect_ratio = (float)pixel_buffer.width / pixel_buffer.height;
+    Matrix4 projection = matrix4_perspective_lh(
+        45.0f, aspect_ratio, 0.01f, 100.0f);
+
+    Matrix4 view = matrix4_lookat_lh(
+        vector3_create(0.0f, 0.0f, -6.0f),
+        vector3_create(0.0f, 0.0f, 0.0f),
+        vector3_create(0.0f, 1.0f, 0.0f));
+
+    Matrix4 model = matrix4_rotate_y(rotation);
+
+    Matrix4 model_view = matrix4_multiply(model, view);
+    Matrix4 transform = matrix4_multiply(model_view, projection);
+
+    // Both sides of the triangle share vertices, only the winding differs.
+    RendererVertexBuffer vertices = {
+        positions, colors, 3
+    };
+
+    RendererIndexBuffer indices = {
+        triangle_indices, sizeof(uint16_t), 6
+    };
 
-    GameWindow* game_window = 
-        game_window_create("back_to_basics", 680, 480);
+    // Only what was drawn the last time these pixels were rendered needs
+    // clearing, the rest still holds the background. The clear is deferred
+    // per tile, so tiles are only written once.
+    RendererDirtyRects clear_rects = *target.dirty;
+    renderer_dirty_rects_clear(target.dirty);
+
+    ProfilerBegin(draw_scene);
+    renderer_command_buffer_begin(commands, pixel_buffer.width, pixel_buffer.height);
+    renderer_command_clear_rects(commands, PackColorRGB(0, 0, 0), 1.0f, &clear_rects);
+    RendererDrawState draw_state = renderer_draw_state_create(pixel_buffer);
+    if (scene)
+    {
+        // The camera orbits the scene instead, so instances keep their place
+        // in the hierarchy
+        Vector3 eye = vector3_create(-6.0f * sinf(rotation), 0.0f, -6.0f * cosf(rotation));
+        view = matrix4_lookat_lh(eye, vector3_create(0.0f, 0.0f, 0.0f), vector3_create(0.0f, 1.0f, 0.0f));
+        Matrix4 view_projection = matrix4_multiply(view, projection);
+
+        int32_t* visible_instances;
+        int32_t visible_count = scene_cull(scene, scene_frustum_create(view_projection), frame_arena, &visible_instances);
+        Matrix4* models = FrameArenaPushArray(frame_arena, Matrix4, Max(visible_count, 1));
+
+        // Runs of visible instances sharing a mesh are drawn instanced
+        int32_t first = 0;
+        while (first < visible_count)
+        {
+            SceneInstance* instance = scene->instances + visible_instances[first];
+            int32_t count = 0;
+            while (first + count < visible_count)
+            {
+                SceneInstance* other = scene->instances + visible_instances[first + count];
+                if (other->vertices.positions.x != instance->vertices.positions.x ||
+                    other->vertices.colors != instance->vertices.colors ||
+                    other->indices.indices != instance->indices.indices ||
+                    other->indices.count != instance->indices.count)
+                {
+                    break;
+                }
+
+                models[count++] = other->model;
+            }
+
+            renderer_command_draw_indexed_instanced(commands, view_projection, models, count, draw_state,
+                                                    instance->vertices, instance->indices);
+            first += count;
+        }
+    }
+    else
+    {
+        renderer_command_draw_indexed(commands, transform, draw_state, vertices, indices);
+    }
+
+    RendererCommandBuffer* buffers[2] = {
+        commands, 0
+    };
+    int32_t buffer_count = 1;
+    if (overlay)
+    {
+        buffers[buffer_count++] = overlay_recorder_wait(overlay);
+    }
+
+    RendererCommandList list = renderer_command_merge(buffers, buffer_count, command_sort, frame_arena);
+    tile_renderer_begin(tile_renderer, pixel_buffer);
+    tile_renderer_execute(tile_renderer, vertex_cache, list);
+    ProfilerEnd(draw_scene);
+
+    tile_renderer_end(tile_renderer);
+
+    if (pixel_buffer.layout == RENDERER_TARGET_TILED)
+    {
+        tile_renderer_resolve(tile_renderer, target);
+    }
+}
+
+// Render frames until the window stops handing them out. Frame N+1 renders
+// here while the main thread presents frame N.
+static int
+render_thread(void* data)
+{
+    RenderThreadState* state = data;
+    GameWindow* game_window = state->game_window;
+    profiler_set_thread_name("render");
+
+    TileRenderer* tile_renderer = tile_renderer_create(state->thread_count);
+    RendererDepthBuffer* depth_buffer = 0;
+    uint8_t* tiled_pixels = 0;
+    int32_t tiled_pixels_size = 0;
+    // Sized up after the first frames overflow it, then never allocates
+    FrameArena* frame_arena = frame_arena_create(1 << 20);
+    RendererVertexCache* vertex_cache = renderer_vertex_cache_create(64, frame_arena);
+
+    RendererCommandBuffer* scene_commands = renderer_command_buffer_create(frame_arena);
+    OverlayRecorder overlay;
+    overlay_recorder_init(&overlay);
+
+    // Target the scene renders into below the frame size, and what was
+    // drawn to it the last time, which needs clearing
+    DynamicResolution resolution = dynamic_resolution_create(state->resolution);
+    uint8_t* scaled_pixels = 0;
+    int32_t scaled_pixels_size = 0;
+    int32_t scaled_width = 0;
+    int32_t scaled_height = 0;
+    RendererDirtyRects scaled_dirty = {0};
+    uint64_t counter_frequency = SDL_GetPerformanceFrequency();
 
     float rotation = 0.0f;
 
-    while ((game_window->flags & GAME_WINDOW_FLAGS_CLOSED) == 0)
+    GameWindowFrame* frame;
+    while ((frame = game_window_acquire_frame(game_window)))
     {
-        game_window_process_events(game_window);
+        RendererTargetBuffer window_buffer = 
+            renderer_create_target_buffer(frame->width, frame->height, frame->format, frame->pixels);
+        window_buffer.pitch = frame->pitch;
+        window_buffer.dirty = &frame->dirty;
+
+        // The scene renders straight into the frame unless its resolution
+        // is scaled down, then into a smaller 32 bit target stretched over
+        // it and converted to the frame's format on the way
+        RendererTargetBuffer target = window_buffer;
+        int32_t width, height;
+        dynamic_resolution_size(&resolution, frame->width, frame->height, &width, &height);
+        if (width != frame->width || height != frame->height)
+        {
+            target = renderer_create_target_buffer(width, height, RENDERER_PIXEL_FORMAT_XRGB8888, 0);
+
+            int32_t size = renderer_target_buffer_size(target);
+            if (size > scaled_pixels_size)
+            {
+                free(scaled_pixels);
+                scaled_pixels = malloc(size);
+                scaled_pixels_size = size;
+            }
+
+            // Pixels left from another size are not background, clear all
+            if (width != scaled_width || height != scaled_height)
+            {
+                RendererRect bounds = {
+                    0, 0, width, height
+                };
+
+                renderer_dirty_rects_clear(&scaled_dirty);
+                renderer_dirty_rects_add(&scaled_dirty, bounds);
+                scaled_width = width;
+                scaled_height = height;
+            }
 
-        game_window_surface_lock_pixels(game_window);
+            target.pixels = scaled_pixels;
+            target.dirty = &scaled_dirty;
+        }
+
+        // Optionally render into a tiled buffer and resolve it to the target
+        // at the end.
+        RendererTargetBuffer pixel_buffer = target;
+        if (state->tiled)
+        {
+            pixel_buffer = renderer_create_tiled_target_buffer(target.width, target.height, target.format, 0);
+            pixel_buffer.dirty = target.dirty;
 
-        int32_t bytes_per_pixel = 4;
-        RendererTargetBuffer pixel_buffer = 
-            renderer_create_target_buffer(game_window->pixel_buffer_width, game_window->pixel_buffer_height, bytes_per_pixel, game_window->pixels);
+            int32_t size = renderer_target_buffer_size(pixel_buffer);
+            if (size > tiled_pixels_size)
+            {
+                free(tiled_pixels);
+                tiled_pixels = malloc(size);
+                tiled_pixels_size = size;
+            }
 
-        renderer_fill(pixel_buffer, PackColorRGB(0, 0, 0));
+            pixel_buffer.pixels = tiled_pixels;
+        }
 
-        if (game_window->pixel_buffer_width != 0)
+        if (!depth_buffer ||
+            depth_buffer->width != pixel_buffer.width ||
+            depth_buffer->height != pixel_buffer.height)
         {
-            RendererRect top_left = {
-                0, 0, 32, 32
-            };
+            if (depth_buffer)
+            {
+                renderer_destroy_depth_buffer(depth_buffer);
+            }
 
-            RendererRect top_right = {
-                pixel_buffer.width - 32,
-                0, 32, 32
-            };
+            depth_buffer = renderer_create_depth_buffer(pixel_buffer.width, pixel_buffer.height);
+        }
 
-            RendererRect bottom_left = {
-                0, 
-                pixel_buffer.height - 32,
-                32, 32
-            };
+        if (frame->width != 0)
+        {
+            uint64_t start = SDL_GetPerformanceCounter();
 
-            RendererRect bottom_right = {
-                pixel_buffer.width - 32,
-                pixel_buffer.height - 32,
-                32, 32
-            };
+            // The overlay is recorded while the scene is. It is merged with
+            // the scene unless the scene is scaled, then drawn after scaling.
+            int32_t scaled = target.pixels != window_buffer.pixels;
+            overlay_recorder_request(&overlay, window_buffer.width, window_buffer.height);
 
-            renderer_fill_rect(pixel_buffer, top_left, PackColorRGB(255, 0, 0));
-            renderer_fill_rect(pixel_buffer, top_right, PackColorRGB(0, 255, 0));
-            renderer_fill_rect(pixel_buffer, bottom_left, PackColorRGB(0, 255, 255));
-            renderer_fill_rect(pixel_buffer, bottom_right, PackColorRGB(255, 255, 0));
+            ProfilerBegin(render_frame);
+            render_frame(target, tile_renderer, depth_buffer, pixel_buffer, vertex_cache, frame_arena,
+                         scene_commands, scaled ? 0 : &overlay, state->command_sort, state->scene, rotation);
+            if (scaled)
+            {
+                // Every pixel of the frame is written, so all of them are
+                // presented, and cleared should it render at full size next
+                renderer_dirty_rects_clear(window_buffer.dirty);
+                renderer_scale(target, window_buffer, state->upscale_filter);
+            }
+            ProfilerEnd(render_frame);
 
-            float aspect_ratio = (float)pixel_buffer.width / pixel_buffer.height;
-            Matrix4 projection = matrix4_perspective_lh(
-                45.0f, aspect_ratio, 0.01f, 100.0f);
+            float frame_time = (float)((double)(SDL_GetPerformanceCounter() - start) / (double)counter_frequency);
+            dynamic_resolution_update(&resolution, frame_time);
 
-            Matrix4 view = matrix4_lookat_lh(
-                vector3_create(0.0f, 0.0f, -6.0f),
-                vector3_create(0.0f, 0.0f, 0.0f),
-                vector3_create(0.0f, 1.0f, 0.0f));
+            if (scaled)
+            {
+                RendererCommandBuffer* overlay_commands = overlay_recorder_wait(&overlay);
+                RendererCommandList overlay_list = renderer_command_merge(&overlay_commands, 1,
+                                                                          RENDERER_COMMAND_SORT_NONE, frame_arena);
+                renderer_command_execute(overlay_list, window_buffer, vertex_cache);
+            }
 
-            Matrix4 model = matrix4_rotate_y(rotation);
             rotation += 0.04f;
+        }
+
+        // Everything transient was consumed by tile_renderer_end
+        ProfilerCount(PROFILER_COUNTER_FRAME_ARENA_BYTES, frame_arena_stats(frame_arena).used);
+        frame_arena_reset(frame_arena);
+
+        game_window_submit_frame(game_window, frame);
+        profiler_frame_mark();
+    }
+
+    if (depth_buffer)
+    {
+        renderer_destroy_depth_buffer(depth_buffer);
+    }
+
+    free(tiled_pixels);
+    free(scaled_pixels);
+    overlay_recorder_destroy(&overlay);
+    renderer_command_buffer_destroy(scene_commands);
+    renderer_vertex_cache_destroy(vertex_cache);
+    frame_arena_destroy(frame_arena);
+    tile_renderer_destroy(tile_renderer);
+
+    return 0;
+}
+
+static int32_t
+parse_pixel_format(const char* name, RendererPixelFormat* format)
+{
+    const char* names[] = {"xrgb8888", "argb8888", "rgb565"};
+    for (int32_t i = 0; i < (int32_t)(sizeof(names) / sizeof(names[0])); ++i)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *format = (RendererPixelFormat)i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int32_t
+parse_command_sort(const char* name, RendererCommandSort* sort)
+{
+    const char* names[] = {"none", "state", "depth", "tile"};
+    for (int32_t i = 0; i < (int32_t)(sizeof(names) / sizeof(names[0])); ++i)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *sort = (RendererCommandSort)i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int32_t
+parse_sink_format(const char* name, FrameSinkFormat* format)
+{
+    const char* names[] = {"none", "raw", "ppm", "y4m", "ring"};
+    for (int32_t i = 0; i < (int32_t)(sizeof(names) / sizeof(names[0])); ++i)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *format = (FrameSinkFormat)i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
 
-            Matrix4 model_view = matrix4_multiply(model, view);
-            Matrix4 transform = matrix4_multiply(model_view, projection);
+// Lay instance_count copies of mesh out on a square grid around the origin,
+// each centered and scaled to roughly the size of the built in triangle
+static Scene*
+create_scene(Mesh* mesh, int32_t instance_count)
+{
+    MeshBounds bounds = mesh->bounds;
+    Vector3 center = vector3_create((bounds.min.x + bounds.max.x) * -0.5f, (bounds.min.y + bounds.max.y) * -0.5f,
+                                    (bounds.min.z + bounds.max.z) * -0.5f);
+    float radius = 0.5f * vector3_length(vector3_subtract(bounds.max, bounds.min));
+    float scale = radius > 0.0f ? 1.5f / radius : 1.0f;
+    Matrix4 fit = matrix4_multiply(matrix4_translate(center), matrix4_scale(scale));
+
+    int32_t side = (int32_t)ceilf(sqrtf((float)instance_count));
+    float spacing = 4.0f;
+
+    Scene* scene = scene_create();
+    for (int32_t i = 0; i < instance_count; ++i)
+    {
+        Vector3 position = vector3_create((i % side - (side - 1) * 0.5f) * spacing, 0.0f,
+                                          (i / side - (side - 1) * 0.5f) * spacing);
 
-            Vector3 positions[6] = {
-                vector3_create(-1.0f, -1.0f, 0.0f),
-                vector3_create(0.0f, 1.0f, 0.0f),
-                vector3_create(1.0f, -1.0f, 0.0f),
-                vector3_create(0.0f, 1.0f, 0.0f),
-                vector3_create(-1.0f, -1.0f, 0.0f),
-                vector3_create(1.0f, -1.0f, 0.0f)};
-            Vector3 transformed[6];
+        scene_add_instance(scene, mesh->vertices, mesh->indices, bounds,
+                           matrix4_multiply(fit, matrix4_translate(position)));
+    }
 
-            vertex_transform_positions(transform, positions, transformed, 6);
-            vertex_transform_map_to_viewport(
-                pixel_buffer.width, pixel_buffer.height, transformed, positions, 6);
+    scene_build(scene);
+    return scene;
+}
 
-            RendererTriangle triangle;
-            triangle.p0 = renderer_point_create((int32_t)positions[0].x, (int32_t)positions[0].y);
-            triangle.p1 = renderer_point_create((int32_t)positions[1].x, (int32_t)positions[1].y);
-            triangle.p2 = renderer_point_create((int32_t)positions[2].x, (int32_t)positions[2].y);
+int main(int argc, char* argv[])
+{
+    int32_t thread_count = 0;
+    int32_t tiled = 0;
+    int32_t frame_count = 2;
+    float target_fps = 0.0f;
+    const char* trace_path = 0;
+    const char* mesh_path = 0;
+    int32_t instance_count = 1;
 
-            RendererTriangle triangle2;
-            triangle2.p0 = renderer_point_create((int32_t)positions[3].x, (int32_t)positions[3].y);
-            triangle2.p1 = renderer_point_create((int32_t)positions[4].x, (int32_t)positions[4].y);
-            triangle2.p2 = renderer_point_create((int32_t)positions[5].x, (int32_t)positions[5].y);
+    // Full resolution unless given a budget in milliseconds
+    DynamicResolutionDesc resolution = dynamic_resolution_desc_create(0.0f);
+    RendererScaleFilter upscale_filter = RENDERER_SCALE_BILINEAR;
+    RendererCommandSort command_sort = RENDERER_COMMAND_SORT_NONE;
 
-            triangle.c0 = PackColorRGB(255, 0, 0);
-            triangle.c1 = PackColorRGB(0, 255, 0);
-            triangle.c2 = PackColorRGB(0, 0, 255);
+    // Frames follow the window surface's format unless one is given
+    int32_t pixel_format_set = 0;
+    RendererPixelFormat pixel_format = RENDERER_PIXEL_FORMAT_XRGB8888;
 
-            triangle2.c0 = PackColorRGB(0, 255, 0);
-            triangle2.c1 = PackColorRGB(255, 0, 0);
-            triangle2.c2 = PackColorRGB(0, 0, 255);
+    // Headless runs write frames to a sink instead of opening a window
+    int32_t headless = 0;
+    int32_t frame_limit = 0;
+    FrameSinkDesc sink = {
+        FRAME_SINK_NONE, "-", 680, 480, 60, 8
+    };
 
-            renderer_fill_triangle(pixel_buffer, triangle);
-            renderer_fill_triangle(pixel_buffer, triangle2);
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            thread_count = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--tiled") == 0)
+        {
+            tiled = 1;
         }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            frame_count = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+        {
+            target_fps = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc)
+        {
+            headless = 1;
+            if (!parse_sink_format(argv[++i], &sink.format))
+            {
+                printf("unknown sink format %s, expected none, raw, ppm, y4m or ring\n", argv[i]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            sink.path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            sscanf(argv[++i], "%dx%d", &sink.width, &sink.height);
+        }
+        else if (strcmp(argv[i], "--frame-limit") == 0 && i + 1 < argc)
+        {
+            frame_limit = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--ring-slots") == 0 && i + 1 < argc)
+        {
+            sink.ring_slot_count = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            trace_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--mesh") == 0 && i + 1 < argc)
+        {
+            mesh_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+        {
+            instance_count = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc)
+        {
+            resolution.frame_time_budget = (float)atof(argv[++i]) / 1000.0f;
+        }
+        else if (strcmp(argv[i], "--min-scale") == 0 && i + 1 < argc)
+        {
+            resolution.min_scale = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-scale") == 0 && i + 1 < argc)
+        {
+            resolution.max_scale = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--scale-hysteresis") == 0 && i + 1 < argc)
+        {
+            resolution.hysteresis = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--upscale") == 0 && i + 1 < argc)
+        {
+            ++i;
+            if (strcmp(argv[i], "nearest") == 0)
+            {
+                upscale_filter = RENDERER_SCALE_NEAREST;
+            }
+            else if (strcmp(argv[i], "bilinear") == 0)
+            {
+                upscale_filter = RENDERER_SCALE_BILINEAR;
+            }
+            else
+            {
+                printf("unknown upscale filter %s, expected nearest or bilinear\n", argv[i]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--pixel-format") == 0 && i + 1 < argc)
+        {
+            pixel_format_set = 1;
+            if (!parse_pixel_format(argv[++i], &pixel_format))
+            {
+                printf("unknown pixel format %s, expected xrgb8888, argb8888 or rgb565\n", argv[i]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--command-sort") == 0 && i + 1 < argc)
+        {
+            if (!parse_command_sort(argv[++i], &command_sort))
+            {
+                printf("unknown command sort %s, expected none, state, depth or tile\n", argv[i]);
+                return -1;
+            }
+        }
+    }
+
+    // Record from the start, the trace keeps the most recent events
+    profiler_set_thread_name("main");
+    profiler_set_enabled(trace_path != 0);
+
+    // Threads and timers work without a display
+    if (SDL_Init(headless ? 0 : SDL_INIT_VIDEO) < 0)
+    {
+        printf("failed initializing SDL2\n");
+        return -1;
+    }
+
+    if (target_fps > 0.0f)
+    {
+        sink.frame_rate = (int32_t)target_fps;
+    }
+
+    GameWindow* game_window = headless ?
+        game_window_create_headless(sink, frame_count, frame_limit) :
+        game_window_create("back_to_basics", 680, 480, frame_count);
+
+    if (!game_window)
+    {
+        SDL_Quit();
+        return -1;
+    }
+
+    Mesh* mesh = 0;
+    if (mesh_path)
+    {
+        ProfilerBegin(load_mesh);
+        mesh = mesh_load(mesh_path);
+        ProfilerEnd(load_mesh);
+
+        if (!mesh)
+        {
+            game_window_destroy(game_window);
+            SDL_Quit();
+            return -1;
+        }
+    }
+
+    if (pixel_format_set)
+    {
+        game_window_set_pixel_format(game_window, pixel_format);
+    }
+
+    // Uncapped unless asked otherwise, presenting as fast as frames arrive
+    if (target_fps > 0.0f)
+    {
+        game_window_set_target_frame_time(game_window, 1.0f / target_fps);
+    }
 
-        game_window_surface_unlock_and_update_pixels(game_window);
+    Scene* scene = mesh ? create_scene(mesh, Max(instance_count, 1)) : 0;
 
-        SDL_Delay(10);
+    RenderThreadState render_state = {
+        game_window, thread_count, tiled, scene, resolution, upscale_filter, command_sort
+    };
+
+    SDL_Thread* thread = SDL_CreateThread(render_thread, "render", &render_state);
+    if (!thread)
+    {
+        printf("failed to create render thread: %s\n", SDL_GetError());
+        if (mesh)
+        {
+            scene_destroy(scene);
+            mesh_unload(mesh);
+        }
+
+        game_window_destroy(game_window);
+        SDL_Quit();
+        return -1;
     }
 
+    while ((game_window->flags & GAME_WINDOW_FLAGS_CLOSED) == 0)
+    {
+        game_window_process_events(game_window);
+
+        ProfilerBegin(present);
+        game_window_present(game_window);
+        ProfilerEnd(present);
+    }
+
+    game_window_stop_frames(game_window);
+    SDL_WaitThread(thread, 0);
+
+    // Nothing is recording once the render thread is gone
+    if (trace_path)
+    {
+        profiler_set_enabled(0);
+        profiler_export_chrome_trace(trace_path);
+    }
+
+    if (mesh)
+    {
+        scene_destroy(scene);
+        mesh_unload(mesh);
+    }
+
+    game_window_destroy(game_window);
+
     SDL_Quit();
 
     return 0;
-}
\ No newline at end of file
+}
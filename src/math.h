@@ -5,6 +5,10 @@
 
 #include <math.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define Min(x, y) (x < y ? x : y)
 #define Min3(x, y, z) Min(x, Min(y, z))
 
@@ -156,6 +160,30 @@ matrix4_perspective_lh(float fov, float aspect_ratio, float z_near, float z_far)
     return result;
 }
 
+static inline Matrix4
+matrix4_translate(Vector3 offset)
+{
+    Matrix4 result = {
+        1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        offset.x, offset.y, offset.z, 1.0f};
+
+    return result;
+}
+
+static inline Matrix4
+matrix4_scale(float scale)
+{
+    Matrix4 result = {
+        scale, 0.0f, 0.0f, 0.0f,
+        0.0f, scale, 0.0f, 0.0f,
+        0.0f, 0.0f, scale, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f};
+
+    return result;
+}
+
 static inline Matrix4
 matrix4_rotate_x(float rotation)
 {
@@ -202,6 +230,8 @@ matrix4_rotate_z(float rotation)
     return result;
 }
 
+// The SSE2 paths add the same products in the same order as the scalar
+// ones, starting from zero, so all of them return bit identical results.
 static inline Matrix4 
 matrix4_multiply(Matrix4 a, Matrix4 b)
 {
@@ -210,6 +240,22 @@ matrix4_multiply(Matrix4 a, Matrix4 b)
                       0.0f, 0.0f, 0.0f, 0.0f,
                       0.0f, 0.0f, 0.0f, 0.0f};
 
+#if defined(__SSE2__)
+    __m128 b0 = _mm_loadu_ps(b.m);
+    __m128 b1 = _mm_loadu_ps(b.m + 4);
+    __m128 b2 = _mm_loadu_ps(b.m + 8);
+    __m128 b3 = _mm_loadu_ps(b.m + 12);
+
+    for (int i = 0; i < 4; i++)
+    {
+        __m128 row = _mm_setzero_ps();
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[i*4]), b0));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[1+i*4]), b1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[2+i*4]), b2));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[3+i*4]), b3));
+        _mm_storeu_ps(result.m + i*4, row);
+    }
+#else
     int i,j,k;
     for (i = 0; i < 4; i++)
     {
@@ -221,18 +267,30 @@ matrix4_multiply(Matrix4 a, Matrix4 b)
             }
         }
     }
+#endif
     return result;
 }
 
 static inline Vector4
 matrix4_multiply_vector3(Matrix4 m, Vector3 v)
 {
+#if defined(__SSE2__)
+    __m128 result = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(v.x), _mm_loadu_ps(m.m)),
+                               _mm_mul_ps(_mm_set1_ps(v.y), _mm_loadu_ps(m.m + 4)));
+    result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(v.z), _mm_loadu_ps(m.m + 8)));
+    result = _mm_add_ps(result, _mm_loadu_ps(m.m + 12));
+
+    Vector4 vector;
+    _mm_storeu_ps(vector.xyzw, result);
+    return vector;
+#else
     float x = v.x, y = v.y, z = v.z;
     Vector4 result = {(x*m.x1 + y * m.x2 + z * m.x3 + m.x4),
                       (x*m.y1 + y * m.y2 + z * m.y3 + m.y4),
                       (x*m.z1 + y * m.z2 + z * m.z3 + m.z4),
                       (x*m.w1 + y * m.w2 + z * m.w3 + m.w4)};
     return result;
+#endif
 }
 
 #endif // MATH_INCLUDED
\ No newline at end of file
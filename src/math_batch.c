@@ -0,0 +1,70 @@
+// math_batch.c
+
+#include "math_batch.h"
+#include "profiler.h"
+#include "renderer.h"
+
+static void
+matrix4_multiply_batch_scalar(const Matrix4* a, Matrix4 b, Matrix4* results, int32_t start, int32_t count)
+{
+    for (int32_t i = start; i < count; ++i)
+    {
+        results[i] = matrix4_multiply(a[i], b);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+// Two rows of a at a time, each 128 bit lane broadcasts elements of its own
+// row against a copy of the same row of b
+__attribute__((target("avx")))
+static int32_t
+matrix4_multiply_batch_avx(const Matrix4* a, Matrix4 b, Matrix4* results, int32_t count)
+{
+    __m256 b0 = _mm256_broadcast_ps((const __m128*)b.m);
+    __m256 b1 = _mm256_broadcast_ps((const __m128*)(b.m + 4));
+    __m256 b2 = _mm256_broadcast_ps((const __m128*)(b.m + 8));
+    __m256 b3 = _mm256_broadcast_ps((const __m128*)(b.m + 12));
+
+    for (int32_t i = 0; i < count; ++i)
+    {
+        for (int32_t half = 0; half < 2; ++half)
+        {
+            __m256 rows = _mm256_loadu_ps(a[i].m + half * 8);
+
+            __m256 result = _mm256_setzero_ps();
+            result = _mm256_add_ps(result, _mm256_mul_ps(_mm256_permute_ps(rows, 0x00), b0));
+            result = _mm256_add_ps(result, _mm256_mul_ps(_mm256_permute_ps(rows, 0x55), b1));
+            result = _mm256_add_ps(result, _mm256_mul_ps(_mm256_permute_ps(rows, 0xaa), b2));
+            result = _mm256_add_ps(result, _mm256_mul_ps(_mm256_permute_ps(rows, 0xff), b3));
+            _mm256_storeu_ps(results[i].m + half * 8, result);
+        }
+    }
+
+    return count;
+}
+
+#endif
+
+void
+matrix4_multiply_batch(const Matrix4* a, Matrix4 b, Matrix4* results, int32_t count)
+{
+    int32_t done = 0;
+
+    ProfilerBegin(multiply_matrices);
+
+#if defined(__x86_64__) || defined(__i386__)
+    // matrix4_multiply is already SSE2 on x86, so the scalar loop covers it.
+    // Every AVX2 CPU has AVX.
+    if (renderer_get_simd_level() == RENDERER_SIMD_AVX2)
+    {
+        done = matrix4_multiply_batch_avx(a, b, results, count);
+    }
+#endif
+
+    matrix4_multiply_batch_scalar(a, b, results, done, count);
+
+    ProfilerEnd(multiply_matrices);
+}
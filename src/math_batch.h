@@ -0,0 +1,16 @@
+// math_batch.h
+
+#ifndef MATH_BATCH_INCLUDED
+#define MATH_BATCH_INCLUDED
+
+#include <stdint.h>
+
+#include "math.h"
+
+// results[i] = matrix4_multiply(a[i], b) for count matrices, typically
+// model matrices times one view projection. Every path rounds exactly like
+// matrix4_multiply, results are bit identical on every machine.
+void
+matrix4_multiply_batch(const Matrix4* a, Matrix4 b, Matrix4* results, int32_t count);
+
+#endif // MATH_BATCH_INCLUDED
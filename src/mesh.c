@@ -0,0 +1,366 @@
+// mesh.c
+
+#include "mesh.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t
+mesh_align(uint64_t offset)
+{
+    return (offset + MESH_FILE_ALIGNMENT - 1) & ~(uint64_t)(MESH_FILE_ALIGNMENT - 1);
+}
+
+// A present section must be aligned and lie entirely inside the file
+static int32_t
+mesh_section_valid(uint64_t offset, uint64_t size, uint64_t file_size)
+{
+    return offset != 0 && (offset & (MESH_FILE_ALIGNMENT - 1)) == 0 &&
+           offset <= file_size && size <= file_size - offset;
+}
+
+static int32_t
+mesh_header_valid(const MeshFileHeader* header, uint64_t file_size)
+{
+    if (memcmp(header->magic, MESH_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != MESH_FILE_VERSION ||
+        header->file_size != file_size ||
+        (header->index_size != 2 && header->index_size != 4) ||
+        header->vertex_count > INT32_MAX || header->index_count > INT32_MAX)
+    {
+        return 0;
+    }
+
+    uint64_t vertex_count = header->vertex_count;
+    for (int32_t i = 0; i < 3; ++i)
+    {
+        if (!mesh_section_valid(header->positions_offset[i], vertex_count * sizeof(float), file_size))
+        {
+            return 0;
+        }
+    }
+
+    if ((header->attributes & MESH_ATTRIBUTE_COLORS) &&
+        !mesh_section_valid(header->colors_offset, vertex_count * sizeof(uint32_t), file_size))
+    {
+        return 0;
+    }
+
+    if ((header->attributes & MESH_ATTRIBUTE_NORMALS) &&
+        !mesh_section_valid(header->normals_offset, vertex_count * 2 * sizeof(int16_t), file_size))
+    {
+        return 0;
+    }
+
+    return mesh_section_valid(header->indices_offset, (uint64_t)header->index_count * header->index_size, file_size) &&
+           mesh_section_valid(header->submeshes_offset, (uint64_t)header->submesh_count * sizeof(MeshSubmesh), file_size);
+}
+
+// Whether every index is below vertex_count. One linear pass over a buffer
+// the first transform reads in full anyway.
+static int32_t
+mesh_indices_valid(const uint8_t* indices, uint32_t index_size, uint32_t index_count, uint32_t vertex_count)
+{
+    uint32_t max_index = 0;
+    if (index_size == 2)
+    {
+        const uint16_t* indices16 = (const uint16_t*)indices;
+        for (uint32_t i = 0; i < index_count; ++i)
+        {
+            max_index = Max(max_index, indices16[i]);
+        }
+    }
+    else
+    {
+        const uint32_t* indices32 = (const uint32_t*)indices;
+        for (uint32_t i = 0; i < index_count; ++i)
+        {
+            max_index = Max(max_index, indices32[i]);
+        }
+    }
+
+    return index_count == 0 || max_index < vertex_count;
+}
+
+Mesh*
+mesh_load(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("failed to open mesh %s\n", path);
+        return 0;
+    }
+
+    struct stat file_stat;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size >= (off_t)sizeof(MeshFileHeader))
+    {
+        // Private and writable so the buffers can be handed out as non-const
+        // pointers. Pages are only copied if someone actually writes to them.
+        mapping = mmap(0, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        printf("failed to map mesh %s\n", path);
+        return 0;
+    }
+
+    uint64_t file_size = file_stat.st_size;
+    MeshFileHeader* header = mapping;
+    if (!mesh_header_valid(header, file_size))
+    {
+        printf("mesh %s is not a version %d mesh file\n", path, MESH_FILE_VERSION);
+        munmap(mapping, file_size);
+        return 0;
+    }
+
+    uint8_t* base = mapping;
+    MeshSubmesh* submeshes = (MeshSubmesh*)(base + header->submeshes_offset);
+    for (uint32_t i = 0; i < header->submesh_count; ++i)
+    {
+        if (submeshes[i].first_index > header->index_count ||
+            submeshes[i].index_count > header->index_count - submeshes[i].first_index)
+        {
+            printf("mesh %s has a submesh outside its index buffer\n", path);
+            munmap(mapping, file_size);
+            return 0;
+        }
+    }
+
+    // Start reading the file in ahead of the index check and the first draw
+    madvise(mapping, file_size, MADV_WILLNEED);
+
+    if (!mesh_indices_valid(base + header->indices_offset, header->index_size, header->index_count,
+                            header->vertex_count))
+    {
+        printf("mesh %s has an index past its last vertex\n", path);
+        munmap(mapping, file_size);
+        return 0;
+    }
+
+    Mesh* mesh = calloc(1, sizeof(Mesh));
+    mesh->vertices.positions.x = (float*)(base + header->positions_offset[0]);
+    mesh->vertices.positions.y = (float*)(base + header->positions_offset[1]);
+    mesh->vertices.positions.z = (float*)(base + header->positions_offset[2]);
+    mesh->vertices.count = header->vertex_count;
+
+    if (header->attributes & MESH_ATTRIBUTE_COLORS)
+    {
+        mesh->vertices.colors = (uint32_t*)(base + header->colors_offset);
+    }
+
+    if (header->attributes & MESH_ATTRIBUTE_NORMALS)
+    {
+        mesh->normals = (int16_t*)(base + header->normals_offset);
+    }
+
+    // Every index was checked to be below vertex_count above
+    mesh->indices.indices = base + header->indices_offset;
+    mesh->indices.index_size = header->index_size;
+    mesh->indices.count = header->index_count;
+
+    mesh->submeshes = submeshes;
+    mesh->submesh_count = header->submesh_count;
+    mesh->bounds = header->bounds;
+    mesh->mapping = mapping;
+    mesh->mapping_size = file_size;
+
+    return mesh;
+}
+
+void
+mesh_unload(Mesh* mesh)
+{
+    munmap(mesh->mapping, mesh->mapping_size);
+    free(mesh);
+}
+
+static MeshBounds
+mesh_bounds_empty(void)
+{
+    MeshBounds bounds = {
+        {{{INFINITY, INFINITY, INFINITY}}},
+        {{{-INFINITY, -INFINITY, -INFINITY}}}
+    };
+
+    return bounds;
+}
+
+static void
+mesh_bounds_add(MeshBounds* bounds, float x, float y, float z)
+{
+    bounds->min.x = fminf(bounds->min.x, x);
+    bounds->min.y = fminf(bounds->min.y, y);
+    bounds->min.z = fminf(bounds->min.z, z);
+    bounds->max.x = fmaxf(bounds->max.x, x);
+    bounds->max.y = fmaxf(bounds->max.y, y);
+    bounds->max.z = fmaxf(bounds->max.z, z);
+}
+
+// Octahedral encoding keeps normals to within a fraction of a degree in
+// 32 bits, a third of three floats
+static void
+mesh_encode_normal(Vector3 normal, int16_t* encoded)
+{
+    float length = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+    if (length == 0.0f)
+    {
+        encoded[0] = 0;
+        encoded[1] = 0;
+        return;
+    }
+
+    float x = normal.x / length;
+    float y = normal.y / length;
+    if (normal.z < 0.0f)
+    {
+        float folded_x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float folded_y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = folded_x;
+        y = folded_y;
+    }
+
+    encoded[0] = (int16_t)lrintf(x * 32767.0f);
+    encoded[1] = (int16_t)lrintf(y * 32767.0f);
+}
+
+static int32_t
+mesh_write_section(FILE* file, uint64_t offset, const void* data, uint64_t size)
+{
+    return fseek(file, (long)offset, SEEK_SET) == 0 && (size == 0 || fwrite(data, size, 1, file) == 1);
+}
+
+int32_t
+mesh_write(const char* path, const MeshData* data)
+{
+    uint64_t vertex_count = data->vertex_count;
+    uint32_t index_size = vertex_count <= 0x10000 ? 2 : 4;
+
+    MeshFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MESH_FILE_MAGIC, sizeof(header.magic));
+    header.version = MESH_FILE_VERSION;
+    header.vertex_count = data->vertex_count;
+    header.index_count = data->index_count;
+    header.index_size = index_size;
+    header.submesh_count = data->submesh_count;
+
+    uint64_t offset = mesh_align(sizeof(header));
+    for (int32_t i = 0; i < 3; ++i)
+    {
+        header.positions_offset[i] = offset;
+        offset = mesh_align(offset + vertex_count * sizeof(float));
+    }
+
+    if (data->colors)
+    {
+        header.attributes |= MESH_ATTRIBUTE_COLORS;
+        header.colors_offset = offset;
+        offset = mesh_align(offset + vertex_count * sizeof(uint32_t));
+    }
+
+    if (data->normals)
+    {
+        header.attributes |= MESH_ATTRIBUTE_NORMALS;
+        header.normals_offset = offset;
+        offset = mesh_align(offset + vertex_count * 2 * sizeof(int16_t));
+    }
+
+    header.indices_offset = offset;
+    offset = mesh_align(offset + (uint64_t)data->index_count * index_size);
+    header.submeshes_offset = offset;
+    offset = mesh_align(offset + (uint64_t)data->submesh_count * sizeof(MeshSubmesh));
+    header.file_size = offset;
+
+    header.bounds = mesh_bounds_empty();
+    for (uint64_t i = 0; i < vertex_count; ++i)
+    {
+        mesh_bounds_add(&header.bounds, data->positions.x[i], data->positions.y[i], data->positions.z[i]);
+    }
+
+    MeshSubmesh* submeshes = malloc((data->submesh_count + 1) * sizeof(MeshSubmesh));
+    for (int32_t i = 0; i < data->submesh_count; ++i)
+    {
+        MeshSubmesh submesh = data->submeshes[i];
+        submesh.bounds = mesh_bounds_empty();
+        for (uint32_t j = 0; j < submesh.index_count; ++j)
+        {
+            uint32_t index = data->indices[submesh.first_index + j];
+            mesh_bounds_add(&submesh.bounds, data->positions.x[index], data->positions.y[index], data->positions.z[index]);
+        }
+
+        submeshes[i] = submesh;
+    }
+
+    void* indices = data->indices;
+    if (index_size == 2)
+    {
+        uint16_t* short_indices = malloc(data->index_count * sizeof(uint16_t) + 1);
+        for (int32_t i = 0; i < data->index_count; ++i)
+        {
+            short_indices[i] = (uint16_t)data->indices[i];
+        }
+
+        indices = short_indices;
+    }
+
+    int16_t* normals = 0;
+    if (data->normals)
+    {
+        normals = malloc(vertex_count * 2 * sizeof(int16_t) + 1);
+        for (uint64_t i = 0; i < vertex_count; ++i)
+        {
+            mesh_encode_normal(data->normals[i], normals + i * 2);
+        }
+    }
+
+    int32_t written = 0;
+    FILE* file = fopen(path, "wb");
+    if (file)
+    {
+        written = mesh_write_section(file, 0, &header, sizeof(header)) &&
+                  mesh_write_section(file, header.positions_offset[0], data->positions.x, vertex_count * sizeof(float)) &&
+                  mesh_write_section(file, header.positions_offset[1], data->positions.y, vertex_count * sizeof(float)) &&
+                  mesh_write_section(file, header.positions_offset[2], data->positions.z, vertex_count * sizeof(float)) &&
+                  (!data->colors ||
+                   mesh_write_section(file, header.colors_offset, data->colors, vertex_count * sizeof(uint32_t))) &&
+                  (!normals ||
+                   mesh_write_section(file, header.normals_offset, normals, vertex_count * 2 * sizeof(int16_t))) &&
+                  mesh_write_section(file, header.indices_offset, indices, (uint64_t)data->index_count * index_size) &&
+                  mesh_write_section(file, header.submeshes_offset, submeshes,
+                                     (uint64_t)data->submesh_count * sizeof(MeshSubmesh));
+
+        // Pad the last section out to the size the header promises
+        uint64_t end = header.submeshes_offset + (uint64_t)data->submesh_count * sizeof(MeshSubmesh);
+        if (written && end < header.file_size)
+        {
+            written = fseek(file, (long)header.file_size - 1, SEEK_SET) == 0 && fputc(0, file) == 0;
+        }
+
+        written = fclose(file) == 0 && written;
+    }
+
+    if (!written)
+    {
+        printf("failed to write mesh %s\n", path);
+    }
+
+    if (indices != data->indices)
+    {
+        free(indices);
+    }
+
+    free(normals);
+    free(submeshes);
+
+    return written;
+}
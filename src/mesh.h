@@ -0,0 +1,114 @@
+// mesh.h
+
+#ifndef MESH_INCLUDED
+#define MESH_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "math.h"
+#include "renderer_draw.h"
+
+// Binary mesh files are laid out exactly as the draw path reads them, so
+// loading one is a single mmap. Everything is little endian, and every
+// section starts on a MESH_FILE_ALIGNMENT boundary.
+#define MESH_FILE_MAGIC "B2BMESH1"
+#define MESH_FILE_VERSION 1
+#define MESH_FILE_ALIGNMENT 64
+
+// Optional per vertex attributes, stored quantized
+enum MeshAttribute {
+    // Packed 8 bit RGB, the vertex color format of the renderer
+    MESH_ATTRIBUTE_COLORS = 1 << 0,
+    // Unit normals octahedral encoded into two snorm16
+    MESH_ATTRIBUTE_NORMALS = 1 << 1,
+};
+
+typedef struct MeshBounds {
+    Vector3 min;
+    Vector3 max;
+} MeshBounds;
+
+// Range of the index buffer drawn as one object, an o or g group in OBJ
+typedef struct MeshSubmesh {
+    char name[32];
+    uint32_t first_index;
+    uint32_t index_count;
+    MeshBounds bounds;
+} MeshSubmesh;
+
+// Offsets are bytes from the start of the file, 0 for missing attributes
+typedef struct MeshFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t attributes;
+    uint32_t vertex_count;
+    uint32_t index_count;
+    // 2 when every index fits in 16 bits, 4 otherwise
+    uint32_t index_size;
+    uint32_t submesh_count;
+    MeshBounds bounds;
+    uint64_t positions_offset[3];
+    uint64_t colors_offset;
+    uint64_t normals_offset;
+    uint64_t indices_offset;
+    uint64_t submeshes_offset;
+    uint64_t file_size;
+} MeshFileHeader;
+
+// A mesh file mapped into memory. Vertex and index buffers point straight
+// into the mapping and stay valid until mesh_unload.
+typedef struct Mesh {
+    RendererVertexBuffer vertices;
+    RendererIndexBuffer indices;
+    // Two snorm16 per vertex, 0 when the file has no normals
+    int16_t* normals;
+    MeshSubmesh* submeshes;
+    int32_t submesh_count;
+    MeshBounds bounds;
+
+    void* mapping;
+    size_t mapping_size;
+} Mesh;
+
+// Uncompressed mesh data handed to mesh_write
+typedef struct MeshData {
+    VertexStream positions;
+    // Optional, 0 when missing
+    uint32_t* colors;
+    Vector3* normals;
+    int32_t vertex_count;
+    uint32_t* indices;
+    int32_t index_count;
+    // Bounds are computed while writing
+    MeshSubmesh* submeshes;
+    int32_t submesh_count;
+} MeshData;
+
+// Map a mesh file, nothing is parsed or copied. Returns 0 on failure.
+Mesh* mesh_load(const char* path);
+void mesh_unload(Mesh* mesh);
+
+// Write data to path in the binary mesh format. Returns 0 on failure.
+int32_t mesh_write(const char* path, const MeshData* data);
+
+static inline Vector3
+mesh_decode_normal(const int16_t* normal)
+{
+    float x = normal[0] / 32767.0f;
+    float y = normal[1] / 32767.0f;
+    float z = 1.0f - fabsf(x) - fabsf(y);
+
+    // The lower hemisphere was folded over the diagonals
+    if (z < 0.0f)
+    {
+        float folded_x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float folded_y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = folded_x;
+        y = folded_y;
+    }
+
+    return vector3_normalize(vector3_create(x, y, z));
+}
+
+#endif // MESH_INCLUDED
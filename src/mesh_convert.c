@@ -0,0 +1,444 @@
+// mesh_convert.c
+
+// Offline converter from Wavefront OBJ to the binary mesh format. Only
+// geometry is kept: positions, optional "v x y z r g b" vertex colors,
+// normals, and o and g groups as submeshes. Faces are triangulated as fans.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mesh.h"
+
+typedef struct ObjVertexKey {
+    int32_t position;
+    int32_t normal;
+} ObjVertexKey;
+
+typedef struct ObjPosition {
+    Vector3 position;
+    uint32_t color;
+} ObjPosition;
+
+typedef struct ObjMesh {
+    ObjPosition* positions;
+    int32_t position_count;
+    int32_t position_capacity;
+    int32_t has_colors;
+
+    Vector3* normals;
+    int32_t normal_count;
+    int32_t normal_capacity;
+
+    // Unique position and normal pairs, each one becomes an output vertex
+    ObjVertexKey* vertices;
+    int32_t vertex_count;
+    int32_t vertex_capacity;
+    int32_t* vertex_table;
+    int32_t vertex_table_size;
+
+    uint32_t* indices;
+    int32_t index_count;
+    int32_t index_capacity;
+
+    MeshSubmesh* submeshes;
+    int32_t submesh_count;
+    int32_t submesh_capacity;
+} ObjMesh;
+
+// Grow array so it holds at least needed elements
+#define ObjReserve(array, capacity, needed)                                      \
+    do                                                                           \
+    {                                                                            \
+        if ((needed) > (capacity))                                               \
+        {                                                                        \
+            capacity = (capacity) * 2 > (needed) ? (capacity) * 2 : (needed) + 256; \
+            array = realloc(array, (capacity) * sizeof(*(array)));               \
+        }                                                                        \
+    } while (0)
+
+static uint32_t
+obj_hash_key(ObjVertexKey key)
+{
+    uint32_t hash = (uint32_t)key.position * 0x9e3779b1u ^ (uint32_t)key.normal * 0x85ebca77u;
+    return hash ^ (hash >> 15);
+}
+
+static void
+obj_rehash(ObjMesh* obj, int32_t table_size)
+{
+    free(obj->vertex_table);
+    obj->vertex_table = malloc(table_size * sizeof(int32_t));
+    obj->vertex_table_size = table_size;
+    memset(obj->vertex_table, 0xff, table_size * sizeof(int32_t));
+
+    for (int32_t i = 0; i < obj->vertex_count; ++i)
+    {
+        uint32_t slot = obj_hash_key(obj->vertices[i]) & (table_size - 1);
+        while (obj->vertex_table[slot] >= 0)
+        {
+            slot = (slot + 1) & (table_size - 1);
+        }
+
+        obj->vertex_table[slot] = i;
+    }
+}
+
+// Index of the output vertex for a position and normal pair, added if new
+static uint32_t
+obj_vertex_index(ObjMesh* obj, ObjVertexKey key)
+{
+    if (obj->vertex_count * 2 >= obj->vertex_table_size)
+    {
+        obj_rehash(obj, obj->vertex_table_size ? obj->vertex_table_size * 2 : 1024);
+    }
+
+    uint32_t mask = obj->vertex_table_size - 1;
+    uint32_t slot = obj_hash_key(key) & mask;
+    while (obj->vertex_table[slot] >= 0)
+    {
+        ObjVertexKey existing = obj->vertices[obj->vertex_table[slot]];
+        if (existing.position == key.position && existing.normal == key.normal)
+        {
+            return obj->vertex_table[slot];
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    ObjReserve(obj->vertices, obj->vertex_capacity, obj->vertex_count + 1);
+    obj->vertices[obj->vertex_count] = key;
+    obj->vertex_table[slot] = obj->vertex_count;
+
+    return obj->vertex_count++;
+}
+
+static void
+obj_begin_submesh(ObjMesh* obj, const char* name)
+{
+    // A group without faces yet is renamed instead of left empty
+    if (obj->submesh_count == 0 || obj->submeshes[obj->submesh_count - 1].index_count != 0)
+    {
+        ObjReserve(obj->submeshes, obj->submesh_capacity, obj->submesh_count + 1);
+        obj->submesh_count++;
+    }
+
+    MeshSubmesh* submesh = obj->submeshes + obj->submesh_count - 1;
+    memset(submesh, 0, sizeof(MeshSubmesh));
+    snprintf(submesh->name, sizeof(submesh->name), "%s", name);
+    submesh->first_index = obj->index_count;
+}
+
+// OBJ indices are 1 based, negative ones count back from the last element
+static int32_t
+obj_resolve_index(long index, int32_t count)
+{
+    int32_t resolved = index < 0 ? count + (int32_t)index : (int32_t)index - 1;
+    return resolved >= 0 && resolved < count ? resolved : -1;
+}
+
+static const char*
+obj_skip_spaces(const char* cursor)
+{
+    while (*cursor == ' ' || *cursor == '\t')
+    {
+        ++cursor;
+    }
+
+    return cursor;
+}
+
+static int32_t
+obj_parse_face(ObjMesh* obj, const char* cursor, int32_t line_number)
+{
+    uint32_t first = 0;
+    uint32_t previous = 0;
+    int32_t corner_count = 0;
+
+    for (;;)
+    {
+        cursor = obj_skip_spaces(cursor);
+        if (*cursor == '\0' || *cursor == '\n' || *cursor == '\r' || *cursor == '#')
+        {
+            break;
+        }
+
+        // v, v/t, v//n or v/t/n, texture coordinates are dropped
+        char* end;
+        long position = strtol(cursor, &end, 10);
+        long normal = 0;
+        if (end == cursor)
+        {
+            printf("line %d: bad face\n", line_number);
+            return 0;
+        }
+
+        cursor = end;
+        if (*cursor == '/')
+        {
+            cursor++;
+            strtol(cursor, &end, 10);
+            cursor = end;
+            if (*cursor == '/')
+            {
+                cursor++;
+                normal = strtol(cursor, &end, 10);
+                cursor = end;
+            }
+        }
+
+        while (*cursor && *cursor != ' ' && *cursor != '\t' && *cursor != '\n' && *cursor != '\r')
+        {
+            ++cursor;
+        }
+
+        ObjVertexKey key;
+        key.position = obj_resolve_index(position, obj->position_count);
+        key.normal = normal ? obj_resolve_index(normal, obj->normal_count) : -1;
+        if (key.position < 0 || (normal && key.normal < 0))
+        {
+            printf("line %d: face index out of range\n", line_number);
+            return 0;
+        }
+
+        uint32_t vertex = obj_vertex_index(obj, key);
+        if (corner_count == 0)
+        {
+            first = vertex;
+        }
+        else if (corner_count >= 2)
+        {
+            // Reversed, OBJ fronts are counter clockwise in a right handed
+            // space and the renderer fills clockwise ones in a left handed one
+            ObjReserve(obj->indices, obj->index_capacity, obj->index_count + 3);
+            obj->indices[obj->index_count++] = first;
+            obj->indices[obj->index_count++] = vertex;
+            obj->indices[obj->index_count++] = previous;
+        }
+
+        previous = vertex;
+        corner_count++;
+    }
+
+    obj->submeshes[obj->submesh_count - 1].index_count = obj->index_count - obj->submeshes[obj->submesh_count - 1].first_index;
+
+    return 1;
+}
+
+static int32_t
+obj_parse(ObjMesh* obj, char* text)
+{
+    obj_begin_submesh(obj, "default");
+
+    int32_t line_number = 0;
+    char* line = text;
+    while (line && *line)
+    {
+        char* next = strchr(line, '\n');
+        if (next)
+        {
+            *next++ = '\0';
+        }
+
+        ++line_number;
+        const char* cursor = obj_skip_spaces(line);
+
+        if (cursor[0] == 'v' && (cursor[1] == ' ' || cursor[1] == '\t'))
+        {
+            float values[6] = {0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f};
+            int32_t value_count = sscanf(cursor + 2, "%f %f %f %f %f %f", values, values + 1, values + 2,
+                                         values + 3, values + 4, values + 5);
+            if (value_count < 3)
+            {
+                printf("line %d: bad vertex\n", line_number);
+                return 0;
+            }
+
+            ObjReserve(obj->positions, obj->position_capacity, obj->position_count + 1);
+
+            // Mirrored on z into the left handed space of the renderer
+            ObjPosition* position = obj->positions + obj->position_count;
+            position->position = vector3_create(values[0], values[1], -values[2]);
+            position->color =
+                PackColorRGB((int32_t)(fminf(fmaxf(values[3], 0.0f), 1.0f) * 255.0f + 0.5f),
+                             (int32_t)(fminf(fmaxf(values[4], 0.0f), 1.0f) * 255.0f + 0.5f),
+                             (int32_t)(fminf(fmaxf(values[5], 0.0f), 1.0f) * 255.0f + 0.5f));
+            obj->position_count++;
+            obj->has_colors |= value_count == 6;
+        }
+        else if (cursor[0] == 'v' && cursor[1] == 'n')
+        {
+            Vector3 normal = vector3_create(0.0f, 0.0f, 0.0f);
+            if (sscanf(cursor + 2, "%f %f %f", &normal.x, &normal.y, &normal.z) != 3)
+            {
+                printf("line %d: bad normal\n", line_number);
+                return 0;
+            }
+
+            normal.z = -normal.z;
+            ObjReserve(obj->normals, obj->normal_capacity, obj->normal_count + 1);
+            obj->normals[obj->normal_count++] = normal;
+        }
+        else if (cursor[0] == 'f' && (cursor[1] == ' ' || cursor[1] == '\t'))
+        {
+            if (!obj_parse_face(obj, cursor + 2, line_number))
+            {
+                return 0;
+            }
+        }
+        else if ((cursor[0] == 'o' || cursor[0] == 'g') && (cursor[1] == ' ' || cursor[1] == '\t'))
+        {
+            char* name = (char*)obj_skip_spaces(cursor + 2);
+            name[strcspn(name, "\r")] = '\0';
+            obj_begin_submesh(obj, name);
+        }
+
+        line = next;
+    }
+
+    // Drop a trailing group that never got any faces
+    if (obj->submesh_count > 1 && obj->submeshes[obj->submesh_count - 1].index_count == 0)
+    {
+        obj->submesh_count--;
+    }
+
+    return 1;
+}
+
+static char*
+read_file(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        return 0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* text = malloc(size + 1);
+    if (size < 0 || fread(text, 1, size, file) != (size_t)size)
+    {
+        free(text);
+        fclose(file);
+        return 0;
+    }
+
+    text[size] = '\0';
+    fclose(file);
+
+    return text;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* input_path = 0;
+    const char* output_path = 0;
+    int32_t keep_normals = 1;
+    int32_t keep_colors = 1;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--no-normals") == 0)
+        {
+            keep_normals = 0;
+        }
+        else if (strcmp(argv[i], "--no-colors") == 0)
+        {
+            keep_colors = 0;
+        }
+        else if (!input_path)
+        {
+            input_path = argv[i];
+        }
+        else
+        {
+            output_path = argv[i];
+        }
+    }
+
+    if (!input_path || !output_path)
+    {
+        printf("usage: %s [--no-normals] [--no-colors] input.obj output.mesh\n", argv[0]);
+        return -1;
+    }
+
+    char* text = read_file(input_path);
+    if (!text)
+    {
+        printf("failed to read %s\n", input_path);
+        return -1;
+    }
+
+    ObjMesh obj;
+    memset(&obj, 0, sizeof(obj));
+    if (!obj_parse(&obj, text))
+    {
+        printf("failed to parse %s\n", input_path);
+        return -1;
+    }
+
+    free(text);
+
+    int32_t vertex_count = obj.vertex_count;
+    int32_t has_normals = keep_normals && obj.normal_count > 0;
+    int32_t has_colors = keep_colors && obj.has_colors;
+
+    VertexStream positions = {
+        malloc(vertex_count * sizeof(float) + 1),
+        malloc(vertex_count * sizeof(float) + 1),
+        malloc(vertex_count * sizeof(float) + 1)
+    };
+
+    uint32_t* colors = has_colors ? malloc(vertex_count * sizeof(uint32_t)) : 0;
+    Vector3* normals = has_normals ? malloc(vertex_count * sizeof(Vector3)) : 0;
+
+    for (int32_t i = 0; i < vertex_count; ++i)
+    {
+        ObjVertexKey key = obj.vertices[i];
+        Vector3 position = obj.positions[key.position].position;
+        positions.x[i] = position.x;
+        positions.y[i] = position.y;
+        positions.z[i] = position.z;
+
+        if (colors)
+        {
+            colors[i] = obj.positions[key.position].color;
+        }
+
+        if (normals)
+        {
+            normals[i] = key.normal >= 0 ? obj.normals[key.normal] : vector3_create(0.0f, 0.0f, 0.0f);
+        }
+    }
+
+    MeshData data = {
+        positions, colors, normals, vertex_count,
+        obj.indices, obj.index_count,
+        obj.submeshes, obj.submesh_count
+    };
+
+    int32_t written = mesh_write(output_path, &data);
+    if (written)
+    {
+        printf("%s: %d vertices, %d triangles, %d submeshes\n", output_path, vertex_count, obj.index_count / 3,
+               obj.submesh_count);
+    }
+
+    free(positions.x);
+    free(positions.y);
+    free(positions.z);
+    free(colors);
+    free(normals);
+    free(obj.positions);
+    free(obj.normals);
+    free(obj.vertices);
+    free(obj.vertex_table);
+    free(obj.indices);
+    free(obj.submeshes);
+
+    return written ? 0 : -1;
+}
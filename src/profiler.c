@@ -0,0 +1,266 @@
+// profiler.c
+
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILER_USE_RDTSC 1
+#endif
+
+// Events each thread keeps, older ones are overwritten
+#define PROFILER_RING_CAPACITY (1 << 16)
+
+typedef enum ProfilerEventType {
+    PROFILER_EVENT_ZONE = 0,
+    PROFILER_EVENT_FRAME = 1,
+    PROFILER_EVENT_COUNTER = 2,
+} ProfilerEventType;
+
+typedef struct ProfilerEvent {
+    const char* name;
+    uint64_t start;
+    // End timestamp of zones, value of counters
+    int64_t value;
+    ProfilerEventType type;
+    int32_t counter;
+} ProfilerEvent;
+
+// Owned and written by one thread only, so recording needs no locks. The
+// counters are atomics only so frame marks on other threads can sum them.
+typedef struct ProfilerThread {
+    struct ProfilerThread* next;
+    int32_t id;
+    char name[32];
+
+    ProfilerEvent* events;
+    atomic_uint_fast64_t event_count;
+    atomic_int_fast64_t counters[PROFILER_COUNTER_COUNT];
+} ProfilerThread;
+
+atomic_int profiler_enabled;
+
+static _Atomic(ProfilerThread*) profiler_threads;
+static atomic_int profiler_thread_count;
+static _Thread_local ProfilerThread* profiler_thread;
+
+// Timestamp and clock time when recording first started, to convert
+// timestamps to microseconds on export
+static uint64_t profiler_base_timestamp;
+static uint64_t profiler_base_ns;
+
+// Counter totals at the previous frame mark
+static int64_t profiler_frame_counters[PROFILER_COUNTER_COUNT];
+
+static const char* profiler_counter_names[PROFILER_COUNTER_COUNT] = {
+    "triangles_submitted",
+    "triangles_culled",
+    "triangles_clipped",
+    "triangles_rasterized",
+    "pixels_shaded",
+    "pixels_filled",
+    "vertices_transformed",
+    "frame_arena_bytes",
+    "instances_culled",
+    "pixels_presented",
+};
+
+static uint64_t
+profiler_clock_ns()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+uint64_t
+profiler_timestamp()
+{
+#ifdef PROFILER_USE_RDTSC
+    return __rdtsc();
+#else
+    return profiler_clock_ns();
+#endif
+}
+
+static ProfilerThread*
+profiler_get_thread()
+{
+    ProfilerThread* thread = profiler_thread;
+    if (thread)
+    {
+        return thread;
+    }
+
+    thread = calloc(1, sizeof(ProfilerThread));
+    thread->id = atomic_fetch_add(&profiler_thread_count, 1) + 1;
+    snprintf(thread->name, sizeof(thread->name), "thread %d", thread->id);
+
+    // Threads are only ever added, so a plain push keeps the list valid for
+    // readers walking it at the same time.
+    ProfilerThread* head = atomic_load(&profiler_threads);
+    do
+    {
+        thread->next = head;
+    } while (!atomic_compare_exchange_weak(&profiler_threads, &head, thread));
+
+    profiler_thread = thread;
+    return thread;
+}
+
+static void
+profiler_push(ProfilerThread* thread, ProfilerEvent event)
+{
+    // Only threads that record anything pay for a ring
+    if (!thread->events)
+    {
+        thread->events = malloc(PROFILER_RING_CAPACITY * sizeof(ProfilerEvent));
+    }
+
+    uint64_t count = atomic_load_explicit(&thread->event_count, memory_order_relaxed);
+    thread->events[count & (PROFILER_RING_CAPACITY - 1)] = event;
+    atomic_store_explicit(&thread->event_count, count + 1, memory_order_release);
+}
+
+void
+profiler_set_enabled(int32_t enabled)
+{
+    if (enabled && profiler_base_timestamp == 0)
+    {
+        profiler_base_ns = profiler_clock_ns();
+        profiler_base_timestamp = profiler_timestamp();
+    }
+
+    atomic_store(&profiler_enabled, enabled);
+}
+
+void
+profiler_set_thread_name(const char* name)
+{
+    ProfilerThread* thread = profiler_get_thread();
+    snprintf(thread->name, sizeof(thread->name), "%s", name);
+}
+
+void
+profiler_record_zone(const char* name, uint64_t start)
+{
+    ProfilerEvent event = {
+        name, start, (int64_t)profiler_timestamp(), PROFILER_EVENT_ZONE, 0
+    };
+
+    profiler_push(profiler_get_thread(), event);
+}
+
+void
+profiler_count(ProfilerCounter counter, int64_t value)
+{
+    ProfilerThread* thread = profiler_get_thread();
+    atomic_fetch_add_explicit(&thread->counters[counter], value, memory_order_relaxed);
+}
+
+void
+profiler_frame_mark()
+{
+    if (!profiler_is_enabled())
+    {
+        return;
+    }
+
+    ProfilerThread* thread = profiler_get_thread();
+    uint64_t now = profiler_timestamp();
+
+    ProfilerEvent frame = {
+        "frame", now, 0, PROFILER_EVENT_FRAME, 0
+    };
+
+    profiler_push(thread, frame);
+
+    for (int32_t counter = 0; counter < PROFILER_COUNTER_COUNT; ++counter)
+    {
+        int64_t total = 0;
+        for (ProfilerThread* other = atomic_load(&profiler_threads); other; other = other->next)
+        {
+            total += atomic_load_explicit(&other->counters[counter], memory_order_relaxed);
+        }
+
+        ProfilerEvent event = {
+            profiler_counter_names[counter], now, total - profiler_frame_counters[counter],
+            PROFILER_EVENT_COUNTER, counter
+        };
+
+        profiler_push(thread, event);
+        profiler_frame_counters[counter] = total;
+    }
+}
+
+int32_t
+profiler_export_chrome_trace(const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+    {
+        printf("failed to open trace %s\n", path);
+        return 0;
+    }
+
+    // Microseconds per timestamp tick, measured over the whole recording
+    double tick_us = 1e-3;
+#ifdef PROFILER_USE_RDTSC
+    uint64_t elapsed_ticks = profiler_timestamp() - profiler_base_timestamp;
+    uint64_t elapsed_ns = profiler_clock_ns() - profiler_base_ns;
+    tick_us = elapsed_ticks > 0 ? (double)elapsed_ns / elapsed_ticks * 1e-3 : 0.0;
+#endif
+
+    fprintf(file, "{\"traceEvents\": [\n");
+
+    int32_t first = 1;
+    for (ProfilerThread* thread = atomic_load(&profiler_threads); thread; thread = thread->next)
+    {
+        fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                first ? "" : ",\n", thread->id, thread->name);
+        first = 0;
+
+        uint64_t count = atomic_load_explicit(&thread->event_count, memory_order_acquire);
+        if (!thread->events)
+        {
+            continue;
+        }
+
+        uint64_t begin = count > PROFILER_RING_CAPACITY ? count - PROFILER_RING_CAPACITY : 0;
+
+        for (uint64_t i = begin; i < count; ++i)
+        {
+            ProfilerEvent* event = thread->events + (i & (PROFILER_RING_CAPACITY - 1));
+            if (event->start < profiler_base_timestamp)
+            {
+                continue;
+            }
+
+            double start_us = (event->start - profiler_base_timestamp) * tick_us;
+            switch (event->type)
+            {
+                case PROFILER_EVENT_ZONE:
+                    fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                            event->name, thread->id, start_us, ((uint64_t)event->value - event->start) * tick_us);
+                    break;
+                case PROFILER_EVENT_FRAME:
+                    fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"p\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f}",
+                            event->name, thread->id, start_us);
+                    break;
+                case PROFILER_EVENT_COUNTER:
+                    fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.3f, \"args\": {\"per_frame\": %lld}}",
+                            event->name, start_us, (long long)event->value);
+                    break;
+            }
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    return 1;
+}
@@ -0,0 +1,85 @@
+// profiler.h
+
+#ifndef PROFILER_INCLUDED
+#define PROFILER_INCLUDED
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+typedef enum ProfilerCounter {
+    // Triangles handed to primitive assembly
+    PROFILER_COUNTER_TRIANGLES_SUBMITTED = 0,
+    // Triangles rejected by frustum, backface or scissor tests
+    PROFILER_COUNTER_TRIANGLES_CULLED = 1,
+    // Triangles crossing the near plane or the guard band
+    PROFILER_COUNTER_TRIANGLES_CLIPPED = 2,
+    // Triangles reaching the rasterizer, once per tile they are binned to
+    PROFILER_COUNTER_TRIANGLES_RASTERIZED = 3,
+    // Pixels in the blocks handed to the span kernels, exact for blocks a
+    // triangle fully covers and an upper bound for its edges
+    PROFILER_COUNTER_PIXELS_SHADED = 4,
+    // Pixels written by fills, clears and blits
+    PROFILER_COUNTER_PIXELS_FILLED = 5,
+    PROFILER_COUNTER_VERTICES_TRANSFORMED = 6,
+    // Transient bytes pushed to the frame arena
+    PROFILER_COUNTER_FRAME_ARENA_BYTES = 7,
+    // Scene instances outside the view frustum, never transformed
+    PROFILER_COUNTER_INSTANCES_CULLED = 8,
+    // Pixels copied to the window surface, only the regions that changed
+    PROFILER_COUNTER_PIXELS_PRESENTED = 9,
+    PROFILER_COUNTER_COUNT = 10,
+} ProfilerCounter;
+
+// Zones and counters are dropped with a single relaxed load while this is 0,
+// so instrumentation can stay compiled into release builds
+extern atomic_int profiler_enabled;
+
+static inline int32_t
+profiler_is_enabled()
+{
+    return atomic_load_explicit(&profiler_enabled, memory_order_relaxed);
+}
+
+// Start or stop recording on every thread
+void profiler_set_enabled(int32_t enabled);
+
+// Name the calling thread in exported traces
+void profiler_set_thread_name(const char* name);
+
+// Raw timestamp, rdtsc where available and a monotonic clock otherwise
+uint64_t profiler_timestamp();
+
+// Record a zone from start to now on the calling thread. name must outlive
+// the profiler, which string literals do.
+void profiler_record_zone(const char* name, uint64_t start);
+void profiler_count(ProfilerCounter counter, int64_t value);
+
+// Mark the end of a frame and record how much each counter changed since
+// the previous mark, summed over all threads. Call it from one thread only.
+void profiler_frame_mark();
+
+// Write every recorded event to path in the Chrome trace event format, for
+// chrome://tracing or Perfetto. Threads must not be recording while this
+// runs, disable the profiler or call it between frames. Returns 0 on failure.
+int32_t profiler_export_chrome_trace(const char* path);
+
+#define ProfilerBegin(zone) \
+    uint64_t profiler_start_##zone = profiler_is_enabled() ? profiler_timestamp() : 0
+
+#define ProfilerEnd(zone)                                       \
+    do {                                                        \
+        if (profiler_start_##zone)                              \
+        {                                                       \
+            profiler_record_zone(#zone, profiler_start_##zone); \
+        }                                                       \
+    } while (0)
+
+#define ProfilerCount(counter, value)       \
+    do {                                    \
+        if (profiler_is_enabled())          \
+        {                                   \
+            profiler_count(counter, value); \
+        }                                   \
+    } while (0)
+
+#endif // PROFILER_INCLUDED
@@ -1,72 +1,685 @@
 // renderer.c
 
 #include <stdint.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
 #include "renderer.h"
+#include "renderer_span.h"
+#include "cpu_features.h"
 #include "math.h"
+#include "profiler.h"
 
-static inline int32_t 
-signed_area2(RendererPoint p0, RendererPoint p1, RendererPoint p2)
+#ifdef RENDERER_SPAN_X86
+#include <immintrin.h>
+#endif
+
+// Fills at least this many bytes use streaming stores
+#define RENDERER_STREAMING_FILL_SIZE (4 * 1024 * 1024)
+
+static atomic_int renderer_simd_level = -1;
+
+RendererSimdLevel
+renderer_simd_level_supported()
+{
+#ifdef RENDERER_SPAN_X86
+    uint32_t features = cpu_features_get();
+    if (features & CPU_FEATURE_AVX2)
+    {
+        return RENDERER_SIMD_AVX2;
+    }
+
+    if (features & CPU_FEATURE_SSE2)
+    {
+        return RENDERER_SIMD_SSE2;
+    }
+#endif
+
+    return RENDERER_SIMD_SCALAR;
+}
+
+void
+renderer_set_simd_level(RendererSimdLevel level)
+{
+    RendererSimdLevel supported = renderer_simd_level_supported();
+    atomic_store(&renderer_simd_level, Min(level, supported));
+}
+
+RendererSimdLevel
+renderer_get_simd_level()
+{
+    int level = atomic_load(&renderer_simd_level);
+    if (level < 0)
+    {
+        level = renderer_simd_level_supported();
+        atomic_store(&renderer_simd_level, level);
+    }
+
+    return (RendererSimdLevel)level;
+}
+
+static RendererSpanKernels
+renderer_span_kernels(RendererPixelFormat format)
 {
-    return (p1.x - p0.x) * (p2.y - p0.y) -
-        (p1.y - p0.y) * (p2.x - p0.x);
+    RendererSpanKernels kernels;
+
+    switch (renderer_get_simd_level())
+    {
+#ifdef RENDERER_SPAN_X86
+        case RENDERER_SIMD_AVX2:
+            renderer_span_kernels_avx2(&kernels, format);
+            break;
+        case RENDERER_SIMD_SSE2:
+            renderer_span_kernels_sse2(&kernels, format);
+            break;
+#endif
+        default:
+            renderer_span_kernels_scalar(&kernels, format);
+            break;
+    }
+
+    return kernels;
 }
 
+static inline void
+renderer_span_generic_scalar(const RendererSpanSetup* setup, uint8_t* pixels, float* depth, int32_t count,
+                             int32_t bcoord0, int32_t bcoord1, int32_t bcoord2, int depth_mode, int covered,
+                             int format)
+{
+    for (int32_t x = 0; x < count; ++x)
+    {
+        if (covered || (bcoord0|bcoord1|bcoord2) >= 0)
+        {
+            float z = 0.0f;
+            if (depth_mode != RENDERER_SPAN_DEPTH_NONE)
+            {
+                z = renderer_span_depth(setup, bcoord1, bcoord2);
+            }
+
+            if (depth_mode != RENDERER_SPAN_DEPTH_TEST || z < depth[x])
+            {
+                uint8_t color_r = (uint8_t)(renderer_span_channel(setup->color_base_r0, bcoord1, setup->color_r10, bcoord2, setup->color_r20) >> 18);
+                uint8_t color_g = (uint8_t)(renderer_span_channel(setup->color_base_g0, bcoord1, setup->color_g10, bcoord2, setup->color_g20) >> 18);
+                uint8_t color_b = (uint8_t)(renderer_span_channel(setup->color_base_b0, bcoord1, setup->color_b10, bcoord2, setup->color_b20) >> 18);
+
+                renderer_span_store(pixels, x, PackColorRGB(color_r, color_g, color_b), format);
+
+                if (depth_mode != RENDERER_SPAN_DEPTH_NONE)
+                {
+                    depth[x] = z;
+                }
+            }
+        }
+
+        bcoord0 += setup->a12;
+        bcoord1 += setup->a20;
+        bcoord2 += setup->a01;
+    }
+}
+
+RENDERER_SPAN_DEFINE_ROW_BLOCKS(scalar, renderer_span_generic_scalar, )
+RENDERER_SPAN_DEFINE_KERNELS(scalar, renderer_span_generic_scalar, renderer_block_rows_scalar, )
+
 RendererTargetBuffer
-renderer_create_target_buffer(int32_t width, int32_t height, int32_t bytes_per_pixel, uint8_t *pixels)
+renderer_create_target_buffer(int32_t width, int32_t height, RendererPixelFormat format, uint8_t *pixels)
 {
+    int32_t bytes_per_pixel = renderer_pixel_format_bytes(format);
+
     RendererTargetBuffer target = {
-        width, height, bytes_per_pixel, pixels
+        width, height, bytes_per_pixel, format, pixels,
+        width * bytes_per_pixel, RENDERER_TARGET_LINEAR, 0
     };
 
     return target;
 }
 
+RendererTargetBuffer
+renderer_create_tiled_target_buffer(int32_t width, int32_t height, RendererPixelFormat format, uint8_t* pixels)
+{
+    int32_t bytes_per_pixel = renderer_pixel_format_bytes(format);
+    int32_t padded_width = (width + RENDERER_BLOCK_SIZE - 1) & ~(RENDERER_BLOCK_SIZE - 1);
+
+    RendererTargetBuffer target = {
+        width, height, bytes_per_pixel, format, pixels,
+        padded_width * bytes_per_pixel, RENDERER_TARGET_TILED, 0
+    };
+
+    return target;
+}
+
+int32_t
+renderer_target_buffer_size(RendererTargetBuffer target)
+{
+    int32_t rows = target.height;
+    if (target.layout == RENDERER_TARGET_TILED)
+    {
+        rows = (rows + RENDERER_BLOCK_SIZE - 1) & ~(RENDERER_BLOCK_SIZE - 1);
+    }
+
+    return rows * target.pitch;
+}
+
+void
+renderer_resolve(RendererTargetBuffer source, RendererTargetBuffer destination)
+{
+    RendererRect rect = {
+        0, 0, source.width, source.height
+    };
+
+    ProfilerBegin(resolve);
+    renderer_resolve_rect(source, destination, rect);
+    ProfilerEnd(resolve);
+}
+
+void
+renderer_resolve_rect(RendererTargetBuffer source, RendererTargetBuffer destination, RendererRect rect)
+{
+    RendererRect bounds = {
+        0, 0, Min(source.width, destination.width), Min(source.height, destination.height)
+    };
+
+    rect = renderer_rect_intersect(rect, bounds);
+
+    int32_t max_x = rect.x + rect.w;
+    int32_t max_y = rect.y + rect.h;
+    int32_t bytes_per_pixel = source.bytes_per_pixel;
+    int32_t convert = source.format != destination.format;
+
+    if (source.layout == RENDERER_TARGET_LINEAR && destination.layout == RENDERER_TARGET_LINEAR)
+    {
+        for (int32_t y = rect.y; y < max_y; ++y)
+        {
+            uint8_t* source_row = source.pixels + IndexPixel(rect.x, y, source);
+            uint8_t* destination_row = destination.pixels + IndexPixel(rect.x, y, destination);
+
+            if (convert)
+            {
+                renderer_convert_pixels(destination_row, destination.format, source_row, source.format, rect.w);
+            }
+            else
+            {
+                memcpy(destination_row, source_row, rect.w * bytes_per_pixel);
+            }
+        }
+
+        return;
+    }
+
+    // Each block row of the source is contiguous, copy it in block row
+    // pieces so the destination is always written one full row at a time.
+    for (int32_t y = rect.y; y < max_y; ++y)
+    {
+        for (int32_t x = rect.x; x < max_x;)
+        {
+            int32_t block_end_x = (x + RENDERER_BLOCK_SIZE) & ~(RENDERER_BLOCK_SIZE - 1);
+            int32_t next_x = Min(block_end_x, max_x);
+            int32_t count = (next_x - x) * bytes_per_pixel;
+            uint8_t* source_row = source.pixels + IndexPixel(x, y, source);
+            uint8_t* destination_row = destination.pixels + IndexPixel(x, y, destination);
+
+            // Constant size for the common full block rows, so the copy
+            // becomes one or two vector moves instead of a call.
+            if (convert)
+            {
+                renderer_convert_pixels(destination_row, destination.format, source_row, source.format, next_x - x);
+            }
+            else if (count == RENDERER_BLOCK_SIZE * sizeof(uint32_t))
+            {
+                memcpy(destination_row, source_row, RENDERER_BLOCK_SIZE * sizeof(uint32_t));
+            }
+            else if (count == RENDERER_BLOCK_SIZE * sizeof(uint16_t))
+            {
+                memcpy(destination_row, source_row, RENDERER_BLOCK_SIZE * sizeof(uint16_t));
+            }
+            else
+            {
+                memcpy(destination_row, source_row, count);
+            }
+
+            x = next_x;
+        }
+    }
+}
+
+RendererDepthBuffer*
+renderer_create_depth_buffer(int32_t width, int32_t height)
+{
+    int32_t block_count_x = (width + RENDERER_BLOCK_SIZE - 1) / RENDERER_BLOCK_SIZE;
+    int32_t block_count_y = (height + RENDERER_BLOCK_SIZE - 1) / RENDERER_BLOCK_SIZE;
+    int32_t block_count = block_count_x * block_count_y;
+
+    uintptr_t pixel_count = (uintptr_t)block_count * RENDERER_BLOCK_SIZE * RENDERER_BLOCK_SIZE;
+    uintptr_t depth_buffer_size = sizeof(RendererDepthBuffer) +
+        (pixel_count + 2 * block_count) * sizeof(float);
+    RendererDepthBuffer* depth_buffer = malloc(depth_buffer_size);
+
+    depth_buffer->width = width;
+    depth_buffer->height = height;
+    depth_buffer->depth = (float*)(depth_buffer + 1);
+    depth_buffer->block_count_x = block_count_x;
+    depth_buffer->block_count_y = block_count_y;
+    depth_buffer->block_min = depth_buffer->depth + pixel_count;
+    depth_buffer->block_max = depth_buffer->block_min + block_count;
+
+    renderer_clear_depth(depth_buffer, 1.0f);
+
+    return depth_buffer;
+}
+
+void
+renderer_destroy_depth_buffer(RendererDepthBuffer* depth_buffer)
+{
+    free(depth_buffer);
+}
+
+#ifdef RENDERER_SPAN_X86
+// Fill count 32 bit values with value, aligning to 16 bytes for the wide
+// stores. Works for both pixels and depth through the raw bits. Streaming
+// stores are only ordered by renderer_fill_fence.
+__attribute__((target("sse2")))
+static void
+renderer_fill_sse2(void* destination, int32_t count, uint32_t value, int32_t streaming)
+{
+    uint8_t* bytes = destination;
+    __m128 values = _mm_castsi128_ps(_mm_set1_epi32((int32_t)value));
+
+    int32_t i = 0;
+    for (; i < count && ((uintptr_t)(bytes + i * 4) & 15); ++i)
+    {
+        _mm_store_ss((float*)(bytes + i * 4), values);
+    }
+
+    if (streaming)
+    {
+        for (; i + 16 <= count; i += 16)
+        {
+            _mm_stream_ps((float*)(bytes + i * 4), values);
+            _mm_stream_ps((float*)(bytes + i * 4 + 16), values);
+            _mm_stream_ps((float*)(bytes + i * 4 + 32), values);
+            _mm_stream_ps((float*)(bytes + i * 4 + 48), values);
+        }
+    }
+
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_store_ps((float*)(bytes + i * 4), values);
+    }
+
+    for (; i < count; ++i)
+    {
+        _mm_store_ss((float*)(bytes + i * 4), values);
+    }
+}
+#endif
+
+// Order streaming stores before anything stored after, once per operation
+// rather than per row since each fence waits for the stores to drain
+static void
+renderer_fill_fence(int32_t streaming)
+{
+#ifdef RENDERER_SPAN_X86
+    if (streaming && renderer_get_simd_level() >= RENDERER_SIMD_SSE2)
+    {
+        _mm_sfence();
+    }
+#endif
+}
+
+// Fill count consecutive 32 bit values. Streaming stores bypass the caches,
+// which pays off for memory that is not read again soon.
+static void
+renderer_fill_words(uint32_t* words, int32_t count, uint32_t value, int32_t streaming)
+{
+#ifdef RENDERER_SPAN_X86
+    if (renderer_get_simd_level() >= RENDERER_SIMD_SSE2)
+    {
+        renderer_fill_sse2(words, count, value, streaming);
+        return;
+    }
+#endif
+
+    for (int32_t i = 0; i < count; ++i)
+    {
+        words[i] = value;
+    }
+}
+
+// Fill count consecutive pixels with pixel, already packed into the target
+// format. 16 bit pixels are filled in pairs once aligned to 4 bytes.
+static void
+renderer_fill_pixels(uint8_t* pixels, int32_t bytes_per_pixel, int32_t count, uint32_t pixel, int32_t streaming)
+{
+    if (bytes_per_pixel == sizeof(uint32_t))
+    {
+        renderer_fill_words((uint32_t*)pixels, count, pixel, streaming);
+        return;
+    }
+
+    uint16_t* pixels16 = (uint16_t*)pixels;
+    if (count > 0 && ((uintptr_t)pixels16 & 2))
+    {
+        *pixels16++ = (uint16_t)pixel;
+        --count;
+    }
+
+    renderer_fill_words((uint32_t*)pixels16, count / 2, pixel | pixel << 16, streaming);
+
+    if (count & 1)
+    {
+        pixels16[count - 1] = (uint16_t)pixel;
+    }
+}
+
+static void
+renderer_fill_depth(float* depth_values, int32_t count, float depth, int32_t streaming)
+{
+#ifdef RENDERER_SPAN_X86
+    if (renderer_get_simd_level() >= RENDERER_SIMD_SSE2)
+    {
+        uint32_t depth_bits;
+        memcpy(&depth_bits, &depth, sizeof(depth_bits));
+        renderer_fill_sse2(depth_values, count, depth_bits, streaming);
+        return;
+    }
+#endif
+
+    for (int32_t i = 0; i < count; ++i)
+    {
+        depth_values[i] = depth;
+    }
+}
+
+void
+renderer_clear_depth(RendererDepthBuffer* depth_buffer, float depth)
+{
+    int32_t block_count = depth_buffer->block_count_x * depth_buffer->block_count_y;
+    int32_t pixel_count = block_count * RENDERER_BLOCK_SIZE * RENDERER_BLOCK_SIZE;
+    int32_t streaming = pixel_count * sizeof(float) >= RENDERER_STREAMING_FILL_SIZE;
+
+    ProfilerBegin(clear_depth);
+    renderer_fill_depth(depth_buffer->depth, pixel_count, depth, streaming);
+    renderer_fill_depth(depth_buffer->block_min, block_count, depth, 0);
+    renderer_fill_depth(depth_buffer->block_max, block_count, depth, 0);
+    renderer_fill_fence(streaming);
+    ProfilerEnd(clear_depth);
+}
+
+void
+renderer_clear_depth_rect(RendererDepthBuffer* depth_buffer, RendererRect rect, float depth)
+{
+    int32_t block_min_x = Max(rect.x, 0) / RENDERER_BLOCK_SIZE;
+    int32_t block_min_y = Max(rect.y, 0) / RENDERER_BLOCK_SIZE;
+    int32_t block_max_x = (rect.x + rect.w + RENDERER_BLOCK_SIZE - 1) / RENDERER_BLOCK_SIZE;
+    int32_t block_max_y = (rect.y + rect.h + RENDERER_BLOCK_SIZE - 1) / RENDERER_BLOCK_SIZE;
+    block_max_x = Min(block_max_x, depth_buffer->block_count_x);
+    block_max_y = Min(block_max_y, depth_buffer->block_count_y);
+
+    if (block_min_x >= block_max_x)
+    {
+        return;
+    }
+
+    // Blocks next to each other in a row are contiguous.
+    int32_t block_row_count = block_max_x - block_min_x;
+    for (int32_t block_y = block_min_y; block_y < block_max_y; ++block_y)
+    {
+        int32_t block_index = block_min_x + block_y * depth_buffer->block_count_x;
+        float* block_depth = depth_buffer->depth + block_index * RENDERER_BLOCK_SIZE * RENDERER_BLOCK_SIZE;
+
+        renderer_fill_depth(block_depth, block_row_count * RENDERER_BLOCK_SIZE * RENDERER_BLOCK_SIZE, depth, 0);
+        renderer_fill_depth(depth_buffer->block_min + block_index, block_row_count, depth, 0);
+        renderer_fill_depth(depth_buffer->block_max + block_index, block_row_count, depth, 0);
+    }
+}
+
+static int64_t
+renderer_rect_area(RendererRect rect)
+{
+    return (int64_t)rect.w * rect.h;
+}
+
+static RendererRect
+renderer_rect_union(RendererRect a, RendererRect b)
+{
+    int32_t min_x = Min(a.x, b.x);
+    int32_t min_y = Min(a.y, b.y);
+    int32_t a_max_x = a.x + a.w;
+    int32_t b_max_x = b.x + b.w;
+    int32_t a_max_y = a.y + a.h;
+    int32_t b_max_y = b.y + b.h;
+    int32_t max_x = Max(a_max_x, b_max_x);
+    int32_t max_y = Max(a_max_y, b_max_y);
+
+    RendererRect result = {
+        min_x, min_y, max_x - min_x, max_y - min_y
+    };
+
+    return result;
+}
+
+void
+renderer_dirty_rects_clear(RendererDirtyRects* dirty)
+{
+    dirty->count = 0;
+}
+
+void
+renderer_dirty_rects_add(RendererDirtyRects* dirty, RendererRect rect)
+{
+    if (rect.w <= 0 || rect.h <= 0)
+    {
+        return;
+    }
+
+    // A union can reach rectangles neither side overlapped, so start over
+    // after every merge until rect stands alone.
+    int32_t i = 0;
+    while (i < dirty->count)
+    {
+        RendererRect other = dirty->rects[i];
+        RendererRect overlap = renderer_rect_intersect(rect, other);
+        RendererRect merged = renderer_rect_union(rect, other);
+
+        if ((overlap.w > 0 && overlap.h > 0) ||
+            renderer_rect_area(merged) == renderer_rect_area(rect) + renderer_rect_area(other))
+        {
+            if (renderer_rect_area(merged) == renderer_rect_area(other))
+            {
+                return;
+            }
+
+            rect = merged;
+            dirty->rects[i] = dirty->rects[--dirty->count];
+            i = 0;
+            continue;
+        }
+
+        ++i;
+    }
+
+    if (dirty->count < RENDERER_DIRTY_RECT_MAX)
+    {
+        dirty->rects[dirty->count++] = rect;
+        return;
+    }
+
+    // Out of room, fold rect into whichever rectangle it wastes the fewest
+    // pixels with, and add that in its place.
+    int32_t best_index = 0;
+    int64_t best_waste = INT64_MAX;
+    for (i = 0; i < dirty->count; ++i)
+    {
+        RendererRect other = dirty->rects[i];
+        int64_t waste = renderer_rect_area(renderer_rect_union(rect, other)) -
+            renderer_rect_area(rect) - renderer_rect_area(other);
+
+        if (waste < best_waste)
+        {
+            best_waste = waste;
+            best_index = i;
+        }
+    }
+
+    RendererRect merged = renderer_rect_union(rect, dirty->rects[best_index]);
+    dirty->rects[best_index] = dirty->rects[--dirty->count];
+    renderer_dirty_rects_add(dirty, merged);
+}
+
+void
+renderer_dirty_rects_add_all(RendererDirtyRects* dirty, const RendererDirtyRects* source)
+{
+    for (int32_t i = 0; i < source->count; ++i)
+    {
+        renderer_dirty_rects_add(dirty, source->rects[i]);
+    }
+}
+
+int64_t
+renderer_dirty_rects_area(const RendererDirtyRects* dirty)
+{
+    int64_t area = 0;
+    for (int32_t i = 0; i < dirty->count; ++i)
+    {
+        area += renderer_rect_area(dirty->rects[i]);
+    }
+
+    return area;
+}
+
 void 
 renderer_fill(RendererTargetBuffer buffer, uint32_t color)
 {
-    uint32_t fill_until = buffer.width * buffer.height * buffer.bytes_per_pixel;
-    uint32_t per_pixel_add = buffer.bytes_per_pixel;
-    for (int offset = 0; offset < fill_until; offset += per_pixel_add)
+    // Row padding and block padding are part of the buffer as well, so the
+    // whole thing is filled in one go regardless of layout.
+    int32_t size = renderer_target_buffer_size(buffer);
+    int32_t streaming = size >= RENDERER_STREAMING_FILL_SIZE;
+
+    ProfilerBegin(fill);
+    uint32_t pixel = renderer_pack_pixel(buffer.format, color);
+    renderer_fill_pixels(buffer.pixels, buffer.bytes_per_pixel, size / buffer.bytes_per_pixel, pixel, streaming);
+    renderer_fill_fence(streaming);
+    ProfilerEnd(fill);
+    ProfilerCount(PROFILER_COUNTER_PIXELS_FILLED, buffer.width * buffer.height);
+
+    if (buffer.dirty)
     {
-        PutPixelByteOffset(buffer, offset, color);
+        RendererRect rect = {
+            0, 0, buffer.width, buffer.height
+        };
+
+        renderer_dirty_rects_add(buffer.dirty, rect);
     }
 }
 
-void 
-renderer_fill_rect(RendererTargetBuffer buffer, RendererRect rect, uint32_t color)
+static void
+renderer_fill_rect_stores(RendererTargetBuffer buffer, RendererRect rect, uint32_t color, int32_t streaming)
 {
-    for (int y = rect.y; y < rect.y + rect.h; y++)
+    RendererRect bounds = {
+        0, 0, buffer.width, buffer.height
+    };
+
+    rect = renderer_rect_intersect(rect, bounds);
+    if (rect.w == 0 || rect.h == 0)
     {
-        for(int x = rect.x; x < rect.x + rect.w; x++)
+        return;
+    }
+
+    ProfilerCount(PROFILER_COUNTER_PIXELS_FILLED, rect.w * rect.h);
+
+    if (buffer.dirty)
+    {
+        renderer_dirty_rects_add(buffer.dirty, rect);
+    }
+
+    int32_t max_x = rect.x + rect.w;
+    int32_t max_y = rect.y + rect.h;
+    uint32_t pixel = renderer_pack_pixel(buffer.format, color);
+
+    if (buffer.layout == RENDERER_TARGET_LINEAR)
+    {
+        for (int32_t y = rect.y; y < max_y; ++y)
         {
-            PutPixelXY(buffer, x, y, color);
+            uint8_t* row = buffer.pixels + IndexPixel(rect.x, y, buffer);
+            renderer_fill_pixels(row, buffer.bytes_per_pixel, rect.w, pixel, streaming);
         }
+
+        renderer_fill_fence(streaming);
+        return;
     }
+
+    // Whole blocks are contiguous, partial ones are filled one block row at
+    // a time.
+    int32_t block_min_x = rect.x & ~(RENDERER_BLOCK_SIZE - 1);
+    int32_t block_min_y = rect.y & ~(RENDERER_BLOCK_SIZE - 1);
+
+    for (int32_t block_y = block_min_y; block_y < max_y; block_y += RENDERER_BLOCK_SIZE)
+    {
+        int32_t y0 = Max(block_y, rect.y);
+        int32_t y1 = Min(block_y + RENDERER_BLOCK_SIZE, max_y);
+
+        for (int32_t block_x = block_min_x; block_x < max_x; block_x += RENDERER_BLOCK_SIZE)
+        {
+            int32_t x0 = Max(block_x, rect.x);
+            int32_t x1 = Min(block_x + RENDERER_BLOCK_SIZE, max_x);
+
+            if (x1 - x0 == RENDERER_BLOCK_SIZE && y1 - y0 == RENDERER_BLOCK_SIZE)
+            {
+                uint8_t* block = buffer.pixels + IndexPixel(block_x, block_y, buffer);
+                renderer_fill_pixels(block, buffer.bytes_per_pixel, RENDERER_BLOCK_SIZE * RENDERER_BLOCK_SIZE, pixel,
+                                     streaming);
+                continue;
+            }
+
+            for (int32_t y = y0; y < y1; ++y)
+            {
+                uint8_t* row = buffer.pixels + IndexPixel(x0, y, buffer);
+                renderer_fill_pixels(row, buffer.bytes_per_pixel, x1 - x0, pixel, streaming);
+            }
+        }
+    }
+
+    renderer_fill_fence(streaming);
+}
+
+void 
+renderer_fill_rect(RendererTargetBuffer buffer, RendererRect rect, uint32_t color)
+{
+    renderer_fill_rect_stores(buffer, rect, color, 0);
+}
+
+void
+renderer_fill_rect_streaming(RendererTargetBuffer buffer, RendererRect rect, uint32_t color)
+{
+    renderer_fill_rect_stores(buffer, rect, color, 1);
 }
 
 void
 renderer_fill_triangle(RendererTargetBuffer buffer, RendererTriangle triangle)
+{
+    RendererRect clip = {
+        0, 0, buffer.width, buffer.height
+    };
+
+    renderer_fill_triangle_clipped(buffer, triangle, clip);
+}
+
+// Edge functions at min_x, min_y and the interpolation gradients of
+// triangle, returns twice its signed area
+static int32_t
+renderer_triangle_setup(RendererTriangle triangle, int32_t min_x, int32_t min_y, RendererSpanSetup* setup,
+                        int32_t* bcoord_rows)
 {
     RendererPoint p0 = triangle.p0;
     RendererPoint p1 = triangle.p1;
     RendererPoint p2 = triangle.p2;
 
-    int32_t min_x = Min3(p0.x, p1.x, p2.x);
-    int32_t max_x = Max3(p0.x, p1.x, p2.x);
-    int32_t min_y = Min3(p0.y, p1.y, p2.y);
-    int32_t max_y = Max3(p0.y, p1.y, p2.y);
-
-    int32_t a12 = p1.y - p2.y; int32_t b12 = p2.x - p1.x;
-    int32_t a20 = p2.y - p0.y; int32_t b20 = p0.x - p2.x;
-    int32_t a01 = p0.y - p1.y; int32_t b01 = p1.x - p0.x;
-
     RendererPoint test_p = { min_x, min_y };
 
-    int32_t bcoord_row0 = signed_area2(p1, p2, test_p);
-    int32_t bcoord_row1 = signed_area2(p2, p0, test_p);
-    int32_t bcoord_row2 = signed_area2(p0, p1, test_p);
-    
-    int32_t total_area2 = bcoord_row0 + bcoord_row1 + bcoord_row2;
+    bcoord_rows[0] = signed_area2(p1, p2, test_p);
+    bcoord_rows[1] = signed_area2(p2, p0, test_p);
+    bcoord_rows[2] = signed_area2(p0, p1, test_p);
+
+    int32_t total_area2 = bcoord_rows[0] + bcoord_rows[1] + bcoord_rows[2];
     float total_area2_inv = 1.0f / total_area2;
 
     uint8_t color_r0; uint8_t color_r1; uint8_t color_r2;
@@ -77,42 +690,543 @@ renderer_fill_triangle(RendererTargetBuffer buffer, RendererTriangle triangle)
     UnpackColorRGB(triangle.c1, color_r1, color_g1, color_b1);
     UnpackColorRGB(triangle.c2, color_r2, color_g2, color_b2);
 
-    int32_t color_base_r0 = (int32_t)(color_r0 << 18);
-    int32_t color_base_g0 = (int32_t)(color_g0 << 18);
-    int32_t color_base_b0 = (int32_t)(color_b0 << 18);
+    setup->a12 = p1.y - p2.y;
+    setup->a20 = p2.y - p0.y;
+    setup->a01 = p0.y - p1.y;
+    setup->b12 = p2.x - p1.x;
+    setup->b20 = p0.x - p2.x;
+    setup->b01 = p1.x - p0.x;
+
+    setup->color_base_r0 = (int32_t)(color_r0 << 18);
+    setup->color_base_g0 = (int32_t)(color_g0 << 18);
+    setup->color_base_b0 = (int32_t)(color_b0 << 18);
+
+    setup->color_r10 = (int32_t)(((color_r1 - color_r0) << 18) * total_area2_inv);
+    setup->color_r20 = (int32_t)(((color_r2 - color_r0) << 18) * total_area2_inv);
+    setup->color_g10 = (int32_t)(((color_g1 - color_g0) << 18) * total_area2_inv);
+    setup->color_g20 = (int32_t)(((color_g2 - color_g0) << 18) * total_area2_inv);
+    setup->color_b10 = (int32_t)(((color_b1 - color_b0) << 18) * total_area2_inv);
+    setup->color_b20 = (int32_t)(((color_b2 - color_b0) << 18) * total_area2_inv);
+
+    setup->z0 = p0.z;
+    setup->z10 = (p1.z - p0.z) * total_area2_inv;
+    setup->z20 = (p2.z - p0.z) * total_area2_inv;
+
+    return total_area2;
+}
+
+void
+renderer_fill_triangle_clipped(RendererTargetBuffer buffer, RendererTriangle triangle, RendererRect clip)
+{
+    RendererPoint p0 = triangle.p0;
+    RendererPoint p1 = triangle.p1;
+    RendererPoint p2 = triangle.p2;
+
+    int32_t min_x = Min3(p0.x, p1.x, p2.x);
+    int32_t max_x = Max3(p0.x, p1.x, p2.x);
+    int32_t min_y = Min3(p0.y, p1.y, p2.y);
+    int32_t max_y = Max3(p0.y, p1.y, p2.y);
+
+    // Edge functions are evaluated at integer pixel positions, so starting
+    // the walk at the clipped corner gives the exact same values per pixel.
+    int32_t clip_max_x = clip.x + clip.w;
+    int32_t clip_max_y = clip.y + clip.h;
+    min_x = Max(min_x, clip.x);
+    min_y = Max(min_y, clip.y);
+    max_x = Min(max_x, clip_max_x);
+    max_y = Min(max_y, clip_max_y);
+
+    if (min_x >= max_x || min_y >= max_y)
+    {
+        return;
+    }
+
+    RendererSpanSetup setup;
+    int32_t bcoord_rows[3];
+    int32_t total_area2 = renderer_triangle_setup(triangle, min_x, min_y, &setup, bcoord_rows);
+
+    // The edge functions of every pixel sum to total_area2, so no pixel is
+    // inside a triangle without a positive area. A zero area one could only
+    // touch pixels exactly on its line, which have no depth plane or colors.
+    if (total_area2 <= 0)
+    {
+        return;
+    }
+
+    if (buffer.dirty)
+    {
+        RendererRect bounds = {
+            min_x, min_y, max_x - min_x, max_y - min_y
+        };
+
+        renderer_dirty_rects_add(buffer.dirty, bounds);
+    }
+
+    int32_t a12 = setup.a12; int32_t b12 = setup.b12;
+    int32_t a20 = setup.a20; int32_t b20 = setup.b20;
+    int32_t a01 = setup.a01; int32_t b01 = setup.b01;
+
+    int32_t bcoord_row0 = bcoord_rows[0];
+    int32_t bcoord_row1 = bcoord_rows[1];
+    int32_t bcoord_row2 = bcoord_rows[2];
+
+    RendererDepthBuffer* depth_buffer = buffer.depth;
+    if (depth_buffer && (depth_buffer->width != buffer.width || depth_buffer->height != buffer.height))
+    {
+        depth_buffer = 0;
+    }
+
+    // Depth change per pixel step, used to bound depth over a whole block.
+    float z_dx = a20 * setup.z10 + a01 * setup.z20;
+    float z_dy = b20 * setup.z10 + b01 * setup.z20;
+    float triangle_z_min = Min3(p0.z, p1.z, p2.z);
+    float triangle_z_max = Max3(p0.z, p1.z, p2.z);
+
+    RendererSpanKernels kernels = renderer_span_kernels(buffer.format);
+    int32_t shaded_pixel_count = 0;
+
+    // Walk screen aligned blocks, so blocks fully outside one edge are skipped
+    // and blocks fully inside all edges are shaded without any edge tests.
+    int32_t block_min_x = min_x & ~(RENDERER_BLOCK_SIZE - 1);
+    int32_t block_min_y = min_y & ~(RENDERER_BLOCK_SIZE - 1);
+
+    for (int32_t block_y = block_min_y; block_y < max_y; block_y += RENDERER_BLOCK_SIZE)
+    {
+        int32_t y0 = Max(block_y, min_y);
+        int32_t y1 = Min(block_y + RENDERER_BLOCK_SIZE, max_y);
+
+        for (int32_t block_x = block_min_x; block_x < max_x; block_x += RENDERER_BLOCK_SIZE)
+        {
+            int32_t x0 = Max(block_x, min_x);
+            int32_t x1 = Min(block_x + RENDERER_BLOCK_SIZE, max_x);
+            int32_t w = x1 - x0;
+            int32_t h = y1 - y0;
+
+            int32_t bcoord0 = bcoord_row0 + (x0 - min_x) * a12 + (y0 - min_y) * b12;
+            int32_t bcoord1 = bcoord_row1 + (x0 - min_x) * a20 + (y0 - min_y) * b20;
+            int32_t bcoord2 = bcoord_row2 + (x0 - min_x) * a01 + (y0 - min_y) * b01;
+
+            if (renderer_edge_block_max(bcoord0, a12, b12, w, h) < 0 ||
+                renderer_edge_block_max(bcoord1, a20, b20, w, h) < 0 ||
+                renderer_edge_block_max(bcoord2, a01, b01, w, h) < 0)
+            {
+                continue;
+            }
+
+            int32_t covered =
+                (renderer_edge_block_min(bcoord0, a12, b12, w, h) |
+                 renderer_edge_block_min(bcoord1, a20, b20, w, h) |
+                 renderer_edge_block_min(bcoord2, a01, b01, w, h)) >= 0;
+
+            int32_t depth_mode = RENDERER_SPAN_DEPTH_NONE;
+            int32_t block_index = 0;
+            float* block_depth = 0;
+            float block_z_min = 0.0f;
+            float block_z_max = 0.0f;
+
+            if (depth_buffer)
+            {
+                // Bound the triangle's depth over the block, a block whose
+                // stored depth is nearer everywhere is rejected untouched and
+                // one that is farther everywhere needs no per pixel test.
+                float z = renderer_span_depth(&setup, bcoord1, bcoord2);
+                float z_extent_x = z_dx * (w - 1);
+                float z_extent_y = z_dy * (h - 1);
+
+                block_z_min = z + Min(z_extent_x, 0.0f) + Min(z_extent_y, 0.0f);
+                block_z_max = z + Max(z_extent_x, 0.0f) + Max(z_extent_y, 0.0f);
+                block_z_min = Max(block_z_min, triangle_z_min) - RENDERER_DEPTH_EPSILON;
+                block_z_max = Min(block_z_max, triangle_z_max) + RENDERER_DEPTH_EPSILON;
+
+                block_index = block_x / RENDERER_BLOCK_SIZE +
+                    block_y / RENDERER_BLOCK_SIZE * depth_buffer->block_count_x;
+
+                if (block_z_min >= depth_buffer->block_max[block_index])
+                {
+                    continue;
+                }
 
-    int32_t color_r10 = (int32_t)(((color_r1 - color_r0) << 18) * total_area2_inv);
-    int32_t color_r20 = (int32_t)(((color_r2 - color_r0) << 18) * total_area2_inv);
-    int32_t color_g10 = (int32_t)(((color_g1 - color_g0) << 18) * total_area2_inv);
-    int32_t color_g20 = (int32_t)(((color_g2 - color_g0) << 18) * total_area2_inv);
-    int32_t color_b10 = (int32_t)(((color_b1 - color_b0) << 18) * total_area2_inv);
-    int32_t color_b20 = (int32_t)(((color_b2 - color_b0) << 18) * total_area2_inv);
+                block_depth = depth_buffer->depth + block_index * RENDERER_BLOCK_SIZE * RENDERER_BLOCK_SIZE +
+                    (y0 - block_y) * RENDERER_BLOCK_SIZE + (x0 - block_x);
 
-    for(test_p.y = min_y; test_p.y < max_y; test_p.y++)
+                depth_mode = block_z_max < depth_buffer->block_min[block_index] ?
+                    RENDERER_SPAN_DEPTH_WRITE : RENDERER_SPAN_DEPTH_TEST;
+            }
+
+            RendererSpanFunction* fill_span = kernels.fill_span[depth_mode][covered];
+            shaded_pixel_count += w * h;
+
+            // Spans never leave their block, so they are contiguous in either
+            // target layout and only the start of each row is looked up.
+            for (int32_t y = y0; y < y1; ++y)
+            {
+                uint8_t* row = buffer.pixels + IndexPixel(x0, y, buffer);
+                fill_span(&setup, row, block_depth, w, bcoord0, bcoord1, bcoord2);
+
+                if (block_depth)
+                {
+                    block_depth += RENDERER_BLOCK_SIZE;
+                }
+
+                bcoord0 += b12;
+                bcoord1 += b20;
+                bcoord2 += b01;
+            }
+
+            if (depth_buffer)
+            {
+                depth_buffer->block_min[block_index] =
+                    Min(depth_buffer->block_min[block_index], block_z_min);
+
+                // Only a triangle covering the entire block lowers its far bound.
+                int32_t block_end_x = Min(block_x + RENDERER_BLOCK_SIZE, buffer.width);
+                int32_t block_end_y = Min(block_y + RENDERER_BLOCK_SIZE, buffer.height);
+                if (covered && x0 == block_x && y0 == block_y && x1 == block_end_x && y1 == block_end_y)
+                {
+                    depth_buffer->block_max[block_index] =
+                        Min(depth_buffer->block_max[block_index], block_z_max);
+                }
+            }
+        }
+    }
+
+    ProfilerCount(PROFILER_COUNTER_TRIANGLES_RASTERIZED, 1);
+    ProfilerCount(PROFILER_COUNTER_PIXELS_SHADED, shaded_pixel_count);
+}
+
+// Per triangle state of the small triangle path, set up a batch at a time
+typedef struct RendererSmallTriangle {
+    RendererSpanSetup setup;
+    int32_t bcoord_rows[3];
+    int32_t total_area2;
+    float z_min;
+} RendererSmallTriangle;
+
+static void
+renderer_small_triangle_setup(RendererTriangle triangle, RendererRect bounds, RendererSmallTriangle* small)
+{
+    small->total_area2 = renderer_triangle_setup(triangle, bounds.x, bounds.y, &small->setup, small->bcoord_rows);
+    small->z_min = Min3(triangle.p0.z, triangle.p1.z, triangle.p2.z);
+}
+
+#ifdef RENDERER_SPAN_X86
+// Low 32 bits of each lane product, SSE2 only multiplies every other lane
+__attribute__((target("sse2")))
+static inline __m128i
+renderer_mullo_epi32_sse2(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// Color channel gradient, the same int to float conversions, multiply and
+// truncation renderer_triangle_setup does per triangle
+__attribute__((target("sse2")))
+static inline __m128i
+renderer_color_gradient_sse2(__m128i channel0, __m128i channel, __m128 total_area2_inv)
+{
+    __m128i difference = _mm_slli_epi32(_mm_sub_epi32(channel, channel0), 18);
+    return _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(difference), total_area2_inv));
+}
+
+#define RendererGatherLanes(type, triangles, field) \
+    _mm_setr_##type(triangles[0].field, triangles[1].field, triangles[2].field, triangles[3].field)
+
+// Set up four small triangles at once, bit identical to doing them one by
+// one with renderer_small_triangle_setup
+__attribute__((target("sse2")))
+static void
+renderer_small_triangles_setup_sse2(const RendererTriangle* triangles, const RendererRect* bounds,
+                                    RendererSmallTriangle* small)
+{
+    __m128i p0_x = RendererGatherLanes(epi32, triangles, p0.x);
+    __m128i p0_y = RendererGatherLanes(epi32, triangles, p0.y);
+    __m128i p1_x = RendererGatherLanes(epi32, triangles, p1.x);
+    __m128i p1_y = RendererGatherLanes(epi32, triangles, p1.y);
+    __m128i p2_x = RendererGatherLanes(epi32, triangles, p2.x);
+    __m128i p2_y = RendererGatherLanes(epi32, triangles, p2.y);
+    __m128i test_x = RendererGatherLanes(epi32, bounds, x);
+    __m128i test_y = RendererGatherLanes(epi32, bounds, y);
+
+    __m128i a12 = _mm_sub_epi32(p1_y, p2_y);
+    __m128i a20 = _mm_sub_epi32(p2_y, p0_y);
+    __m128i a01 = _mm_sub_epi32(p0_y, p1_y);
+    __m128i b12 = _mm_sub_epi32(p2_x, p1_x);
+    __m128i b20 = _mm_sub_epi32(p0_x, p2_x);
+    __m128i b01 = _mm_sub_epi32(p1_x, p0_x);
+
+    // signed_area2 expanded, with the y differences of each edge negated
+    // into its a coefficient
+    __m128i bcoord_row0 = _mm_add_epi32(renderer_mullo_epi32_sse2(b12, _mm_sub_epi32(test_y, p1_y)),
+                                        renderer_mullo_epi32_sse2(a12, _mm_sub_epi32(test_x, p1_x)));
+    __m128i bcoord_row1 = _mm_add_epi32(renderer_mullo_epi32_sse2(b20, _mm_sub_epi32(test_y, p2_y)),
+                                        renderer_mullo_epi32_sse2(a20, _mm_sub_epi32(test_x, p2_x)));
+    __m128i bcoord_row2 = _mm_add_epi32(renderer_mullo_epi32_sse2(b01, _mm_sub_epi32(test_y, p0_y)),
+                                        renderer_mullo_epi32_sse2(a01, _mm_sub_epi32(test_x, p0_x)));
+
+    __m128i total_area2 = _mm_add_epi32(_mm_add_epi32(bcoord_row0, bcoord_row1), bcoord_row2);
+    __m128 total_area2_inv = _mm_div_ps(_mm_set1_ps(1.0f), _mm_cvtepi32_ps(total_area2));
+
+    __m128i channel_mask = _mm_set1_epi32(0xff);
+    __m128i c0 = RendererGatherLanes(epi32, triangles, c0);
+    __m128i c1 = RendererGatherLanes(epi32, triangles, c1);
+    __m128i c2 = RendererGatherLanes(epi32, triangles, c2);
+    __m128i r0 = _mm_and_si128(_mm_srli_epi32(c0, 16), channel_mask);
+    __m128i r1 = _mm_and_si128(_mm_srli_epi32(c1, 16), channel_mask);
+    __m128i r2 = _mm_and_si128(_mm_srli_epi32(c2, 16), channel_mask);
+    __m128i g0 = _mm_and_si128(_mm_srli_epi32(c0, 8), channel_mask);
+    __m128i g1 = _mm_and_si128(_mm_srli_epi32(c1, 8), channel_mask);
+    __m128i g2 = _mm_and_si128(_mm_srli_epi32(c2, 8), channel_mask);
+    __m128i b0 = _mm_and_si128(c0, channel_mask);
+    __m128i b1 = _mm_and_si128(c1, channel_mask);
+    __m128i b2 = _mm_and_si128(c2, channel_mask);
+
+    __m128 z0 = RendererGatherLanes(ps, triangles, p0.z);
+    __m128 z1 = RendererGatherLanes(ps, triangles, p1.z);
+    __m128 z2 = RendererGatherLanes(ps, triangles, p2.z);
+
+    int32_t lanes[22][4];
+    float float_lanes[4][4];
+    __m128i* lane_vectors = (__m128i*)lanes;
+    _mm_storeu_si128(lane_vectors + 0, a12);
+    _mm_storeu_si128(lane_vectors + 1, a20);
+    _mm_storeu_si128(lane_vectors + 2, a01);
+    _mm_storeu_si128(lane_vectors + 3, b12);
+    _mm_storeu_si128(lane_vectors + 4, b20);
+    _mm_storeu_si128(lane_vectors + 5, b01);
+    _mm_storeu_si128(lane_vectors + 6, bcoord_row0);
+    _mm_storeu_si128(lane_vectors + 7, bcoord_row1);
+    _mm_storeu_si128(lane_vectors + 8, bcoord_row2);
+    _mm_storeu_si128(lane_vectors + 9, total_area2);
+    _mm_storeu_si128(lane_vectors + 10, _mm_slli_epi32(r0, 18));
+    _mm_storeu_si128(lane_vectors + 11, _mm_slli_epi32(g0, 18));
+    _mm_storeu_si128(lane_vectors + 12, _mm_slli_epi32(b0, 18));
+    _mm_storeu_si128(lane_vectors + 13, renderer_color_gradient_sse2(r0, r1, total_area2_inv));
+    _mm_storeu_si128(lane_vectors + 14, renderer_color_gradient_sse2(r0, r2, total_area2_inv));
+    _mm_storeu_si128(lane_vectors + 15, renderer_color_gradient_sse2(g0, g1, total_area2_inv));
+    _mm_storeu_si128(lane_vectors + 16, renderer_color_gradient_sse2(g0, g2, total_area2_inv));
+    _mm_storeu_si128(lane_vectors + 17, renderer_color_gradient_sse2(b0, b1, total_area2_inv));
+    _mm_storeu_si128(lane_vectors + 18, renderer_color_gradient_sse2(b0, b2, total_area2_inv));
+    _mm_storeu_ps(float_lanes[0], z0);
+    _mm_storeu_ps(float_lanes[1], _mm_mul_ps(_mm_sub_ps(z1, z0), total_area2_inv));
+    _mm_storeu_ps(float_lanes[2], _mm_mul_ps(_mm_sub_ps(z2, z0), total_area2_inv));
+    _mm_storeu_ps(float_lanes[3], _mm_min_ps(z0, _mm_min_ps(z1, z2)));
+
+    for (int32_t i = 0; i < 4; ++i)
     {
-        int32_t bcoord0 = bcoord_row0;
-        int32_t bcoord1 = bcoord_row1;
-        int32_t bcoord2 = bcoord_row2;
+        RendererSmallTriangle* triangle = small + i;
+        triangle->setup.a12 = lanes[0][i];
+        triangle->setup.a20 = lanes[1][i];
+        triangle->setup.a01 = lanes[2][i];
+        triangle->setup.b12 = lanes[3][i];
+        triangle->setup.b20 = lanes[4][i];
+        triangle->setup.b01 = lanes[5][i];
+        triangle->bcoord_rows[0] = lanes[6][i];
+        triangle->bcoord_rows[1] = lanes[7][i];
+        triangle->bcoord_rows[2] = lanes[8][i];
+        triangle->total_area2 = lanes[9][i];
+        triangle->setup.color_base_r0 = lanes[10][i];
+        triangle->setup.color_base_g0 = lanes[11][i];
+        triangle->setup.color_base_b0 = lanes[12][i];
+        triangle->setup.color_r10 = lanes[13][i];
+        triangle->setup.color_r20 = lanes[14][i];
+        triangle->setup.color_g10 = lanes[15][i];
+        triangle->setup.color_g20 = lanes[16][i];
+        triangle->setup.color_b10 = lanes[17][i];
+        triangle->setup.color_b20 = lanes[18][i];
+        triangle->setup.z0 = float_lanes[0][i];
+        triangle->setup.z10 = float_lanes[1][i];
+        triangle->setup.z20 = float_lanes[2][i];
+        triangle->z_min = float_lanes[3][i];
+    }
+}
+#endif
+
+// Rasterize a triangle whose bounds span at most two blocks each way. The
+// blocks are not bounded in depth or tested for full coverage, at this size
+// that costs more than the edge and depth tests it would save.
+static int32_t
+renderer_fill_small_triangle(RendererTargetBuffer buffer, RendererDepthBuffer* depth_buffer,
+                             const RendererSpanKernels* kernels, const RendererSmallTriangle* small,
+                             RendererRect bounds)
+{
+    const RendererSpanSetup* setup = &small->setup;
+    int32_t max_x = bounds.x + bounds.w;
+    int32_t max_y = bounds.y + bounds.h;
+
+    // Nearer than anything the triangle interpolates, for the whole block
+    float z_min = small->z_min - RENDERER_DEPTH_EPSILON;
+    int32_t depth_mode = depth_buffer ? RENDERER_SPAN_DEPTH_TEST : RENDERER_SPAN_DEPTH_NONE;
+    RendererBlockFunction* fill_block = kernels->fill_block[depth_mode];
+    int32_t shaded_pixel_count = 0;
+
+    // Rows of a block are contiguous in either layout, only their distance
+    // differs
+    int32_t row_pitch = buffer.layout == RENDERER_TARGET_TILED ?
+        RENDERER_BLOCK_SIZE * buffer.bytes_per_pixel : buffer.pitch;
 
-        for(test_p.x = min_x; test_p.x < max_x; test_p.x++)
+    int32_t block_min_x = bounds.x & ~(RENDERER_BLOCK_SIZE - 1);
+    int32_t block_min_y = bounds.y & ~(RENDERER_BLOCK_SIZE - 1);
+
+    for (int32_t block_y = block_min_y; block_y < max_y; block_y += RENDERER_BLOCK_SIZE)
+    {
+        int32_t y0 = Max(block_y, bounds.y);
+        int32_t y1 = Min(block_y + RENDERER_BLOCK_SIZE, max_y);
+
+        for (int32_t block_x = block_min_x; block_x < max_x; block_x += RENDERER_BLOCK_SIZE)
         {
-            if ((bcoord0|bcoord1|bcoord2) >= 0)
+            int32_t x0 = Max(block_x, bounds.x);
+            int32_t x1 = Min(block_x + RENDERER_BLOCK_SIZE, max_x);
+            int32_t w = x1 - x0;
+            int32_t h = y1 - y0;
+
+            int32_t bcoord0 = small->bcoord_rows[0] + (x0 - bounds.x) * setup->a12 + (y0 - bounds.y) * setup->b12;
+            int32_t bcoord1 = small->bcoord_rows[1] + (x0 - bounds.x) * setup->a20 + (y0 - bounds.y) * setup->b20;
+            int32_t bcoord2 = small->bcoord_rows[2] + (x0 - bounds.x) * setup->a01 + (y0 - bounds.y) * setup->b01;
+
+            if (renderer_edge_block_max(bcoord0, setup->a12, setup->b12, w, h) < 0 ||
+                renderer_edge_block_max(bcoord1, setup->a20, setup->b20, w, h) < 0 ||
+                renderer_edge_block_max(bcoord2, setup->a01, setup->b01, w, h) < 0)
             {
-                uint8_t color_r = (uint8_t)((color_base_r0 + bcoord1 * color_r10 + bcoord2 * color_r20) >> 18);
-                uint8_t color_g = (uint8_t)((color_base_g0 + bcoord1 * color_g10 + bcoord2 * color_g20) >> 18);
-                uint8_t color_b = (uint8_t)((color_base_b0 + bcoord1 * color_b10 + bcoord2 * color_b20) >> 18);
-                uint32_t pixel_color = PackColorRGB(color_r, color_g, color_b);
+                continue;
+            }
 
-                PutPixelXY(buffer, test_p.x, test_p.y, pixel_color);
+            int32_t block_index = 0;
+            float* block_depth = 0;
+            if (depth_buffer)
+            {
+                block_index = block_x / RENDERER_BLOCK_SIZE +
+                    block_y / RENDERER_BLOCK_SIZE * depth_buffer->block_count_x;
+
+                if (z_min >= depth_buffer->block_max[block_index])
+                {
+                    continue;
+                }
+
+                block_depth = depth_buffer->depth + block_index * RENDERER_BLOCK_SIZE * RENDERER_BLOCK_SIZE +
+                    (y0 - block_y) * RENDERER_BLOCK_SIZE + (x0 - block_x);
             }
 
-            bcoord0 += a12;
-            bcoord1 += a20;
-            bcoord2 += a01;
+            shaded_pixel_count += w * h;
+            fill_block(setup, buffer.pixels + IndexPixel(x0, y0, buffer), row_pitch, block_depth, w, h,
+                       bcoord0, bcoord1, bcoord2);
+
+            if (depth_buffer)
+            {
+                depth_buffer->block_min[block_index] = Min(depth_buffer->block_min[block_index], z_min);
+            }
         }
+    }
 
-        bcoord_row0 += b12;
-        bcoord_row1 += b20;
-        bcoord_row2 += b01;
+    return shaded_pixel_count;
+}
+
+void
+renderer_fill_triangle_batched(RendererTargetBuffer buffer, RendererTriangleBatch* batch, RendererTriangle triangle,
+                               RendererRect clip)
+{
+    RendererPoint p0 = triangle.p0;
+    RendererPoint p1 = triangle.p1;
+    RendererPoint p2 = triangle.p2;
+
+    int32_t min_x = Min3(p0.x, p1.x, p2.x);
+    int32_t max_x = Max3(p0.x, p1.x, p2.x);
+    int32_t min_y = Min3(p0.y, p1.y, p2.y);
+    int32_t max_y = Max3(p0.y, p1.y, p2.y);
+
+    int32_t clip_max_x = clip.x + clip.w;
+    int32_t clip_max_y = clip.y + clip.h;
+    min_x = Max(min_x, clip.x);
+    min_y = Max(min_y, clip.y);
+    max_x = Min(max_x, clip_max_x);
+    max_y = Min(max_y, clip_max_y);
+
+    if (min_x >= max_x || min_y >= max_y)
+    {
+        return;
+    }
+
+    // Triangles are drawn in order, so everything queued goes first.
+    if (max_x - min_x > RENDERER_SMALL_TRIANGLE_SIZE || max_y - min_y > RENDERER_SMALL_TRIANGLE_SIZE)
+    {
+        renderer_flush_triangle_batch(buffer, batch);
+        renderer_fill_triangle_clipped(buffer, triangle, clip);
+        return;
+    }
+
+    RendererRect bounds = {
+        min_x, min_y, max_x - min_x, max_y - min_y
+    };
+
+    batch->triangles[batch->count] = triangle;
+    batch->bounds[batch->count] = bounds;
+    if (++batch->count == RENDERER_TRIANGLE_BATCH_SIZE)
+    {
+        renderer_flush_triangle_batch(buffer, batch);
+    }
+}
+
+void
+renderer_flush_triangle_batch(RendererTargetBuffer buffer, RendererTriangleBatch* batch)
+{
+    if (batch->count == 0)
+    {
+        return;
+    }
+
+    ProfilerBegin(fill_small_triangles);
+    RendererSmallTriangle small[RENDERER_TRIANGLE_BATCH_SIZE];
+
+    int32_t setup_count = 0;
+#ifdef RENDERER_SPAN_X86
+    if (renderer_get_simd_level() >= RENDERER_SIMD_SSE2)
+    {
+        for (; setup_count + 4 <= batch->count; setup_count += 4)
+        {
+            renderer_small_triangles_setup_sse2(batch->triangles + setup_count, batch->bounds + setup_count,
+                                                small + setup_count);
+        }
+    }
+#endif
+
+    for (; setup_count < batch->count; ++setup_count)
+    {
+        renderer_small_triangle_setup(batch->triangles[setup_count], batch->bounds[setup_count], small + setup_count);
+    }
+
+    RendererDepthBuffer* depth_buffer = buffer.depth;
+    if (depth_buffer && (depth_buffer->width != buffer.width || depth_buffer->height != buffer.height))
+    {
+        depth_buffer = 0;
     }
-}
\ No newline at end of file
+
+    RendererSpanKernels kernels = renderer_span_kernels(buffer.format);
+    int32_t rasterized_count = 0;
+    int32_t shaded_pixel_count = 0;
+
+    for (int32_t i = 0; i < batch->count; ++i)
+    {
+        // Same as the general path, nothing without a positive area is drawn
+        if (small[i].total_area2 <= 0)
+        {
+            continue;
+        }
+
+        if (buffer.dirty)
+        {
+            renderer_dirty_rects_add(buffer.dirty, batch->bounds[i]);
+        }
+
+        shaded_pixel_count += renderer_fill_small_triangle(buffer, depth_buffer, &kernels, small + i, batch->bounds[i]);
+        rasterized_count++;
+    }
+
+    batch->count = 0;
+    ProfilerEnd(fill_small_triangles);
+
+    ProfilerCount(PROFILER_COUNTER_TRIANGLES_RASTERIZED, rasterized_count);
+    ProfilerCount(PROFILER_COUNTER_PIXELS_SHADED, shaded_pixel_count);
+}
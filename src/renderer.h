@@ -3,12 +3,24 @@
 #ifndef RENDERER_INCLUDED
 #define RENDERER_INCLUDED
 
-typedef struct RendererTargetBuffer {
+#include <stdint.h>
+
+// Triangles are traversed in square blocks of this many pixels, the depth
+// buffer keeps coarse depth bounds at the same granularity
+#define RENDERER_BLOCK_SIZE 8
+
+typedef struct RendererDepthBuffer {
     int32_t width;
     int32_t height;
-    int32_t bytes_per_pixel;
-    uint8_t* pixels;
-} RendererTargetBuffer;
+    // Stored in RENDERER_BLOCK_SIZE square blocks, same as a tiled target
+    float* depth;
+
+    // Nearest and farthest depth stored within each block, conservative
+    int32_t block_count_x;
+    int32_t block_count_y;
+    float* block_min;
+    float* block_max;
+} RendererDepthBuffer;
 
 typedef struct RendererRect {
     int32_t x;
@@ -17,20 +29,111 @@ typedef struct RendererRect {
     int32_t h;
 } RendererRect;
 
+// Most rectangles a dirty list holds, past that the two whose union wastes
+// the fewest pixels are merged
+#define RENDERER_DIRTY_RECT_MAX 16
+
+// Bounded list of non-overlapping rectangles covering every pixel written to
+// a target, so only those need presenting or clearing again
+typedef struct RendererDirtyRects {
+    int32_t count;
+    RendererRect rects[RENDERER_DIRTY_RECT_MAX];
+} RendererDirtyRects;
+
+typedef enum RendererTargetLayout {
+    // Rows of pixels, pitch bytes apart
+    RENDERER_TARGET_LINEAR = 0,
+    // RENDERER_BLOCK_SIZE square blocks of row major pixels, with the blocks
+    // row major as well, so a triangle touches few cache lines per block.
+    // The width and height are padded to whole blocks.
+    RENDERER_TARGET_TILED = 1,
+} RendererTargetLayout;
+
+typedef enum RendererPixelFormat {
+    // 32 bit 0x00RRGGBB, blits and blends keep the top byte zero
+    RENDERER_PIXEL_FORMAT_XRGB8888 = 0,
+    // 32 bit 0xAARRGGBB, everything but blending writes opaque pixels
+    RENDERER_PIXEL_FORMAT_ARGB8888 = 1,
+    // 16 bit, 5 bits of red above 6 of green above 5 of blue
+    RENDERER_PIXEL_FORMAT_RGB565 = 2,
+    RENDERER_PIXEL_FORMAT_COUNT = 3,
+} RendererPixelFormat;
+
+typedef struct RendererTargetBuffer {
+    int32_t width;
+    int32_t height;
+    int32_t bytes_per_pixel;
+    RendererPixelFormat format;
+    uint8_t* pixels;
+
+    // Bytes between rows, for tiled targets the rows of the padded width
+    int32_t pitch;
+    RendererTargetLayout layout;
+
+    // Optional, triangles are depth tested when set
+    RendererDepthBuffer* depth;
+
+    // Optional, fills and triangles add the pixels they write when set
+    RendererDirtyRects* dirty;
+} RendererTargetBuffer;
+
+// Byte offset of the pixel at x, y within target
+static inline int32_t
+renderer_target_pixel_offset(RendererTargetBuffer target, int32_t x, int32_t y)
+{
+    if (target.layout == RENDERER_TARGET_TILED)
+    {
+        int32_t block_offset = (y & ~(RENDERER_BLOCK_SIZE - 1)) * target.pitch +
+            (x & ~(RENDERER_BLOCK_SIZE - 1)) * RENDERER_BLOCK_SIZE * target.bytes_per_pixel;
+        int32_t pixel_index = (y & (RENDERER_BLOCK_SIZE - 1)) * RENDERER_BLOCK_SIZE + (x & (RENDERER_BLOCK_SIZE - 1));
+
+        return block_offset + pixel_index * target.bytes_per_pixel;
+    }
+
+    return y * target.pitch + x * target.bytes_per_pixel;
+}
+
+static inline RendererRect
+renderer_rect_intersect(RendererRect a, RendererRect b)
+{
+    int32_t min_x = a.x > b.x ? a.x : b.x;
+    int32_t min_y = a.y > b.y ? a.y : b.y;
+    int32_t max_x = a.x + a.w < b.x + b.w ? a.x + a.w : b.x + b.w;
+    int32_t max_y = a.y + a.h < b.y + b.h ? a.y + a.h : b.y + b.h;
+
+    RendererRect result = {
+        min_x, min_y,
+        max_x > min_x ? max_x - min_x : 0,
+        max_y > min_y ? max_y - min_y : 0
+    };
+
+    return result;
+}
+
 typedef struct RendererPoint {
     int32_t x;
     int32_t y;
+    float z;
 } RendererPoint;
 
 static inline RendererPoint
-renderer_point_create(int32_t x, int32_t y)
+renderer_point_create(int32_t x, int32_t y, float z)
 {
     RendererPoint result = {
-        x, y};
+        x, y, z};
 
     return result;
 }
 
+// Twice the signed area of p0 p1 p2, positive for the winding the rasterizer
+// fills and negative for the opposite one
+static inline int32_t 
+signed_area2(RendererPoint p0, RendererPoint p1, RendererPoint p2)
+{
+    return (p1.x - p0.x) * (p2.y - p0.y) -
+        (p1.y - p0.y) * (p2.x - p0.x);
+}
+
 typedef struct RendererTriangle {
     RendererPoint p0;
     RendererPoint p1;
@@ -49,25 +152,186 @@ typedef struct RendererTriangle {
 // Unpack 3 color bytes from one uint32
 #define UnpackColorRGB(color, r, g, b) r=(color>>16)&0xff;g=(color>>8)&0xff;b=(color>>0)&0xff
 
+static inline int32_t
+renderer_pixel_format_bytes(RendererPixelFormat format)
+{
+    return format == RENDERER_PIXEL_FORMAT_RGB565 ? 2 : 4;
+}
+
+// Pixel of format for a 0x00RRGGBB color, in the low bits of the result.
+// Conversions to RGB565 truncate, the same as the kernels drawing it.
+static inline uint32_t
+renderer_pack_pixel(RendererPixelFormat format, uint32_t color)
+{
+    switch (format)
+    {
+        case RENDERER_PIXEL_FORMAT_ARGB8888:
+            return color | 0xff000000;
+        case RENDERER_PIXEL_FORMAT_RGB565:
+            return ((color >> 8) & 0xf800) | ((color >> 5) & 0x07e0) | ((color >> 3) & 0x001f);
+        default:
+            return color;
+    }
+}
+
+// 0x00RRGGBB color of a pixel of format, the inverse of renderer_pack_pixel.
+// RGB565 channels get their high bits repeated into the low ones, so full
+// intensity stays full.
+static inline uint32_t
+renderer_unpack_pixel(RendererPixelFormat format, uint32_t pixel)
+{
+    if (format == RENDERER_PIXEL_FORMAT_RGB565)
+    {
+        return ((pixel & 0xf800) << 8) | ((pixel & 0xe000) << 3) |
+            ((pixel & 0x07e0) << 5) | ((pixel & 0x0600) >> 1) |
+            ((pixel & 0x001f) << 3) | ((pixel & 0x001c) >> 2);
+    }
+
+    return pixel & 0xffffff;
+}
+
+static inline void
+renderer_put_pixel(RendererTargetBuffer target, int32_t offset, uint32_t color)
+{
+    uint32_t pixel = renderer_pack_pixel(target.format, color);
+    if (target.format == RENDERER_PIXEL_FORMAT_RGB565)
+    {
+        *(uint16_t*)(target.pixels + offset) = (uint16_t)pixel;
+        return;
+    }
+
+    *(uint32_t*)(target.pixels + offset) = pixel;
+}
+
 // Index pixel at x, y coordinates within RendererTargetBuffer target
-#define IndexPixel(x, y, target) (x + y * target.width) * target.bytes_per_pixel
+#define IndexPixel(x, y, target) renderer_target_pixel_offset(target, x, y)
 
-// Put pixel at offset into target
-#define PutPixelByteOffset(target, offset, color) *(uint32_t *)(target.pixels + offset) = color
+// Put pixel at offset into target, packed into its format
+#define PutPixelByteOffset(target, offset, color) renderer_put_pixel(target, offset, color)
 
 // Put pixel at x,y into target
 #define PutPixelXY(target, x, y, color) PutPixelByteOffset(target, IndexPixel(x, y, target), color)
 
+typedef enum RendererSimdLevel {
+    RENDERER_SIMD_SCALAR = 0,
+    RENDERER_SIMD_SSE2 = 1,
+    RENDERER_SIMD_AVX2 = 2,
+} RendererSimdLevel;
+
+// Widest instruction set the rasterizer kernels can use on this CPU
+RendererSimdLevel
+renderer_simd_level_supported();
+
+// Select rasterizer and vertex transform kernels, clamped to what the CPU
+// supports. All levels produce bit identical output, the default is the
+// widest supported one.
+void
+renderer_set_simd_level(RendererSimdLevel level);
+
+RendererSimdLevel
+renderer_get_simd_level();
+
 RendererTargetBuffer 
-renderer_create_target_buffer(int32_t width, int32_t height, int32_t bytes_per_pixel, uint8_t* pixels);
+renderer_create_target_buffer(int32_t width, int32_t height, RendererPixelFormat format, uint8_t* pixels);
+
+// Tiled target, pixels must hold renderer_target_buffer_size bytes
+RendererTargetBuffer
+renderer_create_tiled_target_buffer(int32_t width, int32_t height, RendererPixelFormat format, uint8_t* pixels);
+
+// Bytes of pixel storage target addresses, including any padding
+int32_t
+renderer_target_buffer_size(RendererTargetBuffer target);
+
+// Copy source into destination, converting between layouts and pixel
+// formats, for example to present a tiled target on a linear window surface
+void
+renderer_resolve(RendererTargetBuffer source, RendererTargetBuffer destination);
+
+// Resolve only the pixels inside rect
+void
+renderer_resolve_rect(RendererTargetBuffer source, RendererTargetBuffer destination, RendererRect rect);
+
+// Allocate a depth buffer to attach to a RendererTargetBuffer of the same size
+RendererDepthBuffer*
+renderer_create_depth_buffer(int32_t width, int32_t height);
 
+void
+renderer_destroy_depth_buffer(RendererDepthBuffer* depth_buffer);
+
+void
+renderer_clear_depth(RendererDepthBuffer* depth_buffer, float depth);
+
+// Clear every block of depth_buffer overlapping rect
+void
+renderer_clear_depth_rect(RendererDepthBuffer* depth_buffer, RendererRect rect, float depth);
+
+void
+renderer_dirty_rects_clear(RendererDirtyRects* dirty);
+
+// Add rect, merged with every rectangle it overlaps or lines up next to
+void
+renderer_dirty_rects_add(RendererDirtyRects* dirty, RendererRect rect);
+
+// Add every rectangle of source to dirty
+void
+renderer_dirty_rects_add_all(RendererDirtyRects* dirty, const RendererDirtyRects* source);
+
+// Pixels covered by dirty
+int64_t
+renderer_dirty_rects_area(const RendererDirtyRects* dirty);
+
+// Convert count pixels from source_format to destination_format, the
+// buffers must not overlap
+void
+renderer_convert_pixels(uint8_t* destination, RendererPixelFormat destination_format, const uint8_t* source,
+                        RendererPixelFormat source_format, int32_t count);
+
+// Colors passed to fills and triangles are 0x00RRGGBB, packed into the
+// format of the target as they are written
 void
 renderer_fill(RendererTargetBuffer buffer, uint32_t color);
 
+// Fill the part of rect inside buffer
 void 
 renderer_fill_rect(RendererTargetBuffer buffer, RendererRect rect, uint32_t color);
 
+// Same as renderer_fill_rect with stores that bypass the caches, for pixels
+// that are not read again soon
+void
+renderer_fill_rect_streaming(RendererTargetBuffer buffer, RendererRect rect, uint32_t color);
+
 void 
 renderer_fill_triangle(RendererTargetBuffer buffer, RendererTriangle triangle);
 
+// Fill only the pixels of triangle that fall inside clip
+void
+renderer_fill_triangle_clipped(RendererTargetBuffer buffer, RendererTriangle triangle, RendererRect clip);
+
+// Triangles whose clipped bounds are at most this many pixels each way can
+// take the small triangle path
+#define RENDERER_SMALL_TRIANGLE_SIZE 8
+
+// Small triangles set up together by a RendererTriangleBatch
+#define RENDERER_TRIANGLE_BATCH_SIZE 8
+
+// Small triangles queued to be set up across SIMD lanes and rasterized
+// without the block classification of the general path. Start with a count
+// of 0.
+typedef struct RendererTriangleBatch {
+    int32_t count;
+    RendererTriangle triangles[RENDERER_TRIANGLE_BATCH_SIZE];
+    RendererRect bounds[RENDERER_TRIANGLE_BATCH_SIZE];
+} RendererTriangleBatch;
+
+// Same as renderer_fill_triangle_clipped, except that small triangles are
+// queued in batch and only drawn once it fills up or is flushed. Triangles
+// are still drawn in the order they come in, with identical output.
+void
+renderer_fill_triangle_batched(RendererTargetBuffer buffer, RendererTriangleBatch* batch, RendererTriangle triangle,
+                               RendererRect clip);
+
+// Draw and remove every triangle queued in batch
+void
+renderer_flush_triangle_batch(RendererTargetBuffer buffer, RendererTriangleBatch* batch);
+
 #endif // RENDERER_INCLUDED
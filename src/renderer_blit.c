@@ -0,0 +1,461 @@
+// renderer_blit.c
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "math.h"
+#include "profiler.h"
+#include "renderer.h"
+#include "renderer_blit.h"
+#include "renderer_span.h"
+
+#ifdef RENDERER_SPAN_X86
+#include <immintrin.h>
+#endif
+
+// Most pixels of a 16 bit target blended at once
+#define RENDERER_BLIT_PACKED_SPAN 64
+
+// Blend count source pixels over pixels, keeping the bits of each result in
+// mask. A uniform kernel reads the single color at source for every pixel.
+typedef void RendererBlendFunction(uint32_t* pixels, const uint32_t* source, int32_t count, uint32_t mask);
+
+typedef struct RendererBlendKernels {
+    RendererBlendFunction* blend;
+    RendererBlendFunction* blend_uniform;
+} RendererBlendKernels;
+
+// Every level rounds destination * (255 - alpha) / 255 the same way,
+// (x + 128 + ((x + 128) >> 8)) >> 8, which fits 16 bit lanes, and saturates
+// the sum so colors that are not validly premultiplied cannot wrap.
+static inline uint32_t
+renderer_blend_pixel(uint32_t destination, uint32_t source)
+{
+    uint32_t inverse_alpha = 255 - (source >> 24);
+    uint32_t result = 0;
+
+    for (int32_t shift = 0; shift < 32; shift += 8)
+    {
+        uint32_t scaled = ((destination >> shift) & 0xff) * inverse_alpha + 128;
+        scaled = (scaled + (scaled >> 8)) >> 8;
+
+        uint32_t channel = ((source >> shift) & 0xff) + scaled;
+        result |= Min(channel, 255u) << shift;
+    }
+
+    return result;
+}
+
+static inline void
+renderer_blend_generic_scalar(uint32_t* pixels, const uint32_t* source, int32_t count, uint32_t mask, int uniform)
+{
+    for (int32_t x = 0; x < count; ++x)
+    {
+        pixels[x] = renderer_blend_pixel(pixels[x], uniform ? source[0] : source[x]) & mask;
+    }
+}
+
+static void
+renderer_blend_scalar(uint32_t* pixels, const uint32_t* source, int32_t count, uint32_t mask)
+{
+    renderer_blend_generic_scalar(pixels, source, count, mask, 0);
+}
+
+static void
+renderer_blend_uniform_scalar(uint32_t* pixels, const uint32_t* source, int32_t count, uint32_t mask)
+{
+    renderer_blend_generic_scalar(pixels, source, count, mask, 1);
+}
+
+#ifdef RENDERER_SPAN_X86
+// Two pixels widened to 16 bit channels, blended as renderer_blend_pixel
+__attribute__((target("sse2")))
+static inline __m128i
+renderer_blend_scale_sse2(__m128i destination, __m128i source)
+{
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(source, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i inverse_alpha = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+    __m128i scaled = _mm_add_epi16(_mm_mullo_epi16(destination, inverse_alpha), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(scaled, _mm_srli_epi16(scaled, 8)), 8);
+}
+
+__attribute__((target("sse2"), always_inline))
+static inline void
+renderer_blend_generic_sse2(uint32_t* pixels, const uint32_t* source, int32_t count, uint32_t mask, int uniform)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i color = _mm_set1_epi32((int32_t)source[0]);
+    __m128i masks = _mm_set1_epi32((int32_t)mask);
+
+    int32_t x = 0;
+    for (; x + 4 <= count; x += 4)
+    {
+        __m128i source_pixels = uniform ? color : _mm_loadu_si128((const __m128i*)(source + x));
+        __m128i destination = _mm_loadu_si128((const __m128i*)(pixels + x));
+
+        __m128i low = renderer_blend_scale_sse2(_mm_unpacklo_epi8(destination, zero),
+                                                _mm_unpacklo_epi8(source_pixels, zero));
+        __m128i high = renderer_blend_scale_sse2(_mm_unpackhi_epi8(destination, zero),
+                                                 _mm_unpackhi_epi8(source_pixels, zero));
+
+        __m128i result = _mm_and_si128(_mm_adds_epu8(source_pixels, _mm_packus_epi16(low, high)), masks);
+        _mm_storeu_si128((__m128i*)(pixels + x), result);
+    }
+
+    renderer_blend_generic_scalar(pixels + x, uniform ? source : source + x, count - x, mask, uniform);
+}
+
+__attribute__((target("sse2")))
+static void
+renderer_blend_sse2(uint32_t* pixels, const uint32_t* source, int32_t count, uint32_t mask)
+{
+    renderer_blend_generic_sse2(pixels, source, count, mask, 0);
+}
+
+__attribute__((target("sse2")))
+static void
+renderer_blend_uniform_sse2(uint32_t* pixels, const uint32_t* source, int32_t count, uint32_t mask)
+{
+    renderer_blend_generic_sse2(pixels, source, count, mask, 1);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+renderer_blend_scale_avx2(__m256i destination, __m256i source)
+{
+    __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(source, _MM_SHUFFLE(3, 3, 3, 3)),
+                                           _MM_SHUFFLE(3, 3, 3, 3));
+    __m256i inverse_alpha = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+    __m256i scaled = _mm256_add_epi16(_mm256_mullo_epi16(destination, inverse_alpha), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(scaled, _mm256_srli_epi16(scaled, 8)), 8);
+}
+
+// Unpacking and packing both work within 128 bit halves, so the pixels come
+// back out in order
+__attribute__((target("avx2"), always_inline))
+static inline void
+renderer_blend_generic_avx2(uint32_t* pixels, const uint32_t* source, int32_t count, uint32_t mask, int uniform)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i color = _mm256_set1_epi32((int32_t)source[0]);
+    __m256i masks = _mm256_set1_epi32((int32_t)mask);
+
+    int32_t x = 0;
+    for (; x + 8 <= count; x += 8)
+    {
+        __m256i source_pixels = uniform ? color : _mm256_loadu_si256((const __m256i*)(source + x));
+        __m256i destination = _mm256_loadu_si256((const __m256i*)(pixels + x));
+
+        __m256i low = renderer_blend_scale_avx2(_mm256_unpacklo_epi8(destination, zero),
+                                                _mm256_unpacklo_epi8(source_pixels, zero));
+        __m256i high = renderer_blend_scale_avx2(_mm256_unpackhi_epi8(destination, zero),
+                                                 _mm256_unpackhi_epi8(source_pixels, zero));
+
+        __m256i result = _mm256_and_si256(_mm256_adds_epu8(source_pixels, _mm256_packus_epi16(low, high)), masks);
+        _mm256_storeu_si256((__m256i*)(pixels + x), result);
+    }
+
+    renderer_blend_generic_sse2(pixels + x, uniform ? source : source + x, count - x, mask, uniform);
+}
+
+__attribute__((target("avx2")))
+static void
+renderer_blend_avx2(uint32_t* pixels, const uint32_t* source, int32_t count, uint32_t mask)
+{
+    renderer_blend_generic_avx2(pixels, source, count, mask, 0);
+}
+
+__attribute__((target("avx2")))
+static void
+renderer_blend_uniform_avx2(uint32_t* pixels, const uint32_t* source, int32_t count, uint32_t mask)
+{
+    renderer_blend_generic_avx2(pixels, source, count, mask, 1);
+}
+#endif
+
+static RendererBlendKernels
+renderer_blend_kernels()
+{
+    RendererBlendKernels kernels = {
+        renderer_blend_scalar, renderer_blend_uniform_scalar
+    };
+
+#ifdef RENDERER_SPAN_X86
+    switch (renderer_get_simd_level())
+    {
+        case RENDERER_SIMD_AVX2:
+            kernels.blend = renderer_blend_avx2;
+            kernels.blend_uniform = renderer_blend_uniform_avx2;
+            break;
+        case RENDERER_SIMD_SSE2:
+            kernels.blend = renderer_blend_sse2;
+            kernels.blend_uniform = renderer_blend_uniform_sse2;
+            break;
+        default:
+            break;
+    }
+#endif
+
+    return kernels;
+}
+
+// Blend or copy count source pixels to x, y. Rows of tiled targets are only
+// contiguous within a block, so those spans are split at block edges. 16 bit
+// targets are blended at 32 bits, up to RENDERER_BLIT_PACKED_SPAN pixels at a
+// time, and packed back. XRGB8888 targets get the alpha of source cleared.
+static void
+renderer_blit_span(RendererTargetBuffer buffer, RendererBlendFunction* blend, int32_t x, int32_t y,
+                   const uint32_t* source, int32_t source_step, int32_t count)
+{
+    int32_t packed = buffer.format == RENDERER_PIXEL_FORMAT_RGB565;
+    uint32_t mask = buffer.format == RENDERER_PIXEL_FORMAT_XRGB8888 ? 0x00ffffff : 0xffffffff;
+
+    while (count > 0)
+    {
+        int32_t span_count = count;
+        if (buffer.layout == RENDERER_TARGET_TILED)
+        {
+            int32_t block_remaining = RENDERER_BLOCK_SIZE - (x & (RENDERER_BLOCK_SIZE - 1));
+            span_count = Min(span_count, block_remaining);
+        }
+
+        if (packed)
+        {
+            span_count = Min(span_count, RENDERER_BLIT_PACKED_SPAN);
+        }
+
+        uint8_t* pixels = buffer.pixels + IndexPixel(x, y, buffer);
+        if (packed && blend)
+        {
+            uint32_t colors[RENDERER_BLIT_PACKED_SPAN];
+            renderer_convert_pixels((uint8_t*)colors, RENDERER_PIXEL_FORMAT_ARGB8888, pixels, buffer.format,
+                                    span_count);
+            blend(colors, source, span_count, mask);
+            renderer_convert_pixels(pixels, buffer.format, (uint8_t*)colors, RENDERER_PIXEL_FORMAT_ARGB8888,
+                                    span_count);
+        }
+        else if (packed)
+        {
+            renderer_convert_pixels(pixels, buffer.format, (const uint8_t*)source, RENDERER_PIXEL_FORMAT_ARGB8888,
+                                    span_count);
+        }
+        else if (blend)
+        {
+            blend((uint32_t*)pixels, source, span_count, mask);
+        }
+        else if (mask != 0xffffffff)
+        {
+            uint32_t* pixels32 = (uint32_t*)pixels;
+            for (int32_t i = 0; i < span_count; ++i)
+            {
+                pixels32[i] = source[i] & mask;
+            }
+        }
+        else
+        {
+            memcpy(pixels, source, span_count * sizeof(uint32_t));
+        }
+
+        x += span_count;
+        source += span_count * source_step;
+        count -= span_count;
+    }
+}
+
+void
+renderer_blend_rect(RendererTargetBuffer buffer, RendererRect rect, uint32_t color)
+{
+    uint32_t alpha = color >> 24;
+    if (alpha == 255)
+    {
+        renderer_fill_rect(buffer, rect, color & 0x00ffffff);
+        return;
+    }
+
+    // Fully transparent and premultiplied, so it leaves the target as is
+    if (color == 0)
+    {
+        return;
+    }
+
+    RendererRect bounds = {
+        0, 0, buffer.width, buffer.height
+    };
+
+    rect = renderer_rect_intersect(rect, bounds);
+    if (rect.w == 0 || rect.h == 0)
+    {
+        return;
+    }
+
+    ProfilerBegin(blend_rect);
+    ProfilerCount(PROFILER_COUNTER_PIXELS_FILLED, rect.w * rect.h);
+
+    if (buffer.dirty)
+    {
+        renderer_dirty_rects_add(buffer.dirty, rect);
+    }
+
+    RendererBlendKernels kernels = renderer_blend_kernels();
+    int32_t max_y = rect.y + rect.h;
+
+    for (int32_t y = rect.y; y < max_y; ++y)
+    {
+        renderer_blit_span(buffer, kernels.blend_uniform, rect.x, y, &color, 0, rect.w);
+    }
+
+    ProfilerEnd(blend_rect);
+}
+
+static RendererSpriteRunKind
+renderer_sprite_run_kind(uint32_t pixel)
+{
+    uint32_t alpha = pixel >> 24;
+    if (alpha == 255)
+    {
+        return RENDERER_SPRITE_RUN_COPY;
+    }
+
+    // Premultiplied, so zero alpha with color would still add light
+    return pixel == 0 ? RENDERER_SPRITE_RUN_SKIP : RENDERER_SPRITE_RUN_BLEND;
+}
+
+// Encode pixels into runs, or only count the words needed when runs is 0
+static uint32_t
+renderer_sprite_encode(int32_t width, int32_t height, const uint32_t* pixels, uint32_t* row_offsets,
+                       uint32_t* runs)
+{
+    uint32_t word_count = 0;
+
+    for (int32_t y = 0; y < height; ++y)
+    {
+        const uint32_t* row = pixels + y * width;
+        if (runs)
+        {
+            row_offsets[y] = word_count;
+        }
+
+        int32_t x = 0;
+        while (x < width)
+        {
+            RendererSpriteRunKind kind = renderer_sprite_run_kind(row[x]);
+            int32_t length = 1;
+            while (x + length < width && length < RENDERER_SPRITE_RUN_LENGTH_MASK &&
+                   renderer_sprite_run_kind(row[x + length]) == kind)
+            {
+                ++length;
+            }
+
+            if (runs)
+            {
+                runs[word_count] = (uint32_t)kind << RENDERER_SPRITE_RUN_KIND_SHIFT | (uint32_t)length;
+                if (kind != RENDERER_SPRITE_RUN_SKIP)
+                {
+                    memcpy(runs + word_count + 1, row + x, length * sizeof(uint32_t));
+                }
+            }
+
+            word_count += 1 + (kind != RENDERER_SPRITE_RUN_SKIP ? length : 0);
+            x += length;
+        }
+    }
+
+    return word_count;
+}
+
+RendererSprite*
+renderer_sprite_create(int32_t width, int32_t height, const uint32_t* pixels)
+{
+    uint32_t word_count = renderer_sprite_encode(width, height, pixels, 0, 0);
+    uintptr_t sprite_size = sizeof(RendererSprite) + ((uintptr_t)height + word_count) * sizeof(uint32_t);
+
+    RendererSprite* sprite = malloc(sprite_size);
+    if (!sprite)
+    {
+        return 0;
+    }
+
+    sprite->width = width;
+    sprite->height = height;
+    sprite->row_offsets = (uint32_t*)(sprite + 1);
+    sprite->runs = sprite->row_offsets + height;
+    renderer_sprite_encode(width, height, pixels, sprite->row_offsets, sprite->runs);
+
+    sprite->visible_pixel_count = 0;
+    for (int32_t i = 0; i < width * height; ++i)
+    {
+        sprite->visible_pixel_count += pixels[i] != 0;
+    }
+
+    return sprite;
+}
+
+void
+renderer_sprite_destroy(RendererSprite* sprite)
+{
+    free(sprite);
+}
+
+void
+renderer_draw_sprite(RendererTargetBuffer buffer, const RendererSprite* sprite, int32_t x, int32_t y)
+{
+    RendererRect sprite_rect = {
+        x, y, sprite->width, sprite->height
+    };
+    RendererRect bounds = {
+        0, 0, buffer.width, buffer.height
+    };
+
+    RendererRect visible = renderer_rect_intersect(sprite_rect, bounds);
+    if (visible.w == 0 || visible.h == 0)
+    {
+        return;
+    }
+
+    ProfilerBegin(draw_sprite);
+
+    if (buffer.dirty)
+    {
+        renderer_dirty_rects_add(buffer.dirty, visible);
+    }
+
+    RendererBlendKernels kernels = renderer_blend_kernels();
+    int32_t visible_max_x = visible.x + visible.w;
+    int32_t visible_max_y = visible.y + visible.h;
+    int32_t written_pixel_count = 0;
+
+    for (int32_t row_y = visible.y; row_y < visible_max_y; ++row_y)
+    {
+        const uint32_t* run = sprite->runs + sprite->row_offsets[row_y - y];
+        int32_t run_x = x;
+
+        while (run_x < visible_max_x)
+        {
+            RendererSpriteRunKind kind = (RendererSpriteRunKind)(run[0] >> RENDERER_SPRITE_RUN_KIND_SHIFT);
+            int32_t length = (int32_t)(run[0] & RENDERER_SPRITE_RUN_LENGTH_MASK);
+            int32_t run_max_x = run_x + length;
+
+            if (kind != RENDERER_SPRITE_RUN_SKIP)
+            {
+                int32_t start = Max(run_x, visible.x);
+                int32_t end = Min(run_max_x, visible_max_x);
+
+                if (start < end)
+                {
+                    RendererBlendFunction* blend = kind == RENDERER_SPRITE_RUN_BLEND ? kernels.blend : 0;
+                    renderer_blit_span(buffer, blend, start, row_y, run + 1 + (start - run_x), 1, end - start);
+                    written_pixel_count += end - start;
+                }
+
+                run += length;
+            }
+
+            run += 1;
+            run_x = run_max_x;
+        }
+    }
+
+    ProfilerEnd(draw_sprite);
+    ProfilerCount(PROFILER_COUNTER_PIXELS_FILLED, written_pixel_count);
+}
@@ -0,0 +1,68 @@
+// renderer_blit.h
+
+#ifndef RENDERER_BLIT_INCLUDED
+#define RENDERER_BLIT_INCLUDED
+
+#include <stdint.h>
+
+#include "renderer.h"
+
+// Colors here are premultiplied ARGB, every channel already scaled by alpha,
+// blended as source + destination * (255 - source alpha) / 255
+
+static inline uint32_t
+renderer_premultiply(uint32_t color)
+{
+    uint32_t alpha = color >> 24;
+    uint32_t result = color & 0xff000000;
+    for (int32_t shift = 0; shift < 24; shift += 8)
+    {
+        uint32_t channel = ((color >> shift) & 0xff) * alpha + 127;
+        result |= (channel / 255) << shift;
+    }
+
+    return result;
+}
+
+typedef enum RendererSpriteRunKind {
+    // Fully transparent pixels, skipped without touching the target
+    RENDERER_SPRITE_RUN_SKIP = 0,
+    // Fully opaque pixels, copied over the target
+    RENDERER_SPRITE_RUN_COPY = 1,
+    // Translucent pixels, blended over the target
+    RENDERER_SPRITE_RUN_BLEND = 2,
+} RendererSpriteRunKind;
+
+// Kind and length of a run, in the word heading it
+#define RENDERER_SPRITE_RUN_KIND_SHIFT 24
+#define RENDERER_SPRITE_RUN_LENGTH_MASK 0xffffff
+
+// Run length encoded sprite. Each row is a list of runs covering its width,
+// every run a header word followed by its pixels unless it is skipped.
+typedef struct RendererSprite {
+    int32_t width;
+    int32_t height;
+    // Pixels that are neither transparent nor skipped
+    int32_t visible_pixel_count;
+    // Word offset of the first run of each row within runs
+    uint32_t* row_offsets;
+    uint32_t* runs;
+} RendererSprite;
+
+// Blend color over the part of rect inside buffer, opaque colors are filled
+void
+renderer_blend_rect(RendererTargetBuffer buffer, RendererRect rect, uint32_t color);
+
+// Encode width by height row major premultiplied pixels
+RendererSprite*
+renderer_sprite_create(int32_t width, int32_t height, const uint32_t* pixels);
+
+void
+renderer_sprite_destroy(RendererSprite* sprite);
+
+// Draw sprite with its top left corner at x, y, clipped to buffer. Costs
+// scale with the visible pixels, transparent runs are skipped whole.
+void
+renderer_draw_sprite(RendererTargetBuffer buffer, const RendererSprite* sprite, int32_t x, int32_t y);
+
+#endif // RENDERER_BLIT_INCLUDED
@@ -0,0 +1,404 @@
+// renderer_command.c
+
+#include "renderer_command.h"
+#include "profiler.h"
+#include "vertex_transform.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Bits of the merge sort key, layer first, then clears before draws, then
+// the field the sort mode orders by
+#define RENDERER_COMMAND_KEY_LAYER_SHIFT 56
+#define RENDERER_COMMAND_KEY_DRAW_SHIFT 55
+#define RENDERER_COMMAND_KEY_FIELD_SHIFT 23
+
+typedef struct RendererCommandEntry {
+    uint64_t key;
+    const RendererCommand* command;
+} RendererCommandEntry;
+
+RendererCommandBuffer*
+renderer_command_buffer_create(FrameArena* arena)
+{
+    RendererCommandBuffer* buffer = calloc(1, sizeof(RendererCommandBuffer));
+    buffer->arena = arena;
+    return buffer;
+}
+
+void
+renderer_command_buffer_destroy(RendererCommandBuffer* buffer)
+{
+    free(buffer->commands);
+    free(buffer);
+}
+
+void
+renderer_command_buffer_begin(RendererCommandBuffer* buffer, int32_t width, int32_t height)
+{
+    buffer->width = width;
+    buffer->height = height;
+    buffer->layer = 0;
+    buffer->count = 0;
+}
+
+void
+renderer_command_buffer_set_layer(RendererCommandBuffer* buffer, uint32_t layer)
+{
+    buffer->layer = Min(layer, 255);
+}
+
+// Interleave the bits of x and y, so tiles close on screen are close in order
+static uint32_t
+renderer_command_morton(uint32_t x, uint32_t y)
+{
+    uint32_t result = 0;
+    for (int32_t bit = 0; bit < 16; ++bit)
+    {
+        result |= ((x >> bit) & 1) << (2 * bit);
+        result |= ((y >> bit) & 1) << (2 * bit + 1);
+    }
+
+    return result;
+}
+
+static uint32_t
+renderer_command_tile(float x, float y)
+{
+    // Negated compares also send NaN to 0, past 16 bits of tiles is clamped
+    float max = (float)(0xffff * RENDERER_COMMAND_SORT_TILE_SIZE);
+    float clamped_x = !(x > 0.0f) ? 0.0f : fminf(x, max);
+    float clamped_y = !(y > 0.0f) ? 0.0f : fminf(y, max);
+    return renderer_command_morton((uint32_t)clamped_x / RENDERER_COMMAND_SORT_TILE_SIZE,
+                                   (uint32_t)clamped_y / RENDERER_COMMAND_SORT_TILE_SIZE);
+}
+
+static RendererCommand*
+renderer_command_push(RendererCommandBuffer* buffer, RendererCommandType type, uint32_t variant)
+{
+    if (buffer->count == buffer->capacity)
+    {
+        int32_t capacity = Max(buffer->capacity * 2, 256);
+        buffer->commands = realloc(buffer->commands, capacity * sizeof(RendererCommand));
+        buffer->capacity = capacity;
+    }
+
+    RendererCommand* command = buffer->commands + buffer->count++;
+    memset(command, 0, sizeof(RendererCommand));
+    command->type = type;
+    command->layer = buffer->layer;
+    command->variant = (uint32_t)type << 8 | variant;
+    return command;
+}
+
+// Depth and tile of the origin of a model transformed by transform, anything
+// behind the camera sorts first
+static void
+renderer_command_set_origin(RendererCommandBuffer* buffer, RendererCommand* command, Matrix4 transform)
+{
+    Vector4 clip = matrix4_multiply_vector3(transform, vector3_create(0.0f, 0.0f, 0.0f));
+    if (!(clip.w > 0.0f))
+    {
+        command->depth = 0.0f;
+        command->tile = 0;
+        return;
+    }
+
+    Vector3 screen = vertex_transform_clip_to_viewport(clip, (float)buffer->width, (float)buffer->height);
+    command->depth = screen.z;
+    command->tile = renderer_command_tile(screen.x, screen.y);
+}
+
+void
+renderer_command_clear(RendererCommandBuffer* buffer, uint32_t color, float depth)
+{
+    RendererCommandClear* clear = FrameArenaPushArray(buffer->arena, RendererCommandClear, 1);
+    clear->color = color;
+    clear->depth = depth;
+    clear->rects.count = 0;
+
+    RendererCommand* command = renderer_command_push(buffer, RENDERER_COMMAND_CLEAR, 0);
+    command->clear = clear;
+}
+
+void
+renderer_command_clear_rects(RendererCommandBuffer* buffer, uint32_t color, float depth,
+                             const RendererDirtyRects* rects)
+{
+    RendererCommandClear* clear = FrameArenaPushArray(buffer->arena, RendererCommandClear, 1);
+    clear->color = color;
+    clear->depth = depth;
+    clear->rects = *rects;
+
+    RendererCommand* command = renderer_command_push(buffer, RENDERER_COMMAND_CLEAR_RECTS, 0);
+    command->clear = clear;
+}
+
+void
+renderer_command_fill_rect(RendererCommandBuffer* buffer, RendererRect rect, uint32_t color)
+{
+    RendererCommandFillRect* fill_rect = FrameArenaPushArray(buffer->arena, RendererCommandFillRect, 1);
+    fill_rect->rect = rect;
+    fill_rect->color = color;
+
+    RendererCommand* command = renderer_command_push(buffer, RENDERER_COMMAND_FILL_RECT, 0);
+    command->tile = renderer_command_tile((float)rect.x, (float)rect.y);
+    command->fill_rect = fill_rect;
+}
+
+void
+renderer_command_fill_triangle(RendererCommandBuffer* buffer, RendererTriangle triangle, RendererRect scissor)
+{
+    RendererCommandFillTriangle* fill_triangle =
+        FrameArenaPushArray(buffer->arena, RendererCommandFillTriangle, 1);
+    fill_triangle->triangle = triangle;
+    fill_triangle->scissor = scissor;
+
+    int32_t min_x = Min3(triangle.p0.x, triangle.p1.x, triangle.p2.x);
+    int32_t min_y = Min3(triangle.p0.y, triangle.p1.y, triangle.p2.y);
+    min_x = Max(min_x, scissor.x);
+    min_y = Max(min_y, scissor.y);
+
+    float min_z = fminf(fminf(triangle.p0.z, triangle.p1.z), triangle.p2.z);
+
+    RendererCommand* command = renderer_command_push(buffer, RENDERER_COMMAND_FILL_TRIANGLE, 0);
+    command->depth = min_z;
+    command->tile = renderer_command_tile((float)min_x, (float)min_y);
+    command->fill_triangle = fill_triangle;
+}
+
+void
+renderer_command_draw_indexed(RendererCommandBuffer* buffer, Matrix4 transform, RendererDrawState state,
+                              RendererVertexBuffer vertices, RendererIndexBuffer indices)
+{
+    RendererCommandDraw* draw = FrameArenaPushArray(buffer->arena, RendererCommandDraw, 1);
+    draw->transform = transform;
+    draw->models = 0;
+    draw->instance_count = 1;
+    draw->state = state;
+    draw->vertices = vertices;
+    draw->indices = indices;
+
+    RendererCommand* command = renderer_command_push(buffer, RENDERER_COMMAND_DRAW_INDEXED, state.cull_mode);
+    renderer_command_set_origin(buffer, command, transform);
+    command->draw = draw;
+}
+
+void
+renderer_command_draw_indexed_instanced(RendererCommandBuffer* buffer, Matrix4 view_projection,
+                                        const Matrix4* models, int32_t instance_count, RendererDrawState state,
+                                        RendererVertexBuffer vertices, RendererIndexBuffer indices)
+{
+    if (instance_count <= 0)
+    {
+        return;
+    }
+
+    Matrix4* models_copy = FrameArenaPushArray(buffer->arena, Matrix4, instance_count);
+    memcpy(models_copy, models, instance_count * sizeof(Matrix4));
+
+    RendererCommandDraw* draw = FrameArenaPushArray(buffer->arena, RendererCommandDraw, 1);
+    draw->transform = view_projection;
+    draw->models = models_copy;
+    draw->instance_count = instance_count;
+    draw->state = state;
+    draw->vertices = vertices;
+    draw->indices = indices;
+
+    RendererCommand* command =
+        renderer_command_push(buffer, RENDERER_COMMAND_DRAW_INDEXED_INSTANCED, state.cull_mode);
+    command->draw = draw;
+
+    // The nearest instance decides where the whole draw sorts
+    RendererCommand nearest = *command;
+    renderer_command_set_origin(buffer, command, matrix4_multiply(models[0], view_projection));
+    for (int32_t i = 1; i < instance_count; ++i)
+    {
+        renderer_command_set_origin(buffer, &nearest, matrix4_multiply(models[i], view_projection));
+        if (nearest.depth < command->depth)
+        {
+            command->depth = nearest.depth;
+            command->tile = nearest.tile;
+        }
+    }
+}
+
+static uint64_t
+renderer_command_key(const RendererCommand* command, RendererCommandSort sort)
+{
+    uint64_t draw = command->type != RENDERER_COMMAND_CLEAR && command->type != RENDERER_COMMAND_CLEAR_RECTS;
+    uint64_t key = (uint64_t)command->layer << RENDERER_COMMAND_KEY_LAYER_SHIFT |
+                   draw << RENDERER_COMMAND_KEY_DRAW_SHIFT;
+
+    uint32_t field = 0;
+    switch (sort)
+    {
+        case RENDERER_COMMAND_SORT_NONE:
+            break;
+        case RENDERER_COMMAND_SORT_STATE:
+            field = command->variant;
+            break;
+        case RENDERER_COMMAND_SORT_DEPTH:
+        {
+            // The bits of positive floats order the same as their values
+            float depth = command->depth > 0.0f ? command->depth : 0.0f;
+            memcpy(&field, &depth, sizeof(field));
+            break;
+        }
+        case RENDERER_COMMAND_SORT_TILE:
+            field = command->tile;
+            break;
+    }
+
+    return key | (uint64_t)field << RENDERER_COMMAND_KEY_FIELD_SHIFT;
+}
+
+// Stable least significant digit radix sort on the keys, a byte at a time.
+// Bytes every key shares, like most of them without a sort, are skipped.
+static RendererCommandEntry*
+renderer_command_sort(RendererCommandEntry* entries, RendererCommandEntry* scratch, int32_t count)
+{
+    for (int32_t shift = 0; shift < 64; shift += 8)
+    {
+        int32_t offsets[256] = {0};
+        for (int32_t i = 0; i < count; ++i)
+        {
+            offsets[(entries[i].key >> shift) & 0xff]++;
+        }
+
+        if (offsets[(entries[0].key >> shift) & 0xff] == count)
+        {
+            continue;
+        }
+
+        int32_t offset = 0;
+        for (int32_t digit = 0; digit < 256; ++digit)
+        {
+            int32_t digit_count = offsets[digit];
+            offsets[digit] = offset;
+            offset += digit_count;
+        }
+
+        for (int32_t i = 0; i < count; ++i)
+        {
+            scratch[offsets[(entries[i].key >> shift) & 0xff]++] = entries[i];
+        }
+
+        RendererCommandEntry* swap = entries;
+        entries = scratch;
+        scratch = swap;
+    }
+
+    return entries;
+}
+
+RendererCommandList
+renderer_command_merge(RendererCommandBuffer* const* buffers, int32_t buffer_count, RendererCommandSort sort,
+                       FrameArena* arena)
+{
+    ProfilerBegin(merge_commands);
+
+    int32_t count = 0;
+    for (int32_t i = 0; i < buffer_count; ++i)
+    {
+        count += buffers[i]->count;
+    }
+
+    RendererCommandList list;
+    list.commands = FrameArenaPushArray(arena, const RendererCommand*, Max(count, 1));
+    list.count = count;
+
+    if (count > 0)
+    {
+        RendererCommandEntry* entries = FrameArenaPushArray(arena, RendererCommandEntry, count);
+        RendererCommandEntry* scratch = FrameArenaPushArray(arena, RendererCommandEntry, count);
+
+        int32_t index = 0;
+        for (int32_t i = 0; i < buffer_count; ++i)
+        {
+            for (int32_t j = 0; j < buffers[i]->count; ++j)
+            {
+                const RendererCommand* command = buffers[i]->commands + j;
+                entries[index].key = renderer_command_key(command, sort);
+                entries[index].command = command;
+                ++index;
+            }
+        }
+
+        entries = renderer_command_sort(entries, scratch, count);
+        for (int32_t i = 0; i < count; ++i)
+        {
+            list.commands[i] = entries[i].command;
+        }
+    }
+
+    ProfilerEnd(merge_commands);
+    return list;
+}
+
+void
+renderer_command_execute(RendererCommandList list, RendererTargetBuffer target, RendererVertexCache* cache)
+{
+    // Clearing back to the background is not something to present
+    RendererTargetBuffer clear_target = target;
+    clear_target.dirty = 0;
+
+    RendererRect bounds = {
+        0, 0, target.width, target.height
+    };
+
+    // Runs of triangles share a batch, anything else flushes it first
+    RendererTriangleBatch batch;
+    batch.count = 0;
+
+    for (int32_t i = 0; i < list.count; ++i)
+    {
+        const RendererCommand* command = list.commands[i];
+        if (command->type != RENDERER_COMMAND_FILL_TRIANGLE)
+        {
+            renderer_flush_triangle_batch(target, &batch);
+        }
+
+        switch (command->type)
+        {
+            case RENDERER_COMMAND_CLEAR:
+                renderer_fill(clear_target, command->clear->color);
+                if (target.depth)
+                {
+                    renderer_clear_depth(target.depth, command->clear->depth);
+                }
+                break;
+            case RENDERER_COMMAND_CLEAR_RECTS:
+                for (int32_t j = 0; j < command->clear->rects.count; ++j)
+                {
+                    RendererRect rect = renderer_rect_intersect(command->clear->rects.rects[j], bounds);
+                    renderer_fill_rect(clear_target, rect, command->clear->color);
+                }
+
+                if (target.depth)
+                {
+                    renderer_clear_depth(target.depth, command->clear->depth);
+                }
+                break;
+            case RENDERER_COMMAND_FILL_RECT:
+                renderer_fill_rect(target, renderer_rect_intersect(command->fill_rect->rect, bounds),
+                                   command->fill_rect->color);
+                break;
+            case RENDERER_COMMAND_FILL_TRIANGLE:
+                renderer_fill_triangle_batched(target, &batch, command->fill_triangle->triangle,
+                                               renderer_rect_intersect(command->fill_triangle->scissor, bounds));
+                break;
+            case RENDERER_COMMAND_DRAW_INDEXED:
+                renderer_draw_indexed(target, cache, command->draw->transform, command->draw->state,
+                                      command->draw->vertices, command->draw->indices);
+                break;
+            case RENDERER_COMMAND_DRAW_INDEXED_INSTANCED:
+                renderer_draw_indexed_instanced(target, cache, command->draw->transform, command->draw->models,
+                                                command->draw->instance_count, command->draw->state,
+                                                command->draw->vertices, command->draw->indices);
+                break;
+        }
+    }
+
+    renderer_flush_triangle_batch(target, &batch);
+}
@@ -0,0 +1,164 @@
+// renderer_command.h
+
+#ifndef RENDERER_COMMAND_INCLUDED
+#define RENDERER_COMMAND_INCLUDED
+
+#include <stdint.h>
+
+#include "frame_arena.h"
+#include "math.h"
+#include "renderer.h"
+#include "renderer_draw.h"
+
+// Size of the screen tiles RENDERER_COMMAND_SORT_TILE orders commands by,
+// the same as the tiles of the tile renderer
+#define RENDERER_COMMAND_SORT_TILE_SIZE 64
+
+typedef enum RendererCommandType {
+    RENDERER_COMMAND_CLEAR = 0,
+    RENDERER_COMMAND_CLEAR_RECTS = 1,
+    RENDERER_COMMAND_FILL_RECT = 2,
+    RENDERER_COMMAND_FILL_TRIANGLE = 3,
+    RENDERER_COMMAND_DRAW_INDEXED = 4,
+    RENDERER_COMMAND_DRAW_INDEXED_INSTANCED = 5,
+} RendererCommandType;
+
+// Order merged commands are executed in within a layer. Anything but
+// RENDERER_COMMAND_SORT_NONE only keeps the output the same for commands
+// that do not overlap or are depth tested at distinct depths.
+typedef enum RendererCommandSort {
+    // The order of the buffers, then the order commands were recorded in
+    RENDERER_COMMAND_SORT_NONE = 0,
+    // Grouped by command type and cull mode, which is what picks the
+    // rasterizer paths they run through
+    RENDERER_COMMAND_SORT_STATE = 1,
+    // Nearest first, so the depth test rejects more of what comes later
+    RENDERER_COMMAND_SORT_DEPTH = 2,
+    // By the screen tile each command starts in, in Morton order, so
+    // commands executed one after another touch the same pixels
+    RENDERER_COMMAND_SORT_TILE = 3,
+} RendererCommandSort;
+
+typedef struct RendererCommandClear {
+    uint32_t color;
+    float depth;
+    // Only for RENDERER_COMMAND_CLEAR_RECTS
+    RendererDirtyRects rects;
+} RendererCommandClear;
+
+typedef struct RendererCommandFillRect {
+    RendererRect rect;
+    uint32_t color;
+} RendererCommandFillRect;
+
+typedef struct RendererCommandFillTriangle {
+    RendererTriangle triangle;
+    RendererRect scissor;
+} RendererCommandFillTriangle;
+
+// transform is the view projection of instanced draws, which multiply it
+// with each of models
+typedef struct RendererCommandDraw {
+    Matrix4 transform;
+    const Matrix4* models;
+    int32_t instance_count;
+    RendererDrawState state;
+    RendererVertexBuffer vertices;
+    RendererIndexBuffer indices;
+} RendererCommandDraw;
+
+typedef struct RendererCommand {
+    RendererCommandType type;
+    uint32_t layer;
+
+    // What the sort modes order by, worked out when the command is recorded.
+    // Depth is the nearest screen z of triangles, and that of the origin of
+    // the nearest instance for draws. Tile is the Morton index of the tile
+    // holding the top left of triangles and rects, or the origin of draws.
+    uint32_t variant;
+    float depth;
+    uint32_t tile;
+
+    union {
+        const RendererCommandClear* clear;
+        const RendererCommandFillRect* fill_rect;
+        const RendererCommandFillTriangle* fill_triangle;
+        const RendererCommandDraw* draw;
+    };
+} RendererCommand;
+
+// Commands recorded by one thread. Threads each record into their own
+// buffer and arena, nothing is shared until the buffers are merged.
+typedef struct RendererCommandBuffer {
+    // Command data is pushed here and has to outlive the merged list
+    FrameArena* arena;
+    int32_t width;
+    int32_t height;
+    uint32_t layer;
+
+    RendererCommand* commands;
+    int32_t count;
+    int32_t capacity;
+} RendererCommandBuffer;
+
+// Commands of several buffers merged into the order they execute in
+typedef struct RendererCommandList {
+    const RendererCommand** commands;
+    int32_t count;
+} RendererCommandList;
+
+RendererCommandBuffer*
+renderer_command_buffer_create(FrameArena* arena);
+
+void
+renderer_command_buffer_destroy(RendererCommandBuffer* buffer);
+
+// Forget the commands recorded so far and start recording for a width by
+// height target, in layer 0
+void
+renderer_command_buffer_begin(RendererCommandBuffer* buffer, int32_t width, int32_t height);
+
+// Commands recorded from now on go to layer, 0 to 255. Merged commands run
+// one layer after another whatever the sort, so later layers draw on top.
+void
+renderer_command_buffer_set_layer(RendererCommandBuffer* buffer, uint32_t layer);
+
+// Clears run before everything else in their layer, clearing between two
+// draws takes a layer of its own
+void
+renderer_command_clear(RendererCommandBuffer* buffer, uint32_t color, float depth);
+
+// Clear the depth buffer, but the color only inside rects
+void
+renderer_command_clear_rects(RendererCommandBuffer* buffer, uint32_t color, float depth,
+                             const RendererDirtyRects* rects);
+
+void
+renderer_command_fill_rect(RendererCommandBuffer* buffer, RendererRect rect, uint32_t color);
+
+void
+renderer_command_fill_triangle(RendererCommandBuffer* buffer, RendererTriangle triangle, RendererRect scissor);
+
+// Vertices and indices are referenced, not copied, and have to stay valid
+// until the command is executed
+void
+renderer_command_draw_indexed(RendererCommandBuffer* buffer, Matrix4 transform, RendererDrawState state,
+                              RendererVertexBuffer vertices, RendererIndexBuffer indices);
+
+// Models are copied, vertices and indices referenced
+void
+renderer_command_draw_indexed_instanced(RendererCommandBuffer* buffer, Matrix4 view_projection,
+                                        const Matrix4* models, int32_t instance_count, RendererDrawState state,
+                                        RendererVertexBuffer vertices, RendererIndexBuffer indices);
+
+// Merge buffers once every thread recording into them is done, ordered by
+// layer and then by sort. The list is pushed from arena.
+RendererCommandList
+renderer_command_merge(RendererCommandBuffer* const* buffers, int32_t buffer_count, RendererCommandSort sort,
+                       FrameArena* arena);
+
+// Execute list straight into target, clears leave its dirty list alone
+void
+renderer_command_execute(RendererCommandList list, RendererTargetBuffer target, RendererVertexCache* cache);
+
+#endif // RENDERER_COMMAND_INCLUDED
@@ -0,0 +1,554 @@
+// renderer_draw.c
+
+#include "renderer_draw.h"
+#include "math_batch.h"
+#include "profiler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void
+renderer_vertex_cache_reserve(RendererVertexCache* cache, int32_t vertex_count)
+{
+    if (vertex_count <= cache->capacity)
+    {
+        return;
+    }
+
+    cache->draw_ids = realloc(cache->draw_ids, vertex_count * sizeof(uint32_t));
+    memset(cache->draw_ids + cache->capacity, 0, (vertex_count - cache->capacity) * sizeof(uint32_t));
+
+    if (!cache->frame_arena)
+    {
+        cache->unique_indices = realloc(cache->unique_indices, vertex_count * sizeof(uint32_t));
+
+        cache->screen_positions.x = realloc(cache->screen_positions.x, vertex_count * sizeof(int32_t));
+        cache->screen_positions.y = realloc(cache->screen_positions.y, vertex_count * sizeof(int32_t));
+        cache->screen_positions.z = realloc(cache->screen_positions.z, vertex_count * sizeof(float));
+        cache->screen_positions.clip_codes = realloc(cache->screen_positions.clip_codes, vertex_count * sizeof(uint8_t));
+
+        cache->gathered_positions.x = realloc(cache->gathered_positions.x, vertex_count * sizeof(float));
+        cache->gathered_positions.y = realloc(cache->gathered_positions.y, vertex_count * sizeof(float));
+        cache->gathered_positions.z = realloc(cache->gathered_positions.z, vertex_count * sizeof(float));
+
+        cache->gathered_screen_positions.x = realloc(cache->gathered_screen_positions.x, vertex_count * sizeof(int32_t));
+        cache->gathered_screen_positions.y = realloc(cache->gathered_screen_positions.y, vertex_count * sizeof(int32_t));
+        cache->gathered_screen_positions.z = realloc(cache->gathered_screen_positions.z, vertex_count * sizeof(float));
+        cache->gathered_screen_positions.clip_codes =
+            realloc(cache->gathered_screen_positions.clip_codes, vertex_count * sizeof(uint8_t));
+    }
+
+    cache->capacity = vertex_count;
+}
+
+RendererVertexCache*
+renderer_vertex_cache_create(int32_t vertex_capacity, FrameArena* frame_arena)
+{
+    RendererVertexCache* cache = calloc(1, sizeof(RendererVertexCache));
+    cache->frame_arena = frame_arena;
+    renderer_vertex_cache_reserve(cache, vertex_capacity);
+
+    return cache;
+}
+
+void
+renderer_vertex_cache_destroy(RendererVertexCache* cache)
+{
+    if (!cache->frame_arena)
+    {
+        free(cache->triangles);
+        free(cache->gathered_screen_positions.x);
+        free(cache->gathered_screen_positions.y);
+        free(cache->gathered_screen_positions.z);
+        free(cache->gathered_screen_positions.clip_codes);
+        free(cache->gathered_positions.x);
+        free(cache->gathered_positions.y);
+        free(cache->gathered_positions.z);
+        free(cache->screen_positions.x);
+        free(cache->screen_positions.y);
+        free(cache->screen_positions.z);
+        free(cache->screen_positions.clip_codes);
+        free(cache->unique_indices);
+    }
+
+    free(cache->draw_ids);
+    free(cache);
+}
+
+static inline void
+renderer_vertex_cache_mark(RendererVertexCache* cache, uint32_t index)
+{
+    if (cache->draw_ids[index] != cache->draw_id)
+    {
+        cache->draw_ids[index] = cache->draw_id;
+        cache->unique_indices[cache->unique_count++] = index;
+    }
+}
+
+void
+renderer_vertex_cache_prepare(RendererVertexCache* cache, RendererVertexBuffer vertices, RendererIndexBuffer indices)
+{
+    renderer_vertex_cache_reserve(cache, vertices.count);
+
+    FrameArena* frame_arena = cache->frame_arena;
+    if (frame_arena)
+    {
+        cache->unique_indices = FrameArenaPushArray(frame_arena, uint32_t, vertices.count);
+        cache->screen_positions = vertex_transform_push_screen_stream(frame_arena, vertices.count);
+
+        // Assembled triangles are pushed again by the first assemble
+        cache->triangles = 0;
+        cache->triangle_capacity = 0;
+    }
+
+    // Slots are tagged with the id of the draw that transformed them, so a
+    // new draw invalidates the whole cache without touching it.
+    if (++cache->draw_id == 0)
+    {
+        memset(cache->draw_ids, 0, cache->capacity * sizeof(uint32_t));
+        cache->draw_id = 1;
+    }
+
+    cache->unique_count = 0;
+
+    if (indices.index_size == 2)
+    {
+        const uint16_t* index = indices.indices;
+        for (int32_t i = 0; i < indices.count; ++i)
+        {
+            renderer_vertex_cache_mark(cache, index[i]);
+        }
+    }
+    else
+    {
+        const uint32_t* index = indices.indices;
+        for (int32_t i = 0; i < indices.count; ++i)
+        {
+            renderer_vertex_cache_mark(cache, index[i]);
+        }
+    }
+
+    // When most of the buffer is referenced it is cheaper to transform all
+    // of it in place than to gather and scatter the unique vertices.
+    int32_t unique_count = cache->unique_count;
+    if (unique_count * 2 >= vertices.count)
+    {
+        return;
+    }
+
+    if (frame_arena)
+    {
+        cache->gathered_positions = vertex_transform_push_stream(frame_arena, unique_count);
+        cache->gathered_screen_positions = vertex_transform_push_screen_stream(frame_arena, unique_count);
+    }
+
+    for (int32_t i = 0; i < unique_count; ++i)
+    {
+        uint32_t index = cache->unique_indices[i];
+        cache->gathered_positions.x[i] = vertices.positions.x[index];
+        cache->gathered_positions.y[i] = vertices.positions.y[index];
+        cache->gathered_positions.z[i] = vertices.positions.z[index];
+    }
+}
+
+void
+renderer_vertex_cache_project(RendererVertexCache* cache, Matrix4 transform, int32_t width, int32_t height,
+                              RendererVertexBuffer vertices)
+{
+    cache->transform = transform;
+    cache->viewport_width = width;
+    cache->viewport_height = height;
+
+    int32_t unique_count = cache->unique_count;
+    if (unique_count * 2 >= vertices.count)
+    {
+        vertex_transform_project(transform, width, height, vertices.positions, cache->screen_positions, vertices.count);
+        return;
+    }
+
+    vertex_transform_project(transform, width, height, cache->gathered_positions,
+                             cache->gathered_screen_positions, unique_count);
+
+    for (int32_t i = 0; i < unique_count; ++i)
+    {
+        uint32_t index = cache->unique_indices[i];
+        cache->screen_positions.x[index] = cache->gathered_screen_positions.x[i];
+        cache->screen_positions.y[index] = cache->gathered_screen_positions.y[i];
+        cache->screen_positions.z[index] = cache->gathered_screen_positions.z[i];
+        cache->screen_positions.clip_codes[index] = cache->gathered_screen_positions.clip_codes[i];
+    }
+}
+
+void
+renderer_vertex_cache_transform(RendererVertexCache* cache, Matrix4 transform, int32_t width, int32_t height,
+                                RendererVertexBuffer vertices, RendererIndexBuffer indices)
+{
+    renderer_vertex_cache_prepare(cache, vertices, indices);
+    renderer_vertex_cache_project(cache, transform, width, height, vertices);
+}
+
+RendererDrawState
+renderer_draw_state_create(RendererTargetBuffer buffer)
+{
+    RendererDrawState state = {
+        RENDERER_CULL_BACK,
+        {0, 0, buffer.width, buffer.height}
+    };
+
+    return state;
+}
+
+// Largest polygon clipping a triangle against the near and guard band planes
+// can produce, each plane adds at most one vertex
+#define RENDERER_DRAW_MAX_CLIP_VERTICES (3 + 5)
+
+typedef struct RendererClipVertex {
+    Vector4 position;
+    float r;
+    float g;
+    float b;
+} RendererClipVertex;
+
+static inline void
+renderer_vertex_cache_reserve_triangles(RendererVertexCache* cache, int32_t triangle_count)
+{
+    if (triangle_count > cache->triangle_capacity)
+    {
+        int32_t capacity = Max(triangle_count, cache->triangle_capacity * 2);
+        if (cache->frame_arena)
+        {
+            // Triangles are the last thing pushed, so this usually grows in
+            // place, and instances of one draw reuse the same array
+            cache->triangles = frame_arena_grow(cache->frame_arena, cache->triangles,
+                                                cache->triangle_capacity * sizeof(RendererTriangle),
+                                                capacity * sizeof(RendererTriangle), _Alignof(RendererTriangle));
+        }
+        else
+        {
+            cache->triangles = realloc(cache->triangles, capacity * sizeof(RendererTriangle));
+        }
+
+        cache->triangle_capacity = capacity;
+    }
+}
+
+// Cull and scissor a screen space triangle, flipping it to the winding the
+// rasterizer fills, and append it to the cache when it survives.
+static inline int32_t
+renderer_vertex_cache_emit(RendererVertexCache* cache, RendererDrawState state, RendererTriangle triangle,
+                           int32_t triangle_count)
+{
+    int32_t area2 = signed_area2(triangle.p0, triangle.p1, triangle.p2);
+    if (area2 == 0)
+    {
+        return triangle_count;
+    }
+
+    if (area2 < 0)
+    {
+        if (state.cull_mode == RENDERER_CULL_BACK)
+        {
+            return triangle_count;
+        }
+
+        RendererPoint point = triangle.p1;
+        triangle.p1 = triangle.p2;
+        triangle.p2 = point;
+
+        uint32_t color = triangle.c1;
+        triangle.c1 = triangle.c2;
+        triangle.c2 = color;
+    }
+    else if (state.cull_mode == RENDERER_CULL_FRONT)
+    {
+        return triangle_count;
+    }
+
+    // Bounds are exclusive on the max side, same as the rasterizer.
+    RendererRect scissor = state.scissor;
+    if (Max3(triangle.p0.x, triangle.p1.x, triangle.p2.x) <= scissor.x ||
+        Max3(triangle.p0.y, triangle.p1.y, triangle.p2.y) <= scissor.y ||
+        Min3(triangle.p0.x, triangle.p1.x, triangle.p2.x) >= scissor.x + scissor.w ||
+        Min3(triangle.p0.y, triangle.p1.y, triangle.p2.y) >= scissor.y + scissor.h)
+    {
+        return triangle_count;
+    }
+
+    renderer_vertex_cache_reserve_triangles(cache, triangle_count + 1);
+    cache->triangles[triangle_count] = triangle;
+
+    return triangle_count + 1;
+}
+
+static inline float
+renderer_clip_distance(Vector4 position, int32_t plane, float guard_band_x, float guard_band_y)
+{
+    switch (plane)
+    {
+        case 0: return position.z;
+        case 1: return position.x + guard_band_x * position.w;
+        case 2: return guard_band_x * position.w - position.x;
+        case 3: return position.y + guard_band_y * position.w;
+        default: return guard_band_y * position.w - position.y;
+    }
+}
+
+// Clip against one plane, keeping the part of the polygon with a positive
+// distance. Returns the new vertex count.
+static int32_t
+renderer_clip_polygon(RendererClipVertex* input, int32_t input_count, RendererClipVertex* output,
+                      int32_t plane, float guard_band_x, float guard_band_y)
+{
+    int32_t output_count = 0;
+
+    for (int32_t i = 0; i < input_count; ++i)
+    {
+        RendererClipVertex a = input[i];
+        RendererClipVertex b = input[(i + 1) % input_count];
+
+        float distance_a = renderer_clip_distance(a.position, plane, guard_band_x, guard_band_y);
+        float distance_b = renderer_clip_distance(b.position, plane, guard_band_x, guard_band_y);
+
+        if (distance_a >= 0.0f)
+        {
+            output[output_count++] = a;
+        }
+
+        if ((distance_a >= 0.0f) != (distance_b >= 0.0f))
+        {
+            float t = distance_a / (distance_a - distance_b);
+
+            RendererClipVertex clipped;
+            clipped.position.x = a.position.x + (b.position.x - a.position.x) * t;
+            clipped.position.y = a.position.y + (b.position.y - a.position.y) * t;
+            clipped.position.z = a.position.z + (b.position.z - a.position.z) * t;
+            clipped.position.w = a.position.w + (b.position.w - a.position.w) * t;
+            clipped.r = a.r + (b.r - a.r) * t;
+            clipped.g = a.g + (b.g - a.g) * t;
+            clipped.b = a.b + (b.b - a.b) * t;
+
+            output[output_count++] = clipped;
+        }
+    }
+
+    return output_count;
+}
+
+static inline RendererClipVertex
+renderer_clip_vertex_create(RendererVertexCache* cache, RendererVertexBuffer vertices, uint32_t index, uint32_t color)
+{
+    Vector3 position = {
+        vertices.positions.x[index], vertices.positions.y[index], vertices.positions.z[index]
+    };
+
+    uint8_t r, g, b;
+    UnpackColorRGB(color, r, g, b);
+
+    RendererClipVertex result;
+    result.position = matrix4_multiply_vector3(cache->transform, position);
+    result.r = r;
+    result.g = g;
+    result.b = b;
+
+    return result;
+}
+
+// Clip a triangle crossing the near plane or the guard band in clip space
+// and emit the resulting triangle fan. Clipping is rare, so it can be slow.
+static int32_t
+renderer_vertex_cache_clip_triangle(RendererVertexCache* cache, RendererDrawState state,
+                                    RendererVertexBuffer vertices, RendererTriangle triangle,
+                                    uint32_t i0, uint32_t i1, uint32_t i2, int32_t triangle_count)
+{
+    RendererClipVertex polygon[2][RENDERER_DRAW_MAX_CLIP_VERTICES];
+    polygon[0][0] = renderer_clip_vertex_create(cache, vertices, i0, triangle.c0);
+    polygon[0][1] = renderer_clip_vertex_create(cache, vertices, i1, triangle.c1);
+    polygon[0][2] = renderer_clip_vertex_create(cache, vertices, i2, triangle.c2);
+
+    float guard_band_x = vertex_transform_guard_band(cache->viewport_width);
+    float guard_band_y = vertex_transform_guard_band(cache->viewport_height);
+
+    int32_t vertex_count = 3;
+    int32_t current = 0;
+    for (int32_t plane = 0; plane < 5 && vertex_count >= 3; ++plane)
+    {
+        vertex_count = renderer_clip_polygon(polygon[current], vertex_count, polygon[current ^ 1],
+                                             plane, guard_band_x, guard_band_y);
+        current ^= 1;
+    }
+
+    if (vertex_count < 3)
+    {
+        return triangle_count;
+    }
+
+    // Vertices that survive unclipped go through the exact same math as in
+    // vertex_transform_project, so shared edges stay watertight.
+    RendererPoint points[RENDERER_DRAW_MAX_CLIP_VERTICES];
+    uint32_t colors[RENDERER_DRAW_MAX_CLIP_VERTICES];
+    for (int32_t i = 0; i < vertex_count; ++i)
+    {
+        RendererClipVertex vertex = polygon[current][i];
+        Vector3 screen = vertex_transform_clip_to_viewport(vertex.position, (float)cache->viewport_width,
+                                                           (float)cache->viewport_height);
+
+        points[i] = renderer_point_create((int32_t)screen.x, (int32_t)screen.y, screen.z);
+        colors[i] = PackColorRGB((int32_t)(vertex.r + 0.5f), (int32_t)(vertex.g + 0.5f), (int32_t)(vertex.b + 0.5f));
+    }
+
+    for (int32_t i = 1; i + 1 < vertex_count; ++i)
+    {
+        RendererTriangle fan = {
+            points[0], points[i], points[i + 1],
+            colors[0], colors[i], colors[i + 1]
+        };
+
+        triangle_count = renderer_vertex_cache_emit(cache, state, fan, triangle_count);
+    }
+
+    return triangle_count;
+}
+
+int32_t
+renderer_vertex_cache_assemble(RendererVertexCache* cache, RendererDrawState state,
+                               RendererVertexBuffer vertices, RendererIndexBuffer indices)
+{
+    int32_t index_triangle_count = indices.count / 3;
+    renderer_vertex_cache_reserve_triangles(cache, index_triangle_count);
+
+    VertexScreenStream screen = cache->screen_positions;
+
+    ProfilerBegin(assemble_triangles);
+
+    int32_t triangle_count = 0;
+    int32_t culled_count = 0;
+    int32_t clipped_count = 0;
+    for (int32_t i = 0; i < index_triangle_count; ++i)
+    {
+        uint32_t i0, i1, i2;
+        if (indices.index_size == 2)
+        {
+            const uint16_t* index = (const uint16_t*)indices.indices + i * 3;
+            i0 = index[0]; i1 = index[1]; i2 = index[2];
+        }
+        else
+        {
+            const uint32_t* index = (const uint32_t*)indices.indices + i * 3;
+            i0 = index[0]; i1 = index[1]; i2 = index[2];
+        }
+
+        // All three vertices outside the same plane, nothing can be visible.
+        uint8_t clip_code0 = screen.clip_codes[i0];
+        uint8_t clip_code1 = screen.clip_codes[i1];
+        uint8_t clip_code2 = screen.clip_codes[i2];
+        if (clip_code0 & clip_code1 & clip_code2 & VERTEX_CLIP_FRUSTUM)
+        {
+            ++culled_count;
+            continue;
+        }
+
+        RendererTriangle triangle;
+        if (vertices.colors)
+        {
+            triangle.c0 = vertices.colors[i0];
+            triangle.c1 = vertices.colors[i1];
+            triangle.c2 = vertices.colors[i2];
+        }
+        else
+        {
+            triangle.c0 = PackColorRGB(255, 255, 255);
+            triangle.c1 = PackColorRGB(255, 255, 255);
+            triangle.c2 = PackColorRGB(255, 255, 255);
+        }
+
+        // Everything else is inside the guard band, the rasterizer clips its
+        // bounding box so no real clipping is needed.
+        if ((clip_code0 | clip_code1 | clip_code2) & (VERTEX_CLIP_NEAR | VERTEX_CLIP_GUARD_BAND))
+        {
+            int32_t clipped_triangle_count = renderer_vertex_cache_clip_triangle(cache, state, vertices, triangle,
+                                                                                 i0, i1, i2, triangle_count);
+            culled_count += clipped_triangle_count == triangle_count;
+            triangle_count = clipped_triangle_count;
+            ++clipped_count;
+            continue;
+        }
+
+        triangle.p0 = renderer_point_create(screen.x[i0], screen.y[i0], screen.z[i0]);
+        triangle.p1 = renderer_point_create(screen.x[i1], screen.y[i1], screen.z[i1]);
+        triangle.p2 = renderer_point_create(screen.x[i2], screen.y[i2], screen.z[i2]);
+
+        int32_t emitted_triangle_count = renderer_vertex_cache_emit(cache, state, triangle, triangle_count);
+        culled_count += emitted_triangle_count == triangle_count;
+        triangle_count = emitted_triangle_count;
+    }
+
+    ProfilerEnd(assemble_triangles);
+    ProfilerCount(PROFILER_COUNTER_TRIANGLES_SUBMITTED, index_triangle_count);
+    ProfilerCount(PROFILER_COUNTER_TRIANGLES_CULLED, culled_count);
+    ProfilerCount(PROFILER_COUNTER_TRIANGLES_CLIPPED, clipped_count);
+
+    return triangle_count;
+}
+
+void
+renderer_draw_indexed(RendererTargetBuffer buffer, RendererVertexCache* cache, Matrix4 transform,
+                      RendererDrawState state, RendererVertexBuffer vertices, RendererIndexBuffer indices)
+{
+    renderer_vertex_cache_transform(cache, transform, buffer.width, buffer.height, vertices, indices);
+
+    RendererRect target = {
+        0, 0, buffer.width, buffer.height
+    };
+
+    state.scissor = renderer_rect_intersect(state.scissor, target);
+
+    // Dense meshes are mostly small triangles, which are set up in batches
+    RendererTriangleBatch batch;
+    batch.count = 0;
+
+    int32_t triangle_count = renderer_vertex_cache_assemble(cache, state, vertices, indices);
+    for (int32_t i = 0; i < triangle_count; ++i)
+    {
+        renderer_fill_triangle_batched(buffer, &batch, cache->triangles[i], state.scissor);
+    }
+
+    renderer_flush_triangle_batch(buffer, &batch);
+}
+
+void
+renderer_draw_indexed_instanced(RendererTargetBuffer buffer, RendererVertexCache* cache, Matrix4 view_projection,
+                                const Matrix4* models, int32_t instance_count, RendererDrawState state,
+                                RendererVertexBuffer vertices, RendererIndexBuffer indices)
+{
+    renderer_vertex_cache_prepare(cache, vertices, indices);
+
+    RendererRect target = {
+        0, 0, buffer.width, buffer.height
+    };
+
+    state.scissor = renderer_rect_intersect(state.scissor, target);
+
+    RendererTriangleBatch batch;
+    batch.count = 0;
+
+    Matrix4 transforms[RENDERER_DRAW_INSTANCE_BATCH];
+    for (int32_t first = 0; first < instance_count; first += RENDERER_DRAW_INSTANCE_BATCH)
+    {
+        int32_t remaining = instance_count - first;
+        int32_t batch_count = Min(remaining, RENDERER_DRAW_INSTANCE_BATCH);
+        matrix4_multiply_batch(models + first, view_projection, transforms, batch_count);
+
+        for (int32_t i = 0; i < batch_count; ++i)
+        {
+            renderer_vertex_cache_project(cache, transforms[i], buffer.width, buffer.height, vertices);
+
+            int32_t triangle_count = renderer_vertex_cache_assemble(cache, state, vertices, indices);
+            for (int32_t j = 0; j < triangle_count; ++j)
+            {
+                renderer_fill_triangle_batched(buffer, &batch, cache->triangles[j], state.scissor);
+            }
+        }
+    }
+
+    renderer_flush_triangle_batch(buffer, &batch);
+}
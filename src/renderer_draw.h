@@ -0,0 +1,122 @@
+// renderer_draw.h
+
+#ifndef RENDERER_DRAW_INCLUDED
+#define RENDERER_DRAW_INCLUDED
+
+#include <stdint.h>
+
+#include "frame_arena.h"
+#include "math.h"
+#include "renderer.h"
+#include "vertex_transform.h"
+
+typedef struct RendererVertexBuffer {
+    VertexStream positions;
+    // Optional packed RGB color per vertex, white when not set
+    uint32_t* colors;
+    int32_t count;
+} RendererVertexBuffer;
+
+typedef struct RendererIndexBuffer {
+    const void* indices;
+    // Size in bytes of each index, either 2 or 4
+    int32_t index_size;
+    int32_t count;
+} RendererIndexBuffer;
+
+typedef enum RendererCullMode {
+    // Drop triangles wound opposite to what the rasterizer fills
+    RENDERER_CULL_BACK = 0,
+    // Drop triangles wound the way the rasterizer fills
+    RENDERER_CULL_FRONT = 1,
+    // Draw both windings
+    RENDERER_CULL_NONE = 2,
+} RendererCullMode;
+
+typedef struct RendererDrawState {
+    RendererCullMode cull_mode;
+    // Nothing outside this rectangle of the target is drawn
+    RendererRect scissor;
+} RendererDrawState;
+
+// Back face culling with a scissor covering the whole of buffer
+RendererDrawState
+renderer_draw_state_create(RendererTargetBuffer buffer);
+
+// Post-transform vertex cache, holds the screen position of every vertex
+// referenced by the current draw so shared vertices are transformed once
+typedef struct RendererVertexCache {
+    // Per draw arrays are pushed here instead of kept on the heap when set,
+    // they stay valid until the arena is reset
+    FrameArena* frame_arena;
+
+    int32_t capacity;
+    uint32_t draw_id;
+    uint32_t* draw_ids;
+    VertexScreenStream screen_positions;
+
+    // Kept to clip triangles crossing the near plane or the guard band
+    Matrix4 transform;
+    int32_t viewport_width;
+    int32_t viewport_height;
+
+    int32_t unique_count;
+    uint32_t* unique_indices;
+    VertexStream gathered_positions;
+    VertexScreenStream gathered_screen_positions;
+
+    int32_t triangle_capacity;
+    RendererTriangle* triangles;
+} RendererVertexCache;
+
+// A frame_arena of 0 keeps the per draw arrays on the heap, grown as needed
+RendererVertexCache*
+renderer_vertex_cache_create(int32_t vertex_capacity, FrameArena* frame_arena);
+
+void
+renderer_vertex_cache_destroy(RendererVertexCache* cache);
+
+// Transform each unique vertex referenced by indices into cache, mapped to a
+// width by height viewport. Same as a prepare followed by a project.
+void
+renderer_vertex_cache_transform(RendererVertexCache* cache, Matrix4 transform, int32_t width, int32_t height,
+                                RendererVertexBuffer vertices, RendererIndexBuffer indices);
+
+// Find the unique vertices referenced by indices and gather their positions,
+// the part of a transform that does not depend on the transform matrix
+void
+renderer_vertex_cache_prepare(RendererVertexCache* cache, RendererVertexBuffer vertices, RendererIndexBuffer indices);
+
+// Project the vertices found by the last prepare, which can be done any
+// number of times with different transforms
+void
+renderer_vertex_cache_project(RendererVertexCache* cache, Matrix4 transform, int32_t width, int32_t height,
+                              RendererVertexBuffer vertices);
+
+// Assemble the triangles of indices from a transformed cache into
+// cache->triangles, returns the number of triangles. Triangles that are
+// culled, off screen or outside the scissor are dropped, triangles crossing
+// the near plane or the guard band are clipped. Every triangle left is wound
+// the way the rasterizer fills.
+int32_t
+renderer_vertex_cache_assemble(RendererVertexCache* cache, RendererDrawState state,
+                               RendererVertexBuffer vertices, RendererIndexBuffer indices);
+
+// Draw an indexed triangle list, every three indices form one triangle
+void
+renderer_draw_indexed(RendererTargetBuffer buffer, RendererVertexCache* cache, Matrix4 transform,
+                      RendererDrawState state, RendererVertexBuffer vertices, RendererIndexBuffer indices);
+
+// Model matrices multiplied with the view projection at once by
+// renderer_draw_indexed_instanced
+#define RENDERER_DRAW_INSTANCE_BATCH 64
+
+// Draw the same indexed triangle list once per model matrix, each instance
+// transformed by models[i] times view_projection. Referenced vertices are
+// found and gathered once for all instances.
+void
+renderer_draw_indexed_instanced(RendererTargetBuffer buffer, RendererVertexCache* cache, Matrix4 view_projection,
+                                const Matrix4* models, int32_t instance_count, RendererDrawState state,
+                                RendererVertexBuffer vertices, RendererIndexBuffer indices);
+
+#endif // RENDERER_DRAW_INCLUDED
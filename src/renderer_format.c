@@ -0,0 +1,265 @@
+// renderer_format.c
+
+#include <stdint.h>
+#include <string.h>
+
+#include "renderer.h"
+#include "renderer_span.h"
+
+#ifdef RENDERER_SPAN_X86
+#include <immintrin.h>
+#endif
+
+// Convert count pixels from source to destination. alpha is ORed into every
+// 32 bit pixel written, 0xff000000 for ARGB8888 and 0 for XRGB8888.
+typedef void RendererConvertFunction(uint8_t* destination, const uint8_t* source, int32_t count, uint32_t alpha);
+
+typedef struct RendererConvertKernels {
+    // 32 bit to 32 bit, only the top byte changes
+    RendererConvertFunction* copy_rgb;
+    RendererConvertFunction* pack_rgb565;
+    RendererConvertFunction* unpack_rgb565;
+} RendererConvertKernels;
+
+static void
+renderer_copy_rgb_scalar(uint8_t* destination, const uint8_t* source, int32_t count, uint32_t alpha)
+{
+    uint32_t* destination32 = (uint32_t*)destination;
+    const uint32_t* source32 = (const uint32_t*)source;
+    for (int32_t x = 0; x < count; ++x)
+    {
+        destination32[x] = (source32[x] & 0xffffff) | alpha;
+    }
+}
+
+static void
+renderer_pack_rgb565_scalar(uint8_t* destination, const uint8_t* source, int32_t count, uint32_t alpha)
+{
+    uint16_t* destination16 = (uint16_t*)destination;
+    const uint32_t* source32 = (const uint32_t*)source;
+    for (int32_t x = 0; x < count; ++x)
+    {
+        destination16[x] = (uint16_t)renderer_pack_pixel(RENDERER_PIXEL_FORMAT_RGB565, source32[x]);
+    }
+}
+
+static void
+renderer_unpack_rgb565_scalar(uint8_t* destination, const uint8_t* source, int32_t count, uint32_t alpha)
+{
+    uint32_t* destination32 = (uint32_t*)destination;
+    const uint16_t* source16 = (const uint16_t*)source;
+    for (int32_t x = 0; x < count; ++x)
+    {
+        destination32[x] = renderer_unpack_pixel(RENDERER_PIXEL_FORMAT_RGB565, source16[x]) | alpha;
+    }
+}
+
+#ifdef RENDERER_SPAN_X86
+__attribute__((target("sse2")))
+static void
+renderer_copy_rgb_sse2(uint8_t* destination, const uint8_t* source, int32_t count, uint32_t alpha)
+{
+    __m128i rgb_mask = _mm_set1_epi32(0xffffff);
+    __m128i alphas = _mm_set1_epi32((int32_t)alpha);
+
+    int32_t x = 0;
+    for (; x + 4 <= count; x += 4)
+    {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(source + x * 4));
+        _mm_storeu_si128((__m128i*)(destination + x * 4), _mm_or_si128(_mm_and_si128(pixels, rgb_mask), alphas));
+    }
+
+    renderer_copy_rgb_scalar(destination + x * 4, source + x * 4, count - x, alpha);
+}
+
+// Channels of 4 pixels shifted into 565, sign extended from 16 bits so a
+// saturating pack keeps them as they are
+__attribute__((target("sse2")))
+static inline __m128i
+renderer_pack_rgb565_lanes_sse2(__m128i pixels)
+{
+    __m128i r = _mm_and_si128(_mm_srli_epi32(pixels, 8), _mm_set1_epi32(0xf800));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(pixels, 5), _mm_set1_epi32(0x07e0));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(pixels, 3), _mm_set1_epi32(0x001f));
+    __m128i packed = _mm_or_si128(_mm_or_si128(r, g), b);
+
+    return _mm_srai_epi32(_mm_slli_epi32(packed, 16), 16);
+}
+
+__attribute__((target("sse2")))
+static void
+renderer_pack_rgb565_sse2(uint8_t* destination, const uint8_t* source, int32_t count, uint32_t alpha)
+{
+    int32_t x = 0;
+    for (; x + 8 <= count; x += 8)
+    {
+        __m128i low = renderer_pack_rgb565_lanes_sse2(_mm_loadu_si128((const __m128i*)(source + x * 4)));
+        __m128i high = renderer_pack_rgb565_lanes_sse2(_mm_loadu_si128((const __m128i*)(source + x * 4 + 16)));
+        _mm_storeu_si128((__m128i*)(destination + x * 2), _mm_packs_epi32(low, high));
+    }
+
+    renderer_pack_rgb565_scalar(destination + x * 2, source + x * 4, count - x, alpha);
+}
+
+// Same expansion as renderer_unpack_pixel, on 4 pixels zero extended to
+// 32 bits
+__attribute__((target("sse2")))
+static inline __m128i
+renderer_unpack_rgb565_lanes_sse2(__m128i pixels, __m128i alphas)
+{
+    __m128i r = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(pixels, _mm_set1_epi32(0xf800)), 8),
+                             _mm_slli_epi32(_mm_and_si128(pixels, _mm_set1_epi32(0xe000)), 3));
+    __m128i g = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(pixels, _mm_set1_epi32(0x07e0)), 5),
+                             _mm_srli_epi32(_mm_and_si128(pixels, _mm_set1_epi32(0x0600)), 1));
+    __m128i b = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(pixels, _mm_set1_epi32(0x001f)), 3),
+                             _mm_srli_epi32(_mm_and_si128(pixels, _mm_set1_epi32(0x001c)), 2));
+
+    return _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, alphas));
+}
+
+__attribute__((target("sse2")))
+static void
+renderer_unpack_rgb565_sse2(uint8_t* destination, const uint8_t* source, int32_t count, uint32_t alpha)
+{
+    __m128i alphas = _mm_set1_epi32((int32_t)alpha);
+    __m128i zero = _mm_setzero_si128();
+
+    int32_t x = 0;
+    for (; x + 8 <= count; x += 8)
+    {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(source + x * 2));
+        __m128i low = renderer_unpack_rgb565_lanes_sse2(_mm_unpacklo_epi16(pixels, zero), alphas);
+        __m128i high = renderer_unpack_rgb565_lanes_sse2(_mm_unpackhi_epi16(pixels, zero), alphas);
+        _mm_storeu_si128((__m128i*)(destination + x * 4), low);
+        _mm_storeu_si128((__m128i*)(destination + x * 4 + 16), high);
+    }
+
+    renderer_unpack_rgb565_scalar(destination + x * 4, source + x * 2, count - x, alpha);
+}
+
+__attribute__((target("avx2")))
+static void
+renderer_copy_rgb_avx2(uint8_t* destination, const uint8_t* source, int32_t count, uint32_t alpha)
+{
+    __m256i rgb_mask = _mm256_set1_epi32(0xffffff);
+    __m256i alphas = _mm256_set1_epi32((int32_t)alpha);
+
+    int32_t x = 0;
+    for (; x + 8 <= count; x += 8)
+    {
+        __m256i pixels = _mm256_loadu_si256((const __m256i*)(source + x * 4));
+        _mm256_storeu_si256((__m256i*)(destination + x * 4),
+                            _mm256_or_si256(_mm256_and_si256(pixels, rgb_mask), alphas));
+    }
+
+    renderer_copy_rgb_scalar(destination + x * 4, source + x * 4, count - x, alpha);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+renderer_pack_rgb565_lanes_avx2(__m256i pixels)
+{
+    __m256i r = _mm256_and_si256(_mm256_srli_epi32(pixels, 8), _mm256_set1_epi32(0xf800));
+    __m256i g = _mm256_and_si256(_mm256_srli_epi32(pixels, 5), _mm256_set1_epi32(0x07e0));
+    __m256i b = _mm256_and_si256(_mm256_srli_epi32(pixels, 3), _mm256_set1_epi32(0x001f));
+
+    return _mm256_or_si256(_mm256_or_si256(r, g), b);
+}
+
+__attribute__((target("avx2")))
+static void
+renderer_pack_rgb565_avx2(uint8_t* destination, const uint8_t* source, int32_t count, uint32_t alpha)
+{
+    int32_t x = 0;
+    for (; x + 16 <= count; x += 16)
+    {
+        __m256i low = renderer_pack_rgb565_lanes_avx2(_mm256_loadu_si256((const __m256i*)(source + x * 4)));
+        __m256i high = renderer_pack_rgb565_lanes_avx2(_mm256_loadu_si256((const __m256i*)(source + x * 4 + 32)));
+
+        // The pack works within 128 bit halves, interleaving the two inputs
+        __m256i packed = _mm256_packus_epi32(low, high);
+        _mm256_storeu_si256((__m256i*)(destination + x * 2), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+
+    renderer_pack_rgb565_sse2(destination + x * 2, source + x * 4, count - x, alpha);
+}
+
+__attribute__((target("avx2")))
+static void
+renderer_unpack_rgb565_avx2(uint8_t* destination, const uint8_t* source, int32_t count, uint32_t alpha)
+{
+    __m256i alphas = _mm256_set1_epi32((int32_t)alpha);
+
+    int32_t x = 0;
+    for (; x + 8 <= count; x += 8)
+    {
+        __m256i pixels = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(source + x * 2)));
+        __m256i r = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(pixels, _mm256_set1_epi32(0xf800)), 8),
+                                    _mm256_slli_epi32(_mm256_and_si256(pixels, _mm256_set1_epi32(0xe000)), 3));
+        __m256i g = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(pixels, _mm256_set1_epi32(0x07e0)), 5),
+                                    _mm256_srli_epi32(_mm256_and_si256(pixels, _mm256_set1_epi32(0x0600)), 1));
+        __m256i b = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(pixels, _mm256_set1_epi32(0x001f)), 3),
+                                    _mm256_srli_epi32(_mm256_and_si256(pixels, _mm256_set1_epi32(0x001c)), 2));
+
+        _mm256_storeu_si256((__m256i*)(destination + x * 4),
+                            _mm256_or_si256(_mm256_or_si256(r, g), _mm256_or_si256(b, alphas)));
+    }
+
+    renderer_unpack_rgb565_scalar(destination + x * 4, source + x * 2, count - x, alpha);
+}
+#endif
+
+static RendererConvertKernels
+renderer_convert_kernels()
+{
+    RendererConvertKernels kernels = {
+        renderer_copy_rgb_scalar, renderer_pack_rgb565_scalar, renderer_unpack_rgb565_scalar
+    };
+
+#ifdef RENDERER_SPAN_X86
+    switch (renderer_get_simd_level())
+    {
+        case RENDERER_SIMD_AVX2:
+            kernels.copy_rgb = renderer_copy_rgb_avx2;
+            kernels.pack_rgb565 = renderer_pack_rgb565_avx2;
+            kernels.unpack_rgb565 = renderer_unpack_rgb565_avx2;
+            break;
+        case RENDERER_SIMD_SSE2:
+            kernels.copy_rgb = renderer_copy_rgb_sse2;
+            kernels.pack_rgb565 = renderer_pack_rgb565_sse2;
+            kernels.unpack_rgb565 = renderer_unpack_rgb565_sse2;
+            break;
+        default:
+            break;
+    }
+#endif
+
+    return kernels;
+}
+
+void
+renderer_convert_pixels(uint8_t* destination, RendererPixelFormat destination_format, const uint8_t* source,
+                        RendererPixelFormat source_format, int32_t count)
+{
+    if (destination_format == source_format)
+    {
+        memcpy(destination, source, count * renderer_pixel_format_bytes(source_format));
+        return;
+    }
+
+    RendererConvertKernels kernels = renderer_convert_kernels();
+    uint32_t alpha = destination_format == RENDERER_PIXEL_FORMAT_ARGB8888 ? 0xff000000 : 0;
+
+    if (source_format == RENDERER_PIXEL_FORMAT_RGB565)
+    {
+        kernels.unpack_rgb565(destination, source, count, alpha);
+    }
+    else if (destination_format == RENDERER_PIXEL_FORMAT_RGB565)
+    {
+        kernels.pack_rgb565(destination, source, count, alpha);
+    }
+    else
+    {
+        kernels.copy_rgb(destination, source, count, alpha);
+    }
+}
@@ -0,0 +1,426 @@
+// renderer_scale.c
+
+#include <stdint.h>
+#include <string.h>
+
+#include "math.h"
+#include "profiler.h"
+#include "renderer.h"
+#include "renderer_scale.h"
+#include "renderer_span.h"
+
+#ifdef RENDERER_SPAN_X86
+#include <immintrin.h>
+#endif
+
+// Destination columns scaled per pass. Their positions are worked out once
+// and reused for every row.
+#define RENDERER_SCALE_SPAN 256
+
+// Most source columns a bilinear pass reads, fewer destination columns are
+// scaled per pass when shrinking by more than this allows
+#define RENDERER_SCALE_SOURCE_SPAN 512
+
+// Blend count pixels of two rows, weight / 256 of the way from a to b
+typedef void RendererScaleRowsFunction(uint32_t* pixels, const uint32_t* a, const uint32_t* b, uint32_t weight,
+                                       int32_t count);
+
+// Blend each pixel of row at indices with the one after it, by weights
+typedef void RendererScaleColumnsFunction(uint32_t* pixels, const uint32_t* row, const int32_t* indices,
+                                          const int32_t* weights, int32_t count);
+
+// Copy the pixels at byte offsets from row
+typedef void RendererScaleGatherFunction(uint32_t* pixels, const uint8_t* row, const int32_t* offsets,
+                                         int32_t count);
+
+typedef struct RendererScaleKernels {
+    RendererScaleRowsFunction* lerp_rows;
+    RendererScaleColumnsFunction* lerp_columns;
+    RendererScaleGatherFunction* gather;
+} RendererScaleKernels;
+
+static void
+renderer_scale_lerp_rows_scalar(uint32_t* pixels, const uint32_t* a, const uint32_t* b, uint32_t weight,
+                                int32_t count)
+{
+    for (int32_t x = 0; x < count; ++x)
+    {
+        pixels[x] = renderer_span_lerp(a[x], b[x], weight);
+    }
+}
+
+static void
+renderer_scale_lerp_columns_scalar(uint32_t* pixels, const uint32_t* row, const int32_t* indices,
+                                   const int32_t* weights, int32_t count)
+{
+    for (int32_t x = 0; x < count; ++x)
+    {
+        pixels[x] = renderer_span_lerp(row[indices[x]], row[indices[x] + 1], (uint32_t)weights[x]);
+    }
+}
+
+static void
+renderer_scale_gather_scalar(uint32_t* pixels, const uint8_t* row, const int32_t* offsets, int32_t count)
+{
+    for (int32_t x = 0; x < count; ++x)
+    {
+        pixels[x] = *(const uint32_t*)(row + offsets[x]);
+    }
+}
+
+#ifdef RENDERER_SPAN_X86
+__attribute__((target("sse2")))
+static void
+renderer_scale_lerp_rows_sse2(uint32_t* pixels, const uint32_t* a, const uint32_t* b, uint32_t weight,
+                              int32_t count)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i weights = _mm_set1_epi16((int16_t)weight);
+
+    int32_t x = 0;
+    for (; x + 4 <= count; x += 4)
+    {
+        __m128i top = _mm_loadu_si128((const __m128i*)(a + x));
+        __m128i bottom = _mm_loadu_si128((const __m128i*)(b + x));
+
+        __m128i low = renderer_span_lerp_sse2(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero), weights);
+        __m128i high = renderer_span_lerp_sse2(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero), weights);
+        _mm_storeu_si128((__m128i*)(pixels + x), _mm_packus_epi16(low, high));
+    }
+
+    renderer_scale_lerp_rows_scalar(pixels + x, a + x, b + x, weight, count - x);
+}
+
+__attribute__((target("sse2")))
+static void
+renderer_scale_lerp_columns_sse2(uint32_t* pixels, const uint32_t* row, const int32_t* indices,
+                                 const int32_t* weights, int32_t count)
+{
+    __m128i zero = _mm_setzero_si128();
+
+    int32_t x = 0;
+    for (; x + 4 <= count; x += 4)
+    {
+        const int32_t* index = indices + x;
+        __m128i left = _mm_setr_epi32((int32_t)row[index[0]], (int32_t)row[index[1]],
+                                      (int32_t)row[index[2]], (int32_t)row[index[3]]);
+        __m128i right = _mm_setr_epi32((int32_t)row[index[0] + 1], (int32_t)row[index[1] + 1],
+                                       (int32_t)row[index[2] + 1], (int32_t)row[index[3] + 1]);
+
+        // Weights repeated for the 4 channels of each pixel, pixels 0 and 1
+        // in the low and 2 and 3 in the high vector
+        __m128i weight = _mm_loadu_si128((const __m128i*)(weights + x));
+        weight = _mm_or_si128(weight, _mm_slli_epi32(weight, 16));
+        __m128i weight_low = _mm_unpacklo_epi32(weight, weight);
+        __m128i weight_high = _mm_unpackhi_epi32(weight, weight);
+
+        __m128i low = renderer_span_lerp_sse2(_mm_unpacklo_epi8(left, zero), _mm_unpacklo_epi8(right, zero),
+                                               weight_low);
+        __m128i high = renderer_span_lerp_sse2(_mm_unpackhi_epi8(left, zero), _mm_unpackhi_epi8(right, zero),
+                                                weight_high);
+        _mm_storeu_si128((__m128i*)(pixels + x), _mm_packus_epi16(low, high));
+    }
+
+    renderer_scale_lerp_columns_scalar(pixels + x, row, indices + x, weights + x, count - x);
+}
+
+__attribute__((target("avx2")))
+static void
+renderer_scale_lerp_rows_avx2(uint32_t* pixels, const uint32_t* a, const uint32_t* b, uint32_t weight,
+                              int32_t count)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i weights = _mm256_set1_epi16((int16_t)weight);
+
+    int32_t x = 0;
+    for (; x + 8 <= count; x += 8)
+    {
+        __m256i top = _mm256_loadu_si256((const __m256i*)(a + x));
+        __m256i bottom = _mm256_loadu_si256((const __m256i*)(b + x));
+
+        __m256i low = renderer_span_lerp_avx2(_mm256_unpacklo_epi8(top, zero), _mm256_unpacklo_epi8(bottom, zero),
+                                               weights);
+        __m256i high = renderer_span_lerp_avx2(_mm256_unpackhi_epi8(top, zero), _mm256_unpackhi_epi8(bottom, zero),
+                                                weights);
+        _mm256_storeu_si256((__m256i*)(pixels + x), _mm256_packus_epi16(low, high));
+    }
+
+    renderer_scale_lerp_rows_sse2(pixels + x, a + x, b + x, weight, count - x);
+}
+
+__attribute__((target("avx2")))
+static void
+renderer_scale_lerp_columns_avx2(uint32_t* pixels, const uint32_t* row, const int32_t* indices,
+                                 const int32_t* weights, int32_t count)
+{
+    __m256i zero = _mm256_setzero_si256();
+
+    int32_t x = 0;
+    for (; x + 8 <= count; x += 8)
+    {
+        __m256i index = _mm256_loadu_si256((const __m256i*)(indices + x));
+        __m256i left = _mm256_i32gather_epi32((const int*)row, index, 4);
+        __m256i right = _mm256_i32gather_epi32((const int*)(row + 1), index, 4);
+
+        __m256i weight = _mm256_loadu_si256((const __m256i*)(weights + x));
+        weight = _mm256_or_si256(weight, _mm256_slli_epi32(weight, 16));
+        __m256i weight_low = _mm256_unpacklo_epi32(weight, weight);
+        __m256i weight_high = _mm256_unpackhi_epi32(weight, weight);
+
+        __m256i low = renderer_span_lerp_avx2(_mm256_unpacklo_epi8(left, zero), _mm256_unpacklo_epi8(right, zero),
+                                               weight_low);
+        __m256i high = renderer_span_lerp_avx2(_mm256_unpackhi_epi8(left, zero), _mm256_unpackhi_epi8(right, zero),
+                                                weight_high);
+        _mm256_storeu_si256((__m256i*)(pixels + x), _mm256_packus_epi16(low, high));
+    }
+
+    renderer_scale_lerp_columns_sse2(pixels + x, row, indices + x, weights + x, count - x);
+}
+
+__attribute__((target("avx2")))
+static void
+renderer_scale_gather_avx2(uint32_t* pixels, const uint8_t* row, const int32_t* offsets, int32_t count)
+{
+    int32_t x = 0;
+    for (; x + 8 <= count; x += 8)
+    {
+        __m256i offset = _mm256_loadu_si256((const __m256i*)(offsets + x));
+        _mm256_storeu_si256((__m256i*)(pixels + x), _mm256_i32gather_epi32((const int*)row, offset, 1));
+    }
+
+    renderer_scale_gather_scalar(pixels + x, row, offsets + x, count - x);
+}
+#endif
+
+static RendererScaleKernels
+renderer_scale_kernels()
+{
+    RendererScaleKernels kernels = {
+        renderer_scale_lerp_rows_scalar, renderer_scale_lerp_columns_scalar, renderer_scale_gather_scalar
+    };
+
+#ifdef RENDERER_SPAN_X86
+    switch (renderer_get_simd_level())
+    {
+        case RENDERER_SIMD_AVX2:
+            kernels.lerp_rows = renderer_scale_lerp_rows_avx2;
+            kernels.lerp_columns = renderer_scale_lerp_columns_avx2;
+            kernels.gather = renderer_scale_gather_avx2;
+            break;
+        case RENDERER_SIMD_SSE2:
+            // Without a gather instruction nearest stays scalar
+            kernels.lerp_rows = renderer_scale_lerp_rows_sse2;
+            kernels.lerp_columns = renderer_scale_lerp_columns_sse2;
+            break;
+        default:
+            break;
+    }
+#endif
+
+    return kernels;
+}
+
+// Where the center of destination pixel index lands in the source, in 16.16
+// fixed point, rounded down exactly rather than stepped so it does not drift
+static inline int64_t
+renderer_scale_center(int32_t index, int32_t source_size, int32_t destination_size)
+{
+    return (((int64_t)index * 2 + 1) * source_size << 16) / ((int64_t)destination_size * 2);
+}
+
+// Source pixel to the left of or above the center of destination pixel
+// index, and how far toward the next one the center is in 256ths
+static inline int32_t
+renderer_scale_position(int32_t index, int32_t source_size, int32_t destination_size, uint32_t* weight)
+{
+    int64_t position = renderer_scale_center(index, source_size, destination_size) - 0x8000;
+    if (position < 0)
+    {
+        *weight = 0;
+        return 0;
+    }
+
+    int32_t pixel = (int32_t)(position >> 16);
+    if (pixel >= source_size - 1)
+    {
+        *weight = 0;
+        return source_size - 1;
+    }
+
+    *weight = (uint32_t)(position >> 8) & 0xff;
+    return pixel;
+}
+
+static void
+renderer_scale_nearest(RendererScaleKernels* kernels, RendererTargetBuffer source,
+                       RendererTargetBuffer destination)
+{
+    // Pixel offsets are a row part plus a column part in either layout
+    int32_t offsets[RENDERER_SCALE_SPAN];
+    uint32_t converted[RENDERER_SCALE_SPAN];
+    int32_t convert = destination.format != source.format;
+
+    for (int32_t first = 0; first < destination.width; first += RENDERER_SCALE_SPAN)
+    {
+        int32_t remaining = destination.width - first;
+        int32_t count = Min(remaining, RENDERER_SCALE_SPAN);
+        for (int32_t x = 0; x < count; ++x)
+        {
+            int32_t column = (int32_t)(renderer_scale_center(first + x, source.width, destination.width) >> 16);
+            offsets[x] = IndexPixel(Min(column, source.width - 1), 0, source);
+        }
+
+        for (int32_t y = 0; y < destination.height; ++y)
+        {
+            int32_t row = (int32_t)(renderer_scale_center(y, source.height, destination.height) >> 16);
+            row = Min(row, source.height - 1);
+
+            uint8_t* pixels = destination.pixels + IndexPixel(first, y, destination);
+            uint32_t* colors = convert ? converted : (uint32_t*)pixels;
+            kernels->gather(colors, source.pixels + IndexPixel(0, row, source), offsets, count);
+
+            if (convert)
+            {
+                renderer_convert_pixels(pixels, destination.format, (uint8_t*)colors, source.format, count);
+            }
+        }
+    }
+}
+
+// Blend count pixels from x onward of source rows y0 and y1 into row. Rows
+// of tiled sources are only contiguous within a block, so those are blended
+// a block at a time.
+static void
+renderer_scale_blend_rows(RendererScaleKernels* kernels, RendererTargetBuffer source, int32_t x, int32_t y0,
+                          int32_t y1, uint32_t weight, int32_t count, uint32_t* row)
+{
+    int32_t max_x = x + count;
+    while (x < max_x)
+    {
+        int32_t run = max_x - x;
+        if (source.layout == RENDERER_TARGET_TILED)
+        {
+            int32_t block_remaining = RENDERER_BLOCK_SIZE - (x & (RENDERER_BLOCK_SIZE - 1));
+            run = Min(run, block_remaining);
+        }
+
+        const uint32_t* top = (const uint32_t*)(source.pixels + IndexPixel(x, y0, source));
+        if (weight == 0)
+        {
+            memcpy(row, top, run * sizeof(uint32_t));
+        }
+        else
+        {
+            const uint32_t* bottom = (const uint32_t*)(source.pixels + IndexPixel(x, y1, source));
+            kernels->lerp_rows(row, top, bottom, weight, run);
+        }
+
+        row += run;
+        x += run;
+    }
+}
+
+// Each destination row blends the two source rows around it into a single
+// row first, across only the columns this pass reads, then blends columns
+// of that row. Source rows are read straight through, only the blended row
+// is gathered from.
+static void
+renderer_scale_bilinear(RendererScaleKernels* kernels, RendererTargetBuffer source,
+                        RendererTargetBuffer destination)
+{
+    int32_t indices[RENDERER_SCALE_SPAN];
+    int32_t weights[RENDERER_SCALE_SPAN];
+    // One past the columns read, for the right neighbor of the last one
+    uint32_t row[RENDERER_SCALE_SOURCE_SPAN + 1];
+    uint32_t converted[RENDERER_SCALE_SPAN];
+    int32_t convert = destination.format != source.format;
+
+    int32_t first = 0;
+    while (first < destination.width)
+    {
+        int32_t remaining = destination.width - first;
+        int32_t max_count = Min(remaining, RENDERER_SCALE_SPAN);
+
+        uint32_t weight;
+        int32_t first_column = renderer_scale_position(first, source.width, destination.width, &weight);
+        int32_t last_column = first_column;
+
+        int32_t count = 0;
+        while (count < max_count)
+        {
+            int32_t column = renderer_scale_position(first + count, source.width, destination.width, &weight);
+            if (column + 2 - first_column > RENDERER_SCALE_SOURCE_SPAN)
+            {
+                break;
+            }
+
+            indices[count] = column - first_column;
+            weights[count] = (int32_t)weight;
+            last_column = column;
+            ++count;
+        }
+
+        int32_t end_column = Min(last_column + 2, source.width);
+        int32_t column_count = end_column - first_column;
+
+        for (int32_t y = 0; y < destination.height; ++y)
+        {
+            uint32_t row_weight;
+            int32_t y0 = renderer_scale_position(y, source.height, destination.height, &row_weight);
+            int32_t y1 = Min(y0 + 1, source.height - 1);
+
+            renderer_scale_blend_rows(kernels, source, first_column, y0, y1, row_weight, column_count, row);
+            // Past the right edge the last column is its own neighbor
+            row[column_count] = row[column_count - 1];
+
+            uint8_t* pixels = destination.pixels + IndexPixel(first, y, destination);
+            uint32_t* colors = convert ? converted : (uint32_t*)pixels;
+            kernels->lerp_columns(colors, row, indices, weights, count);
+
+            if (convert)
+            {
+                renderer_convert_pixels(pixels, destination.format, (uint8_t*)colors, source.format, count);
+            }
+        }
+
+        first += count;
+    }
+}
+
+void
+renderer_scale(RendererTargetBuffer source, RendererTargetBuffer destination, RendererScaleFilter filter)
+{
+    if (source.width <= 0 || source.height <= 0 || destination.width <= 0 || destination.height <= 0)
+    {
+        return;
+    }
+
+    RendererRect bounds = {
+        0, 0, destination.width, destination.height
+    };
+
+    if (destination.dirty)
+    {
+        renderer_dirty_rects_add(destination.dirty, bounds);
+    }
+
+    if (source.width == destination.width && source.height == destination.height)
+    {
+        renderer_resolve(source, destination);
+        return;
+    }
+
+    ProfilerBegin(scale);
+    RendererScaleKernels kernels = renderer_scale_kernels();
+    if (filter == RENDERER_SCALE_BILINEAR)
+    {
+        renderer_scale_bilinear(&kernels, source, destination);
+    }
+    else
+    {
+        renderer_scale_nearest(&kernels, source, destination);
+    }
+
+    ProfilerCount(PROFILER_COUNTER_PIXELS_FILLED, destination.width * destination.height);
+    ProfilerEnd(scale);
+}
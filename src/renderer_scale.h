@@ -0,0 +1,22 @@
+// renderer_scale.h
+
+#ifndef RENDERER_SCALE_INCLUDED
+#define RENDERER_SCALE_INCLUDED
+
+#include <stdint.h>
+
+#include "renderer.h"
+
+typedef enum RendererScaleFilter {
+    RENDERER_SCALE_NEAREST = 0,
+    RENDERER_SCALE_BILINEAR = 1,
+} RendererScaleFilter;
+
+// Stretch all of source over all of destination, sampling at pixel centers
+// with edges clamped. Source can have either layout and must be 32 bit,
+// destination must be linear and is converted to when its format differs.
+// Output is the same at every SIMD level.
+void
+renderer_scale(RendererTargetBuffer source, RendererTargetBuffer destination, RendererScaleFilter filter);
+
+#endif // RENDERER_SCALE_INCLUDED
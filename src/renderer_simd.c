@@ -0,0 +1,423 @@
+// renderer_simd.c
+
+#include "renderer_span.h"
+
+#ifdef RENDERER_SPAN_X86
+
+#include <immintrin.h>
+
+// Each kernel is compiled for its own instruction set and only called after
+// CPUID reported support, so the rest of the program stays baseline x86.
+
+static inline uint32_t
+renderer_span_step(int32_t value, int32_t step, int32_t times)
+{
+    return (uint32_t)value + (uint32_t)step * (uint32_t)times;
+}
+
+__attribute__((target("sse2")))
+static inline __m128i
+renderer_span_lanes_sse2(int32_t value, int32_t step)
+{
+    return _mm_setr_epi32(value,
+                          (int32_t)renderer_span_step(value, step, 1),
+                          (int32_t)renderer_span_step(value, step, 2),
+                          (int32_t)renderer_span_step(value, step, 3));
+}
+
+// The depth mode and covered arguments are always constants, so each wrapper
+// gets a copy with the unused depth and coverage work compiled away.
+__attribute__((target("sse2"), always_inline))
+static inline void
+renderer_span_generic_sse2(const RendererSpanSetup* setup, uint8_t* pixels, float* depth, int32_t count,
+                           int32_t bcoord0, int32_t bcoord1, int32_t bcoord2, int depth_mode, int covered,
+                           int format)
+{
+    int32_t color_r = renderer_span_channel(setup->color_base_r0, bcoord1, setup->color_r10, bcoord2, setup->color_r20);
+    int32_t color_g = renderer_span_channel(setup->color_base_g0, bcoord1, setup->color_g10, bcoord2, setup->color_g20);
+    int32_t color_b = renderer_span_channel(setup->color_base_b0, bcoord1, setup->color_b10, bcoord2, setup->color_b20);
+
+    // Moving one pixel right adds a20 to bcoord1 and a01 to bcoord2.
+    int32_t step_r = renderer_span_channel(0, setup->a20, setup->color_r10, setup->a01, setup->color_r20);
+    int32_t step_g = renderer_span_channel(0, setup->a20, setup->color_g10, setup->a01, setup->color_g20);
+    int32_t step_b = renderer_span_channel(0, setup->a20, setup->color_b10, setup->a01, setup->color_b20);
+
+    __m128i edge0 = renderer_span_lanes_sse2(bcoord0, setup->a12);
+    __m128i edge1 = renderer_span_lanes_sse2(bcoord1, setup->a20);
+    __m128i edge2 = renderer_span_lanes_sse2(bcoord2, setup->a01);
+    __m128i red = renderer_span_lanes_sse2(color_r, step_r);
+    __m128i green = renderer_span_lanes_sse2(color_g, step_g);
+    __m128i blue = renderer_span_lanes_sse2(color_b, step_b);
+
+    __m128i edge0_step = _mm_set1_epi32((int32_t)renderer_span_step(0, setup->a12, 4));
+    __m128i edge1_step = _mm_set1_epi32((int32_t)renderer_span_step(0, setup->a20, 4));
+    __m128i edge2_step = _mm_set1_epi32((int32_t)renderer_span_step(0, setup->a01, 4));
+    __m128i red_step = _mm_set1_epi32((int32_t)renderer_span_step(0, step_r, 4));
+    __m128i green_step = _mm_set1_epi32((int32_t)renderer_span_step(0, step_g, 4));
+    __m128i blue_step = _mm_set1_epi32((int32_t)renderer_span_step(0, step_b, 4));
+
+    __m128 z0 = _mm_set1_ps(setup->z0);
+    __m128 z10 = _mm_set1_ps(setup->z10);
+    __m128 z20 = _mm_set1_ps(setup->z20);
+
+    __m128i channel_mask = _mm_set1_epi32(0xff);
+
+    int32_t x = 0;
+    for (; x + 4 <= count; x += 4)
+    {
+        // A lane is outside when any edge function has its sign bit set.
+        __m128i outside = _mm_setzero_si128();
+        if (!covered)
+        {
+            outside = _mm_srai_epi32(_mm_or_si128(_mm_or_si128(edge0, edge1), edge2), 31);
+        }
+
+        // Early depth test, pixels failing it are dropped before any color work.
+        __m128 z = _mm_setzero_ps();
+        if (depth_mode != RENDERER_SPAN_DEPTH_NONE)
+        {
+            z = _mm_add_ps(_mm_add_ps(z0, _mm_mul_ps(_mm_cvtepi32_ps(edge1), z10)),
+                           _mm_mul_ps(_mm_cvtepi32_ps(edge2), z20));
+        }
+
+        if (depth_mode == RENDERER_SPAN_DEPTH_TEST)
+        {
+            __m128 passed = _mm_cmplt_ps(z, _mm_loadu_ps(depth + x));
+            outside = _mm_or_si128(outside, _mm_xor_si128(_mm_castps_si128(passed), _mm_set1_epi32(-1)));
+        }
+
+        int outside_bits = _mm_movemask_ps(_mm_castsi128_ps(outside));
+
+        if (outside_bits != 0xf)
+        {
+            __m128i r = _mm_and_si128(_mm_srli_epi32(red, 18), channel_mask);
+            __m128i g = _mm_and_si128(_mm_srli_epi32(green, 18), channel_mask);
+            __m128i b = _mm_and_si128(_mm_srli_epi32(blue, 18), channel_mask);
+
+            if (depth_mode != RENDERER_SPAN_DEPTH_NONE && outside_bits != 0)
+            {
+                __m128 existing_z = _mm_loadu_ps(depth + x);
+                __m128 outside_ps = _mm_castsi128_ps(outside);
+                z = _mm_or_ps(_mm_andnot_ps(outside_ps, z), _mm_and_ps(outside_ps, existing_z));
+            }
+
+            if (format == RENDERER_PIXEL_FORMAT_RGB565)
+            {
+                // Sign extended from 16 bits, so the saturating pack keeps
+                // every pixel as is and four of them fill the low half.
+                __m128i color = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(r, 3), 27),
+                                                          _mm_slli_epi32(_mm_srli_epi32(g, 2), 21)),
+                                             _mm_slli_epi32(_mm_srli_epi32(b, 3), 16));
+                color = _mm_srai_epi32(color, 16);
+                color = _mm_packs_epi32(color, color);
+
+                __m128i* destination = (__m128i*)(pixels + x * sizeof(uint16_t));
+                if (outside_bits != 0)
+                {
+                    __m128i existing = _mm_loadl_epi64(destination);
+                    __m128i outside16 = _mm_packs_epi32(outside, outside);
+                    color = _mm_or_si128(_mm_andnot_si128(outside16, color), _mm_and_si128(outside16, existing));
+                }
+
+                _mm_storel_epi64(destination, color);
+            }
+            else
+            {
+                __m128i color = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 16), _mm_slli_epi32(g, 8)), b);
+                if (format == RENDERER_PIXEL_FORMAT_ARGB8888)
+                {
+                    color = _mm_or_si128(color, _mm_set1_epi32((int32_t)0xff000000));
+                }
+
+                __m128i* destination = (__m128i*)(pixels + x * sizeof(uint32_t));
+                if (outside_bits != 0)
+                {
+                    __m128i existing = _mm_loadu_si128(destination);
+                    color = _mm_or_si128(_mm_andnot_si128(outside, color), _mm_and_si128(outside, existing));
+                }
+
+                _mm_storeu_si128(destination, color);
+            }
+
+            if (depth_mode != RENDERER_SPAN_DEPTH_NONE)
+            {
+                _mm_storeu_ps(depth + x, z);
+            }
+        }
+
+        edge0 = _mm_add_epi32(edge0, edge0_step);
+        edge1 = _mm_add_epi32(edge1, edge1_step);
+        edge2 = _mm_add_epi32(edge2, edge2_step);
+        red = _mm_add_epi32(red, red_step);
+        green = _mm_add_epi32(green, green_step);
+        blue = _mm_add_epi32(blue, blue_step);
+    }
+
+    // Finish the last partial group one pixel at a time from lane 0.
+    int32_t e0 = _mm_cvtsi128_si32(edge0);
+    int32_t e1 = _mm_cvtsi128_si32(edge1);
+    int32_t e2 = _mm_cvtsi128_si32(edge2);
+    color_r = _mm_cvtsi128_si32(red);
+    color_g = _mm_cvtsi128_si32(green);
+    color_b = _mm_cvtsi128_si32(blue);
+
+    for (; x < count; ++x)
+    {
+        if (covered || (e0|e1|e2) >= 0)
+        {
+            float z = 0.0f;
+            if (depth_mode != RENDERER_SPAN_DEPTH_NONE)
+            {
+                z = renderer_span_depth(setup, e1, e2);
+            }
+
+            if (depth_mode != RENDERER_SPAN_DEPTH_TEST || z < depth[x])
+            {
+                uint32_t color = ((color_r >> 18) & 0xff) << 16 |
+                    ((color_g >> 18) & 0xff) << 8 |
+                    ((color_b >> 18) & 0xff);
+                renderer_span_store(pixels, x, color, format);
+
+                if (depth_mode != RENDERER_SPAN_DEPTH_NONE)
+                {
+                    depth[x] = z;
+                }
+            }
+        }
+
+        e0 = (int32_t)renderer_span_step(e0, setup->a12, 1);
+        e1 = (int32_t)renderer_span_step(e1, setup->a20, 1);
+        e2 = (int32_t)renderer_span_step(e2, setup->a01, 1);
+        color_r = (int32_t)renderer_span_step(color_r, step_r, 1);
+        color_g = (int32_t)renderer_span_step(color_g, step_g, 1);
+        color_b = (int32_t)renderer_span_step(color_b, step_b, 1);
+    }
+}
+
+RENDERER_SPAN_DEFINE_ROW_BLOCKS(sse2, renderer_span_generic_sse2, __attribute__((target("sse2"))))
+RENDERER_SPAN_DEFINE_KERNELS(sse2, renderer_span_generic_sse2, renderer_block_rows_sse2, __attribute__((target("sse2"))))
+
+__attribute__((target("avx2")))
+static inline __m256i
+renderer_span_lanes_avx2(int32_t value, int32_t step)
+{
+    __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    return _mm256_add_epi32(_mm256_set1_epi32(value),
+                            _mm256_mullo_epi32(lane, _mm256_set1_epi32(step)));
+}
+
+// Shade the pixels of mask among 8 consecutive ones, from their edge and
+// color interpolants
+__attribute__((target("avx2"), always_inline))
+static inline void
+renderer_span_shade_avx2(__m256i mask, __m256i edge1, __m256i edge2, __m256i red, __m256i green, __m256i blue,
+                         __m256 z0, __m256 z10, __m256 z20, uint8_t* pixels, float* depth, int depth_mode,
+                         int format)
+{
+    __m256 z = _mm256_setzero_ps();
+    if (depth_mode != RENDERER_SPAN_DEPTH_NONE)
+    {
+        z = _mm256_add_ps(_mm256_add_ps(z0, _mm256_mul_ps(_mm256_cvtepi32_ps(edge1), z10)),
+                          _mm256_mul_ps(_mm256_cvtepi32_ps(edge2), z20));
+    }
+
+    if (depth_mode == RENDERER_SPAN_DEPTH_TEST)
+    {
+        __m256 existing_z = _mm256_maskload_ps(depth, mask);
+        __m256 passed = _mm256_cmp_ps(z, existing_z, _CMP_LT_OQ);
+        mask = _mm256_and_si256(mask, _mm256_castps_si256(passed));
+    }
+
+    if (!_mm256_testz_si256(mask, mask))
+    {
+        __m256i channel_mask = _mm256_set1_epi32(0xff);
+        __m256i r = _mm256_and_si256(_mm256_srli_epi32(red, 18), channel_mask);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi32(green, 18), channel_mask);
+        __m256i b = _mm256_and_si256(_mm256_srli_epi32(blue, 18), channel_mask);
+        __m256i color = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r, 16), _mm256_slli_epi32(g, 8)), b);
+        int mask_bits = _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+
+        if (format == RENDERER_PIXEL_FORMAT_RGB565)
+        {
+            __m256i color565 = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(_mm256_srli_epi32(r, 3), 11),
+                                                               _mm256_slli_epi32(_mm256_srli_epi32(g, 2), 5)),
+                                               _mm256_srli_epi32(b, 3));
+            __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(color565),
+                                              _mm256_extracti128_si256(color565, 1));
+
+            // There is no 16 bit masked store, and reading and writing back
+            // pixels past the span would race with whoever owns them.
+            if (mask_bits == 0xff)
+            {
+                _mm_storeu_si128((__m128i*)pixels, packed);
+            }
+            else
+            {
+                uint16_t lanes[8];
+                _mm_storeu_si128((__m128i*)lanes, packed);
+                for (int bits = mask_bits; bits; bits &= bits - 1)
+                {
+                    int lane = __builtin_ctz(bits);
+                    ((uint16_t*)pixels)[lane] = lanes[lane];
+                }
+            }
+        }
+        else
+        {
+            if (format == RENDERER_PIXEL_FORMAT_ARGB8888)
+            {
+                color = _mm256_or_si256(color, _mm256_set1_epi32((int32_t)0xff000000));
+            }
+
+            if (mask_bits == 0xff)
+            {
+                _mm256_storeu_si256((__m256i*)pixels, color);
+            }
+            else
+            {
+                _mm256_maskstore_epi32((int*)pixels, mask, color);
+            }
+        }
+
+        if (depth_mode != RENDERER_SPAN_DEPTH_NONE)
+        {
+            if (mask_bits == 0xff)
+            {
+                _mm256_storeu_ps(depth, z);
+            }
+            else
+            {
+                _mm256_maskstore_ps(depth, mask, z);
+            }
+        }
+    }
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline void
+renderer_span_generic_avx2(const RendererSpanSetup* setup, uint8_t* pixels, float* depth, int32_t count,
+                           int32_t bcoord0, int32_t bcoord1, int32_t bcoord2, int depth_mode, int covered,
+                           int format)
+{
+    int32_t color_r = renderer_span_channel(setup->color_base_r0, bcoord1, setup->color_r10, bcoord2, setup->color_r20);
+    int32_t color_g = renderer_span_channel(setup->color_base_g0, bcoord1, setup->color_g10, bcoord2, setup->color_g20);
+    int32_t color_b = renderer_span_channel(setup->color_base_b0, bcoord1, setup->color_b10, bcoord2, setup->color_b20);
+
+    int32_t step_r = renderer_span_channel(0, setup->a20, setup->color_r10, setup->a01, setup->color_r20);
+    int32_t step_g = renderer_span_channel(0, setup->a20, setup->color_g10, setup->a01, setup->color_g20);
+    int32_t step_b = renderer_span_channel(0, setup->a20, setup->color_b10, setup->a01, setup->color_b20);
+
+    __m256i edge0 = renderer_span_lanes_avx2(bcoord0, setup->a12);
+    __m256i edge1 = renderer_span_lanes_avx2(bcoord1, setup->a20);
+    __m256i edge2 = renderer_span_lanes_avx2(bcoord2, setup->a01);
+    __m256i red = renderer_span_lanes_avx2(color_r, step_r);
+    __m256i green = renderer_span_lanes_avx2(color_g, step_g);
+    __m256i blue = renderer_span_lanes_avx2(color_b, step_b);
+
+    __m256i edge0_step = _mm256_set1_epi32((int32_t)renderer_span_step(0, setup->a12, 8));
+    __m256i edge1_step = _mm256_set1_epi32((int32_t)renderer_span_step(0, setup->a20, 8));
+    __m256i edge2_step = _mm256_set1_epi32((int32_t)renderer_span_step(0, setup->a01, 8));
+    __m256i red_step = _mm256_set1_epi32((int32_t)renderer_span_step(0, step_r, 8));
+    __m256i green_step = _mm256_set1_epi32((int32_t)renderer_span_step(0, step_g, 8));
+    __m256i blue_step = _mm256_set1_epi32((int32_t)renderer_span_step(0, step_b, 8));
+
+    __m256 z0 = _mm256_set1_ps(setup->z0);
+    __m256 z10 = _mm256_set1_ps(setup->z10);
+    __m256 z20 = _mm256_set1_ps(setup->z20);
+
+    __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i minus_one = _mm256_set1_epi32(-1);
+
+    for (int32_t x = 0; x < count; x += 8)
+    {
+        // Lanes past the end of the span are masked off, so there is no
+        // scalar tail and no read or write outside of the span.
+        __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(count - x), lane);
+        if (!covered)
+        {
+            __m256i inside = _mm256_cmpgt_epi32(_mm256_or_si256(_mm256_or_si256(edge0, edge1), edge2), minus_one);
+            mask = _mm256_and_si256(mask, inside);
+        }
+
+        renderer_span_shade_avx2(mask, edge1, edge2, red, green, blue, z0, z10, z20,
+                                 pixels + x * renderer_pixel_format_bytes(format), depth ? depth + x : 0,
+                                 depth_mode, format);
+
+        edge0 = _mm256_add_epi32(edge0, edge0_step);
+        edge1 = _mm256_add_epi32(edge1, edge1_step);
+        edge2 = _mm256_add_epi32(edge2, edge2_step);
+        red = _mm256_add_epi32(red, red_step);
+        green = _mm256_add_epi32(green, green_step);
+        blue = _mm256_add_epi32(blue, blue_step);
+    }
+}
+
+// A block row fits in one vector, so the interpolants are set up once and
+// stepped down the rows instead of set up again for every span.
+__attribute__((target("avx2"), always_inline))
+static inline void
+renderer_block_generic_avx2(const RendererSpanSetup* setup, uint8_t* pixels, int32_t pitch, float* depth,
+                            int32_t count, int32_t h, int32_t bcoord0, int32_t bcoord1, int32_t bcoord2,
+                            int depth_mode, int format)
+{
+    int32_t color_r = renderer_span_channel(setup->color_base_r0, bcoord1, setup->color_r10, bcoord2, setup->color_r20);
+    int32_t color_g = renderer_span_channel(setup->color_base_g0, bcoord1, setup->color_g10, bcoord2, setup->color_g20);
+    int32_t color_b = renderer_span_channel(setup->color_base_b0, bcoord1, setup->color_b10, bcoord2, setup->color_b20);
+
+    int32_t step_r = renderer_span_channel(0, setup->a20, setup->color_r10, setup->a01, setup->color_r20);
+    int32_t step_g = renderer_span_channel(0, setup->a20, setup->color_g10, setup->a01, setup->color_g20);
+    int32_t step_b = renderer_span_channel(0, setup->a20, setup->color_b10, setup->a01, setup->color_b20);
+
+    // Moving one row down adds b20 to bcoord1 and b01 to bcoord2.
+    int32_t row_step_r = renderer_span_channel(0, setup->b20, setup->color_r10, setup->b01, setup->color_r20);
+    int32_t row_step_g = renderer_span_channel(0, setup->b20, setup->color_g10, setup->b01, setup->color_g20);
+    int32_t row_step_b = renderer_span_channel(0, setup->b20, setup->color_b10, setup->b01, setup->color_b20);
+
+    __m256i edge0 = renderer_span_lanes_avx2(bcoord0, setup->a12);
+    __m256i edge1 = renderer_span_lanes_avx2(bcoord1, setup->a20);
+    __m256i edge2 = renderer_span_lanes_avx2(bcoord2, setup->a01);
+    __m256i red = renderer_span_lanes_avx2(color_r, step_r);
+    __m256i green = renderer_span_lanes_avx2(color_g, step_g);
+    __m256i blue = renderer_span_lanes_avx2(color_b, step_b);
+
+    __m256i edge0_step = _mm256_set1_epi32(setup->b12);
+    __m256i edge1_step = _mm256_set1_epi32(setup->b20);
+    __m256i edge2_step = _mm256_set1_epi32(setup->b01);
+    __m256i red_step = _mm256_set1_epi32(row_step_r);
+    __m256i green_step = _mm256_set1_epi32(row_step_g);
+    __m256i blue_step = _mm256_set1_epi32(row_step_b);
+
+    __m256 z0 = _mm256_set1_ps(setup->z0);
+    __m256 z10 = _mm256_set1_ps(setup->z10);
+    __m256 z20 = _mm256_set1_ps(setup->z20);
+
+    __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i in_span = _mm256_cmpgt_epi32(_mm256_set1_epi32(count), lane);
+    __m256i minus_one = _mm256_set1_epi32(-1);
+
+    for (int32_t y = 0; y < h; ++y)
+    {
+        __m256i inside = _mm256_cmpgt_epi32(_mm256_or_si256(_mm256_or_si256(edge0, edge1), edge2), minus_one);
+        __m256i mask = _mm256_and_si256(in_span, inside);
+
+        renderer_span_shade_avx2(mask, edge1, edge2, red, green, blue, z0, z10, z20, pixels, depth, depth_mode,
+                                 format);
+
+        pixels += pitch;
+        if (depth_mode != RENDERER_SPAN_DEPTH_NONE)
+        {
+            depth += RENDERER_BLOCK_SIZE;
+        }
+
+        edge0 = _mm256_add_epi32(edge0, edge0_step);
+        edge1 = _mm256_add_epi32(edge1, edge1_step);
+        edge2 = _mm256_add_epi32(edge2, edge2_step);
+        red = _mm256_add_epi32(red, red_step);
+        green = _mm256_add_epi32(green, green_step);
+        blue = _mm256_add_epi32(blue, blue_step);
+    }
+}
+
+RENDERER_SPAN_DEFINE_KERNELS(avx2, renderer_span_generic_avx2, renderer_block_generic_avx2, __attribute__((target("avx2"))))
+
+#endif // RENDERER_SPAN_X86
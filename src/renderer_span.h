@@ -0,0 +1,274 @@
+// renderer_span.h
+
+#ifndef RENDERER_SPAN_INCLUDED
+#define RENDERER_SPAN_INCLUDED
+
+#include <stdint.h>
+
+#include "math.h"
+#include "renderer.h"
+
+// Slack added to coarse block depth bounds so float rounding in the per
+// pixel interpolation can never make them reject a visible pixel
+#define RENDERER_DEPTH_EPSILON 1e-5f
+
+// Per triangle constants needed to shade a horizontal run of pixels. Colors
+// are 14.18 fixed point, interpolated from the edge functions bcoord1/2.
+typedef struct RendererSpanSetup {
+    int32_t a12;
+    int32_t a20;
+    int32_t a01;
+
+    int32_t color_base_r0;
+    int32_t color_base_g0;
+    int32_t color_base_b0;
+
+    int32_t color_r10;
+    int32_t color_r20;
+    int32_t color_g10;
+    int32_t color_g20;
+    int32_t color_b10;
+    int32_t color_b20;
+
+    float z0;
+    float z10;
+    float z20;
+
+    // Edge function steps from one row to the next, for the block kernels
+    int32_t b12;
+    int32_t b20;
+    int32_t b01;
+} RendererSpanSetup;
+
+enum RendererSpanDepthMode {
+    // No depth target
+    RENDERER_SPAN_DEPTH_NONE = 0,
+    // Early depth test against and write to the depth target
+    RENDERER_SPAN_DEPTH_TEST = 1,
+    // Every pixel is known to pass, only write the depth target
+    RENDERER_SPAN_DEPTH_WRITE = 2,
+    RENDERER_SPAN_DEPTH_MODE_COUNT = 3,
+};
+
+// Shade count pixels starting at pixels, where bcoord0..2 are the edge
+// function values of the first pixel. Only covered pixels are written. The
+// depth row is only touched when the kernel has a depth mode.
+typedef void RendererSpanFunction(const RendererSpanSetup* setup, uint8_t* pixels, float* depth, int32_t count,
+                                  int32_t bcoord0, int32_t bcoord1, int32_t bcoord2);
+
+// Shade h rows of count pixels within one block, pitch bytes apart, with the
+// depth rows RENDERER_BLOCK_SIZE floats apart. Same as a span per row, but
+// the per triangle constants are only set up once.
+typedef void RendererBlockFunction(const RendererSpanSetup* setup, uint8_t* pixels, int32_t pitch, float* depth,
+                                   int32_t count, int32_t h, int32_t bcoord0, int32_t bcoord1, int32_t bcoord2);
+
+// Kernels for one pixel format, indexed by depth mode and by whether the
+// span is known to be fully inside the triangle, in which case the edge
+// tests are skipped. The block kernels always test the edges.
+typedef struct RendererSpanKernels {
+    RendererSpanFunction* fill_span[RENDERER_SPAN_DEPTH_MODE_COUNT][2];
+    RendererBlockFunction* fill_block[RENDERER_SPAN_DEPTH_MODE_COUNT];
+} RendererSpanKernels;
+
+void renderer_span_kernels_scalar(RendererSpanKernels* kernels, RendererPixelFormat format);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RENDERER_SPAN_X86 1
+
+#include <immintrin.h>
+
+void renderer_span_kernels_sse2(RendererSpanKernels* kernels, RendererPixelFormat format);
+void renderer_span_kernels_avx2(RendererSpanKernels* kernels, RendererPixelFormat format);
+#endif
+
+// Store a 0x00RRGGBB color as pixel x of a row of format. Kernels always
+// pass a constant format, so this folds down to a single store.
+static inline void
+renderer_span_store(uint8_t* pixels, int32_t x, uint32_t color, int format)
+{
+    if (format == RENDERER_PIXEL_FORMAT_RGB565)
+    {
+        ((uint16_t*)pixels)[x] = (uint16_t)renderer_pack_pixel(RENDERER_PIXEL_FORMAT_RGB565, color);
+        return;
+    }
+
+    ((uint32_t*)pixels)[x] = renderer_pack_pixel((RendererPixelFormat)format, color);
+}
+
+// Define the six depth mode and coverage wrappers around a kernel taking
+// constant mode, covered and format arguments, the three depth mode
+// wrappers around a block kernel, for every pixel format, and the function
+// filling the table.
+#define RENDERER_SPAN_DEFINE_WRAPPER(name, suffix, generic, target_attribute, format, mode, covered)  \
+    target_attribute static void                                                                      \
+    renderer_span_##name##suffix(const RendererSpanSetup* setup, uint8_t* pixels, float* depth,       \
+                                 int32_t count, int32_t bcoord0, int32_t bcoord1, int32_t bcoord2)    \
+    {                                                                                                 \
+        generic(setup, pixels, depth, count, bcoord0, bcoord1, bcoord2, mode, covered, format);       \
+    }
+
+// Define a block kernel taking constant depth mode and format, and a generic
+// one shading a span per row for instruction sets without a block kernel of
+// their own.
+#define RENDERER_SPAN_DEFINE_ROW_BLOCKS(name, generic, target_attribute)                                     \
+    target_attribute static inline void                                                                      \
+    renderer_block_rows_##name(const RendererSpanSetup* setup, uint8_t* pixels, int32_t pitch, float* depth, \
+                               int32_t count, int32_t h, int32_t bcoord0, int32_t bcoord1, int32_t bcoord2,  \
+                               int depth_mode, int format)                                                   \
+    {                                                                                                        \
+        for (int32_t y = 0; y < h; ++y)                                                                      \
+        {                                                                                                    \
+            generic(setup, pixels, depth, count, bcoord0, bcoord1, bcoord2, depth_mode, 0, format);          \
+            pixels += pitch;                                                                                 \
+            if (depth_mode != RENDERER_SPAN_DEPTH_NONE)                                                      \
+            {                                                                                                \
+                depth += RENDERER_BLOCK_SIZE;                                                                \
+            }                                                                                                \
+            bcoord0 += setup->b12;                                                                           \
+            bcoord1 += setup->b20;                                                                           \
+            bcoord2 += setup->b01;                                                                           \
+        }                                                                                                    \
+    }
+
+#define RENDERER_SPAN_DEFINE_BLOCK_WRAPPER(name, suffix, block_generic, target_attribute, format, mode)     \
+    target_attribute static void                                                                            \
+    renderer_block_##name##suffix(const RendererSpanSetup* setup, uint8_t* pixels, int32_t pitch,           \
+                                  float* depth, int32_t count, int32_t h, int32_t bcoord0, int32_t bcoord1, \
+                                  int32_t bcoord2)                                                          \
+    {                                                                                                       \
+        block_generic(setup, pixels, pitch, depth, count, h, bcoord0, bcoord1, bcoord2, mode, format);      \
+    }
+
+#define RENDERER_SPAN_DEFINE_FORMAT_KERNELS(name, generic, block_generic, target_attribute, format)              \
+    RENDERER_SPAN_DEFINE_WRAPPER(name, _none, generic, target_attribute, format, RENDERER_SPAN_DEPTH_NONE, 0)    \
+    RENDERER_SPAN_DEFINE_WRAPPER(name, _none_covered, generic, target_attribute, format,                        \
+                                 RENDERER_SPAN_DEPTH_NONE, 1)                                                   \
+    RENDERER_SPAN_DEFINE_WRAPPER(name, _test, generic, target_attribute, format, RENDERER_SPAN_DEPTH_TEST, 0)    \
+    RENDERER_SPAN_DEFINE_WRAPPER(name, _test_covered, generic, target_attribute, format,                        \
+                                 RENDERER_SPAN_DEPTH_TEST, 1)                                                   \
+    RENDERER_SPAN_DEFINE_WRAPPER(name, _write, generic, target_attribute, format, RENDERER_SPAN_DEPTH_WRITE, 0)  \
+    RENDERER_SPAN_DEFINE_WRAPPER(name, _write_covered, generic, target_attribute, format,                       \
+                                 RENDERER_SPAN_DEPTH_WRITE, 1)                                                  \
+    RENDERER_SPAN_DEFINE_BLOCK_WRAPPER(name, _none, block_generic, target_attribute, format,                    \
+                                       RENDERER_SPAN_DEPTH_NONE)                                                \
+    RENDERER_SPAN_DEFINE_BLOCK_WRAPPER(name, _test, block_generic, target_attribute, format,                    \
+                                       RENDERER_SPAN_DEPTH_TEST)                                                \
+    RENDERER_SPAN_DEFINE_BLOCK_WRAPPER(name, _write, block_generic, target_attribute, format,                   \
+                                       RENDERER_SPAN_DEPTH_WRITE)                                               \
+    static void                                                                                                 \
+    renderer_span_kernels_##name(RendererSpanKernels* kernels)                                                  \
+    {                                                                                                           \
+        kernels->fill_span[RENDERER_SPAN_DEPTH_NONE][0] = renderer_span_##name##_none;                          \
+        kernels->fill_span[RENDERER_SPAN_DEPTH_NONE][1] = renderer_span_##name##_none_covered;                  \
+        kernels->fill_span[RENDERER_SPAN_DEPTH_TEST][0] = renderer_span_##name##_test;                          \
+        kernels->fill_span[RENDERER_SPAN_DEPTH_TEST][1] = renderer_span_##name##_test_covered;                  \
+        kernels->fill_span[RENDERER_SPAN_DEPTH_WRITE][0] = renderer_span_##name##_write;                        \
+        kernels->fill_span[RENDERER_SPAN_DEPTH_WRITE][1] = renderer_span_##name##_write_covered;                \
+        kernels->fill_block[RENDERER_SPAN_DEPTH_NONE] = renderer_block_##name##_none;                           \
+        kernels->fill_block[RENDERER_SPAN_DEPTH_TEST] = renderer_block_##name##_test;                           \
+        kernels->fill_block[RENDERER_SPAN_DEPTH_WRITE] = renderer_block_##name##_write;                         \
+    }
+
+#define RENDERER_SPAN_DEFINE_KERNELS(name, generic, block_generic, target_attribute)                  \
+    RENDERER_SPAN_DEFINE_FORMAT_KERNELS(name##_xrgb8888, generic, block_generic, target_attribute,    \
+                                        RENDERER_PIXEL_FORMAT_XRGB8888)                               \
+    RENDERER_SPAN_DEFINE_FORMAT_KERNELS(name##_argb8888, generic, block_generic, target_attribute,    \
+                                        RENDERER_PIXEL_FORMAT_ARGB8888)                               \
+    RENDERER_SPAN_DEFINE_FORMAT_KERNELS(name##_rgb565, generic, block_generic, target_attribute,      \
+                                        RENDERER_PIXEL_FORMAT_RGB565)                                 \
+    void                                                                                              \
+    renderer_span_kernels_##name(RendererSpanKernels* kernels, RendererPixelFormat format)            \
+    {                                                                                                 \
+        switch (format)                                                                               \
+        {                                                                                             \
+            case RENDERER_PIXEL_FORMAT_ARGB8888:                                                      \
+                renderer_span_kernels_##name##_argb8888(kernels);                                     \
+                break;                                                                                \
+            case RENDERER_PIXEL_FORMAT_RGB565:                                                        \
+                renderer_span_kernels_##name##_rgb565(kernels);                                       \
+                break;                                                                                \
+            default:                                                                                  \
+                renderer_span_kernels_##name##_xrgb8888(kernels);                                     \
+                break;                                                                                \
+        }                                                                                             \
+    }
+
+// Interpolated color channel at an edge position, wrapping like the per pixel
+// int32 math does, so SIMD lanes can be stepped with adds and still match.
+static inline int32_t
+renderer_span_channel(int32_t base, int32_t bcoord1, int32_t gradient1, int32_t bcoord2, int32_t gradient2)
+{
+    return (int32_t)((uint32_t)base +
+                     (uint32_t)bcoord1 * (uint32_t)gradient1 +
+                     (uint32_t)bcoord2 * (uint32_t)gradient2);
+}
+
+// Interpolated depth at an edge position. SIMD kernels evaluate the same
+// expression per lane in the same order, so depth matches bit for bit as
+// long as the compiler is not allowed to fuse it into an fma.
+static inline float
+renderer_span_depth(const RendererSpanSetup* setup, int32_t bcoord1, int32_t bcoord2)
+{
+    float depth = setup->z0 + (float)bcoord1 * setup->z10;
+    return depth + (float)bcoord2 * setup->z20;
+}
+
+// Channel by channel a + (b - a) * weight / 256 of two packed pixels, exact
+// in 16 bits since the two weights add up to 256. Shared by bilinear texture
+// sampling and the bilinear upscale so both round the same.
+static inline uint32_t
+renderer_span_lerp(uint32_t a, uint32_t b, uint32_t weight)
+{
+    uint32_t result = 0;
+    for (int32_t shift = 0; shift < 32; shift += 8)
+    {
+        uint32_t channel = (((a >> shift) & 0xff) * (256 - weight) + ((b >> shift) & 0xff) * weight) >> 8;
+        result |= channel << shift;
+    }
+
+    return result;
+}
+
+#ifdef RENDERER_SPAN_X86
+// Same math as renderer_span_lerp on channels widened to 16 bits, 2 pixels
+// per 128 bits
+__attribute__((target("sse2")))
+static inline __m128i
+renderer_span_lerp_sse2(__m128i a, __m128i b, __m128i weight)
+{
+    __m128i inverse_weight = _mm_sub_epi16(_mm_set1_epi16(256), weight);
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(a, inverse_weight), _mm_mullo_epi16(b, weight));
+    return _mm_srli_epi16(sum, 8);
+}
+
+// Same again 4 pixels at a time. Widening with unpack and narrowing with
+// pack both work within 128 bit halves, so pixels come back out in order.
+__attribute__((target("avx2")))
+static inline __m256i
+renderer_span_lerp_avx2(__m256i a, __m256i b, __m256i weight)
+{
+    __m256i inverse_weight = _mm256_sub_epi16(_mm256_set1_epi16(256), weight);
+    __m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(a, inverse_weight), _mm256_mullo_epi16(b, weight));
+    return _mm256_srli_epi16(sum, 8);
+}
+#endif
+
+// Smallest and largest value of an edge function over a w by h pixel block
+// starting where it evaluates to edge. It is linear, so both are at corners.
+static inline int32_t
+renderer_edge_block_min(int32_t edge, int32_t a, int32_t b, int32_t w, int32_t h)
+{
+    int32_t step_x = a * (w - 1);
+    int32_t step_y = b * (h - 1);
+    return edge + Min(step_x, 0) + Min(step_y, 0);
+}
+
+static inline int32_t
+renderer_edge_block_max(int32_t edge, int32_t a, int32_t b, int32_t w, int32_t h)
+{
+    int32_t step_x = a * (w - 1);
+    int32_t step_y = b * (h - 1);
+    return edge + Max(step_x, 0) + Max(step_y, 0);
+}
+
+#endif // RENDERER_SPAN_INCLUDED
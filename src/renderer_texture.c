@@ -0,0 +1,454 @@
+// renderer_texture.c
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "math.h"
+#include "renderer.h"
+#include "renderer_span.h"
+#include "renderer_texture.h"
+#include "renderer_varying.h"
+
+#ifdef RENDERER_SPAN_X86
+#include <immintrin.h>
+#endif
+
+// Texel blocks start on a cache line
+#define RENDERER_TEXTURE_ALIGNMENT 64
+
+static int32_t
+renderer_texture_is_power_of_two(int32_t value)
+{
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+static int32_t
+renderer_texture_log2(int32_t value)
+{
+    int32_t result = 0;
+    while ((1 << (result + 1)) <= value)
+    {
+        ++result;
+    }
+
+    return result;
+}
+
+// Average of four packed ARGB texels, per channel and rounded
+static uint32_t
+renderer_texture_average(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3)
+{
+    uint32_t result = 0;
+    for (int32_t shift = 0; shift < 32; shift += 8)
+    {
+        uint32_t sum = ((c0 >> shift) & 0xff) + ((c1 >> shift) & 0xff) + ((c2 >> shift) & 0xff) +
+            ((c3 >> shift) & 0xff);
+        result |= ((sum + 2) >> 2) << shift;
+    }
+
+    return result;
+}
+
+RendererTexture*
+renderer_texture_create(int32_t width, int32_t height, const uint32_t* pixels)
+{
+    if (!renderer_texture_is_power_of_two(width) || !renderer_texture_is_power_of_two(height))
+    {
+        return 0;
+    }
+
+    int32_t level_count = renderer_texture_log2(Max(width, height)) + 1;
+    if (level_count > RENDERER_TEXTURE_MAX_LEVELS)
+    {
+        return 0;
+    }
+
+    RendererTexture texture = {0};
+    texture.level_count = level_count;
+
+    uintptr_t texel_count = 0;
+    for (int32_t i = 0; i < level_count; ++i)
+    {
+        RendererTextureLevel* level = &texture.levels[i];
+        level->width = Max(width >> i, 1);
+        level->height = Max(height >> i, 1);
+        level->block_count_x = (level->width + RENDERER_TEXTURE_BLOCK_SIZE - 1) / RENDERER_TEXTURE_BLOCK_SIZE;
+
+        int32_t block_count_y = (level->height + RENDERER_TEXTURE_BLOCK_SIZE - 1) / RENDERER_TEXTURE_BLOCK_SIZE;
+        texel_count += (uintptr_t)level->block_count_x * block_count_y *
+            RENDERER_TEXTURE_BLOCK_SIZE * RENDERER_TEXTURE_BLOCK_SIZE;
+    }
+
+    uintptr_t texture_size = sizeof(RendererTexture) + RENDERER_TEXTURE_ALIGNMENT + texel_count * sizeof(uint32_t);
+    RendererTexture* result = malloc(texture_size);
+    if (!result)
+    {
+        return 0;
+    }
+
+    *result = texture;
+
+    uintptr_t texels = ((uintptr_t)(result + 1) + RENDERER_TEXTURE_ALIGNMENT - 1) &
+        ~(uintptr_t)(RENDERER_TEXTURE_ALIGNMENT - 1);
+
+    for (int32_t i = 0; i < level_count; ++i)
+    {
+        RendererTextureLevel* level = &result->levels[i];
+        int32_t block_count_y = (level->height + RENDERER_TEXTURE_BLOCK_SIZE - 1) / RENDERER_TEXTURE_BLOCK_SIZE;
+
+        level->texels = (uint32_t*)texels;
+        texels += (uintptr_t)level->block_count_x * block_count_y *
+            RENDERER_TEXTURE_BLOCK_SIZE * RENDERER_TEXTURE_BLOCK_SIZE * sizeof(uint32_t);
+    }
+
+    RendererTextureLevel* top = &result->levels[0];
+    for (int32_t y = 0; y < height; ++y)
+    {
+        for (int32_t x = 0; x < width; ++x)
+        {
+            top->texels[renderer_texture_texel_index(top, x, y)] = pixels[y * width + x];
+        }
+    }
+
+    // Each level box filters the one above, a side that is already 1 texel
+    // wide only halves the other way
+    for (int32_t i = 1; i < level_count; ++i)
+    {
+        RendererTextureLevel* source = &result->levels[i - 1];
+        RendererTextureLevel* level = &result->levels[i];
+
+        for (int32_t y = 0; y < level->height; ++y)
+        {
+            int32_t y0 = Min(y * 2, source->height - 1);
+            int32_t y1 = Min(y * 2 + 1, source->height - 1);
+
+            for (int32_t x = 0; x < level->width; ++x)
+            {
+                int32_t x0 = Min(x * 2, source->width - 1);
+                int32_t x1 = Min(x * 2 + 1, source->width - 1);
+
+                level->texels[renderer_texture_texel_index(level, x, y)] = renderer_texture_average(
+                    source->texels[renderer_texture_texel_index(source, x0, y0)],
+                    source->texels[renderer_texture_texel_index(source, x1, y0)],
+                    source->texels[renderer_texture_texel_index(source, x0, y1)],
+                    source->texels[renderer_texture_texel_index(source, x1, y1)]);
+            }
+        }
+    }
+
+    return result;
+}
+
+void
+renderer_texture_destroy(RendererTexture* texture)
+{
+    free(texture);
+}
+
+int32_t
+renderer_texture_triangle_level(const RendererTexture* texture, RendererTriangle triangle, const float* u,
+                                const float* v)
+{
+    int32_t pixel_area2 = signed_area2(triangle.p0, triangle.p1, triangle.p2);
+    if (pixel_area2 < 0)
+    {
+        pixel_area2 = -pixel_area2;
+    }
+
+    if (pixel_area2 == 0)
+    {
+        return 0;
+    }
+
+    const RendererTextureLevel* top = &texture->levels[0];
+    float du1 = (u[1] - u[0]) * top->width;
+    float dv1 = (v[1] - v[0]) * top->height;
+    float du2 = (u[2] - u[0]) * top->width;
+    float dv2 = (v[2] - v[0]) * top->height;
+    float texel_area2 = fabsf(du1 * dv2 - du2 * dv1);
+
+    // Each level has a quarter of the texels, so a level per factor of 4
+    float texels_per_pixel = texel_area2 / pixel_area2;
+    if (texels_per_pixel <= 1.0f)
+    {
+        return 0;
+    }
+
+    int32_t level = (int32_t)(0.5f * log2f(texels_per_pixel) + 0.5f);
+    return Min(level, texture->level_count - 1);
+}
+
+// Largest integer not above value, the same as the SSE2 version for any
+// value that fits in an int32
+static inline int32_t
+renderer_texture_floor(float value)
+{
+    int32_t result = (int32_t)value;
+    return value < (float)result ? result - 1 : result;
+}
+
+static void
+renderer_texture_sample_nearest_scalar(const RendererTextureLevel* level, const float* u, const float* v,
+                                       int32_t count, uint32_t* colors)
+{
+    for (int32_t i = 0; i < count; ++i)
+    {
+        int32_t x = renderer_texture_floor(u[i] * level->width) & (level->width - 1);
+        int32_t y = renderer_texture_floor(v[i] * level->height) & (level->height - 1);
+        colors[i] = level->texels[renderer_texture_texel_index(level, x, y)];
+    }
+}
+
+static void
+renderer_texture_sample_bilinear_scalar(const RendererTextureLevel* level, const float* u, const float* v,
+                                        int32_t count, uint32_t* colors)
+{
+    for (int32_t i = 0; i < count; ++i)
+    {
+        // Texel centers are at half texels, positions have 8 fraction bits
+        int32_t s = renderer_texture_floor(u[i] * (level->width * 256.0f)) - 128;
+        int32_t t = renderer_texture_floor(v[i] * (level->height * 256.0f)) - 128;
+
+        int32_t x0 = (s >> 8) & (level->width - 1);
+        int32_t y0 = (t >> 8) & (level->height - 1);
+        int32_t x1 = (x0 + 1) & (level->width - 1);
+        int32_t y1 = (y0 + 1) & (level->height - 1);
+
+        uint32_t c00 = level->texels[renderer_texture_texel_index(level, x0, y0)];
+        uint32_t c10 = level->texels[renderer_texture_texel_index(level, x1, y0)];
+        uint32_t c01 = level->texels[renderer_texture_texel_index(level, x0, y1)];
+        uint32_t c11 = level->texels[renderer_texture_texel_index(level, x1, y1)];
+
+        uint32_t top = renderer_span_lerp(c00, c10, (uint32_t)(s & 0xff));
+        uint32_t bottom = renderer_span_lerp(c01, c11, (uint32_t)(s & 0xff));
+        colors[i] = renderer_span_lerp(top, bottom, (uint32_t)(t & 0xff));
+    }
+}
+
+#ifdef RENDERER_SPAN_X86
+__attribute__((target("sse2")))
+static inline __m128i
+renderer_texture_floor_sse2(__m128 value)
+{
+    __m128i result = _mm_cvttps_epi32(value);
+    __m128 truncated = _mm_cvtepi32_ps(result);
+    return _mm_add_epi32(result, _mm_castps_si128(_mm_cmplt_ps(value, truncated)));
+}
+
+// Texel indices are a row part from y plus a column part from x, the rows of
+// blocks are a power of two texels apart since the level sizes are
+__attribute__((target("sse2")))
+static inline __m128i
+renderer_texture_row_index_sse2(__m128i y, int32_t block_row_shift)
+{
+    __m128i block_row = _mm_sll_epi32(_mm_srli_epi32(y, 2), _mm_cvtsi32_si128(block_row_shift));
+    return _mm_add_epi32(block_row, _mm_slli_epi32(_mm_and_si128(y, _mm_set1_epi32(3)), 2));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i
+renderer_texture_column_index_sse2(__m128i x)
+{
+    return _mm_add_epi32(_mm_slli_epi32(_mm_srli_epi32(x, 2), 4), _mm_and_si128(x, _mm_set1_epi32(3)));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i
+renderer_texture_gather_sse2(const uint32_t* texels, __m128i indices)
+{
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, indices);
+    return _mm_setr_epi32((int32_t)texels[lanes[0]], (int32_t)texels[lanes[1]],
+                          (int32_t)texels[lanes[2]], (int32_t)texels[lanes[3]]);
+}
+
+__attribute__((target("sse2")))
+static void
+renderer_texture_sample_nearest_sse2(const RendererTextureLevel* level, const float* u, const float* v,
+                                     int32_t count, uint32_t* colors)
+{
+    __m128 scale_u = _mm_set1_ps((float)level->width);
+    __m128 scale_v = _mm_set1_ps((float)level->height);
+    __m128i wrap_x = _mm_set1_epi32(level->width - 1);
+    __m128i wrap_y = _mm_set1_epi32(level->height - 1);
+    int32_t block_row_shift = renderer_texture_log2(level->block_count_x) + 4;
+
+    int32_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i x = _mm_and_si128(renderer_texture_floor_sse2(_mm_mul_ps(_mm_loadu_ps(u + i), scale_u)), wrap_x);
+        __m128i y = _mm_and_si128(renderer_texture_floor_sse2(_mm_mul_ps(_mm_loadu_ps(v + i), scale_v)), wrap_y);
+
+        __m128i indices = _mm_add_epi32(renderer_texture_row_index_sse2(y, block_row_shift),
+                                        renderer_texture_column_index_sse2(x));
+        _mm_storeu_si128((__m128i*)(colors + i), renderer_texture_gather_sse2(level->texels, indices));
+    }
+
+    renderer_texture_sample_nearest_scalar(level, u + i, v + i, count - i, colors + i);
+}
+
+__attribute__((target("sse2")))
+static void
+renderer_texture_sample_bilinear_sse2(const RendererTextureLevel* level, const float* u, const float* v,
+                                      int32_t count, uint32_t* colors)
+{
+    __m128 scale_u = _mm_set1_ps(level->width * 256.0f);
+    __m128 scale_v = _mm_set1_ps(level->height * 256.0f);
+    __m128i wrap_x = _mm_set1_epi32(level->width - 1);
+    __m128i wrap_y = _mm_set1_epi32(level->height - 1);
+    __m128i half = _mm_set1_epi32(128);
+    __m128i fraction_mask = _mm_set1_epi32(0xff);
+    __m128i one = _mm_set1_epi32(1);
+    __m128i zero = _mm_setzero_si128();
+    int32_t block_row_shift = renderer_texture_log2(level->block_count_x) + 4;
+
+    int32_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i s = _mm_sub_epi32(renderer_texture_floor_sse2(_mm_mul_ps(_mm_loadu_ps(u + i), scale_u)), half);
+        __m128i t = _mm_sub_epi32(renderer_texture_floor_sse2(_mm_mul_ps(_mm_loadu_ps(v + i), scale_v)), half);
+
+        __m128i x0 = _mm_and_si128(_mm_srai_epi32(s, 8), wrap_x);
+        __m128i y0 = _mm_and_si128(_mm_srai_epi32(t, 8), wrap_y);
+        __m128i x1 = _mm_and_si128(_mm_add_epi32(x0, one), wrap_x);
+        __m128i y1 = _mm_and_si128(_mm_add_epi32(y0, one), wrap_y);
+
+        __m128i row0 = renderer_texture_row_index_sse2(y0, block_row_shift);
+        __m128i row1 = renderer_texture_row_index_sse2(y1, block_row_shift);
+        __m128i column0 = renderer_texture_column_index_sse2(x0);
+        __m128i column1 = renderer_texture_column_index_sse2(x1);
+
+        __m128i c00 = renderer_texture_gather_sse2(level->texels, _mm_add_epi32(row0, column0));
+        __m128i c10 = renderer_texture_gather_sse2(level->texels, _mm_add_epi32(row0, column1));
+        __m128i c01 = renderer_texture_gather_sse2(level->texels, _mm_add_epi32(row1, column0));
+        __m128i c11 = renderer_texture_gather_sse2(level->texels, _mm_add_epi32(row1, column1));
+
+        // Weights repeated for the 4 channels of each pixel, pixels 0 and 1
+        // in the low and 2 and 3 in the high vectors
+        __m128i fx = _mm_packs_epi32(_mm_and_si128(s, fraction_mask), zero);
+        __m128i fy = _mm_packs_epi32(_mm_and_si128(t, fraction_mask), zero);
+        fx = _mm_unpacklo_epi16(fx, fx);
+        fy = _mm_unpacklo_epi16(fy, fy);
+        __m128i fx_low = _mm_unpacklo_epi32(fx, fx);
+        __m128i fx_high = _mm_unpackhi_epi32(fx, fx);
+        __m128i fy_low = _mm_unpacklo_epi32(fy, fy);
+        __m128i fy_high = _mm_unpackhi_epi32(fy, fy);
+
+        __m128i top_low = renderer_span_lerp_sse2(_mm_unpacklo_epi8(c00, zero), _mm_unpacklo_epi8(c10, zero), fx_low);
+        __m128i top_high = renderer_span_lerp_sse2(_mm_unpackhi_epi8(c00, zero), _mm_unpackhi_epi8(c10, zero), fx_high);
+        __m128i bottom_low = renderer_span_lerp_sse2(_mm_unpacklo_epi8(c01, zero), _mm_unpacklo_epi8(c11, zero),
+                                                     fx_low);
+        __m128i bottom_high = renderer_span_lerp_sse2(_mm_unpackhi_epi8(c01, zero), _mm_unpackhi_epi8(c11, zero),
+                                                      fx_high);
+
+        __m128i result_low = renderer_span_lerp_sse2(top_low, bottom_low, fy_low);
+        __m128i result_high = renderer_span_lerp_sse2(top_high, bottom_high, fy_high);
+        _mm_storeu_si128((__m128i*)(colors + i), _mm_packus_epi16(result_low, result_high));
+    }
+
+    renderer_texture_sample_bilinear_scalar(level, u + i, v + i, count - i, colors + i);
+}
+#endif
+
+void
+renderer_texture_sample_nearest(const RendererTextureLevel* level, const float* u, const float* v, int32_t count,
+                                uint32_t* colors)
+{
+#ifdef RENDERER_SPAN_X86
+    if (renderer_get_simd_level() >= RENDERER_SIMD_SSE2)
+    {
+        renderer_texture_sample_nearest_sse2(level, u, v, count, colors);
+        return;
+    }
+#endif
+
+    renderer_texture_sample_nearest_scalar(level, u, v, count, colors);
+}
+
+void
+renderer_texture_sample_bilinear(const RendererTextureLevel* level, const float* u, const float* v, int32_t count,
+                                 uint32_t* colors)
+{
+#ifdef RENDERER_SPAN_X86
+    if (renderer_get_simd_level() >= RENDERER_SIMD_SSE2)
+    {
+        renderer_texture_sample_bilinear_sse2(level, u, v, count, colors);
+        return;
+    }
+#endif
+
+    renderer_texture_sample_bilinear_scalar(level, u, v, count, colors);
+}
+
+static inline void
+renderer_shade_texture_nearest(const float* varyings, const uint8_t* mask, int32_t count, uint32_t* pixels,
+                               const void* user_data)
+{
+    const RendererTextureSampler* sampler = user_data;
+    uint32_t colors[RENDERER_BLOCK_SIZE];
+
+    renderer_texture_sample_nearest(&sampler->texture->levels[sampler->level], varyings,
+                                    varyings + RENDERER_BLOCK_SIZE, count, colors);
+
+    for (int32_t x = 0; x < count; ++x)
+    {
+        if (mask[x])
+        {
+            pixels[x] = colors[x];
+        }
+    }
+}
+
+static inline void
+renderer_shade_texture_bilinear(const float* varyings, const uint8_t* mask, int32_t count, uint32_t* pixels,
+                                const void* user_data)
+{
+    const RendererTextureSampler* sampler = user_data;
+    uint32_t colors[RENDERER_BLOCK_SIZE];
+
+    renderer_texture_sample_bilinear(&sampler->texture->levels[sampler->level], varyings,
+                                     varyings + RENDERER_BLOCK_SIZE, count, colors);
+
+    for (int32_t x = 0; x < count; ++x)
+    {
+        if (mask[x])
+        {
+            pixels[x] = colors[x];
+        }
+    }
+}
+
+static RENDERER_VARYING_DEFINE_SPAN_RASTERIZER(renderer_fill_triangle_texture_nearest, 2,
+                                               RENDERER_VARYING_PERSPECTIVE, renderer_shade_texture_nearest)
+
+static RENDERER_VARYING_DEFINE_SPAN_RASTERIZER(renderer_fill_triangle_texture_bilinear, 2,
+                                               RENDERER_VARYING_PERSPECTIVE, renderer_shade_texture_bilinear)
+
+void
+renderer_fill_triangle_textured(RendererTargetBuffer buffer, const RendererVaryingTriangle* triangle,
+                                RendererRect clip, const RendererTexture* texture, RendererTextureFilter filter)
+{
+    RendererTriangle positions = {
+        triangle->v0.position, triangle->v1.position, triangle->v2.position
+    };
+    float u[3] = {
+        triangle->v0.varyings[0], triangle->v1.varyings[0], triangle->v2.varyings[0]
+    };
+    float v[3] = {
+        triangle->v0.varyings[1], triangle->v1.varyings[1], triangle->v2.varyings[1]
+    };
+
+    RendererTextureSampler sampler = {
+        texture, renderer_texture_triangle_level(texture, positions, u, v)
+    };
+
+    if (filter == RENDERER_TEXTURE_BILINEAR)
+    {
+        renderer_fill_triangle_texture_bilinear(buffer, triangle, clip, &sampler);
+    }
+    else
+    {
+        renderer_fill_triangle_texture_nearest(buffer, triangle, clip, &sampler);
+    }
+}
@@ -0,0 +1,88 @@
+// renderer_texture.h
+
+#ifndef RENDERER_TEXTURE_INCLUDED
+#define RENDERER_TEXTURE_INCLUDED
+
+#include <stdint.h>
+
+#include "renderer.h"
+#include "renderer_varying.h"
+
+// Texels are stored in square blocks of this many texels, 64 bytes each, so
+// a bilinear footprint usually touches one cache line whatever the direction
+// the texture is walked in
+#define RENDERER_TEXTURE_BLOCK_SIZE 4
+
+// Enough levels for a 32768 texel wide texture
+#define RENDERER_TEXTURE_MAX_LEVELS 16
+
+typedef struct RendererTextureLevel {
+    int32_t width;
+    int32_t height;
+    // Blocks per row of blocks, the level is padded to whole blocks
+    int32_t block_count_x;
+    // Packed ARGB texels, blocks row major and texels row major within
+    uint32_t* texels;
+} RendererTextureLevel;
+
+// Power of two texture with its full mip chain down to 1x1 texels, wrapping
+// in both directions
+typedef struct RendererTexture {
+    int32_t level_count;
+    RendererTextureLevel levels[RENDERER_TEXTURE_MAX_LEVELS];
+} RendererTexture;
+
+typedef enum RendererTextureFilter {
+    RENDERER_TEXTURE_NEAREST = 0,
+    RENDERER_TEXTURE_BILINEAR = 1,
+} RendererTextureFilter;
+
+// What a textured rasterizer samples, as its user_data
+typedef struct RendererTextureSampler {
+    const RendererTexture* texture;
+    int32_t level;
+} RendererTextureSampler;
+
+// Index of texel x, y within level
+static inline int32_t
+renderer_texture_texel_index(const RendererTextureLevel* level, int32_t x, int32_t y)
+{
+    int32_t block_index = (y / RENDERER_TEXTURE_BLOCK_SIZE) * level->block_count_x + x / RENDERER_TEXTURE_BLOCK_SIZE;
+    int32_t texel_index = (y & (RENDERER_TEXTURE_BLOCK_SIZE - 1)) * RENDERER_TEXTURE_BLOCK_SIZE +
+        (x & (RENDERER_TEXTURE_BLOCK_SIZE - 1));
+
+    return block_index * RENDERER_TEXTURE_BLOCK_SIZE * RENDERER_TEXTURE_BLOCK_SIZE + texel_index;
+}
+
+// Texture from width by height row major ARGB pixels, with every mip level
+// box filtered from the one above. Returns 0 unless both sizes are powers of
+// two.
+RendererTexture*
+renderer_texture_create(int32_t width, int32_t height, const uint32_t* pixels);
+
+void
+renderer_texture_destroy(RendererTexture* texture);
+
+// Mip level matching the texel to pixel ratio of a triangle with texture
+// coordinates u and v at its three vertices, rounded to the nearest level
+int32_t
+renderer_texture_triangle_level(const RendererTexture* texture, RendererTriangle triangle, const float* u,
+                                const float* v);
+
+// Sample count texels of level at texture coordinates u, v, where 0 to 1
+// covers the texture once. Bilinear output is the same at every SIMD level.
+void
+renderer_texture_sample_nearest(const RendererTextureLevel* level, const float* u, const float* v, int32_t count,
+                                uint32_t* colors);
+
+void
+renderer_texture_sample_bilinear(const RendererTextureLevel* level, const float* u, const float* v, int32_t count,
+                                 uint32_t* colors);
+
+// Draw triangle textured with perspective correct varyings 0 and 1 as u and
+// v, from the mip level its size on screen picks
+void
+renderer_fill_triangle_textured(RendererTargetBuffer buffer, const RendererVaryingTriangle* triangle,
+                                RendererRect clip, const RendererTexture* texture, RendererTextureFilter filter);
+
+#endif // RENDERER_TEXTURE_INCLUDED
@@ -0,0 +1,91 @@
+// renderer_varying.c
+
+#include <stdint.h>
+
+#include "renderer.h"
+#include "renderer_varying.h"
+
+static inline uint32_t
+renderer_varying_channel(float value)
+{
+    // Interpolation can overshoot the vertex values by a rounding error
+    if (value <= 0.0f)
+    {
+        return 0;
+    }
+
+    if (value >= 255.0f)
+    {
+        return 255;
+    }
+
+    return (uint32_t)value;
+}
+
+static inline uint32_t
+renderer_shade_color(const float* varyings, float z, const void* user_data)
+{
+    uint32_t r = renderer_varying_channel(varyings[0]);
+    uint32_t g = renderer_varying_channel(varyings[1]);
+    uint32_t b = renderer_varying_channel(varyings[2]);
+
+    return PackColorRGB(r, g, b);
+}
+
+static inline uint32_t
+renderer_shade_uv(const float* varyings, float z, const void* user_data)
+{
+    uint32_t r = renderer_varying_channel(varyings[0] * 255.0f);
+    uint32_t g = renderer_varying_channel(varyings[1] * 255.0f);
+
+    return PackColorRGB(r, g, 0);
+}
+
+static inline uint32_t
+renderer_shade_depth(const float* varyings, float z, const void* user_data)
+{
+    uint32_t gray = renderer_varying_channel((1.0f - z) * 255.0f);
+
+    return PackColorRGB(gray, gray, gray);
+}
+
+RendererVaryingTriangle
+renderer_varying_triangle_from_colors(RendererTriangle triangle)
+{
+    RendererVaryingTriangle result = {0};
+    RendererVaryingVertex* vertices[3] = {
+        &result.v0, &result.v1, &result.v2
+    };
+    RendererPoint positions[3] = {
+        triangle.p0, triangle.p1, triangle.p2
+    };
+    uint32_t colors[3] = {
+        triangle.c0, triangle.c1, triangle.c2
+    };
+
+    for (int32_t i = 0; i < 3; ++i)
+    {
+        uint8_t r; uint8_t g; uint8_t b;
+        UnpackColorRGB(colors[i], r, g, b);
+
+        vertices[i]->position = positions[i];
+        vertices[i]->inverse_w = 1.0f;
+        vertices[i]->varyings[0] = r;
+        vertices[i]->varyings[1] = g;
+        vertices[i]->varyings[2] = b;
+    }
+
+    return result;
+}
+
+RENDERER_VARYING_DEFINE_RASTERIZER(renderer_fill_triangle_varying_color, 3, RENDERER_VARYING_AFFINE,
+                                   renderer_shade_color)
+
+RENDERER_VARYING_DEFINE_RASTERIZER(renderer_fill_triangle_varying_color_perspective, 3,
+                                   RENDERER_VARYING_PERSPECTIVE, renderer_shade_color)
+
+RENDERER_VARYING_DEFINE_RASTERIZER(renderer_fill_triangle_varying_uv, 2, RENDERER_VARYING_PERSPECTIVE,
+                                   renderer_shade_uv)
+
+RENDERER_VARYING_DEFINE_RASTERIZER(renderer_fill_triangle_varying_depth, 0, RENDERER_VARYING_AFFINE,
+                                   renderer_shade_depth)
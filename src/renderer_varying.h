@@ -0,0 +1,423 @@
+// renderer_varying.h
+
+#ifndef RENDERER_VARYING_INCLUDED
+#define RENDERER_VARYING_INCLUDED
+
+#include <stdint.h>
+
+#include "math.h"
+#include "profiler.h"
+#include "renderer.h"
+#include "renderer_span.h"
+
+// Most per vertex attributes a rasterizer variant can interpolate
+#define RENDERER_VARYING_MAX 8
+
+typedef enum RendererVaryingInterpolation {
+    // Linear in screen space, right for 2D and for attributes where the
+    // distortion does not show
+    RENDERER_VARYING_AFFINE = 0,
+    // Linear in clip space, varyings are interpolated divided by w and
+    // multiplied back by the interpolated w at every pixel
+    RENDERER_VARYING_PERSPECTIVE = 1,
+} RendererVaryingInterpolation;
+
+typedef struct RendererVaryingVertex {
+    RendererPoint position;
+    // 1 / clip space w, only read by perspective correct variants
+    float inverse_w;
+    float varyings[RENDERER_VARYING_MAX];
+} RendererVaryingVertex;
+
+typedef struct RendererVaryingTriangle {
+    RendererVaryingVertex v0;
+    RendererVaryingVertex v1;
+    RendererVaryingVertex v2;
+} RendererVaryingTriangle;
+
+// Color of one pixel from its interpolated varyings and depth
+typedef uint32_t RendererPixelShader(const float* varyings, float z, const void* user_data);
+
+// Colors of up to RENDERER_BLOCK_SIZE pixels of one row at once, for shaders
+// that work on several pixels together. Varying i of pixel x is at
+// varyings[i * RENDERER_BLOCK_SIZE + x], only pixels with mask[x] set may be
+// written and the varyings of the others are 0.
+typedef void RendererSpanShader(const float* varyings, const uint8_t* mask, int32_t count, uint32_t* pixels,
+                                const void* user_data);
+
+// Fill the pixels of triangle inside clip. Coverage, winding, depth values
+// and depth test are the same as renderer_fill_triangle_clipped, so variants
+// and the color rasterizer can draw into one target.
+typedef void RendererVaryingRasterizer(RendererTargetBuffer buffer, const RendererVaryingTriangle* triangle,
+                                       RendererRect clip, const void* user_data);
+
+static inline int32_t
+renderer_varying_has_depth(RendererTargetBuffer buffer)
+{
+    return buffer.depth && buffer.depth->width == buffer.width && buffer.depth->height == buffer.height;
+}
+
+// Pack the pixels of mask among count shaded 0x00RRGGBB colors into a row
+// of format
+static inline void
+renderer_varying_store_row(RendererPixelFormat format, uint8_t* row, const uint32_t* colors, const uint8_t* mask,
+                           int32_t count)
+{
+    for (int32_t x = 0; x < count; ++x)
+    {
+        if (mask[x])
+        {
+            renderer_span_store(row, x, colors[x], format);
+        }
+    }
+}
+
+// Rasterizer shared by every variant, always inlined into a wrapper with
+// constant varying_count, perspective, has_depth and shader arguments, so
+// the pixel loop is specialized for each of them. Exactly one of shader and
+// span_shader is set.
+__attribute__((always_inline))
+static inline void
+renderer_varying_fill_generic(RendererTargetBuffer buffer, const RendererVaryingTriangle* triangle,
+                              RendererRect clip, const void* user_data, int32_t varying_count, int perspective,
+                              int has_depth, RendererPixelShader* shader, RendererSpanShader* span_shader)
+{
+    RendererPoint p0 = triangle->v0.position;
+    RendererPoint p1 = triangle->v1.position;
+    RendererPoint p2 = triangle->v2.position;
+
+    int32_t min_x = Min3(p0.x, p1.x, p2.x);
+    int32_t max_x = Max3(p0.x, p1.x, p2.x);
+    int32_t min_y = Min3(p0.y, p1.y, p2.y);
+    int32_t max_y = Max3(p0.y, p1.y, p2.y);
+
+    int32_t clip_max_x = clip.x + clip.w;
+    int32_t clip_max_y = clip.y + clip.h;
+    min_x = Max(min_x, clip.x);
+    min_y = Max(min_y, clip.y);
+    max_x = Min(max_x, clip_max_x);
+    max_y = Min(max_y, clip_max_y);
+
+    if (min_x >= max_x || min_y >= max_y)
+    {
+        return;
+    }
+
+    RendererPoint test_p = { min_x, min_y };
+    int32_t bcoord_row0 = signed_area2(p1, p2, test_p);
+    int32_t bcoord_row1 = signed_area2(p2, p0, test_p);
+    int32_t bcoord_row2 = signed_area2(p0, p1, test_p);
+
+    int32_t total_area2 = bcoord_row0 + bcoord_row1 + bcoord_row2;
+    if (total_area2 <= 0)
+    {
+        return;
+    }
+
+    if (buffer.dirty)
+    {
+        RendererRect bounds = {
+            min_x, min_y, max_x - min_x, max_y - min_y
+        };
+
+        renderer_dirty_rects_add(buffer.dirty, bounds);
+    }
+
+    int32_t a12 = p1.y - p2.y; int32_t b12 = p2.x - p1.x;
+    int32_t a20 = p2.y - p0.y; int32_t b20 = p0.x - p2.x;
+    int32_t a01 = p0.y - p1.y; int32_t b01 = p1.x - p0.x;
+
+    float total_area2_inv = 1.0f / total_area2;
+
+    // Plane of each varying over the edge functions bcoord1/2, followed by
+    // the plane of 1 / w when perspective correct
+    float weight0 = perspective ? triangle->v0.inverse_w : 1.0f;
+    float weight1 = perspective ? triangle->v1.inverse_w : 1.0f;
+    float weight2 = perspective ? triangle->v2.inverse_w : 1.0f;
+
+    float base[RENDERER_VARYING_MAX + 1];
+    float gradient1[RENDERER_VARYING_MAX + 1];
+    float gradient2[RENDERER_VARYING_MAX + 1];
+
+    for (int32_t i = 0; i < varying_count; ++i)
+    {
+        float value0 = triangle->v0.varyings[i] * weight0;
+        float value1 = triangle->v1.varyings[i] * weight1;
+        float value2 = triangle->v2.varyings[i] * weight2;
+
+        base[i] = value0;
+        gradient1[i] = (value1 - value0) * total_area2_inv;
+        gradient2[i] = (value2 - value0) * total_area2_inv;
+    }
+
+    if (perspective)
+    {
+        base[varying_count] = weight0;
+        gradient1[varying_count] = (weight1 - weight0) * total_area2_inv;
+        gradient2[varying_count] = (weight2 - weight0) * total_area2_inv;
+    }
+
+    // Same depth plane as the color rasterizer
+    RendererSpanSetup depth_setup;
+    depth_setup.z0 = p0.z;
+    depth_setup.z10 = (p1.z - p0.z) * total_area2_inv;
+    depth_setup.z20 = (p2.z - p0.z) * total_area2_inv;
+
+    RendererDepthBuffer* depth_buffer = has_depth ? buffer.depth : 0;
+
+    float z_dx = a20 * depth_setup.z10 + a01 * depth_setup.z20;
+    float z_dy = b20 * depth_setup.z10 + b01 * depth_setup.z20;
+    float triangle_z_min = Min3(p0.z, p1.z, p2.z);
+    float triangle_z_max = Max3(p0.z, p1.z, p2.z);
+
+    int32_t shaded_pixel_count = 0;
+
+    int32_t block_min_x = min_x & ~(RENDERER_BLOCK_SIZE - 1);
+    int32_t block_min_y = min_y & ~(RENDERER_BLOCK_SIZE - 1);
+
+    for (int32_t block_y = block_min_y; block_y < max_y; block_y += RENDERER_BLOCK_SIZE)
+    {
+        int32_t y0 = Max(block_y, min_y);
+        int32_t y1 = Min(block_y + RENDERER_BLOCK_SIZE, max_y);
+
+        for (int32_t block_x = block_min_x; block_x < max_x; block_x += RENDERER_BLOCK_SIZE)
+        {
+            int32_t x0 = Max(block_x, min_x);
+            int32_t x1 = Min(block_x + RENDERER_BLOCK_SIZE, max_x);
+            int32_t w = x1 - x0;
+            int32_t h = y1 - y0;
+
+            int32_t bcoord0 = bcoord_row0 + (x0 - min_x) * a12 + (y0 - min_y) * b12;
+            int32_t bcoord1 = bcoord_row1 + (x0 - min_x) * a20 + (y0 - min_y) * b20;
+            int32_t bcoord2 = bcoord_row2 + (x0 - min_x) * a01 + (y0 - min_y) * b01;
+
+            if (renderer_edge_block_max(bcoord0, a12, b12, w, h) < 0 ||
+                renderer_edge_block_max(bcoord1, a20, b20, w, h) < 0 ||
+                renderer_edge_block_max(bcoord2, a01, b01, w, h) < 0)
+            {
+                continue;
+            }
+
+            int32_t covered =
+                (renderer_edge_block_min(bcoord0, a12, b12, w, h) |
+                 renderer_edge_block_min(bcoord1, a20, b20, w, h) |
+                 renderer_edge_block_min(bcoord2, a01, b01, w, h)) >= 0;
+
+            int32_t block_index = 0;
+            int32_t depth_test = 0;
+            float* block_depth = 0;
+            float block_z_min = 0.0f;
+            float block_z_max = 0.0f;
+
+            if (has_depth)
+            {
+                float z = renderer_span_depth(&depth_setup, bcoord1, bcoord2);
+                float z_extent_x = z_dx * (w - 1);
+                float z_extent_y = z_dy * (h - 1);
+
+                block_z_min = z + Min(z_extent_x, 0.0f) + Min(z_extent_y, 0.0f);
+                block_z_max = z + Max(z_extent_x, 0.0f) + Max(z_extent_y, 0.0f);
+                block_z_min = Max(block_z_min, triangle_z_min) - RENDERER_DEPTH_EPSILON;
+                block_z_max = Min(block_z_max, triangle_z_max) + RENDERER_DEPTH_EPSILON;
+
+                block_index = block_x / RENDERER_BLOCK_SIZE +
+                    block_y / RENDERER_BLOCK_SIZE * depth_buffer->block_count_x;
+
+                if (block_z_min >= depth_buffer->block_max[block_index])
+                {
+                    continue;
+                }
+
+                block_depth = depth_buffer->depth + block_index * RENDERER_BLOCK_SIZE * RENDERER_BLOCK_SIZE +
+                    (y0 - block_y) * RENDERER_BLOCK_SIZE + (x0 - block_x);
+
+                depth_test = block_z_max >= depth_buffer->block_min[block_index];
+            }
+
+            shaded_pixel_count += w * h;
+
+            for (int32_t y = y0; y < y1; ++y)
+            {
+                uint8_t* row = buffer.pixels + IndexPixel(x0, y, buffer);
+                int32_t edge0 = bcoord0;
+                int32_t edge1 = bcoord1;
+                int32_t edge2 = bcoord2;
+
+                // Shaders write 0x00RRGGBB, rows of any other format are
+                // shaded aside and packed once done
+                uint32_t row_colors[RENDERER_BLOCK_SIZE];
+                int32_t packed = buffer.format != RENDERER_PIXEL_FORMAT_XRGB8888;
+                uint32_t* row_pixels = packed ? row_colors : (uint32_t*)row;
+
+                float row_varyings[RENDERER_VARYING_MAX * RENDERER_BLOCK_SIZE];
+                uint8_t row_mask[RENDERER_BLOCK_SIZE];
+                int32_t row_any = 0;
+
+                for (int32_t x = 0; x < w; ++x)
+                {
+                    if (span_shader || packed)
+                    {
+                        row_mask[x] = 0;
+                    }
+
+                    if (span_shader)
+                    {
+                        for (int32_t i = 0; i < varying_count; ++i)
+                        {
+                            row_varyings[i * RENDERER_BLOCK_SIZE + x] = 0.0f;
+                        }
+                    }
+
+                    if (covered || (edge0|edge1|edge2) >= 0)
+                    {
+                        float z = renderer_span_depth(&depth_setup, edge1, edge2);
+
+                        if (!has_depth || !depth_test || z < block_depth[x])
+                        {
+                            float e1 = (float)edge1;
+                            float e2 = (float)edge2;
+                            float varyings[RENDERER_VARYING_MAX];
+                            float w_scale = 1.0f;
+
+                            if (perspective)
+                            {
+                                float inverse_w = base[varying_count] + e1 * gradient1[varying_count];
+                                inverse_w = inverse_w + e2 * gradient2[varying_count];
+                                w_scale = 1.0f / inverse_w;
+                            }
+
+                            for (int32_t i = 0; i < varying_count; ++i)
+                            {
+                                float value = base[i] + e1 * gradient1[i];
+                                value = value + e2 * gradient2[i];
+                                varyings[i] = perspective ? value * w_scale : value;
+                            }
+
+                            if (span_shader)
+                            {
+                                for (int32_t i = 0; i < varying_count; ++i)
+                                {
+                                    row_varyings[i * RENDERER_BLOCK_SIZE + x] = varyings[i];
+                                }
+                            }
+                            else
+                            {
+                                row_pixels[x] = shader(varyings, z, user_data);
+                            }
+
+                            if (span_shader || packed)
+                            {
+                                row_mask[x] = 1;
+                                row_any = 1;
+                            }
+
+                            if (has_depth)
+                            {
+                                block_depth[x] = z;
+                            }
+                        }
+                    }
+
+                    edge0 += a12;
+                    edge1 += a20;
+                    edge2 += a01;
+                }
+
+                if (span_shader && row_any)
+                {
+                    span_shader(row_varyings, row_mask, w, row_pixels, user_data);
+                }
+
+                if (packed && row_any)
+                {
+                    renderer_varying_store_row(buffer.format, row, row_colors, row_mask, w);
+                }
+
+                if (has_depth)
+                {
+                    block_depth += RENDERER_BLOCK_SIZE;
+                }
+
+                bcoord0 += b12;
+                bcoord1 += b20;
+                bcoord2 += b01;
+            }
+
+            if (has_depth)
+            {
+                depth_buffer->block_min[block_index] =
+                    Min(depth_buffer->block_min[block_index], block_z_min);
+
+                int32_t block_end_x = Min(block_x + RENDERER_BLOCK_SIZE, buffer.width);
+                int32_t block_end_y = Min(block_y + RENDERER_BLOCK_SIZE, buffer.height);
+                if (covered && x0 == block_x && y0 == block_y && x1 == block_end_x && y1 == block_end_y)
+                {
+                    depth_buffer->block_max[block_index] =
+                        Min(depth_buffer->block_max[block_index], block_z_max);
+                }
+            }
+        }
+    }
+
+    ProfilerCount(PROFILER_COUNTER_TRIANGLES_RASTERIZED, 1);
+    ProfilerCount(PROFILER_COUNTER_PIXELS_SHADED, shaded_pixel_count);
+}
+
+#define RENDERER_VARYING_DEFINE_GENERIC(name, varying_count, interpolation, shader, span_shader)           \
+    void                                                                                                 \
+    name(RendererTargetBuffer buffer, const RendererVaryingTriangle* triangle, RendererRect clip,        \
+         const void* user_data)                                                                          \
+    {                                                                                                    \
+        _Static_assert((varying_count) <= RENDERER_VARYING_MAX, #name " has too many varyings");         \
+        if (renderer_varying_has_depth(buffer))                                                          \
+        {                                                                                                \
+            renderer_varying_fill_generic(buffer, triangle, clip, user_data, varying_count,              \
+                                          (interpolation) == RENDERER_VARYING_PERSPECTIVE, 1, shader,    \
+                                          span_shader);                                                  \
+        }                                                                                                \
+        else                                                                                             \
+        {                                                                                                \
+            renderer_varying_fill_generic(buffer, triangle, clip, user_data, varying_count,              \
+                                          (interpolation) == RENDERER_VARYING_PERSPECTIVE, 0, shader,    \
+                                          span_shader);                                                  \
+        }                                                                                                \
+    }
+
+// Define name as a RendererVaryingRasterizer interpolating varying_count
+// varyings the RendererVaryingInterpolation way and coloring pixels with
+// shader, a static inline RendererPixelShader. All three are fixed at compile
+// time, so the pixel loop has no branches on them and the shader is inlined.
+// Depth testing is picked once per triangle. Prefix with static for a
+// variant private to one file.
+#define RENDERER_VARYING_DEFINE_RASTERIZER(name, varying_count, interpolation, shader) \
+    RENDERER_VARYING_DEFINE_GENERIC(name, varying_count, interpolation, shader, 0)
+
+// Same with a RendererSpanShader called once per block row
+#define RENDERER_VARYING_DEFINE_SPAN_RASTERIZER(name, varying_count, interpolation, span_shader) \
+    RENDERER_VARYING_DEFINE_GENERIC(name, varying_count, interpolation, 0, span_shader)
+
+// Varying triangle with the positions of triangle and its colors as
+// varyings 0 to 2, red, green and blue from 0 to 255. inverse_w is 1.
+RendererVaryingTriangle
+renderer_varying_triangle_from_colors(RendererTriangle triangle);
+
+// Varyings 0 to 2 are red, green and blue from 0 to 255
+void
+renderer_fill_triangle_varying_color(RendererTargetBuffer buffer, const RendererVaryingTriangle* triangle,
+                                     RendererRect clip, const void* user_data);
+
+void
+renderer_fill_triangle_varying_color_perspective(RendererTargetBuffer buffer, const RendererVaryingTriangle* triangle,
+                                                 RendererRect clip, const void* user_data);
+
+// Varyings 0 and 1 are u and v from 0 to 1, shown as red and green
+void
+renderer_fill_triangle_varying_uv(RendererTargetBuffer buffer, const RendererVaryingTriangle* triangle,
+                                  RendererRect clip, const void* user_data);
+
+// No varyings, depth shown from white at 0 to black at 1
+void
+renderer_fill_triangle_varying_depth(RendererTargetBuffer buffer, const RendererVaryingTriangle* triangle,
+                                     RendererRect clip, const void* user_data);
+
+#endif // RENDERER_VARYING_INCLUDED
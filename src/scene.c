@@ -0,0 +1,420 @@
+// scene.c
+
+#include "scene.h"
+#include "profiler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Instances per leaf, more make the tree shallower but test more boxes
+#define SCENE_LEAF_SIZE 4
+
+// Deep enough for any tree built from median splits of int32 instances
+#define SCENE_STACK_SIZE 64
+
+typedef struct SceneNode {
+    MeshBounds bounds;
+    // Right child, the left one directly follows its parent. -1 for leaves.
+    int32_t right;
+    // Range of leaf_instances under this node
+    int32_t first;
+    int32_t count;
+} SceneNode;
+
+Scene*
+scene_create(void)
+{
+    Scene* scene = calloc(1, sizeof(Scene));
+    return scene;
+}
+
+void
+scene_destroy(Scene* scene)
+{
+    free(scene->leaf_instances);
+    free(scene->nodes);
+    free(scene->instances);
+    free(scene);
+}
+
+// Bounds of a transformed box, without transforming all eight corners
+static MeshBounds
+scene_transform_bounds(MeshBounds bounds, Matrix4 m)
+{
+    MeshBounds result;
+    for (int32_t j = 0; j < 3; ++j)
+    {
+        float min = m.m[12 + j];
+        float max = m.m[12 + j];
+        for (int32_t i = 0; i < 3; ++i)
+        {
+            float a = m.m[j + i * 4] * bounds.min.xyz[i];
+            float b = m.m[j + i * 4] * bounds.max.xyz[i];
+            min += a < b ? a : b;
+            max += a < b ? b : a;
+        }
+
+        result.min.xyz[j] = min;
+        result.max.xyz[j] = max;
+    }
+
+    return result;
+}
+
+static MeshBounds
+scene_bounds_union(MeshBounds a, MeshBounds b)
+{
+    MeshBounds result;
+    for (int32_t i = 0; i < 3; ++i)
+    {
+        result.min.xyz[i] = fminf(a.min.xyz[i], b.min.xyz[i]);
+        result.max.xyz[i] = fmaxf(a.max.xyz[i], b.max.xyz[i]);
+    }
+
+    return result;
+}
+
+int32_t
+scene_add_instance(Scene* scene, RendererVertexBuffer vertices, RendererIndexBuffer indices,
+                   MeshBounds bounds, Matrix4 model)
+{
+    if (scene->instance_count == scene->instance_capacity)
+    {
+        scene->instance_capacity = Max(scene->instance_capacity * 2, 64);
+        scene->instances = realloc(scene->instances, scene->instance_capacity * sizeof(SceneInstance));
+    }
+
+    SceneInstance* instance = scene->instances + scene->instance_count;
+    instance->vertices = vertices;
+    instance->indices = indices;
+    instance->bounds = bounds;
+    instance->model = model;
+    instance->world_bounds = scene_transform_bounds(bounds, model);
+
+    scene->needs_build = 1;
+    return scene->instance_count++;
+}
+
+void
+scene_set_model(Scene* scene, int32_t instance, Matrix4 model)
+{
+    scene->instances[instance].model = model;
+    scene->instances[instance].world_bounds = scene_transform_bounds(scene->instances[instance].bounds, model);
+    scene->needs_refit = 1;
+}
+
+// Instances are sorted by copies of their bounds during a build, so the
+// partitioning walks memory linearly instead of chasing instance indices
+typedef struct SceneBuildEntry {
+    MeshBounds bounds;
+    Vector3 centroid;
+    int32_t instance;
+} SceneBuildEntry;
+
+// Partially sort entries so the one at nth has every entry with a smaller
+// centroid on axis before it and none after
+static void
+scene_select(SceneBuildEntry* entries, int32_t count, int32_t nth, int32_t axis)
+{
+    int32_t left = 0;
+    int32_t right = count - 1;
+    while (left < right)
+    {
+        float pivot = entries[(left + right) / 2].centroid.xyz[axis];
+        int32_t i = left;
+        int32_t j = right;
+        while (i <= j)
+        {
+            while (entries[i].centroid.xyz[axis] < pivot)
+            {
+                ++i;
+            }
+
+            while (entries[j].centroid.xyz[axis] > pivot)
+            {
+                --j;
+            }
+
+            if (i <= j)
+            {
+                SceneBuildEntry swap = entries[i];
+                entries[i] = entries[j];
+                entries[j] = swap;
+                ++i;
+                --j;
+            }
+        }
+
+        if (nth <= j)
+        {
+            right = j;
+        }
+        else if (nth >= i)
+        {
+            left = i;
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+// Build the subtree over a range of entries, splitting at the median
+// centroid along the axis the centroids spread the most
+static int32_t
+scene_build_node(Scene* scene, SceneBuildEntry* entries, int32_t first, int32_t count)
+{
+    int32_t node_index = scene->node_count++;
+
+    MeshBounds bounds = entries[first].bounds;
+    MeshBounds centroids = {
+        entries[first].centroid, entries[first].centroid
+    };
+
+    for (int32_t i = first + 1; i < first + count; ++i)
+    {
+        bounds = scene_bounds_union(bounds, entries[i].bounds);
+        for (int32_t axis = 0; axis < 3; ++axis)
+        {
+            centroids.min.xyz[axis] = fminf(centroids.min.xyz[axis], entries[i].centroid.xyz[axis]);
+            centroids.max.xyz[axis] = fmaxf(centroids.max.xyz[axis], entries[i].centroid.xyz[axis]);
+        }
+    }
+
+    int32_t right = -1;
+    if (count > SCENE_LEAF_SIZE)
+    {
+        int32_t axis = 0;
+        for (int32_t i = 1; i < 3; ++i)
+        {
+            if (centroids.max.xyz[i] - centroids.min.xyz[i] > centroids.max.xyz[axis] - centroids.min.xyz[axis])
+            {
+                axis = i;
+            }
+        }
+
+        int32_t left_count = count / 2;
+        scene_select(entries + first, count, left_count, axis);
+
+        scene_build_node(scene, entries, first, left_count);
+        right = scene_build_node(scene, entries, first + left_count, count - left_count);
+    }
+
+    SceneNode* node = scene->nodes + node_index;
+    node->bounds = bounds;
+    node->right = right;
+    node->first = first;
+    node->count = count;
+
+    return node_index;
+}
+
+void
+scene_build(Scene* scene)
+{
+    ProfilerBegin(scene_build);
+
+    // A binary tree with at least one instance per leaf has fewer than
+    // twice as many nodes as instances
+    int32_t instance_count = scene->instance_count;
+    free(scene->nodes);
+    free(scene->leaf_instances);
+    scene->nodes = malloc(Max(instance_count * 2, 1) * sizeof(SceneNode));
+    scene->leaf_instances = malloc(Max(instance_count, 1) * sizeof(int32_t));
+    scene->node_count = 0;
+
+    if (instance_count > 0)
+    {
+        SceneBuildEntry* entries = malloc(instance_count * sizeof(SceneBuildEntry));
+        for (int32_t i = 0; i < instance_count; ++i)
+        {
+            MeshBounds bounds = scene->instances[i].world_bounds;
+            entries[i].bounds = bounds;
+            entries[i].centroid = vector3_create(bounds.min.x + bounds.max.x, bounds.min.y + bounds.max.y,
+                                                 bounds.min.z + bounds.max.z);
+            entries[i].instance = i;
+        }
+
+        scene_build_node(scene, entries, 0, instance_count);
+
+        for (int32_t i = 0; i < instance_count; ++i)
+        {
+            scene->leaf_instances[i] = entries[i].instance;
+        }
+
+        free(entries);
+    }
+
+    scene->needs_build = 0;
+    scene->needs_refit = 0;
+
+    ProfilerEnd(scene_build);
+}
+
+// Children always come after their parent, so walking the nodes backwards
+// updates children before the parents reading them
+static void
+scene_refit(Scene* scene)
+{
+    for (int32_t i = scene->node_count - 1; i >= 0; --i)
+    {
+        SceneNode* node = scene->nodes + i;
+        if (node->right < 0)
+        {
+            MeshBounds bounds = scene->instances[scene->leaf_instances[node->first]].world_bounds;
+            for (int32_t j = node->first + 1; j < node->first + node->count; ++j)
+            {
+                bounds = scene_bounds_union(bounds, scene->instances[scene->leaf_instances[j]].world_bounds);
+            }
+
+            node->bounds = bounds;
+        }
+        else
+        {
+            node->bounds = scene_bounds_union(scene->nodes[i + 1].bounds, scene->nodes[node->right].bounds);
+        }
+    }
+
+    scene->needs_refit = 0;
+}
+
+SceneFrustum
+scene_frustum_create(Matrix4 view_projection)
+{
+    // Points are row vectors, so each clip space coordinate is the dot
+    // product of the point with a column. Inside is -w <= x <= w,
+    // -w <= y <= w and 0 <= z <= w, the same as the clip codes.
+    Matrix4 m = view_projection;
+    Vector4 x = {{{m.x1, m.x2, m.x3, m.x4}}};
+    Vector4 y = {{{m.y1, m.y2, m.y3, m.y4}}};
+    Vector4 z = {{{m.z1, m.z2, m.z3, m.z4}}};
+    Vector4 w = {{{m.w1, m.w2, m.w3, m.w4}}};
+
+    SceneFrustum frustum;
+    for (int32_t i = 0; i < 4; ++i)
+    {
+        frustum.planes[0].xyzw[i] = w.xyzw[i] + x.xyzw[i];
+        frustum.planes[1].xyzw[i] = w.xyzw[i] - x.xyzw[i];
+        frustum.planes[2].xyzw[i] = w.xyzw[i] + y.xyzw[i];
+        frustum.planes[3].xyzw[i] = w.xyzw[i] - y.xyzw[i];
+        frustum.planes[4].xyzw[i] = z.xyzw[i];
+        frustum.planes[5].xyzw[i] = w.xyzw[i] - z.xyzw[i];
+    }
+
+    return frustum;
+}
+
+// Returns 1 when bounds is outside one of the planes in plane_mask, and
+// clears the planes it is fully inside of from plane_mask
+static int32_t
+scene_cull_bounds(SceneFrustum* frustum, MeshBounds bounds, uint32_t* plane_mask)
+{
+    for (int32_t i = 0; i < 6; ++i)
+    {
+        if (!(*plane_mask & (1u << i)))
+        {
+            continue;
+        }
+
+        // Test the corners furthest along and against the plane normal
+        Vector4 plane = frustum->planes[i];
+        float far_distance = plane.w;
+        float near_distance = plane.w;
+        for (int32_t axis = 0; axis < 3; ++axis)
+        {
+            float a = plane.xyzw[axis] * bounds.min.xyz[axis];
+            float b = plane.xyzw[axis] * bounds.max.xyz[axis];
+            far_distance += a > b ? a : b;
+            near_distance += a > b ? b : a;
+        }
+
+        if (far_distance < 0.0f)
+        {
+            return 1;
+        }
+
+        if (near_distance >= 0.0f)
+        {
+            *plane_mask &= ~(1u << i);
+        }
+    }
+
+    return 0;
+}
+
+typedef struct SceneCullEntry {
+    int32_t node;
+    // Planes the node's parent straddles, planes it is fully inside of
+    // can not cull anything below it
+    uint32_t plane_mask;
+} SceneCullEntry;
+
+int32_t
+scene_cull(Scene* scene, SceneFrustum frustum, FrameArena* arena, int32_t** visible_instances)
+{
+    if (scene->needs_build)
+    {
+        scene_build(scene);
+    }
+    else if (scene->needs_refit)
+    {
+        scene_refit(scene);
+    }
+
+    ProfilerBegin(scene_cull);
+
+    int32_t* visible = FrameArenaPushArray(arena, int32_t, Max(scene->instance_count, 1));
+    int32_t visible_count = 0;
+
+    SceneCullEntry stack[SCENE_STACK_SIZE];
+    int32_t stack_size = 0;
+    if (scene->node_count > 0)
+    {
+        SceneCullEntry root = {0, 0x3f};
+        stack[stack_size++] = root;
+    }
+
+    while (stack_size > 0)
+    {
+        SceneCullEntry entry = stack[--stack_size];
+        SceneNode* node = scene->nodes + entry.node;
+
+        if (scene_cull_bounds(&frustum, node->bounds, &entry.plane_mask))
+        {
+            continue;
+        }
+
+        // Everything under a node inside every plane is visible
+        if (entry.plane_mask == 0)
+        {
+            memcpy(visible + visible_count, scene->leaf_instances + node->first, node->count * sizeof(int32_t));
+            visible_count += node->count;
+        }
+        else if (node->right < 0)
+        {
+            for (int32_t i = node->first; i < node->first + node->count; ++i)
+            {
+                int32_t instance = scene->leaf_instances[i];
+                uint32_t plane_mask = entry.plane_mask;
+                if (!scene_cull_bounds(&frustum, scene->instances[instance].world_bounds, &plane_mask))
+                {
+                    visible[visible_count++] = instance;
+                }
+            }
+        }
+        else
+        {
+            SceneCullEntry right = {node->right, entry.plane_mask};
+            SceneCullEntry left = {entry.node + 1, entry.plane_mask};
+            stack[stack_size++] = right;
+            stack[stack_size++] = left;
+        }
+    }
+
+    ProfilerEnd(scene_cull);
+    ProfilerCount(PROFILER_COUNTER_INSTANCES_CULLED, scene->instance_count - visible_count);
+
+    *visible_instances = visible;
+    return visible_count;
+}
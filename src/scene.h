@@ -0,0 +1,69 @@
+// scene.h
+
+#ifndef SCENE_INCLUDED
+#define SCENE_INCLUDED
+
+#include <stdint.h>
+
+#include "frame_arena.h"
+#include "math.h"
+#include "mesh.h"
+#include "renderer_draw.h"
+
+// One placement of a mesh in the world
+typedef struct SceneInstance {
+    RendererVertexBuffer vertices;
+    RendererIndexBuffer indices;
+    // Bounds of vertices in model space
+    MeshBounds bounds;
+    Matrix4 model;
+    // Model space bounds transformed by model, kept up to date by the scene
+    MeshBounds world_bounds;
+} SceneInstance;
+
+// Planes as (normal, distance), a point p is inside a plane when
+// dot(normal, p) + distance >= 0
+typedef struct SceneFrustum {
+    Vector4 planes[6];
+} SceneFrustum;
+
+// Instances arranged in a bounding volume hierarchy, so whole groups of
+// them can be culled with one box test
+typedef struct Scene {
+    SceneInstance* instances;
+    int32_t instance_count;
+    int32_t instance_capacity;
+
+    struct SceneNode* nodes;
+    int32_t node_count;
+    // Instance indices in leaf order, each leaf owns a contiguous range
+    int32_t* leaf_instances;
+
+    // Hierarchy no longer matches the instances and has to be rebuilt
+    int32_t needs_build;
+    // Instances moved, node bounds have to be refit
+    int32_t needs_refit;
+} Scene;
+
+Scene* scene_create(void);
+void scene_destroy(Scene* scene);
+
+// Add an instance, returns its index
+int32_t scene_add_instance(Scene* scene, RendererVertexBuffer vertices, RendererIndexBuffer indices,
+                           MeshBounds bounds, Matrix4 model);
+void scene_set_model(Scene* scene, int32_t instance, Matrix4 model);
+
+// Rebuild the hierarchy from scratch. Culling does this on its own after
+// instances are added, moving instances only refits the existing one, which
+// gets slower to cull the further they move from where they were built.
+void scene_build(Scene* scene);
+
+// Frustum of a view and projection made with matrix4_lookat_lh and
+// matrix4_perspective_lh, in the space their product is applied to
+SceneFrustum scene_frustum_create(Matrix4 view_projection);
+
+// Indices of the instances whose world bounds intersect frustum, pushed
+// from arena. Returns the number of visible instances.
+int32_t scene_cull(Scene* scene, SceneFrustum frustum, FrameArena* arena, int32_t** visible_instances);
+
+#endif // SCENE_INCLUDED
@@ -0,0 +1,756 @@
+// tile_renderer.c
+
+#include "tile_renderer.h"
+#include "math.h"
+#include "math_batch.h"
+#include "profiler.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+enum TileClearFlags {
+    TILE_CLEAR_NONE = 0,
+    TILE_CLEAR_COLOR = 1 << 0,
+    TILE_CLEAR_DEPTH = 1 << 1,
+};
+
+// Set on bin entries indexing rects rather than triangles
+#define TILE_BIN_RECT 0x80000000u
+
+typedef struct TileBin {
+    // In the order they were binned, rects have TILE_BIN_RECT set
+    uint32_t* triangle_indices;
+    int32_t count;
+    int32_t capacity;
+
+    // Bounds of the triangles binned this frame, valid while count is not 0
+    RendererRect bounds;
+
+    // Clears requested for the tile that were not written to memory yet, and
+    // the part of the tile a pending color clear covers
+    uint32_t clear_flags;
+    RendererRect clear_rect;
+} TileBin;
+
+typedef enum TileRendererJob {
+    TILE_RENDERER_JOB_RASTERIZE = 0,
+    TILE_RENDERER_JOB_RESOLVE = 1,
+} TileRendererJob;
+
+typedef struct TileRendererInternal {
+    pthread_t* threads;
+    int32_t worker_count;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    uint32_t generation;
+    int32_t workers_busy;
+    int32_t quit;
+
+    atomic_int next_tile;
+    TileRendererJob job;
+    RendererTargetBuffer resolve_destination;
+
+    uint32_t clear_color;
+    float clear_depth;
+    int32_t clear_pending;
+
+    // Dirty list of the target, only touched by the binning thread
+    RendererDirtyRects* dirty;
+
+    RendererTriangle* triangles;
+    RendererRect* scissors;
+    int32_t triangle_count;
+    int32_t triangle_capacity;
+
+    RendererRect* rects;
+    uint32_t* rect_colors;
+    int32_t rect_count;
+    int32_t rect_capacity;
+
+    TileBin* bins;
+    int32_t bin_capacity;
+} TileRendererInternal;
+
+static void
+tile_renderer_reset_bins(TileRenderer* tile_renderer)
+{
+    TileRendererInternal* internal = tile_renderer->internal;
+    int32_t tile_count = tile_renderer->tile_count_x * tile_renderer->tile_count_y;
+
+    for (int32_t i = 0; i < tile_count; ++i)
+    {
+        internal->bins[i].count = 0;
+    }
+
+    internal->triangle_count = 0;
+    internal->rect_count = 0;
+}
+
+static RendererRect
+tile_renderer_tile_rect(TileRenderer* tile_renderer, int32_t tile_index)
+{
+    int32_t tile_x = tile_index % tile_renderer->tile_count_x;
+    int32_t tile_y = tile_index / tile_renderer->tile_count_x;
+
+    RendererRect rect = {
+        tile_x * TILE_RENDERER_TILE_SIZE,
+        tile_y * TILE_RENDERER_TILE_SIZE,
+        TILE_RENDERER_TILE_SIZE,
+        TILE_RENDERER_TILE_SIZE
+    };
+
+    rect.w = Min(rect.w, tile_renderer->target.width - rect.x);
+    rect.h = Min(rect.h, tile_renderer->target.height - rect.y);
+
+    return rect;
+}
+
+static void
+tile_renderer_rasterize_tiles(TileRenderer* tile_renderer)
+{
+    TileRendererInternal* internal = tile_renderer->internal;
+    RendererTargetBuffer target = tile_renderer->target;
+    int32_t tile_count = tile_renderer->tile_count_x * tile_renderer->tile_count_y;
+
+    // Tiles never overlap so each one is owned by exactly one thread and
+    // pixels can be written without any synchronization.
+    int32_t tile_index;
+    while ((tile_index = atomic_fetch_add(&internal->next_tile, 1)) < tile_count)
+    {
+        TileBin* bin = internal->bins + tile_index;
+
+        // Depth is only cleared once something is drawn to the tile. A tiled
+        // target is always resolved, so the color of a tile nothing is drawn
+        // to is written straight to the resolve destination.
+        uint32_t clear_flags = bin->clear_flags;
+        if (bin->count == 0)
+        {
+            clear_flags &= ~TILE_CLEAR_DEPTH;
+            if (target.layout == RENDERER_TARGET_TILED)
+            {
+                clear_flags &= ~TILE_CLEAR_COLOR;
+            }
+        }
+
+        if (clear_flags == TILE_CLEAR_NONE && bin->count == 0)
+        {
+            continue;
+        }
+
+        ProfilerBegin(rasterize_tile);
+        RendererRect clip = tile_renderer_tile_rect(tile_renderer, tile_index);
+
+        // Clearing right before rasterizing leaves the tile in the cache,
+        // tiles that only get cleared are not read again this frame.
+        if (clear_flags & TILE_CLEAR_COLOR)
+        {
+            if (bin->count == 0)
+            {
+                renderer_fill_rect_streaming(target, bin->clear_rect, internal->clear_color);
+            }
+            else
+            {
+                renderer_fill_rect(target, bin->clear_rect, internal->clear_color);
+            }
+        }
+
+        if (clear_flags & TILE_CLEAR_DEPTH)
+        {
+            renderer_clear_depth_rect(target.depth, clip, internal->clear_depth);
+        }
+
+        bin->clear_flags &= ~clear_flags;
+
+        // Triangles cut down to the tile edges often end up small as well
+        RendererTriangleBatch batch;
+        batch.count = 0;
+
+        for (int32_t i = 0; i < bin->count; ++i)
+        {
+            uint32_t triangle_index = bin->triangle_indices[i];
+            if (triangle_index & TILE_BIN_RECT)
+            {
+                uint32_t rect_index = triangle_index & ~TILE_BIN_RECT;
+                renderer_flush_triangle_batch(target, &batch);
+                renderer_fill_rect(target, renderer_rect_intersect(clip, internal->rects[rect_index]),
+                                   internal->rect_colors[rect_index]);
+                continue;
+            }
+
+            RendererRect scissor = renderer_rect_intersect(clip, internal->scissors[triangle_index]);
+            renderer_fill_triangle_batched(target, &batch, internal->triangles[triangle_index], scissor);
+        }
+
+        renderer_flush_triangle_batch(target, &batch);
+
+        ProfilerEnd(rasterize_tile);
+    }
+}
+
+static void
+tile_renderer_resolve_tiles(TileRenderer* tile_renderer)
+{
+    TileRendererInternal* internal = tile_renderer->internal;
+    RendererTargetBuffer destination = internal->resolve_destination;
+    int32_t tile_count = tile_renderer->tile_count_x * tile_renderer->tile_count_y;
+
+    int32_t tile_index;
+    while ((tile_index = atomic_fetch_add(&internal->next_tile, 1)) < tile_count)
+    {
+        TileBin* bin = internal->bins + tile_index;
+        RendererRect rect = tile_renderer_tile_rect(tile_renderer, tile_index);
+
+        ProfilerBegin(resolve_tile);
+        if (bin->clear_flags & TILE_CLEAR_COLOR)
+        {
+            renderer_fill_rect_streaming(destination, rect, internal->clear_color);
+            bin->clear_flags &= ~TILE_CLEAR_COLOR;
+        }
+        else
+        {
+            renderer_resolve_rect(tile_renderer->target, destination, rect);
+        }
+        ProfilerEnd(resolve_tile);
+    }
+}
+
+static void
+tile_renderer_run_job(TileRenderer* tile_renderer)
+{
+    switch (tile_renderer->internal->job)
+    {
+        case TILE_RENDERER_JOB_RASTERIZE:
+            tile_renderer_rasterize_tiles(tile_renderer);
+            break;
+        case TILE_RENDERER_JOB_RESOLVE:
+            tile_renderer_resolve_tiles(tile_renderer);
+            break;
+    }
+}
+
+// Run job over all tiles on every worker and the calling thread, and wait
+// until they are all done
+static void
+tile_renderer_run(TileRenderer* tile_renderer, TileRendererJob job)
+{
+    TileRendererInternal* internal = tile_renderer->internal;
+
+    atomic_store(&internal->next_tile, 0);
+
+    pthread_mutex_lock(&internal->mutex);
+    internal->job = job;
+    internal->workers_busy = internal->worker_count;
+    internal->generation++;
+    pthread_cond_broadcast(&internal->work_cond);
+    pthread_mutex_unlock(&internal->mutex);
+
+    tile_renderer_run_job(tile_renderer);
+
+    pthread_mutex_lock(&internal->mutex);
+    while (internal->workers_busy > 0)
+    {
+        pthread_cond_wait(&internal->done_cond, &internal->mutex);
+    }
+    pthread_mutex_unlock(&internal->mutex);
+}
+
+static void*
+tile_renderer_worker(void* data)
+{
+    TileRenderer* tile_renderer = data;
+    TileRendererInternal* internal = tile_renderer->internal;
+
+    uint32_t generation = 0;
+    profiler_set_thread_name("tile worker");
+
+    pthread_mutex_lock(&internal->mutex);
+    for (;;)
+    {
+        while (!internal->quit && internal->generation == generation)
+        {
+            pthread_cond_wait(&internal->work_cond, &internal->mutex);
+        }
+
+        if (internal->quit)
+        {
+            break;
+        }
+
+        generation = internal->generation;
+        pthread_mutex_unlock(&internal->mutex);
+
+        tile_renderer_run_job(tile_renderer);
+
+        pthread_mutex_lock(&internal->mutex);
+        if (--internal->workers_busy == 0)
+        {
+            pthread_cond_signal(&internal->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&internal->mutex);
+
+    return 0;
+}
+
+TileRenderer* tile_renderer_create(int32_t thread_count)
+{
+    if (thread_count <= 0)
+    {
+        thread_count = (int32_t)sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = Max(thread_count, 1);
+    }
+
+    uintptr_t renderer_and_internal_size =
+        sizeof(TileRenderer) + sizeof(TileRendererInternal);
+    TileRenderer* tile_renderer = calloc(1, renderer_and_internal_size);
+    tile_renderer->internal = (TileRendererInternal*)(tile_renderer + 1);
+
+    TileRendererInternal* internal = tile_renderer->internal;
+    pthread_mutex_init(&internal->mutex, 0);
+    pthread_cond_init(&internal->work_cond, 0);
+    pthread_cond_init(&internal->done_cond, 0);
+    atomic_init(&internal->next_tile, 0);
+
+    // The calling thread rasterizes as well, so only spawn the extra workers.
+    internal->threads = calloc(thread_count, sizeof(pthread_t));
+    for (int32_t i = 0; i < thread_count - 1; ++i)
+    {
+        if (pthread_create(internal->threads + i, 0, tile_renderer_worker, tile_renderer) != 0)
+        {
+            printf("failed to create tile renderer thread\n");
+            break;
+        }
+
+        internal->worker_count++;
+    }
+
+    tile_renderer->thread_count = internal->worker_count + 1;
+
+    return tile_renderer;
+}
+
+void tile_renderer_destroy(TileRenderer* tile_renderer)
+{
+    TileRendererInternal* internal = tile_renderer->internal;
+
+    pthread_mutex_lock(&internal->mutex);
+    internal->quit = 1;
+    pthread_cond_broadcast(&internal->work_cond);
+    pthread_mutex_unlock(&internal->mutex);
+
+    for (int32_t i = 0; i < internal->worker_count; ++i)
+    {
+        pthread_join(internal->threads[i], 0);
+    }
+
+    pthread_cond_destroy(&internal->done_cond);
+    pthread_cond_destroy(&internal->work_cond);
+    pthread_mutex_destroy(&internal->mutex);
+
+    for (int32_t i = 0; i < internal->bin_capacity; ++i)
+    {
+        free(internal->bins[i].triangle_indices);
+    }
+
+    free(internal->bins);
+    free(internal->rect_colors);
+    free(internal->rects);
+    free(internal->scissors);
+    free(internal->triangles);
+    free(internal->threads);
+    free(tile_renderer);
+}
+
+void tile_renderer_begin(TileRenderer* tile_renderer, RendererTargetBuffer target)
+{
+    TileRendererInternal* internal = tile_renderer->internal;
+
+    int32_t tile_count_x = (target.width + TILE_RENDERER_TILE_SIZE - 1) / TILE_RENDERER_TILE_SIZE;
+    int32_t tile_count_y = (target.height + TILE_RENDERER_TILE_SIZE - 1) / TILE_RENDERER_TILE_SIZE;
+    int32_t grid_changed =
+        tile_count_x != tile_renderer->tile_count_x || tile_count_y != tile_renderer->tile_count_y;
+
+    // Tiles are rasterized concurrently, so the binned triangles are added
+    // to the dirty list instead, by tile_renderer_end.
+    internal->dirty = target.dirty;
+    target.dirty = 0;
+
+    tile_renderer->target = target;
+    tile_renderer->tile_count_x = tile_count_x;
+    tile_renderer->tile_count_y = tile_count_y;
+
+    int32_t tile_count = tile_count_x * tile_count_y;
+    if (tile_count > internal->bin_capacity)
+    {
+        internal->bins = realloc(internal->bins, tile_count * sizeof(TileBin));
+        for (int32_t i = internal->bin_capacity; i < tile_count; ++i)
+        {
+            TileBin empty_bin = {0};
+            internal->bins[i] = empty_bin;
+        }
+
+        internal->bin_capacity = tile_count;
+    }
+
+    // Clears still pending were made for tiles of the previous grid.
+    if (grid_changed)
+    {
+        for (int32_t i = 0; i < tile_count; ++i)
+        {
+            internal->bins[i].clear_flags = TILE_CLEAR_NONE;
+        }
+    }
+
+    tile_renderer_reset_bins(tile_renderer);
+}
+
+// Add index to the bin of every tile overlapping the pixels from min to max,
+// exclusive on the max side
+static void
+tile_renderer_bin(TileRenderer* tile_renderer, uint32_t index, int32_t min_x, int32_t min_y, int32_t max_x,
+                  int32_t max_y)
+{
+    TileRendererInternal* internal = tile_renderer->internal;
+
+    int32_t tile_min_x = min_x / TILE_RENDERER_TILE_SIZE;
+    int32_t tile_min_y = min_y / TILE_RENDERER_TILE_SIZE;
+    int32_t tile_max_x = (max_x - 1) / TILE_RENDERER_TILE_SIZE;
+    int32_t tile_max_y = (max_y - 1) / TILE_RENDERER_TILE_SIZE;
+
+    for (int32_t tile_y = tile_min_y; tile_y <= tile_max_y; ++tile_y)
+    {
+        for (int32_t tile_x = tile_min_x; tile_x <= tile_max_x; ++tile_x)
+        {
+            TileBin* bin = internal->bins + tile_x + tile_y * tile_renderer->tile_count_x;
+            if (bin->count == 0)
+            {
+                RendererRect bounds = {
+                    min_x, min_y, max_x - min_x, max_y - min_y
+                };
+
+                bin->bounds = bounds;
+            }
+            else
+            {
+                int32_t bin_max_x = bin->bounds.x + bin->bounds.w;
+                int32_t bin_max_y = bin->bounds.y + bin->bounds.h;
+                bin_max_x = Max(bin_max_x, max_x);
+                bin_max_y = Max(bin_max_y, max_y);
+                bin->bounds.x = Min(bin->bounds.x, min_x);
+                bin->bounds.y = Min(bin->bounds.y, min_y);
+                bin->bounds.w = bin_max_x - bin->bounds.x;
+                bin->bounds.h = bin_max_y - bin->bounds.y;
+            }
+
+            if (bin->count == bin->capacity)
+            {
+                int32_t capacity = Max(bin->capacity * 2, 64);
+                bin->triangle_indices = realloc(bin->triangle_indices, capacity * sizeof(uint32_t));
+                bin->capacity = capacity;
+            }
+
+            bin->triangle_indices[bin->count++] = index;
+        }
+    }
+}
+
+void tile_renderer_fill_triangle(TileRenderer* tile_renderer, RendererTriangle triangle)
+{
+    RendererRect scissor = {
+        0, 0, tile_renderer->target.width, tile_renderer->target.height
+    };
+
+    tile_renderer_fill_triangle_clipped(tile_renderer, triangle, scissor);
+}
+
+void tile_renderer_fill_triangle_clipped(TileRenderer* tile_renderer, RendererTriangle triangle, RendererRect scissor)
+{
+    TileRendererInternal* internal = tile_renderer->internal;
+    RendererTargetBuffer target = tile_renderer->target;
+
+    RendererPoint p0 = triangle.p0;
+    RendererPoint p1 = triangle.p1;
+    RendererPoint p2 = triangle.p2;
+
+    // Pixel bounds are exclusive on the max side, same as the rasterizer.
+    int32_t min_x = Min3(p0.x, p1.x, p2.x);
+    int32_t max_x = Max3(p0.x, p1.x, p2.x);
+    int32_t min_y = Min3(p0.y, p1.y, p2.y);
+    int32_t max_y = Max3(p0.y, p1.y, p2.y);
+
+    RendererRect bounds = {
+        0, 0, target.width, target.height
+    };
+
+    scissor = renderer_rect_intersect(scissor, bounds);
+    min_x = Max(min_x, scissor.x);
+    min_y = Max(min_y, scissor.y);
+    max_x = Min(max_x, scissor.x + scissor.w);
+    max_y = Min(max_y, scissor.y + scissor.h);
+
+    if (min_x >= max_x || min_y >= max_y)
+    {
+        return;
+    }
+
+    if (internal->triangle_count == internal->triangle_capacity)
+    {
+        int32_t capacity = Max(internal->triangle_capacity * 2, 256);
+        internal->triangles = realloc(internal->triangles, capacity * sizeof(RendererTriangle));
+        internal->scissors = realloc(internal->scissors, capacity * sizeof(RendererRect));
+        internal->triangle_capacity = capacity;
+    }
+
+    uint32_t triangle_index = internal->triangle_count++;
+    internal->triangles[triangle_index] = triangle;
+    internal->scissors[triangle_index] = scissor;
+
+    tile_renderer_bin(tile_renderer, triangle_index, min_x, min_y, max_x, max_y);
+}
+
+void tile_renderer_fill_rect(TileRenderer* tile_renderer, RendererRect rect, uint32_t color)
+{
+    TileRendererInternal* internal = tile_renderer->internal;
+    RendererTargetBuffer target = tile_renderer->target;
+
+    RendererRect bounds = {
+        0, 0, target.width, target.height
+    };
+
+    rect = renderer_rect_intersect(rect, bounds);
+    if (rect.w == 0 || rect.h == 0)
+    {
+        return;
+    }
+
+    if (internal->rect_count == internal->rect_capacity)
+    {
+        int32_t capacity = Max(internal->rect_capacity * 2, 64);
+        internal->rects = realloc(internal->rects, capacity * sizeof(RendererRect));
+        internal->rect_colors = realloc(internal->rect_colors, capacity * sizeof(uint32_t));
+        internal->rect_capacity = capacity;
+    }
+
+    uint32_t rect_index = internal->rect_count++;
+    internal->rects[rect_index] = rect;
+    internal->rect_colors[rect_index] = color;
+
+    tile_renderer_bin(tile_renderer, rect_index | TILE_BIN_RECT, rect.x, rect.y, rect.x + rect.w, rect.y + rect.h);
+}
+
+void tile_renderer_draw_indexed(TileRenderer* tile_renderer, RendererVertexCache* cache, Matrix4 transform,
+                                RendererDrawState state, RendererVertexBuffer vertices, RendererIndexBuffer indices)
+{
+    RendererTargetBuffer target = tile_renderer->target;
+    renderer_vertex_cache_transform(cache, transform, target.width, target.height, vertices, indices);
+
+    int32_t triangle_count = renderer_vertex_cache_assemble(cache, state, vertices, indices);
+
+    ProfilerBegin(bin_triangles);
+    for (int32_t i = 0; i < triangle_count; ++i)
+    {
+        tile_renderer_fill_triangle_clipped(tile_renderer, cache->triangles[i], state.scissor);
+    }
+    ProfilerEnd(bin_triangles);
+}
+
+void tile_renderer_draw_indexed_instanced(TileRenderer* tile_renderer, RendererVertexCache* cache,
+                                          Matrix4 view_projection, const Matrix4* models, int32_t instance_count,
+                                          RendererDrawState state, RendererVertexBuffer vertices,
+                                          RendererIndexBuffer indices)
+{
+    RendererTargetBuffer target = tile_renderer->target;
+    renderer_vertex_cache_prepare(cache, vertices, indices);
+
+    Matrix4 transforms[RENDERER_DRAW_INSTANCE_BATCH];
+    for (int32_t first = 0; first < instance_count; first += RENDERER_DRAW_INSTANCE_BATCH)
+    {
+        int32_t remaining = instance_count - first;
+        int32_t batch_count = Min(remaining, RENDERER_DRAW_INSTANCE_BATCH);
+        matrix4_multiply_batch(models + first, view_projection, transforms, batch_count);
+
+        for (int32_t i = 0; i < batch_count; ++i)
+        {
+            renderer_vertex_cache_project(cache, transforms[i], target.width, target.height, vertices);
+            int32_t triangle_count = renderer_vertex_cache_assemble(cache, state, vertices, indices);
+
+            ProfilerBegin(bin_triangles);
+            for (int32_t j = 0; j < triangle_count; ++j)
+            {
+                tile_renderer_fill_triangle_clipped(tile_renderer, cache->triangles[j], state.scissor);
+            }
+            ProfilerEnd(bin_triangles);
+        }
+    }
+}
+
+void tile_renderer_clear(TileRenderer* tile_renderer, uint32_t color, float depth)
+{
+    TileRendererInternal* internal = tile_renderer->internal;
+    int32_t tile_count = tile_renderer->tile_count_x * tile_renderer->tile_count_y;
+
+    uint32_t clear_flags = TILE_CLEAR_COLOR;
+    if (tile_renderer->target.depth)
+    {
+        clear_flags |= TILE_CLEAR_DEPTH;
+    }
+
+    for (int32_t i = 0; i < tile_count; ++i)
+    {
+        internal->bins[i].clear_flags = clear_flags;
+        internal->bins[i].clear_rect = tile_renderer_tile_rect(tile_renderer, i);
+    }
+
+    internal->clear_color = color;
+    internal->clear_depth = depth;
+    internal->clear_pending = 1;
+}
+
+void tile_renderer_clear_rects(TileRenderer* tile_renderer, uint32_t color, float depth,
+                               const RendererDirtyRects* rects)
+{
+    if (tile_renderer->target.layout == RENDERER_TARGET_TILED)
+    {
+        tile_renderer_clear(tile_renderer, color, depth);
+        return;
+    }
+
+    TileRendererInternal* internal = tile_renderer->internal;
+    int32_t tile_count = tile_renderer->tile_count_x * tile_renderer->tile_count_y;
+
+    for (int32_t i = 0; i < tile_count; ++i)
+    {
+        TileBin* bin = internal->bins + i;
+        RendererRect tile_rect = tile_renderer_tile_rect(tile_renderer, i);
+
+        // Tiles clear one rectangle, the bounds of the parts of rects inside
+        int32_t min_x = tile_rect.x + tile_rect.w;
+        int32_t min_y = tile_rect.y + tile_rect.h;
+        int32_t max_x = tile_rect.x;
+        int32_t max_y = tile_rect.y;
+        for (int32_t j = 0; j < rects->count; ++j)
+        {
+            RendererRect overlap = renderer_rect_intersect(tile_rect, rects->rects[j]);
+            if (overlap.w == 0 || overlap.h == 0)
+            {
+                continue;
+            }
+
+            int32_t overlap_max_x = overlap.x + overlap.w;
+            int32_t overlap_max_y = overlap.y + overlap.h;
+            min_x = Min(min_x, overlap.x);
+            min_y = Min(min_y, overlap.y);
+            max_x = Max(max_x, overlap_max_x);
+            max_y = Max(max_y, overlap_max_y);
+        }
+
+        bin->clear_flags = tile_renderer->target.depth ? TILE_CLEAR_DEPTH : TILE_CLEAR_NONE;
+        if (min_x < max_x && min_y < max_y)
+        {
+            RendererRect clear_rect = {
+                min_x, min_y, max_x - min_x, max_y - min_y
+            };
+
+            bin->clear_flags |= TILE_CLEAR_COLOR;
+            bin->clear_rect = clear_rect;
+        }
+    }
+
+    internal->clear_color = color;
+    internal->clear_depth = depth;
+    internal->clear_pending = 1;
+}
+
+void tile_renderer_execute(TileRenderer* tile_renderer, RendererVertexCache* cache, RendererCommandList list)
+{
+    TileRendererInternal* internal = tile_renderer->internal;
+
+    for (int32_t i = 0; i < list.count; ++i)
+    {
+        const RendererCommand* command = list.commands[i];
+        switch (command->type)
+        {
+            case RENDERER_COMMAND_CLEAR:
+            case RENDERER_COMMAND_CLEAR_RECTS:
+                // Tiles clear before drawing what they were binned, so what
+                // came before the clear has to be drawn already
+                if (internal->triangle_count > 0 || internal->rect_count > 0)
+                {
+                    tile_renderer_end(tile_renderer);
+                }
+
+                if (command->type == RENDERER_COMMAND_CLEAR)
+                {
+                    tile_renderer_clear(tile_renderer, command->clear->color, command->clear->depth);
+                }
+                else
+                {
+                    tile_renderer_clear_rects(tile_renderer, command->clear->color, command->clear->depth,
+                                              &command->clear->rects);
+                }
+                break;
+            case RENDERER_COMMAND_FILL_RECT:
+                tile_renderer_fill_rect(tile_renderer, command->fill_rect->rect, command->fill_rect->color);
+                break;
+            case RENDERER_COMMAND_FILL_TRIANGLE:
+                tile_renderer_fill_triangle_clipped(tile_renderer, command->fill_triangle->triangle,
+                                                    command->fill_triangle->scissor);
+                break;
+            case RENDERER_COMMAND_DRAW_INDEXED:
+                tile_renderer_draw_indexed(tile_renderer, cache, command->draw->transform, command->draw->state,
+                                           command->draw->vertices, command->draw->indices);
+                break;
+            case RENDERER_COMMAND_DRAW_INDEXED_INSTANCED:
+                tile_renderer_draw_indexed_instanced(tile_renderer, cache, command->draw->transform,
+                                                     command->draw->models, command->draw->instance_count,
+                                                     command->draw->state, command->draw->vertices,
+                                                     command->draw->indices);
+                break;
+        }
+    }
+}
+
+void tile_renderer_end(TileRenderer* tile_renderer)
+{
+    TileRendererInternal* internal = tile_renderer->internal;
+
+    if (internal->triangle_count == 0 && internal->rect_count == 0 && !internal->clear_pending)
+    {
+        return;
+    }
+
+    if (internal->dirty)
+    {
+        int32_t tile_count = tile_renderer->tile_count_x * tile_renderer->tile_count_y;
+        for (int32_t i = 0; i < tile_count; ++i)
+        {
+            TileBin* bin = internal->bins + i;
+            if (bin->count > 0)
+            {
+                RendererRect tile_rect = tile_renderer_tile_rect(tile_renderer, i);
+                renderer_dirty_rects_add(internal->dirty, renderer_rect_intersect(tile_rect, bin->bounds));
+            }
+        }
+    }
+
+    ProfilerBegin(rasterize);
+    tile_renderer_run(tile_renderer, TILE_RENDERER_JOB_RASTERIZE);
+    ProfilerEnd(rasterize);
+
+    internal->clear_pending = 0;
+    tile_renderer_reset_bins(tile_renderer);
+}
+
+void tile_renderer_resolve(TileRenderer* tile_renderer, RendererTargetBuffer destination)
+{
+    tile_renderer->internal->resolve_destination = destination;
+
+    ProfilerBegin(resolve);
+    tile_renderer_run(tile_renderer, TILE_RENDERER_JOB_RESOLVE);
+    ProfilerEnd(resolve);
+}
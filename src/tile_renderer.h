@@ -0,0 +1,73 @@
+// tile_renderer.h
+
+#ifndef TILE_RENDERER_INCLUDED
+#define TILE_RENDERER_INCLUDED
+
+#include <stdint.h>
+
+#include "renderer.h"
+#include "renderer_command.h"
+#include "renderer_draw.h"
+
+// Width and height in pixels of each screen tile triangles are binned into
+#define TILE_RENDERER_TILE_SIZE 64
+
+typedef struct TileRenderer {
+    int32_t thread_count;
+    int32_t tile_count_x;
+    int32_t tile_count_y;
+    RendererTargetBuffer target;
+
+    struct TileRendererInternal* internal;
+} TileRenderer;
+
+// Create a tile renderer rasterizing on thread_count threads, including the
+// calling thread. A thread_count of 0 uses one thread per online core.
+TileRenderer* tile_renderer_create(int32_t thread_count);
+void tile_renderer_destroy(TileRenderer* tile_renderer);
+
+// Start binning triangles for target, pixels are not touched until end. The
+// dirty list of target gets the bounds of the triangles drawn to each tile.
+void tile_renderer_begin(TileRenderer* tile_renderer, RendererTargetBuffer target);
+
+// Clear the target and its depth buffer. Each tile is cleared by the thread
+// rasterizing it, right before its triangles. The depth of a tile nothing is
+// drawn to stays pending until something is, and on a tiled target so does
+// its color, which tile_renderer_resolve then writes to the destination.
+void tile_renderer_clear(TileRenderer* tile_renderer, uint32_t color, float depth);
+
+// Clear the depth buffer like tile_renderer_clear, but the color only inside
+// rects, for a target whose other pixels hold color already. Tiled targets
+// are resolved in full, so their color is cleared everywhere regardless.
+void tile_renderer_clear_rects(TileRenderer* tile_renderer, uint32_t color, float depth,
+                               const RendererDirtyRects* rects);
+void tile_renderer_fill_triangle(TileRenderer* tile_renderer, RendererTriangle triangle);
+
+// Fill rect without a depth test, ordered with the triangles around it
+void tile_renderer_fill_rect(TileRenderer* tile_renderer, RendererRect rect, uint32_t color);
+
+// Fill only the pixels of triangle inside scissor
+void tile_renderer_fill_triangle_clipped(TileRenderer* tile_renderer, RendererTriangle triangle, RendererRect scissor);
+void tile_renderer_draw_indexed(TileRenderer* tile_renderer, RendererVertexCache* cache, Matrix4 transform,
+                                RendererDrawState state, RendererVertexBuffer vertices, RendererIndexBuffer indices);
+
+// Bin the same indexed triangle list once per model matrix, the tiled
+// version of renderer_draw_indexed_instanced
+void tile_renderer_draw_indexed_instanced(TileRenderer* tile_renderer, RendererVertexCache* cache,
+                                          Matrix4 view_projection, const Matrix4* models, int32_t instance_count,
+                                          RendererDrawState state, RendererVertexBuffer vertices,
+                                          RendererIndexBuffer indices);
+
+// Bin every command of list in order. Clears coming after anything binned
+// first rasterize what came before them.
+void tile_renderer_execute(TileRenderer* tile_renderer, RendererVertexCache* cache, RendererCommandList list);
+
+// Rasterize all binned tiles in parallel and wait for them to finish. More
+// can be binned and drawn over it before the next begin.
+void tile_renderer_end(TileRenderer* tile_renderer);
+
+// Copy the target of the last frame into destination in parallel. Tiled
+// targets cleared with tile_renderer_clear must be resolved this way.
+void tile_renderer_resolve(TileRenderer* tile_renderer, RendererTargetBuffer destination);
+
+#endif // TILE_RENDERER_INCLUDED
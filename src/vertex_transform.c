@@ -1,10 +1,16 @@
 // vertex_transform.c
 
 #include "vertex_transform.h"
+#include "profiler.h"
+#include "renderer.h"
+
+#include <string.h>
 
 void
 vertex_transform_positions(Matrix4 transform, Vector3 *positions, Vector3 *transformed_positions, int count)
 {
+    ProfilerBegin(transform_positions);
+
     for (int i = 0; i < count; ++i)
     {
         Vector3 position = *(positions + i);
@@ -18,6 +24,9 @@ vertex_transform_positions(Matrix4 transform, Vector3 *positions, Vector3 *trans
 
         *(transformed_positions + i) = result;
     }
+
+    ProfilerEnd(transform_positions);
+    ProfilerCount(PROFILER_COUNTER_VERTICES_TRANSFORMED, count);
 }
 
 void
@@ -34,4 +43,305 @@ vertex_transform_map_to_viewport(int width, int height, Vector3 *positions, Vect
 
         *(mapped_positions + i) = result;
     }
-}
\ No newline at end of file
+}
+void
+vertex_transform_split(Vector3* positions, VertexStream stream, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        stream.x[i] = positions[i].x;
+        stream.y[i] = positions[i].y;
+        stream.z[i] = positions[i].z;
+    }
+}
+
+// 32 bytes so AVX2 loads of 8 lanes never split a cache line
+#define VERTEX_TRANSFORM_STREAM_ALIGNMENT 32
+
+VertexStream
+vertex_transform_push_stream(FrameArena* arena, int count)
+{
+    VertexStream stream;
+    stream.x = frame_arena_push(arena, count * sizeof(float), VERTEX_TRANSFORM_STREAM_ALIGNMENT);
+    stream.y = frame_arena_push(arena, count * sizeof(float), VERTEX_TRANSFORM_STREAM_ALIGNMENT);
+    stream.z = frame_arena_push(arena, count * sizeof(float), VERTEX_TRANSFORM_STREAM_ALIGNMENT);
+
+    return stream;
+}
+
+VertexScreenStream
+vertex_transform_push_screen_stream(FrameArena* arena, int count)
+{
+    VertexScreenStream stream;
+    stream.x = frame_arena_push(arena, count * sizeof(int32_t), VERTEX_TRANSFORM_STREAM_ALIGNMENT);
+    stream.y = frame_arena_push(arena, count * sizeof(int32_t), VERTEX_TRANSFORM_STREAM_ALIGNMENT);
+    stream.z = frame_arena_push(arena, count * sizeof(float), VERTEX_TRANSFORM_STREAM_ALIGNMENT);
+    stream.clip_codes = frame_arena_push(arena, count * sizeof(uint8_t), VERTEX_TRANSFORM_STREAM_ALIGNMENT);
+
+    return stream;
+}
+
+// The SIMD paths below evaluate exactly these operations in exactly this
+// order per lane, so all of them snap every vertex to the same pixel.
+static inline void
+vertex_transform_project_one(Matrix4 m, float width, float height, float guard_band_x, float guard_band_y,
+                             VertexStream positions, VertexScreenStream screen_positions, int i)
+{
+    Vector3 position = {
+        positions.x[i], positions.y[i], positions.z[i]
+    };
+
+    Vector4 clip = matrix4_multiply_vector3(m, position);
+    Vector3 screen = vertex_transform_clip_to_viewport(clip, width, height);
+
+    float guard_x = guard_band_x * clip.w;
+    float guard_y = guard_band_y * clip.w;
+
+    uint8_t clip_code = 0;
+    clip_code |= clip.x < -clip.w ? VERTEX_CLIP_LEFT : 0;
+    clip_code |= clip.x > clip.w ? VERTEX_CLIP_RIGHT : 0;
+    clip_code |= clip.y < -clip.w ? VERTEX_CLIP_BOTTOM : 0;
+    clip_code |= clip.y > clip.w ? VERTEX_CLIP_TOP : 0;
+    clip_code |= clip.z < 0.0f ? VERTEX_CLIP_NEAR : 0;
+    clip_code |= clip.z > clip.w ? VERTEX_CLIP_FAR : 0;
+    clip_code |= (clip.x < -guard_x || clip.x > guard_x ||
+                  clip.y < -guard_y || clip.y > guard_y) ? VERTEX_CLIP_GUARD_BAND : 0;
+
+    screen_positions.clip_codes[i] = clip_code;
+    screen_positions.z[i] = screen.z;
+
+    // Positions outside the guard band may not fit an int32 at all.
+    if (clip_code & (VERTEX_CLIP_NEAR | VERTEX_CLIP_GUARD_BAND))
+    {
+        screen_positions.x[i] = 0;
+        screen_positions.y[i] = 0;
+    }
+    else
+    {
+        screen_positions.x[i] = (int32_t)screen.x;
+        screen_positions.y[i] = (int32_t)screen.y;
+    }
+}
+
+static void
+vertex_transform_project_scalar(Matrix4 m, float width, float height, float guard_band_x, float guard_band_y,
+                                VertexStream positions, VertexScreenStream screen_positions, int start, int count)
+{
+    for (int i = start; i < count; ++i)
+    {
+        vertex_transform_project_one(m, width, height, guard_band_x, guard_band_y, positions, screen_positions, i);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static inline __m128
+vertex_transform_row_sse2(__m128 x, __m128 y, __m128 z, float a, float b, float c, float d)
+{
+    __m128 result = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(a)), _mm_mul_ps(y, _mm_set1_ps(b)));
+    result = _mm_add_ps(result, _mm_mul_ps(z, _mm_set1_ps(c)));
+    return _mm_add_ps(result, _mm_set1_ps(d));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i
+vertex_transform_clip_bit_sse2(__m128 outside, int bit)
+{
+    return _mm_and_si128(_mm_castps_si128(outside), _mm_set1_epi32(bit));
+}
+
+__attribute__((target("avx2")))
+static inline __m256
+vertex_transform_row_avx2(__m256 x, __m256 y, __m256 z, float a, float b, float c, float d)
+{
+    __m256 result = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(a)), _mm256_mul_ps(y, _mm256_set1_ps(b)));
+    result = _mm256_add_ps(result, _mm256_mul_ps(z, _mm256_set1_ps(c)));
+    return _mm256_add_ps(result, _mm256_set1_ps(d));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+vertex_transform_clip_bit_avx2(__m256 outside, int bit)
+{
+    return _mm256_and_si256(_mm256_castps_si256(outside), _mm256_set1_epi32(bit));
+}
+
+// A single exact divide per vertex gives the reciprocal, rather than an
+// approximation, so the SIMD paths stay bit exact with the scalar one.
+__attribute__((target("sse2")))
+static int
+vertex_transform_project_sse2(Matrix4 m, float width, float height, float guard_band_x, float guard_band_y,
+                              VertexStream positions, VertexScreenStream screen_positions, int count)
+{
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 zero = _mm_setzero_ps();
+    __m128 viewport_width = _mm_set1_ps(width);
+    __m128 viewport_height = _mm_set1_ps(height);
+    __m128 guard_band_scale_x = _mm_set1_ps(guard_band_x);
+    __m128 guard_band_scale_y = _mm_set1_ps(guard_band_y);
+    __m128i unusable_codes = _mm_set1_epi32(VERTEX_CLIP_NEAR | VERTEX_CLIP_GUARD_BAND);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(positions.x + i);
+        __m128 y = _mm_loadu_ps(positions.y + i);
+        __m128 z = _mm_loadu_ps(positions.z + i);
+
+        __m128 clip_x = vertex_transform_row_sse2(x, y, z, m.x1, m.x2, m.x3, m.x4);
+        __m128 clip_y = vertex_transform_row_sse2(x, y, z, m.y1, m.y2, m.y3, m.y4);
+        __m128 clip_z = vertex_transform_row_sse2(x, y, z, m.z1, m.z2, m.z3, m.z4);
+        __m128 clip_w = vertex_transform_row_sse2(x, y, z, m.w1, m.w2, m.w3, m.w4);
+
+        __m128 inverse_w = _mm_div_ps(one, clip_w);
+
+        __m128 screen_x = _mm_mul_ps(_mm_add_ps(half, _mm_mul_ps(_mm_mul_ps(clip_x, inverse_w), half)), viewport_width);
+        __m128 screen_y = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(half, _mm_mul_ps(_mm_mul_ps(clip_y, inverse_w), half))),
+                                     viewport_height);
+        __m128 screen_z = _mm_add_ps(half, _mm_mul_ps(_mm_mul_ps(clip_z, inverse_w), half));
+
+        __m128 negative_w = _mm_sub_ps(zero, clip_w);
+        __m128 guard_x = _mm_mul_ps(guard_band_scale_x, clip_w);
+        __m128 guard_y = _mm_mul_ps(guard_band_scale_y, clip_w);
+        __m128 outside_guard_band = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(clip_x, _mm_sub_ps(zero, guard_x)),
+                                                        _mm_cmpgt_ps(clip_x, guard_x)),
+                                              _mm_or_ps(_mm_cmplt_ps(clip_y, _mm_sub_ps(zero, guard_y)),
+                                                        _mm_cmpgt_ps(clip_y, guard_y)));
+
+        __m128i clip_codes = vertex_transform_clip_bit_sse2(_mm_cmplt_ps(clip_x, negative_w), VERTEX_CLIP_LEFT);
+        clip_codes = _mm_or_si128(clip_codes, vertex_transform_clip_bit_sse2(_mm_cmpgt_ps(clip_x, clip_w), VERTEX_CLIP_RIGHT));
+        clip_codes = _mm_or_si128(clip_codes, vertex_transform_clip_bit_sse2(_mm_cmplt_ps(clip_y, negative_w), VERTEX_CLIP_BOTTOM));
+        clip_codes = _mm_or_si128(clip_codes, vertex_transform_clip_bit_sse2(_mm_cmpgt_ps(clip_y, clip_w), VERTEX_CLIP_TOP));
+        clip_codes = _mm_or_si128(clip_codes, vertex_transform_clip_bit_sse2(_mm_cmplt_ps(clip_z, zero), VERTEX_CLIP_NEAR));
+        clip_codes = _mm_or_si128(clip_codes, vertex_transform_clip_bit_sse2(_mm_cmpgt_ps(clip_z, clip_w), VERTEX_CLIP_FAR));
+        clip_codes = _mm_or_si128(clip_codes, vertex_transform_clip_bit_sse2(outside_guard_band, VERTEX_CLIP_GUARD_BAND));
+
+        __m128i unusable = _mm_cmpeq_epi32(_mm_and_si128(clip_codes, unusable_codes), _mm_setzero_si128());
+        __m128i snapped_x = _mm_and_si128(_mm_cvttps_epi32(screen_x), unusable);
+        __m128i snapped_y = _mm_and_si128(_mm_cvttps_epi32(screen_y), unusable);
+
+        __m128i packed_codes = _mm_packs_epi32(clip_codes, clip_codes);
+        packed_codes = _mm_packus_epi16(packed_codes, packed_codes);
+        int32_t packed_codes4 = _mm_cvtsi128_si32(packed_codes);
+
+        _mm_storeu_si128((__m128i*)(screen_positions.x + i), snapped_x);
+        _mm_storeu_si128((__m128i*)(screen_positions.y + i), snapped_y);
+        _mm_storeu_ps(screen_positions.z + i, screen_z);
+        memcpy(screen_positions.clip_codes + i, &packed_codes4, sizeof(packed_codes4));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int
+vertex_transform_project_avx2(Matrix4 m, float width, float height, float guard_band_x, float guard_band_y,
+                              VertexStream positions, VertexScreenStream screen_positions, int count)
+{
+    __m256 half = _mm256_set1_ps(0.5f);
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 zero = _mm256_setzero_ps();
+    __m256 viewport_width = _mm256_set1_ps(width);
+    __m256 viewport_height = _mm256_set1_ps(height);
+    __m256 guard_band_scale_x = _mm256_set1_ps(guard_band_x);
+    __m256 guard_band_scale_y = _mm256_set1_ps(guard_band_y);
+    __m256i unusable_codes = _mm256_set1_epi32(VERTEX_CLIP_NEAR | VERTEX_CLIP_GUARD_BAND);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(positions.x + i);
+        __m256 y = _mm256_loadu_ps(positions.y + i);
+        __m256 z = _mm256_loadu_ps(positions.z + i);
+
+        __m256 clip_x = vertex_transform_row_avx2(x, y, z, m.x1, m.x2, m.x3, m.x4);
+        __m256 clip_y = vertex_transform_row_avx2(x, y, z, m.y1, m.y2, m.y3, m.y4);
+        __m256 clip_z = vertex_transform_row_avx2(x, y, z, m.z1, m.z2, m.z3, m.z4);
+        __m256 clip_w = vertex_transform_row_avx2(x, y, z, m.w1, m.w2, m.w3, m.w4);
+
+        __m256 inverse_w = _mm256_div_ps(one, clip_w);
+
+        __m256 screen_x = _mm256_mul_ps(_mm256_add_ps(half, _mm256_mul_ps(_mm256_mul_ps(clip_x, inverse_w), half)),
+                                        viewport_width);
+        __m256 screen_y = _mm256_mul_ps(
+            _mm256_sub_ps(one, _mm256_add_ps(half, _mm256_mul_ps(_mm256_mul_ps(clip_y, inverse_w), half))),
+            viewport_height);
+        __m256 screen_z = _mm256_add_ps(half, _mm256_mul_ps(_mm256_mul_ps(clip_z, inverse_w), half));
+
+        __m256 negative_w = _mm256_sub_ps(zero, clip_w);
+        __m256 guard_x = _mm256_mul_ps(guard_band_scale_x, clip_w);
+        __m256 guard_y = _mm256_mul_ps(guard_band_scale_y, clip_w);
+        __m256 outside_guard_band =
+            _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(clip_x, _mm256_sub_ps(zero, guard_x), _CMP_LT_OQ),
+                                      _mm256_cmp_ps(clip_x, guard_x, _CMP_GT_OQ)),
+                         _mm256_or_ps(_mm256_cmp_ps(clip_y, _mm256_sub_ps(zero, guard_y), _CMP_LT_OQ),
+                                      _mm256_cmp_ps(clip_y, guard_y, _CMP_GT_OQ)));
+
+        __m256i clip_codes = vertex_transform_clip_bit_avx2(_mm256_cmp_ps(clip_x, negative_w, _CMP_LT_OQ), VERTEX_CLIP_LEFT);
+        clip_codes = _mm256_or_si256(clip_codes,
+                                     vertex_transform_clip_bit_avx2(_mm256_cmp_ps(clip_x, clip_w, _CMP_GT_OQ), VERTEX_CLIP_RIGHT));
+        clip_codes = _mm256_or_si256(clip_codes,
+                                     vertex_transform_clip_bit_avx2(_mm256_cmp_ps(clip_y, negative_w, _CMP_LT_OQ), VERTEX_CLIP_BOTTOM));
+        clip_codes = _mm256_or_si256(clip_codes,
+                                     vertex_transform_clip_bit_avx2(_mm256_cmp_ps(clip_y, clip_w, _CMP_GT_OQ), VERTEX_CLIP_TOP));
+        clip_codes = _mm256_or_si256(clip_codes,
+                                     vertex_transform_clip_bit_avx2(_mm256_cmp_ps(clip_z, zero, _CMP_LT_OQ), VERTEX_CLIP_NEAR));
+        clip_codes = _mm256_or_si256(clip_codes,
+                                     vertex_transform_clip_bit_avx2(_mm256_cmp_ps(clip_z, clip_w, _CMP_GT_OQ), VERTEX_CLIP_FAR));
+        clip_codes = _mm256_or_si256(clip_codes, vertex_transform_clip_bit_avx2(outside_guard_band, VERTEX_CLIP_GUARD_BAND));
+
+        __m256i unusable = _mm256_cmpeq_epi32(_mm256_and_si256(clip_codes, unusable_codes), _mm256_setzero_si256());
+        __m256i snapped_x = _mm256_and_si256(_mm256_cvttps_epi32(screen_x), unusable);
+        __m256i snapped_y = _mm256_and_si256(_mm256_cvttps_epi32(screen_y), unusable);
+
+        __m128i packed_codes = _mm_packs_epi32(_mm256_castsi256_si128(clip_codes), _mm256_extracti128_si256(clip_codes, 1));
+        packed_codes = _mm_packus_epi16(packed_codes, packed_codes);
+
+        _mm256_storeu_si256((__m256i*)(screen_positions.x + i), snapped_x);
+        _mm256_storeu_si256((__m256i*)(screen_positions.y + i), snapped_y);
+        _mm256_storeu_ps(screen_positions.z + i, screen_z);
+        _mm_storel_epi64((__m128i*)(screen_positions.clip_codes + i), packed_codes);
+    }
+
+    return i;
+}
+
+#endif
+
+void
+vertex_transform_project(Matrix4 transform, int width, int height, VertexStream positions,
+                         VertexScreenStream screen_positions, int count)
+{
+    float viewport_width = (float)width;
+    float viewport_height = (float)height;
+    float guard_band_x = vertex_transform_guard_band(width);
+    float guard_band_y = vertex_transform_guard_band(height);
+
+    int done = 0;
+
+    ProfilerBegin(project_vertices);
+
+#if defined(__x86_64__) || defined(__i386__)
+    RendererSimdLevel level = renderer_get_simd_level();
+    if (level == RENDERER_SIMD_AVX2)
+    {
+        done = vertex_transform_project_avx2(transform, viewport_width, viewport_height, guard_band_x, guard_band_y,
+                                             positions, screen_positions, count);
+    }
+    else if (level == RENDERER_SIMD_SSE2)
+    {
+        done = vertex_transform_project_sse2(transform, viewport_width, viewport_height, guard_band_x, guard_band_y,
+                                             positions, screen_positions, count);
+    }
+#endif
+
+    vertex_transform_project_scalar(transform, viewport_width, viewport_height, guard_band_x, guard_band_y,
+                                    positions, screen_positions, done, count);
+
+    ProfilerEnd(project_vertices);
+    ProfilerCount(PROFILER_COUNTER_VERTICES_TRANSFORMED, count);
+}
@@ -3,12 +3,93 @@
 #ifndef VERTEX_TRANSFORM_H
 #define VERTEX_TRANSFORM_H
 
+#include <stdint.h>
+
+#include "frame_arena.h"
 #include "math.h"
 
+// Structure of arrays vertex positions, so SIMD code can load one component
+// of 4 or 8 consecutive vertices at once
+typedef struct VertexStream {
+    float* x;
+    float* y;
+    float* z;
+} VertexStream;
+
+// Bits set in a vertex clip code for each clip space plane it is outside of
+enum VertexClipCode {
+    VERTEX_CLIP_LEFT = 1 << 0,
+    VERTEX_CLIP_RIGHT = 1 << 1,
+    VERTEX_CLIP_BOTTOM = 1 << 2,
+    VERTEX_CLIP_TOP = 1 << 3,
+    VERTEX_CLIP_NEAR = 1 << 4,
+    VERTEX_CLIP_FAR = 1 << 5,
+    // Outside the guard band on x or y, screen x and y can not be used
+    VERTEX_CLIP_GUARD_BAND = 1 << 6,
+};
+
+#define VERTEX_CLIP_FRUSTUM                                                \
+    (VERTEX_CLIP_LEFT | VERTEX_CLIP_RIGHT | VERTEX_CLIP_BOTTOM | VERTEX_CLIP_TOP | \
+     VERTEX_CLIP_NEAR | VERTEX_CLIP_FAR)
+
+// Pixels the guard band extends past each viewport edge. Triangles inside it
+// only need their bounding box clipped, which keeps the edge functions of
+// the rasterizer well inside int32 range.
+#define VERTEX_TRANSFORM_GUARD_BAND_PIXELS 8192
+
+// Screen space vertices with x and y snapped to whole pixels. Vertices with
+// a near or guard band clip code get a screen x and y of 0.
+typedef struct VertexScreenStream {
+    int32_t* x;
+    int32_t* y;
+    float* z;
+    uint8_t* clip_codes;
+} VertexScreenStream;
+
+// Perspective divide and viewport map a clip space position, the same math
+// vertex_transform_project does for every vertex
+static inline Vector3
+vertex_transform_clip_to_viewport(Vector4 clip, float width, float height)
+{
+    float inverse_w = 1.0f / clip.w;
+
+    Vector3 result = {
+        (0.5f + (clip.x * inverse_w) * 0.5f) * width,
+        (1.0f - (0.5f + (clip.y * inverse_w) * 0.5f)) * height,
+        0.5f + (clip.z * inverse_w) * 0.5f
+    };
+
+    return result;
+}
+
+// Guard band extent in clip space, as a multiple of w
+static inline float
+vertex_transform_guard_band(int size)
+{
+    return 1.0f + (2.0f * VERTEX_TRANSFORM_GUARD_BAND_PIXELS) / size;
+}
+
 void
 vertex_transform_positions(Matrix4 transform, Vector3* positions, Vector3* transformed_positions, int count);
 
 void
 vertex_transform_map_to_viewport(int width, int height, Vector3 *positions, Vector3 *mapped_positions, int count);
 
-#endif // VERTEX_TRANSFORM_H
\ No newline at end of file
+// Transform, clip code, perspective divide, map to a width by height viewport
+// and snap count positions in a single pass, using SIMD when supported
+void
+vertex_transform_project(Matrix4 transform, int width, int height, VertexStream positions,
+                         VertexScreenStream screen_positions, int count);
+
+// Streams of count vertices pushed from arena, each array aligned for SIMD
+VertexStream
+vertex_transform_push_stream(FrameArena* arena, int count);
+
+VertexScreenStream
+vertex_transform_push_screen_stream(FrameArena* arena, int count);
+
+// Split count AoS positions into the x, y and z arrays of stream
+void
+vertex_transform_split(Vector3* positions, VertexStream stream, int count);
+
+#endif // VERTEX_TRANSFORM_H